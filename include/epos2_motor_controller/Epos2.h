@@ -22,8 +22,25 @@
 #define Epos2_H
 
 #include <string>
+#include <vector>
+#include <map>
 #include <stdexcept>
+#include <exception>
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+#include <future>
+#include <thread>
+#include <functional>
 #include <ftdi.hpp>
+#include "epos2_motor_controller/Epos2PositionTracker.h"
+
+class CEpos2StatusPoller;
+class CEpos2Mirror;
+
+#define EPOS2_MAX_ANSWER_WORDS  40   // data words of the answer buffers (uint16_t[40])
 
 /*! \class CEpos2
  \brief Implementation of a driver for EPOS2 Motor Controller
@@ -49,7 +66,6 @@
 
  \todo
    - Smarter ReadObject (16-32 bits)
-   - Current mode functions
    - Sensor functions
    - Motor functions
    - Utilities functions: window/window times, notation/dimension index,
@@ -59,26 +75,151 @@
 
 class CEpos2 {
 
+  friend class CEpos2StatusPoller;
+  friend class CEpos2AxisGroup;
+  friend class CEpos2CamFollower;
+  friend class CEpos2Broker;
+  friend class CEpos2Mirror;
+  friend class CEpos2Firmware;
+  friend class CEpos2Ipm;
+  friend class CEpos2FrameTest;     // test/test_frame_encoder.cpp
 
 	private:
 
     int8_t  node_id;
 
     /**
-     * \brief a reference to the FTDI USB device
+     * \brief StatusWord poller the axis is attached to (NULL if none)
      *
-     * This attribute points to the communication device used to send and receive data
-     * to and from the EPOS2. The communication device is cretaed inside the
-     * object at initialization time using the CFTDIServer and the description or serial
-     * number of the desired platform via the connect() function.
+     *  Set by CEpos2StatusPoller::add and CEpos2StatusPoller::remove.
+     */
+    CEpos2StatusPoller *status_poller;
+
+    /**
+     * \brief shared memory mirror of the values read and written (NULL if none)
      *
-     * It is not possible to send or receive data to or from the epos2 until the
-     * driver is not connected to the hardware platform. Any attempt to do so will
-     * result in an exception being thrown.
+     *  Set by the constructor and destructor of CEpos2Mirror, used through
+     *  mirrorValue and mirrorPosition only.
+     */
+    std::atomic<CEpos2Mirror*> mirror;
+
+    /*! \brief updates of the mirror in progress, the destructor of
+     *  CEpos2Mirror waits for them after clearing mirror */
+    std::atomic<int> mirror_users;
+
+    /**
+     * \brief function to store a value in the mirror, if any
+     */
+    void mirrorValue(int16_t index, int8_t subindex, int32_t value,
+                     const std::chrono::steady_clock::time_point &time, bool write);
+
+    /**
+     * \brief function to store the unwrapped position in the mirror, if any
+     */
+    void mirrorPosition(int64_t position, const std::chrono::steady_clock::time_point &time);
+
+    /**
+     * \brief a USB link to the EPOS2
      *
+     *  Every EPOS2 connected by USB is its own FTDI device, told apart by its
+     *  serial number. All the objects of the same serial share the link,
+     *  objects of different serials talk in parallel. An empty serial is
+     *  the first device found: openDevice resolves it to the serial of that
+     *  device, so it shares the link of the objects naming the device.
+     *
+     *  Only one request/answer transaction can be on a link at a time. The
+     *  mutex only protects the flags (and the statistics of the axes of the
+     *  link), the link itself is held through busy so that a transaction in
+     *  progress is never interrupted. Pending emergency stops (stop_pending)
+     *  are served before any ordinary transaction waiting for the link.
+     */
+    struct epos_link {
+      std::string serial;
+      Ftdi::Context ftdi;
+      bool initialized;
+      std::mutex mutex;
+      std::condition_variable cond;
+      bool busy;
+      int stop_pending;
+      // received bytes not parsed yet, only used while the link is held
+      uint8_t rx_buffer[512];
+      int rx_begin;
+      int rx_end;
+    };
+
+    /**
+     * \brief function to get the link of a serial, created if needed
+     *
+     *  The links are kept while an object uses them, the device is closed
+     *  with the last one.
+     */
+    static std::shared_ptr<epos_link> getLink(const std::string &serial);
+
+    /**
+     * \brief function to get the serial of the first FTDI device found
+     *
+     *  The device opened without serial, found without opening it (it may
+     *  be open through its serial already).
      */
-    static Ftdi::Context ftdi;
-    static bool ftdi_initialized;
+    static std::string firstSerial();
+
+    static std::mutex links_mutex;
+    static std::map<std::string, std::weak_ptr<epos_link> > links;
+
+    /**
+     * \brief link of the axis
+     */
+    std::shared_ptr<epos_link> link;
+
+    /**
+     * \brief scoped ownership of a link for one transaction
+     *
+     *  The constructor blocks until the link is free. Ordinary transactions
+     *  also wait while an emergency stop is pending, priority ones only
+     *  wait for the transaction in progress to finish.
+     */
+    class LinkGuard
+    {
+      public:
+        LinkGuard(epos_link &link, bool priority = false);
+        ~LinkGuard();
+        /*! \brief lets the priority requests waiting (stops) take the link
+         *  and takes it back, only between transactions */
+        void yield();
+      private:
+        epos_link &link;
+    };
+
+    /**
+     * \brief pre-encoded controlword frames of the emergency stop path
+     *
+     *  They are built once in the constructor (node_id doesn't change) so a
+     *  stop only has to write the bytes to the link.
+     */
+    uint8_t quick_stop_frame[32];
+    int16_t quick_stop_frame_len;
+    uint8_t disable_voltage_frame[32];
+    int16_t disable_voltage_frame_len;
+
+    /**
+     * \brief pre-encoded start of the WriteObject frame of a streamed setpoint
+     *
+     *  The sync, header, index and subindex bytes (stuffed) and the CRC
+     *  after them are kept, so a write only appends the data words and
+     *  finishes the CRC (see writeObjectCached). The mutex guards the
+     *  template, the frame itself is built on the stack of each writer.
+     */
+    struct epos_frame_cache {
+      int16_t  index;
+      int8_t   subindex;
+      bool     valid;
+      uint8_t  prefix[16];
+      int16_t  prefix_length;
+      uint16_t crc_prefix;
+      std::mutex mutex;
+    };
+
+    epos_frame_cache current_frame;
 
 
    /// @name Communication low level
@@ -88,7 +229,8 @@ class CEpos2 {
     /**
      * \brief open EPOS2 device using CFTDI
      *
-     * It finds and configures the FTDI communication.
+     * It finds and configures the FTDI communication of the link, once for
+     * all the objects sharing it.
      */
     void openDevice();
 
@@ -97,6 +239,10 @@ class CEpos2 {
      *
      *  This function sends a read object request using CFTDI.
      *
+     *  An answer with an error code (an SDO abort, e.g. 0x06020000 for an
+     *  object that does not exist) throws EPOS2IOException; it used to be
+     *  returned as if it were the value.
+     *
      *  \param index the hexadecimal index of the object you want to read
      *  \param subindex hexadecimal value of the object (usually 0x00)
      *  \return the value in the object as a long
@@ -115,6 +261,115 @@ class CEpos2 {
      */
     int writeObject(int16_t index, int8_t subindex, int32_t data);
 
+    /**
+     * \brief function to write an object through a frame cache
+     *
+     *  The constant start of the frame is only encoded again if the object
+     *  changed, a value only costs its data words and the end of the CRC,
+     *  and the answer is only checked for an error code, so a setpoint can
+     *  be streamed as fast as the link allows. Safe from several threads.
+     *
+     *  \param cache frame cache of the object
+     *  \param index the hexadecimal index of the object you want to write
+     *  \param subindex hexadecimal value of the object (usually 0x00)
+     *  \param data information to send
+     */
+    void writeObjectCached(epos_frame_cache &cache, int16_t index, int8_t subindex, int32_t data);
+
+    /**
+     * \brief function to write an object longer than 4 bytes to the EPOS2
+     *
+     *  It does a segmented transfer (InitiateSegmentedWrite and
+     *  SegmentedWrite of up to 63 bytes) holding the link for the whole
+     *  transfer, except for a stop (quickStop, disableVoltage) requested
+     *  meanwhile, which is let through between two segments. The protocol
+     *  allows one request in flight, so the next segment is taken from the
+     *  source and encoded while the EPOS2 answers the previous one. Nothing
+     *  is allocated per segment.
+     *
+     *  \param index the hexadecimal index of the object you want to write
+     *  \param subindex hexadecimal value of the object (usually 0x00)
+     *  \param length number of bytes
+     *  \param source called for every segment to fill the buffer with the
+     *    given number of bytes (the next ones of the object)
+     */
+    void writeObjectSegmented(int16_t index, int8_t subindex, uint32_t length,
+                              const std::function<void(uint8_t *data, size_t size)> &source);
+
+    /**
+     * \brief function to write an object longer than 4 bytes from memory
+     *
+     *  \param index the hexadecimal index of the object you want to write
+     *  \param subindex hexadecimal value of the object (usually 0x00)
+     *  \param data bytes to send
+     *  \param length number of bytes
+     */
+    void writeObjectSegmented(int16_t index, int8_t subindex, const uint8_t *data, uint32_t length);
+
+    /**
+     * \brief function to read an object longer than 4 bytes from the EPOS2
+     *
+     *  It does a segmented transfer (InitiateSegmentedRead and SegmentRead
+     *  of up to 63 bytes) holding the link for the whole transfer, a stop
+     *  requested meanwhile is let through between two segments. The two
+     *  SegmentRead frames (one per toggle) are encoded once, and the request
+     *  of the next segment is sent before the sink is called, so the sink
+     *  runs while the EPOS2 prepares the answer. Nothing is allocated per
+     *  segment.
+     *
+     *  \param index the hexadecimal index of the object you want to read
+     *  \param subindex hexadecimal value of the object (usually 0x00)
+     *  \param sink called for every segment, in order, with its bytes and the
+     *    length of the object; it may throw to abort
+     *  \return length of the object
+     */
+    uint32_t readObjectSegmented(int16_t index, int8_t subindex,
+                                 const std::function<void(const uint8_t *data, size_t size,
+                                                          uint32_t length)> &sink);
+
+    /**
+     * \brief function to read an object longer than 4 bytes into memory
+     *
+     *  \param index the hexadecimal index of the object you want to read
+     *  \param subindex hexadecimal value of the object (usually 0x00)
+     *  \param data buffer
+     *  \param capacity bytes of the buffer, std::length_error if the object
+     *    is longer
+     *  \return length of the object
+     */
+    uint32_t readObjectSegmented(int16_t index, int8_t subindex, uint8_t *data, uint32_t capacity);
+
+    /**
+     * \brief function to read an object longer than 4 bytes into a vector
+     *
+     *  \param index the hexadecimal index of the object you want to read
+     *  \param subindex hexadecimal value of the object (usually 0x00)
+     *  \param data filled with the bytes of the object
+     */
+    void readObjectSegmented(int16_t index, int8_t subindex, std::vector<uint8_t> &data);
+
+    /**
+     * \brief function to receive and drop the answer of a request in flight
+     *
+     *  Used when a segmented transfer is aborted by its callback, so the
+     *  next transaction doesn't get this answer.
+     *
+     *  \param ans_frame scratch answer buffer
+     */
+    void drainAnswer(uint16_t *ans_frame);
+
+    /**
+     * \brief function to account a segmented transfer in transfer_stats
+     */
+    void accountTransfer(uint32_t bytes, std::chrono::steady_clock::time_point start);
+
+    /**
+     * \brief function to check the error code of an answer frame
+     *
+     *  \param ans_frame answer as returned by receiveFrame
+     */
+    void checkAnswer(const uint16_t *ans_frame);
+
     /**
      * \brief function send a frame to EPOS2
      *
@@ -125,6 +380,96 @@ class CEpos2 {
      */
     void sendFrame(int16_t *frame);
 
+    /**
+     * \brief function to encode a frame for transmission
+     *
+     *  It adds the checksum to the 16 bit frame, the sync characters and
+     *  does the data stuffing for character 0x90.
+     *
+     *  \param frame data frame (the checksum word is overwritten)
+     *  \param trans_frame output buffer, at least 4*length+2 bytes
+     *  \return number of bytes in trans_frame
+     */
+    int16_t encodeFrame(int16_t *frame, uint8_t *trans_frame);
+
+    /**
+     * \brief function to encode a ReadObject request for later transmission
+     *
+     *  \param index the hexadecimal index of the object you want to read
+     *  \param subindex hexadecimal value of the object (usually 0x00)
+     *  \param trans_frame output buffer, at least 18 bytes
+     *  \return number of bytes in trans_frame
+     */
+    int16_t encodeReadObject(int16_t index, int8_t subindex, uint8_t *trans_frame);
+
+    /**
+     * \brief function to encode a WriteObject request for later transmission
+     *
+     *  \param index the hexadecimal index of the object you want to write
+     *  \param subindex hexadecimal value of the object (usually 0x00)
+     *  \param data information to send
+     *  \param trans_frame output buffer, at least 26 bytes
+     *  \return number of bytes in trans_frame
+     */
+    int16_t encodeWriteObject(int16_t index, int8_t subindex, int32_t data, uint8_t *trans_frame);
+
+    /**
+     * \brief function to send an already encoded frame to EPOS2
+     *
+     *  \param trans_frame frame as returned by encodeFrame
+     *  \param length number of bytes
+     */
+    void sendEncodedFrame(const uint8_t *trans_frame, int16_t length);
+
+    /**
+     * \brief function to send a pre-encoded controlword through the priority lane
+     *
+     *  The frame is written at the next transaction boundary, before any
+     *  other queued transaction, and the latency is accounted in stop_latency.
+     *  Throws EPOS2IOException if the EPOS2 answers with an error code.
+     *
+     *  \param trans_frame pre-encoded frame
+     *  \param length number of bytes
+     */
+    void sendPriorityFrame(const uint8_t *trans_frame, int16_t length);
+
+    /**
+     * \brief function to send pre-encoded frames to several EPOS2 at once
+     *
+     *  The links of the axes are all held (taken in a fixed order, so two
+     *  callers can't deadlock), every frame is written before any answer is
+     *  waited for, then the answers are collected in the same order. Frames
+     *  of axes on different links are therefore not delayed by the round
+     *  trips of the others either.
+     *
+     *  \param axes EPOS2 of each frame
+     *  \param frames pre-encoded frames
+     *  \param lengths number of bytes of each frame
+     *  \param sent filled with when the write of each frame completed
+     *  \param answers filled with EPOS2_MAX_ANSWER_WORDS words per frame
+     */
+    static void transactTogether(const std::vector<CEpos2*> &axes,
+                                 const std::vector<const uint8_t*> &frames,
+                                 const std::vector<int16_t> &lengths,
+                                 std::vector<std::chrono::steady_clock::time_point> &sent,
+                                 std::vector<uint16_t> &answers);
+
+    /**
+     * \brief function to write an object of several EPOS2 at once
+     *
+     *  transactTogether of pre-encoded WriteObject frames of the same
+     *  object, accounted like writeObject: the object is write-pending for
+     *  the read cache and the values accepted are mirrored.
+     *
+     *  \param values value written to each axis
+     */
+    static void writeTogether(const std::vector<CEpos2*> &axes, int16_t index, int8_t subindex,
+                              const std::vector<int32_t> &values,
+                              const std::vector<const uint8_t*> &frames,
+                              const std::vector<int16_t> &lengths,
+                              std::vector<std::chrono::steady_clock::time_point> &sent,
+                              std::vector<uint16_t> &answers);
+
     /**
      * \brief function receive a frame from EPOS2
      *
@@ -133,8 +478,11 @@ class CEpos2 {
      *  piece of data and checks if data pieces have been stuffed for character
      *  0x90, If there are, frame length is changed.
      *  Also It converts the 8 bit received frame to 16 bit frame.
+     *  The frame is parsed in buffers on the stack, without allocations;
+     *  an answer of more than EPOS2_MAX_ANSWER_WORDS data words is an error.
      *
-     *  \param frame data frame which will be saved from EPOS2
+     *  \param frame data frame which will be saved from EPOS2, at least
+     *    EPOS2_MAX_ANSWER_WORDS words
      */
     void receiveFrame(uint16_t* ans_frame);
 
@@ -164,6 +512,32 @@ class CEpos2 {
 
     bool verbose;
 
+    /**
+     * \brief last known profile values used by estimateProfilePositionTime
+     *
+     *  They are updated by the getters and setters of the objects, -1 if
+     *  not known yet.
+     */
+    long profile_velocity;
+    long profile_acceleration;
+    long profile_deceleration;
+    long profile_type;
+    long encoder_pulses;
+    long target_position;
+    bool target_position_valid;
+
+    /**
+     * \brief last known motor current limits [mA] used to clamp the
+     *  current setpoint, -1 if not known yet
+     */
+    long continuous_current_limit;
+    long output_current_limit;
+
+    /**
+     * \brief unwraps every position read (see readPosition64)
+     */
+    CEpos2PositionTracker position_tracker;
+
     /*!
     \brief function to make a unsigned long signed
 
@@ -181,10 +555,14 @@ class CEpos2 {
 	public:
 
 		/*! \brief Constructor
+		 *
+		 *  \param nodeId node id of the EPOS2
+		 *  \param serial serial number of the USB device (FTDI) of the EPOS2,
+		 *    empty for the first one found
 		*/
-		CEpos2(int8_t nodeId = 0x00);
+		CEpos2(int8_t nodeId = 0x00, const std::string &serial = "");
 
-		/*! \brief Destructor
+		/*! \brief Destructor, detaches the axis from its status poller
 		*/
 		~CEpos2();
 
@@ -225,6 +603,9 @@ class CEpos2 {
 		 * \brief function to reach switch_on state
 		 *
 		 *  Transitions: 7,10,11 \ref state_machine See EPOS2 state machine
+		 *
+		 *  It uses the emergency stop path: a pre-encoded frame that is sent
+		 *  before any other pending request.
 		 */
 		void quickStop			();
 
@@ -246,9 +627,36 @@ class CEpos2 {
 		 * \brief function to reach switch_on_disabled state
 		 *
 		 *  Transition: 7,9,10,12 \ref state_machine See EPOS2 state machine
+		 *
+		 *  It uses the emergency stop path like quickStop.
 		 */
 		void disableVoltage		();
 
+    /*! \brief latency of the emergency stop path
+
+        Measured from the call of quickStop or disableVoltage until the answer
+        of the EPOS2 is received, waiting for the transaction in progress
+        included. [us]
+     */
+    struct epos_latency {
+      unsigned long count;
+      long last_us;
+      long worst_us;
+      long total_us;
+    };
+
+		/**
+		 * \brief function to get the measured emergency stop latency
+		 *
+		 *  \return latency statistics since creation or last reset
+		 */
+		epos_latency getStopLatency	();
+
+		/**
+		 * \brief function to reset the emergency stop latency statistics
+		 */
+		void resetStopLatency		();
+
 		/**
 		 * \brief function to reach switch_on_disabled state after a FAULT
 		 *
@@ -301,7 +709,7 @@ class CEpos2 {
      *  work with the motor.
 		 *
 		 *  \param opmode desired operation mode (velocity, profile_position,
-     *  profile_velocity,current,homing)
+     *  profile_velocity,current,homing,master_encoder,step_direction)
 		 */
 		void enableMotor		(long opmode);
 
@@ -313,6 +721,19 @@ class CEpos2 {
 		 */
 		bool isTargetReached	();
 
+		/**
+		 * \brief function to wait until the motor has reached the target
+		 *
+		 *  If the axis is attached to a CEpos2StatusPoller it sleeps until the
+		 *  poller sees StatusWord bit 10, otherwise it polls isTargetReached
+		 *  every millisecond.
+		 *
+		 *  \pre Operation Mode = profile_position or profile_velocity
+		 *  \param timeout_ms maximum waiting time, -1 waits forever
+		 *  \return false on timeout
+		 */
+		bool waitTargetReached	(long timeout_ms = -1);
+
 ///@}
 
 
@@ -332,7 +753,8 @@ class CEpos2 {
         \note "no_operation" is an arbitrary number
      */
     enum epos_opmodes{
-      NO_OPERATION = 99, VELOCITY = -2, POSITION = -1, PROFILE_VELOCITY = 3,
+      NO_OPERATION = 99, STEP_DIRECTION = -6, MASTER_ENCODER = -5,
+      CURRENT = -3, VELOCITY = -2, POSITION = -1, PROFILE_VELOCITY = 3,
       PROFILE_POSITION = 1, INTERPOLATED_PROFILE_POSITION = 7, HOMING = 6 };
 
     /*! \enum epos_posmodes
@@ -341,6 +763,12 @@ class CEpos2 {
     enum epos_posmodes{
       HALT, ABSOLUTE, RELATIVE };
 
+    /*! \enum epos_homing_results
+        Outcome of a homing operation (doHomingAsync)
+     */
+    enum epos_homing_results{
+      HOMING_ATTAINED, HOMING_ERROR, HOMING_CANCELLED };
+
 /// @}
 
 /// @name Operation Mode - velocity
@@ -409,12 +837,43 @@ class CEpos2 {
 		 *
 		 *  \pre Operation Mode = profile_position
 		 *  \param mode epos_posmodes
-		 *  \param blocking If it block the program or if it leave the program manage position reached
+		 *  \param blocking If it block the program (see waitTargetReached) or if it leave the program manage position reached
      *  \param wait If it has to wait current movement to finish or just start the new one
      *  \param new_point Assume Target position (seems that it doesn't do anything)
 		 */
     void startProfilePosition (epos_posmodes mode, bool blocking=true, bool wait=true, bool new_point=true);
 
+		/**
+		 * \brief function to compute the duration of a profile position movement
+		 *
+		 *  Trapezoidal or sinusoidal (sin^2 ramps, acceleration as peak value)
+		 *  profile from and to standstill.
+		 *
+		 *  \param distance [qc]
+		 *  \param velocity profile velocity [rev/min]
+		 *  \param acceleration profile acceleration [rev/min/s]
+		 *  \param deceleration profile deceleration [rev/min/s]
+		 *  \param type 0: trapezoidal, 1: sinusoidal
+		 *  \param encoder_pulses encoder pulses per revolution
+		 *  \return duration [s], -1 if the profile is invalid
+		 */
+		static double computeProfileTime	(long distance, long velocity, long acceleration,
+		                                     long deceleration, long type, long encoder_pulses);
+
+		/**
+		 * \brief function to estimate the duration of the next profile position movement
+		 *
+		 *  It uses the profile data and target position last set or read, only
+		 *  the values never seen are read. An absolute movement reads the actual
+		 *  position. startProfilePosition uses it to tell an attached
+		 *  CEpos2StatusPoller when to poll densely.
+		 *
+		 *  \pre Operation Mode = profile_position, motor stopped
+		 *  \param mode epos_posmodes (absolute or relative)
+		 *  \return duration [s], -1 if the profile is invalid
+		 */
+		double estimateProfilePositionTime	(epos_posmodes mode);
+
 ///@}
 
 /// @name Operation Mode - profile_velocity
@@ -452,31 +911,97 @@ class CEpos2 {
 
 ///@}
 
+/// @name Operation Mode - interpolated_profile_position
+/// @{
+
+		/**
+		 * \brief [OPMODE=interpolated_profile_position] function to prepare the buffer
+		 *
+		 *  It selects the PVT sub mode, clears the interpolation buffer and
+		 *  enables it again.
+		 */
+		void clearIpmBuffer		();
+
+		/**
+		 * \brief [OPMODE=interpolated_profile_position] function to add a PVT point
+		 *
+		 *  It writes one Interpolation Data Record (0x20C1, 8 bytes) in the
+		 *  interpolation buffer, which takes a segmented transfer.
+		 *
+		 *  \param position [qc]
+		 *  \param velocity [rev/min] (24 bit)
+		 *  \param time_ms time since the previous point [ms]
+		 */
+		void addPvtPoint		(long position, long velocity, unsigned char time_ms);
+
+		/**
+		 * \brief [OPMODE=interpolated_profile_position] function to read the buffer status
+		 *
+		 *  bit 0: underflow warning, bit 1: overflow warning, bit 2: velocity
+		 *  warning, bit 3: acceleration warning, bit 8: underflow error,
+		 *  bit 9: overflow error, bit 10: velocity error, bit 11: acceleration
+		 *  error, bit 14: buffer enabled, bit 15: IP mode active
+		 *
+		 *  \return Interpolation Buffer Status
+		 */
+		long getIpmBufferStatus		();
+
+		/**
+		 * \brief [OPMODE=interpolated_profile_position] function to GET the buffer size
+		 *
+		 *  \return number of PVT points the buffer can hold
+		 */
+		long getIpmBufferSize		();
+
+		/**
+		 * \brief [OPMODE=interpolated_profile_position] function to start the motion
+		 *
+		 *  \pre Operation Mode = interpolated_profile_position, points in buffer
+		 */
+		void startIpm			();
+
+		/**
+		 * \brief [OPMODE=interpolated_profile_position] function to stop the motion
+		 *
+		 *  \pre Operation Mode = interpolated_profile_position
+		 */
+		void stopIpm			();
+
+///@}
+
 /// @name Operation Mode - current
 /// @{
 
-		/** \todo CURRENT MODE FUNCTIONS
+		/**
 		 * \brief [OPMODE=current] function to GET the target current
 		 *
-		 *  This function gets the target current of current operation mode
+		 *  This function gets the current mode setting value (0x2030)
 		 *
-		 *  \return Target current
+		 *  \return Target current [mA]
 		 */
 		long getTargetCurrent		();
 
 		/**
 		 * \brief [OPMODE=current] function to SET the target current
 		 *
-		 *  This function sets the target current of current operation mode
+		 *  This function sets the current mode setting value (0x2030). It is
+		 *  clamped to +-output current limit (0x6410-02), which is read the
+		 *  first time and then kept up to date by setMotorOutputCurrentLimit.
+		 *
+		 *  The encoded frame of the last setpoint is kept and the answer is
+		 *  only checked for errors, so it can be called every cycle of a
+		 *  force control loop.
 		 *
-		 * \param current Target current
+		 * \param current Target current [mA]
+		 * \return current written after clamping [mA]
 		 */
-		void setTargetCurrent		(long current);
+		long setTargetCurrent		(long current);
 
 		/**
 		 * \brief [OPMODE=current] function to move the motor in current mode
 		 *
-		 *  This function makes move the motor if current mode is the actual operation mode
+		 *  This function enables the operation, the motor follows the target
+		 *  current from now on
 		 *
 		 * \pre Operation Mode = current
 		 */
@@ -485,13 +1010,112 @@ class CEpos2 {
 		/**
 		 * \brief [OPMODE=current] function to stop the motor in current mode
 		 *
-		 *  This function stops the motor if current mode is the actual operation mode
+		 *  This function sets the target current to 0
 		 *
 		 *  \pre Operation Mode = current
 		 */
 		void stopCurrent		();
 ///@}
 
+/// @name Operation Modes - master_encoder and step_direction
+/// @{
+
+    /*! \brief state of the drive following an external signal
+     *
+     *  Decoded from the StatusWord (0x6041) in master encoder and step
+     *  direction modes, where target reached has no meaning.
+     */
+    struct epos_gearing_status {
+      bool following;         // operation enabled, the motor follows the input
+      bool limit_active;      // bit 11, e.g. the gear maximal velocity is reached
+      bool following_error;   // bit 13
+      bool fault;             // bit 3
+    };
+
+		/**
+		 * \brief [OPMODE=master_encoder] function to GET the gear factor
+		 *
+		 *  The motor moves numerator/denominator [qc] per [qc] of the master
+		 *  encoder, the encoder 2 input (0x2300-01, 0x2300-02)
+		 *
+		 *  \param numerator
+		 *  \param denominator
+		 */
+		void getGearFactor		(long &numerator, long &denominator);
+
+		/**
+		 * \brief [OPMODE=master_encoder] function to SET the gear factor
+		 *
+		 *  \param numerator 1...65535
+		 *  \param denominator 1...65535
+		 */
+		void setGearFactor		(long numerator, long denominator);
+
+		/**
+		 * \brief [OPMODE=master_encoder] function to GET the gear maximal velocity
+		 *
+		 *  The motor velocity is limited to it while following (0x2300-03)
+		 *
+		 *  \return maximal velocity [rev/min]
+		 */
+		long getGearMaxVelocity		();
+
+		/**
+		 * \brief [OPMODE=master_encoder] function to SET the gear maximal velocity
+		 *
+		 *  \param velocity [rev/min]
+		 */
+		void setGearMaxVelocity		(long velocity);
+
+		/**
+		 * \brief [OPMODE=step_direction] function to GET the digital position input
+		 *
+		 *  The motor moves numerator/denominator [qc] per step (0x2301-01,
+		 *  0x2301-02) in the direction given by the polarity (0x2301-03)
+		 *
+		 *  \param numerator
+		 *  \param denominator
+		 *  \param polarity 0: normal, 1: inverted
+		 */
+		void getDigitalPositionInput	(long &numerator, long &denominator, long &polarity);
+
+		/**
+		 * \brief [OPMODE=step_direction] function to SET the digital position input
+		 *
+		 *  \param numerator 1...65535
+		 *  \param denominator 1...65535
+		 *  \param polarity 0: normal, 1: inverted
+		 */
+		void setDigitalPositionInput	(long numerator, long denominator, long polarity);
+
+		/**
+		 * \brief [OPMODE=master_encoder,step_direction] function to start following
+		 *
+		 *  It enables the operation, from now on the motor follows the input
+		 *
+		 *  \pre Operation Mode = master_encoder or step_direction
+		 */
+		void startFollowing		();
+
+		/**
+		 * \brief [OPMODE=master_encoder,step_direction] function to stop following
+		 *
+		 *  Halt (controlword bit 8): the motor stops with the halt deceleration
+		 *  and holds its position, still enabled. Not an emergency stop, use
+		 *  quickStop for that.
+		 *
+		 *  \pre Operation Mode = master_encoder or step_direction
+		 */
+		void stopFollowing		();
+
+		/**
+		 * \brief [OPMODE=master_encoder,step_direction] function to get the following state
+		 *
+		 *  \return state decoded from one StatusWord read
+		 */
+		epos_gearing_status getGearingStatus	();
+///@}
+
 /// @name Operation Mode - home
 /// @{
 
@@ -1054,6 +1678,173 @@ class CEpos2 {
 		 */
 		int32_t readPosition		();
 
+		/**
+		 * \brief function to read the multi-turn motor position
+		 *
+		 *  Reads the position and unwraps it with the position tracker, which
+		 *  is fed by every readPosition, so it doesn't wrap at 32 bit.
+		 *
+		 *  \return actual position [qc]
+		 */
+		int64_t readPosition64		();
+
+		/**
+		 * \brief function to get the last multi-turn position read
+		 *
+		 *  No transaction, it is the position of the last readPosition of
+		 *  any user of the axis.
+		 *
+		 *  \return last position [qc]
+		 */
+		int64_t getPosition64		();
+
+		/**
+		 * \brief function to get the position tracker of the axis
+		 *
+		 *  To save its state on exit and load it after a restart, or to
+		 *  set the largest step between reads.
+		 *
+		 *  \return tracker
+		 */
+		CEpos2PositionTracker &getPositionTracker	();
+
+    /*! \brief a value read with host timestamps
+
+        The EPOS2 samples the object somewhere between the request is sent
+        and the answer is complete. Part of the round trip is the minimal
+        time to transfer the request and the answer, which is estimated as
+        the lower envelope of the measured round trips and split between
+        them in proportion of their bytes on the link. The sample was
+        taken in what is left of the interval: sampled is its middle and
+        uncertainty_us its half width.
+     */
+    struct epos_sample {
+      int32_t value;
+      int64_t position;     // unwrapped value (readPositionSample), else value
+      std::chrono::steady_clock::time_point sent;       // request written
+      std::chrono::steady_clock::time_point received;   // answer complete
+      std::chrono::steady_clock::time_point sampled;    // estimated sampling time
+      long uncertainty_us;
+    };
+
+		/**
+		 * \brief function to read motor position with timestamps
+		 *
+		 *  Like readPosition, it feeds the position tracker; position is the
+		 *  unwrapped position (see readPosition64), value the raw counter.
+		 *
+		 *  \return actual position [qc] and its timestamps
+		 */
+		epos_sample readPositionSample		();
+
+		/**
+		 * \brief function to read the velocity actual value with timestamps
+		 *
+		 *  \return velocity [rev/min] and its timestamps
+		 */
+		epos_sample readVelocityActualSample	();
+
+		/**
+		 * \brief function to read motor current with timestamps
+		 *
+		 *  \return current [mA] and its timestamps
+		 */
+		epos_sample readCurrentSample		();
+
+		/**
+		 * \brief function to read the StatusWord with timestamps
+		 *
+		 *  \return StatusWord and its timestamps
+		 */
+		epos_sample readStatusWordSample	();
+
+		/**
+		 * \brief function to get the measured round trip of object reads
+		 *
+		 *  From the request written to the answer complete, the wait for the
+		 *  link excluded [us].
+		 *
+		 *  \return round trip statistics since creation or last reset
+		 */
+		epos_latency getRoundTrip		();
+
+		/**
+		 * \brief function to reset the round trip statistics
+		 *
+		 *  The minimal transfer time estimate is kept.
+		 */
+		void resetRoundTrip		();
+
+    /*! \brief throughput of the segmented transfers
+     */
+    struct epos_transfer_stats {
+      unsigned long count;
+      uint64_t bytes;
+      uint64_t last_bytes;
+      long last_us;
+      long total_us;
+    };
+
+		/**
+		 * \brief function to get the measured segmented transfers
+		 *
+		 *  From the initiate request written to the last answer complete, the
+		 *  wait for the link excluded. bytes * 1e6 / total_us is the
+		 *  throughput [bytes/s].
+		 *
+		 *  \return transfer statistics since creation or last reset
+		 */
+		epos_transfer_stats getTransferStats	();
+
+		/**
+		 * \brief function to reset the segmented transfer statistics
+		 */
+		void resetTransferStats		();
+
+    /*! \brief how object reads were served
+
+        Concurrent reads of the same object are served by one transaction
+        (shared) and, with a freshness window, reads of a value recently
+        read are served without transaction (cached).
+     */
+    struct epos_read_stats {
+      unsigned long transactions;   // misses
+      unsigned long shared;         // hits on a transaction of another caller
+      unsigned long cached;         // hits on a value younger than the window
+    };
+
+		/**
+		 * \brief function to SET the freshness window of object reads
+		 *
+		 *  Reads of an object are always shared with a concurrent read of the
+		 *  same object still waiting for the link. With a window they also
+		 *  join a read already on the link, and a value received less than
+		 *  the window ago is returned without transaction. Writes through the
+		 *  driver invalidate the value of the object written.
+		 *
+		 *  \param window_us maximum age of a value [us], 0 disables it
+		 */
+		void setReadFreshness		(long window_us);
+
+		/**
+		 * \brief function to GET the freshness window of object reads
+		 *
+		 *  \return window [us]
+		 */
+		long getReadFreshness		();
+
+		/**
+		 * \brief function to get how object reads were served
+		 *
+		 *  \return counters since creation or last reset
+		 */
+		epos_read_stats getReadStats		();
+
+		/**
+		 * \brief function to reset the object read counters
+		 */
+		void resetReadStats		();
+
     	/**
 		 * \brief function to read EPOS2 StatusWord
 		 *
@@ -1201,6 +1992,25 @@ class CEpos2 {
 		 */
 		void setEncoderPulseNumber	(long pulses);
 
+		/**
+		 * \brief function to GET the Encoder 2 Pulses
+		 *
+		 *  This function gets the pulses of the second encoder input, the
+		 *  master encoder of master_encoder mode (0x2212-01)
+		 *
+		 *  \return Encoder 2 Pulses
+		 */
+		long getEncoder2PulseNumber	();
+
+		/**
+		 * \brief function to SET the Encoder 2 Pulses
+		 *
+		 *  DISABLE STATE only
+		 *
+		 *  \param pulses
+		 */
+		void setEncoder2PulseNumber	(long pulses);
+
 		/**
 		 * \brief function to GET the Encoder Pulses
 		 *
@@ -1296,9 +2106,9 @@ class CEpos2 {
 		/**
 		 * \brief function to GET Motor Continous Current Limit
 		 *
-		 *  This function gets Motor Continous Current Limit
+		 *  This function gets Motor Continous Current Limit (0x6410-01)
 		 *
-		 *  \return Motor Continous Current Limit
+		 *  \return Motor Continous Current Limit [mA]
 		 */
 		long getMotorContinuousCurrentLimit	();
 
@@ -1315,9 +2125,10 @@ class CEpos2 {
 		/**
 		 * \brief function to GET Motor Output Current Limit
 		 *
-		 *  This function gets Motor Output Current Limit
+		 *  This function gets Motor Output Current Limit (0x6410-02), the
+		 *  peak current and the limit of the target current
 		 *
-		 *  \return Motor Output Current Limit
+		 *  \return Motor Output Current Limit [mA]
 		 */
 		long getMotorOutputCurrentLimit	();
 
@@ -1733,6 +2544,162 @@ class CEpos2 {
 ///@}
 
 
+/// @name Data recorder
+/// @{
+
+    /*! \brief a variable sampled by the data recorder
+     */
+    struct epos_recorder_variable {
+      int16_t index;
+      int8_t  subindex;
+      uint8_t size;           // bytes: 1, 2 or 4
+      bool    is_signed;
+    };
+
+    /*! \enum epos_recorder_triggers
+        Events starting a recording (0x2011), may be combined
+     */
+    enum epos_recorder_triggers{
+      RECORDER_TRIGGER_MOVEMENT_START = 0x01,
+      RECORDER_TRIGGER_ERROR          = 0x02,
+      RECORDER_TRIGGER_DIGITAL_INPUT  = 0x04,
+      RECORDER_TRIGGER_MOVEMENT_END   = 0x08 };
+
+    /*! \brief samples uploaded from the data recorder
+     */
+    struct epos_recorder_data {
+      long period_us;                               // between samples
+      long preceding_samples;                       // before the trigger
+      long trigger_sample;                          // in values, -1 if unknown
+      std::vector<epos_recorder_variable> variables;
+      std::vector<std::vector<int32_t> > values;    // per variable, oldest first
+    };
+
+    /**
+     * \brief function to get the variable of an object with its size
+     *
+     *  The size and sign of the common objects (position, velocity,
+     *  current, following error, StatusWord...) are known, others are
+     *  taken as 32 bit signed.
+     *
+     *  \param index the hexadecimal index of the object
+     *  \param subindex hexadecimal value of the object (usually 0x00)
+     *  \return variable
+     */
+    static epos_recorder_variable recorderVariable(int16_t index, int8_t subindex = 0x00);
+
+    /**
+     * \brief function to SET the variables sampled by the data recorder
+     *
+     *  \param variables 1 to 4 variables (0x2015, 0x2016, 0x2017)
+     */
+    void setRecorderVariables(const std::vector<epos_recorder_variable> &variables);
+
+    /**
+     * \brief function to GET the variables sampled by the data recorder
+     *
+     *  Sizes of variables not set by setRecorderVariables are taken from
+     *  recorderVariable.
+     */
+    std::vector<epos_recorder_variable> getRecorderVariables();
+
+    /**
+     * \brief function to SET the sampling period of the data recorder
+     *
+     *  It is a multiple of the current control period (0x2013).
+     *
+     *  \param period_us [us], rounded to 100 us
+     */
+    void setRecorderSamplingPeriod(long period_us);
+
+    /**
+     * \brief function to GET the sampling period of the data recorder
+     *
+     *  \return [us]
+     */
+    long getRecorderSamplingPeriod();
+
+    /**
+     * \brief function to SET the trigger of the data recorder
+     *
+     *  \param triggers epos_recorder_triggers combined (0x2011)
+     *  \param preceding_samples samples kept before the trigger (0x2014)
+     */
+    void setRecorderTrigger(long triggers, long preceding_samples = 0);
+
+    /**
+     * \brief function to arm the data recorder
+     *
+     *  It records the preceding samples and waits for the trigger.
+     */
+    void startRecorder();
+
+    /**
+     * \brief function to stop the data recorder
+     */
+    void stopRecorder();
+
+    /**
+     * \brief function to trigger the data recorder now
+     */
+    void forceRecorderTrigger();
+
+    /**
+     * \brief function to GET the status of the data recorder
+     *
+     *  \return 0x2012: bit 0 running, bit 1 triggered, bit 2 data available
+     */
+    long getRecorderStatus();
+
+    /**
+     * \brief function to wait until the data recorder has its samples
+     *
+     *  \param timeout_ms -1 waits forever
+     *  \param period_us poll period [us]
+     *  \return true if complete, false on timeout
+     */
+    bool waitRecorderComplete(long timeout_ms = -1, long period_us = 10000);
+
+    /**
+     * \brief function to GET the number of samples recorded
+     *
+     *  \return 0x2018-02
+     */
+    long getRecorderSampleCount();
+
+    /**
+     * \brief function to GET the number of samples the recorder can hold
+     *
+     *  \return 0x2018-01, for all the variables
+     */
+    long getRecorderCapacity();
+
+    /**
+     * \brief function to GET where the oldest sample is in the buffer
+     *
+     *  The buffer is a ring: once it has wrapped (or with preceding
+     *  samples) the oldest sample is not the first one.
+     *
+     *  \return 0x2018-03 [samples]
+     */
+    long getRecorderBufferOffset();
+
+    /**
+     * \brief function to upload the samples of the data recorder
+     *
+     *  The buffer (0x201B) is uploaded with one segmented transfer, turned
+     *  oldest first from the offset of the ring (getRecorderBufferOffset)
+     *  and split into one array per variable. When the recorder was
+     *  triggered, trigger_sample is where the trigger is: the samples after
+     *  it fill the capacity left by the preceding ones, so it is also right
+     *  when the trigger came before all the preceding samples were taken.
+     *
+     *  \return samples
+     */
+    epos_recorder_data readRecorder();
+///@}
+
+
 /// @name Utilities
 /// @{
 
@@ -1788,6 +2755,13 @@ class CEpos2 {
     */
     long getPositionMarker(int buffer = 0);
 
+    /*!
+    \brief gets the number of position markers captured
+
+    It is a 16 bit counter incremented by the EPOS2 on every capture.
+    */
+    long getPositionMarkerCounter();
+
     /*!
     \brief Sets the configuration of a marker position
 
@@ -1802,9 +2776,13 @@ class CEpos2 {
 
     /*! \brief wait for marker position reached
     *
-    *  \param param
+    *  It polls the position marker counter, so a marker at the same position
+    *  as the previous one is not missed. To receive every marker use
+    *  CEpos2MarkerCapture.
+    *
+    *  \param period_us poll period [us]
     */
-    void waitPositionMarker();
+    void waitPositionMarker(long period_us = 50000);
 
     /*!
     \brief Sets the configuration of a homing operation
@@ -1847,21 +2825,62 @@ class CEpos2 {
     \brief starts a homing operation
 
     Options had to be set with setHoming
+
+    \param blocking wait for the end of the homing (see doHomingAsync)
     */
     void doHoming(bool blocking=false);
 
+    /*!
+    \brief starts a homing operation and returns without waiting
+
+    Homing attained (StatusWord bits 10 and 12) and homing error (bit 13) are
+    detected by the attached CEpos2StatusPoller, so one thread can home many
+    axes at once. Without poller a thread running threadTargetReached polls
+    the StatusWord every homing poll period. The thread is owned by the
+    object: a new homing or the destructor cancels and joins it.
+
+    \param callback called with the result when the homing ends (optional)
+    \return future with the result
+    */
+    std::future<epos_homing_results> doHomingAsync(
+        std::function<void(epos_homing_results)> callback = nullptr);
+
     /*! \brief Thread listens to target reached
     *
-    *  \param param
+    *  Polls the StatusWord until homing attained, homing error or stopHoming.
+    *  Bit 12 is first waited to clear (up to 1 s), so the attained bit of a
+    *  previous homing isn't taken for this one.
+    *
+    *  \param param the CEpos2 doing the homing
+    *  \return epos_homing_results cast to pointer
     */
     static void *threadTargetReached(void *param);
 
+    /*! \brief function to cancel and join the polling thread of a homing
+    */
+    void joinHoming();
+
     /*!
     \brief stops a homing operation
 
+    A pending doHomingAsync finishes with HOMING_CANCELLED.
     */
     void stopHoming();
 
+    /*!
+    \brief GET the StatusWord poll period used by threadTargetReached
+
+    \return period [us]
+    */
+    long getHomingPollPeriod();
+
+    /*!
+    \brief SET the StatusWord poll period used by threadTargetReached
+
+    \param period_us period [us]
+    */
+    void setHomingPollPeriod(long period_us);
+
     /*!
     \brief Gives the state of a certain digital Input
 
@@ -1899,6 +2918,102 @@ class CEpos2 {
     int getDigInExecutionMask();
 
 ///@}
+
+  private:
+
+    /*! \brief emergency stop latency statistics, guarded by the link mutex */
+    epos_latency stop_latency;
+
+    /*! \brief round trip of object reads and its lower envelope [us],
+     *  guarded by the link mutex (-1 if no read yet) */
+    epos_latency round_trip;
+    double min_round_trip_us;
+
+    /*! \brief segmented transfers, guarded by the link mutex */
+    epos_transfer_stats transfer_stats;
+
+    /*! \brief a read of an object in progress, shared by its callers
+     */
+    struct read_flight {
+      int16_t index;
+      int8_t  subindex;
+      bool    sent;           // on the link, only joined with a window
+      bool    done;
+      bool    current;        // no write of the object since it was sent
+      epos_sample sample;
+      std::exception_ptr error;
+    };
+
+    /*! \brief reads in progress and last value read of every object,
+     *  guarded by read_mutex */
+    std::vector<std::shared_ptr<read_flight> > read_flights;
+    std::vector<read_flight> read_values;
+    epos_read_stats read_stats;
+    long read_freshness_us;
+    std::mutex read_mutex;
+    std::condition_variable read_cond;
+
+    /*! \brief objects being written, one entry per write in progress,
+     *  guarded by read_mutex; reads of them are not kept */
+    std::vector<std::pair<int16_t, int8_t> > read_writes;
+
+    /**
+     * \brief function to forget the last value read of an object
+     *
+     *  \param index the hexadecimal index of the object written
+     *  \param subindex hexadecimal value of the object (usually 0x00)
+     */
+    void invalidateRead(int16_t index, int8_t subindex);
+
+    /**
+     * \brief scoped write of an object for the read cache
+     *
+     *  From construction to destruction (after the write answer) the object
+     *  is write-pending: reads completed meanwhile may have sampled the old
+     *  value and are not kept. The last value read is forgotten at both
+     *  ends.
+     */
+    class PendingWrite
+    {
+      public:
+        PendingWrite(CEpos2 &axis, int16_t index, int8_t subindex);
+        ~PendingWrite();
+      private:
+        CEpos2 &axis;
+        std::pair<int16_t, int8_t> object;
+    };
+
+    /**
+     * \brief function to read an object from the EPOS2 with timestamps
+     *
+     *  readObject is this without the timestamps. The round trip is
+     *  accounted in round_trip and the sampling time estimated from it.
+     *  Concurrent reads of the same object are served by one transaction,
+     *  see setReadFreshness.
+     *
+     *  \param index the hexadecimal index of the object you want to read
+     *  \param subindex hexadecimal value of the object (usually 0x00)
+     *  \return the value in the object and its timestamps
+     */
+    epos_sample readObjectSample(int16_t index, int8_t subindex);
+
+    /**
+     * \brief function to account a round trip and estimate the sampling time
+     *
+     *  \param sample sample with sent and received set
+     */
+    void estimateSampleTime(epos_sample &sample);
+
+    /*! \brief cancel flag of the homing in progress (threadTargetReached) */
+    std::shared_ptr<std::atomic<bool> > homing_cancel;
+
+    /*! \brief thread running threadTargetReached (doHomingAsync without poller) */
+    std::thread homing_thread;
+
+    long homing_poll_us;
+
+    /*! \brief variables set by setRecorderVariables (empty if none) */
+    std::vector<epos_recorder_variable> recorder_variables;
 };
 
 class EPOS2OpenException : public std::runtime_error
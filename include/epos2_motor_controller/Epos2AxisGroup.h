@@ -0,0 +1,165 @@
+// Copyright (C) 2009-2010 Institut de Robòtica i Informàtica Industrial, CSIC-UPC.
+// Author Martí Morta Garriga  (mmorta@iri.upc.edu)
+// All rights reserved.
+//
+// Copyright (C) 2013 Jochen Sprickerhof <jochen@sprickerhof.de>
+//
+// This file is part of IRI EPOS2 Driver
+// IRI EPOS2 Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef Epos2AxisGroup_H
+#define Epos2AxisGroup_H
+
+#include <vector>
+#include <chrono>
+#include "epos2_motor_controller/Epos2.h"
+
+/*! \class CEpos2AxisGroup
+ \brief Coordinated profile position movements of several EPOS2 axes
+
+ A movement is done in two steps. prepare() writes the targets and the
+ profiles of all axes and pre-encodes the start controlwords, start() then
+ only has to send them: it takes the links once and writes all the frames
+ before waiting for any answer, so no round trip separates two starts. The
+ answers are collected afterwards. The start skew (time between the writes
+ of the first and the last start frame completed) is measured on every
+ start.
+
+ With synchronization, the profile of every axis is slowed down so all of
+ them take as long as the slowest one and arrive together: velocity is scaled
+ by k and acceleration/deceleration by k^2, which scales the duration of a
+ trapezoidal or sinusoidal profile by 1/k.
+
+ The nominal profile of an axis is read when it is added and can be changed
+ with setProfile. The scaled profiles stay on the EPOS2 after the movement.
+
+ The axes may be on one USB link or on several (serials): the start frames
+ are written one after the other, each on the link of its axis, holding
+ all the links (see CEpos2::transactTogether).
+*/
+
+class CEpos2AxisGroup {
+
+  public:
+
+    /*! \brief Constructor of an empty group
+     */
+    CEpos2AxisGroup();
+
+    /**
+     * \brief function to add an axis to the group
+     *
+     *  It reads the profile of the axis, which becomes its nominal profile.
+     *
+     *  \pre axis in profile position mode
+     *  \param axis initialized EPOS2
+     */
+    void add(CEpos2 *axis);
+
+    /**
+     * \brief function to get the number of axes of the group
+     */
+    size_t size();
+
+    /**
+     * \brief function to get an axis of the group
+     *
+     *  \param i axis number, in order of addition
+     *  \return axis
+     */
+    CEpos2 *getAxis(size_t i);
+
+    /**
+     * \brief function to SET the nominal profile of an axis
+     *
+     *  \param i axis number, in order of addition
+     *  \param velocity profile velocity [rev/min]
+     *  \param acceleration profile acceleration [rev/min/s]
+     *  \param deceleration profile deceleration [rev/min/s]
+     */
+    void setProfile(size_t i, long velocity, long acceleration, long deceleration);
+
+    /**
+     * \brief function to prepare a movement of all axes
+     *
+     *  It writes the target and the (scaled) profile of every axis and arms
+     *  the start. Profile values equal to the ones on the EPOS2 aren't
+     *  written again. An absolute movement reads the actual positions.
+     *
+     *  \pre axes in profile position mode and enabled, not moving
+     *  \param targets one target per axis [qc]
+     *  \param mode ABSOLUTE or RELATIVE
+     *  \param synchronize scale the profiles so all axes arrive together
+     *  \return expected duration of the movement [s]
+     */
+    double prepare(const std::vector<long> &targets, CEpos2::epos_posmodes mode,
+                   bool synchronize = true);
+
+    /**
+     * \brief function to start the prepared movement
+     *
+     *  \param blocking wait until all axes reached their target
+     */
+    void start(bool blocking = false);
+
+    /**
+     * \brief function to wait until all axes reached their target
+     *
+     *  It uses the status poller the axes are attached to if it is the same
+     *  for all of them, else it polls the StatusWords.
+     *
+     *  \param timeout_ms maximum waiting time, -1 waits forever
+     *  \return false on timeout
+     */
+    bool waitTargetReached(long timeout_ms = -1);
+
+    /**
+     * \brief function to get the start skew statistics
+     *
+     *  \return time between the first and the last start frame written [us]
+     */
+    CEpos2::epos_latency getStartSkew();
+
+    /**
+     * \brief function to get when each start frame of the last start was written
+     *
+     *  \return offset of each axis from the first one [us]
+     */
+    std::vector<long> getLastStartOffsets();
+
+    /**
+     * \brief function to reset the start skew statistics
+     */
+    void resetStartSkew();
+
+  private:
+
+    struct group_axis {
+      CEpos2 *axis;
+      long velocity;          // nominal profile
+      long acceleration;
+      long deceleration;
+      uint8_t start_frame[32];
+      int16_t start_frame_len;
+      int32_t start_value;        // ControlWord of start_frame
+      long start_offset_us;
+    };
+
+    std::vector<group_axis> axes;
+    bool prepared;
+    double duration;
+    CEpos2::epos_latency skew;
+};
+
+#endif
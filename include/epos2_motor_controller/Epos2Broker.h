@@ -0,0 +1,157 @@
+// Copyright (C) 2009-2010 Institut de Robòtica i Informàtica Industrial, CSIC-UPC.
+// Author Martí Morta Garriga  (mmorta@iri.upc.edu)
+// All rights reserved.
+//
+// Copyright (C) 2013 Jochen Sprickerhof <jochen@sprickerhof.de>
+//
+// This file is part of IRI EPOS2 Driver
+// IRI EPOS2 Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef Epos2Broker_H
+#define Epos2Broker_H
+
+#include <vector>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include "epos2_motor_controller/Epos2.h"
+#include "epos2_motor_controller/Epos2BrokerShm.h"
+
+/*! \class CEpos2Broker
+ \brief Owner of the EPOS2 link serving other processes through shared memory
+
+ The FTDI device can only be opened by one process. The broker owns the
+ axes and publishes their telemetry (position, velocity, current and
+ StatusWord) every period in lock-free rings of a POSIX shared memory
+ object, and executes the commands other processes push to its command
+ queue (see Epos2BrokerShm.h and CEpos2Remote).
+
+ Clients read telemetry with a few memory loads, only commands cost a round
+ trip through the broker. Between polls the broker serves commands as they
+ arrive (checked every command poll interval), and one between the polls of
+ two axes; a busy queue is left for the next period when it is time to poll.
+ Quick stop and disable voltage don't go through the queue: every axis has
+ a stop slot, served by a thread of its own (checked every command poll
+ interval) through the priority lane of CEpos2, so a stop waits at most for
+ the transaction in progress, not for the command or poll it is part of.
+
+ A command that throws is answered with the error message, which the
+ client throws again.
+*/
+
+class CEpos2Broker {
+
+  public:
+
+    /*! \brief Constructor
+     *
+     *  \param name name of the shared memory object (e.g. "/epos2_broker")
+     *  \param period_us telemetry period [us]
+     *  \param command_poll_us maximum wait of a command between polls [us]
+     */
+    CEpos2Broker(const std::string &name = "/epos2_broker", long period_us = 10000,
+                 long command_poll_us = 200);
+
+    /*! \brief Destructor, stops and removes the shared memory object
+     */
+    ~CEpos2Broker();
+
+    /**
+     * \brief function to add an axis
+     *
+     *  \pre broker stopped
+     *  \param axis initialized EPOS2
+     *  \return axis number of the clients
+     */
+    size_t add(CEpos2 *axis);
+
+    /**
+     * \brief function to create the shared memory and start serving
+     *
+     *  A shared memory object left by a broker that died is replaced; one
+     *  of a live broker (this or another process) is not, EPOS2IOException
+     *  is thrown.
+     */
+    void start();
+
+    /**
+     * \brief function to stop serving
+     *
+     *  Clients see the heartbeat stop and their commands time out. The
+     *  shared memory object stays until destruction.
+     */
+    void stop();
+
+    /**
+     * \brief function to know if the broker is serving
+     */
+    bool isRunning();
+
+    /**
+     * \brief function to get the number of commands served
+     */
+    unsigned long getCommandCount();
+
+  private:
+
+    /**
+     * \brief serving loop
+     */
+    void run();
+
+    /**
+     * \brief polls an axis and publishes its telemetry
+     */
+    void publish(size_t i);
+
+    /**
+     * \brief stop serving loop, concurrent with run
+     */
+    void runStops();
+
+    /**
+     * \brief executes the stops requested in the stop slots of the axes
+     */
+    void serveStops();
+
+    /**
+     * \brief executes the commands in the queue
+     *
+     *  \param until stops after the first command past this time
+     *  \return commands executed
+     */
+    size_t serveCommands(const std::chrono::steady_clock::time_point &until);
+
+    /**
+     * \brief executes a command on an axis
+     */
+    int32_t execute(const epos2_shm_command &command);
+
+    std::string name;
+    long period_us;
+    long command_poll_us;
+    std::vector<CEpos2*> axes;
+
+    epos2_shm_segment *shm;
+    int fd;
+
+    std::thread thread;
+    std::thread stop_thread;
+    std::atomic<bool> running;
+    std::atomic<unsigned long> commands;
+};
+
+#endif
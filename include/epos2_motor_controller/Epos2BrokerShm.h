@@ -0,0 +1,179 @@
+// Copyright (C) 2009-2010 Institut de Robòtica i Informàtica Industrial, CSIC-UPC.
+// Author Martí Morta Garriga  (mmorta@iri.upc.edu)
+// All rights reserved.
+//
+// Copyright (C) 2013 Jochen Sprickerhof <jochen@sprickerhof.de>
+//
+// This file is part of IRI EPOS2 Driver
+// IRI EPOS2 Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef Epos2BrokerShm_H
+#define Epos2BrokerShm_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+/*! \file Epos2BrokerShm.h
+ \brief Layout of the shared memory of CEpos2Broker and CEpos2Remote
+
+ The broker creates one POSIX shared memory object with:
+   - a telemetry ring per axis, written by the broker only and read by any
+     number of clients without locks: every slot is a seqlock and head is
+     the number of records published,
+   - a stop slot per axis for quick stop and disable voltage, served by a
+     thread of the broker of its own so an emergency stop never waits
+     behind the queue or the command in progress,
+   - a bounded multi-producer single-consumer command queue (a ring of
+     cells with a sequence number each, producers claim a cell with a CAS
+     on enqueue_pos; a command not taken by the broker yet can be
+     cancelled by its client),
+   - a result slot per command cell, the client of the command waits until
+     the slot has the ticket of its command.
+
+ Only lock-free atomics are used, so the processes never block each other.
+ Times are of CLOCK_MONOTONIC (std::chrono::steady_clock) [ns].
+*/
+
+#define EPOS2_SHM_MAGIC     0x45503253u   // "EP2S", set when the segment is ready
+#define EPOS2_SHM_VERSION   2u
+
+static const size_t EPOS2_SHM_MAX_AXES       = 16;
+static const size_t EPOS2_SHM_TELEMETRY_SIZE = 256;   // records per axis, power of 2
+static const size_t EPOS2_SHM_COMMAND_SIZE   = 64;    // power of 2
+static const size_t EPOS2_SHM_MESSAGE_SIZE   = 120;
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "the broker needs lock-free 64 bit atomics");
+
+/*! \brief commands of the clients
+ */
+enum epos2_shm_opcodes {
+  EPOS2_SHM_READ_OBJECT = 1,          // index, subindex -> value
+  EPOS2_SHM_WRITE_OBJECT,             // index, subindex, value
+  EPOS2_SHM_GET_STATE,
+  EPOS2_SHM_ENABLE_CONTROLLER,
+  EPOS2_SHM_ENABLE_MOTOR,             // value: opmode
+  EPOS2_SHM_DISABLE_OPERATION,
+  EPOS2_SHM_QUICK_STOP,
+  EPOS2_SHM_DISABLE_VOLTAGE,
+  EPOS2_SHM_FAULT_RESET,
+  EPOS2_SHM_GET_OPERATION_MODE,
+  EPOS2_SHM_SET_OPERATION_MODE,       // value: opmode
+  EPOS2_SHM_SET_TARGET_VELOCITY,      // value: [rev/min]
+  EPOS2_SHM_START_VELOCITY,
+  EPOS2_SHM_STOP_VELOCITY,
+  EPOS2_SHM_SET_TARGET_PROFILE_POSITION,  // value: [qc]
+  EPOS2_SHM_START_PROFILE_POSITION,   // value: epos_posmodes | 0x100 wait | 0x200 new_point
+  EPOS2_SHM_SET_TARGET_PROFILE_VELOCITY,  // value: [rev/min]
+  EPOS2_SHM_START_PROFILE_VELOCITY,
+  EPOS2_SHM_STOP_PROFILE_VELOCITY,
+  EPOS2_SHM_SET_PROFILE_VELOCITY,     // value: [rev/min]
+  EPOS2_SHM_SET_PROFILE_ACCELERATION, // value: [rev/min/s]
+  EPOS2_SHM_SET_PROFILE_DECELERATION, // value: [rev/min/s]
+  EPOS2_SHM_SET_TARGET_CURRENT,       // value: [mA] -> clamped value
+  EPOS2_SHM_START_CURRENT,
+  EPOS2_SHM_STOP_CURRENT
+};
+
+/*! \brief stops requested in the stop slot of an axis (bits)
+ */
+enum epos2_shm_stops {
+  EPOS2_SHM_STOP_QUICK_STOP      = 0x01,
+  EPOS2_SHM_STOP_DISABLE_VOLTAGE = 0x02
+};
+
+/*! \brief states of a command cell
+ */
+enum epos2_shm_command_states {
+  EPOS2_SHM_COMMAND_QUEUED = 0,
+  EPOS2_SHM_COMMAND_TAKEN,        // by the broker, it will be executed
+  EPOS2_SHM_COMMAND_CANCELLED     // by the client, it won't
+};
+
+/*! \brief telemetry of an axis at a poll of the broker
+ */
+struct epos2_shm_telemetry {
+  int64_t  time_ns;       // estimated sampling time of the position
+  int64_t  position;      // unwrapped [qc]
+  int32_t  velocity;      // velocity actual value [rev/min]
+  int32_t  current;       // [mA]
+  int32_t  status_word;
+  int32_t  error;         // 0, or the poll failed (the values are the last ones)
+};
+
+struct epos2_shm_telemetry_slot {
+  std::atomic<uint64_t> seq;    // odd while written, 2*record number when complete
+  epos2_shm_telemetry   data;
+};
+
+/*! \brief stop slot of an axis
+ *
+ *  A client sets its bit in request, then takes a ticket from requests. The
+ *  broker loads requests, takes the bits (exchange with 0), executes them
+ *  and stores what it loaded in served: a ticket is served once
+ *  served >= ticket, error tells if the last stop served failed.
+ */
+struct epos2_shm_stop {
+  std::atomic<uint32_t> request;
+  std::atomic<uint64_t> requests;
+  std::atomic<uint64_t> served;
+  std::atomic<int32_t>  error;
+};
+
+struct epos2_shm_axis {
+  int32_t node_id;
+  epos2_shm_stop stop;
+  std::atomic<uint64_t> head;   // records published
+  epos2_shm_telemetry_slot slots[EPOS2_SHM_TELEMETRY_SIZE];
+};
+
+struct epos2_shm_command {
+  uint32_t axis;
+  uint32_t opcode;
+  int32_t  index;
+  int32_t  subindex;
+  int32_t  value;
+};
+
+struct epos2_shm_command_cell {
+  std::atomic<uint64_t> seq;    // position + 1 when filled, position + size when free
+  std::atomic<uint32_t> state;  // epos2_shm_command_states, set queued before seq
+  epos2_shm_command     command;
+};
+
+struct epos2_shm_result {
+  std::atomic<uint64_t> ticket; // position + 1 of the command when written
+  int32_t value;
+  int32_t error;                // 0 or the command threw message
+  char    message[EPOS2_SHM_MESSAGE_SIZE];
+};
+
+struct epos2_shm_segment {
+  std::atomic<uint32_t> magic;
+  uint32_t version;
+  int32_t  broker_pid;
+  uint32_t axes;
+  int64_t  period_ns;
+  std::atomic<uint64_t> heartbeat_ns;   // last cycle of the broker
+
+  epos2_shm_axis axis[EPOS2_SHM_MAX_AXES];
+
+  std::atomic<uint64_t> enqueue_pos;
+  std::atomic<uint64_t> dequeue_pos;
+  epos2_shm_command_cell commands[EPOS2_SHM_COMMAND_SIZE];
+  epos2_shm_result       results[EPOS2_SHM_COMMAND_SIZE];
+};
+
+#endif
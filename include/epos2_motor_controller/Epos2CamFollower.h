@@ -0,0 +1,254 @@
+// Copyright (C) 2009-2010 Institut de Robòtica i Informàtica Industrial, CSIC-UPC.
+// Author Martí Morta Garriga  (mmorta@iri.upc.edu)
+// All rights reserved.
+//
+// Copyright (C) 2013 Jochen Sprickerhof <jochen@sprickerhof.de>
+//
+// This file is part of IRI EPOS2 Driver
+// IRI EPOS2 Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef Epos2CamFollower_H
+#define Epos2CamFollower_H
+
+#include <vector>
+#include <mutex>
+#include <chrono>
+#include "epos2_motor_controller/Epos2.h"
+#include "epos2_motor_controller/Epos2CycleRunner.h"
+
+/*! \class CEpos2CamFollower
+ \brief Electronic gearing / camming of a slave EPOS2 on a master EPOS2
+
+ Every cycle a CEpos2CycleRunner thread reads the position of the master,
+ evaluates the cam table and writes the result as position mode setting
+ value (0x2062) of the slave.
+
+ The master read and the slave write are done back to back holding the
+ links once: the master read request is encoded once, the cam is evaluated
+ while the links are held and the slave frame is sent right after the
+ master answer, so no other transaction gets in between. When the two
+ controllers are on different USB links (serials), the master link is
+ released as soon as the master answers and the slave read of the
+ synchronization error is sent together with the master read, so it
+ overlaps the master round trip instead of following the write.
+
+ The cam is a table of slave positions over one period of the master,
+ linearly interpolated in integer (fixed-point) arithmetic: the master
+ position is taken with 8 fractional bits, so the result is exact and
+ doesn't depend on the magnitude of the positions. After a period the
+ slave goes on from the last point of the table (a table ending higher than
+ it starts makes the slave advance every period). A gear ratio is a table
+ of two points.
+
+ The time from the master sample (estimated from the round trip, see
+ CEpos2::epos_sample) to the arrival of the slave setpoint (transport
+ delay) is measured every cycle. With compensation enabled the
+ master position is extrapolated by its velocity over the filtered delay.
+
+ The synchronization error is the slave actual position minus the cam of
+ the master at the same time (the master extrapolated to the time of the
+ slave read). Reading the slave costs a third transaction, so it is done
+ only every few cycles.
+
+ The master position is unwrapped by its CEpos2PositionTracker, so the
+ master may run forever, and both trackers are fed by the reads of the loop.
+*/
+
+class CEpos2CamFollower {
+
+  public:
+
+    /*! \brief synchronization error statistics [qc]
+     *
+     *  worst and total are of the absolute value.
+     */
+    struct epos_sync_error {
+      unsigned long count;
+      long last;
+      long worst;
+      long total;
+    };
+
+    /*! \brief Constructor
+     *
+     *  The cam is a 1:1 gear until one is set.
+     *
+     *  \param master EPOS2 read
+     *  \param slave EPOS2 driven
+     *  \param period_us cycle period [us]
+     */
+    CEpos2CamFollower(CEpos2 &master, CEpos2 &slave, long period_us = 2000);
+
+    /*! \brief Destructor, stops the loop
+     */
+    ~CEpos2CamFollower();
+
+    /**
+     * \brief function to SET a gear ratio
+     *
+     *  \pre loop stopped
+     *  \param numerator slave [qc] per denominator master [qc]
+     *  \param denominator master [qc], > 0
+     */
+    void setGear(long numerator, long denominator);
+
+    /**
+     * \brief function to SET a cam table
+     *
+     *  \pre loop stopped
+     *  \param slave slave positions [qc] at equally spaced master positions,
+     *    the first at master 0 and the last at master_period, at least 2
+     *  \param master_period master positions of one period [qc], > 0
+     */
+    void setCamTable(const std::vector<int32_t> &slave, long master_period);
+
+    /**
+     * \brief function to SET the master phase at start
+     *
+     *  At start the master position is taken as phase and the slave as the
+     *  cam at this phase, so the slave doesn't jump.
+     *
+     *  \pre loop stopped
+     *  \param phase master position in the cam [qc]
+     */
+    void setPhase(long phase);
+
+    /**
+     * \brief function to SET the transport delay compensation
+     *
+     *  \param enable extrapolate the master over the measured delay
+     *  \param extra_us delay added to the measured one (e.g. the slave
+     *    position loop) [us]
+     */
+    void setDelayCompensation(bool enable, long extra_us = 0);
+
+    /**
+     * \brief function to SET how often the synchronization error is measured
+     *
+     *  \param cycles the slave is read every this many cycles, 0 never
+     */
+    void setErrorSampling(unsigned long cycles);
+
+    /**
+     * \brief function to evaluate the cam
+     *
+     *  \param master master position in the cam, 8 fractional bits [qc/256]
+     *  \return slave position [qc], the interpolated table plus its rise
+     *    (last minus first point) for every period of the master
+     */
+    int64_t evaluate(int64_t master) const;
+
+    /**
+     * \brief function to start following
+     *
+     *  \pre slave in position mode and enabled
+     */
+    void start();
+
+    /**
+     * \brief function to stop following
+     *
+     *  The slave keeps the last setpoint. An error of the loop thread is
+     *  thrown here.
+     */
+    void stop();
+
+    /**
+     * \brief function to know if the loop is running
+     *
+     *  \return false if stopped or stopped by an error
+     */
+    bool isRunning();
+
+    /**
+     * \brief function to get the filtered transport delay
+     *
+     *  \return master sample to slave setpoint time [us]
+     */
+    long getTransportDelay();
+
+    /**
+     * \brief function to get the transport delay of every cycle
+     *
+     *  \return delay statistics since start or last reset
+     */
+    CEpos2::epos_latency getTransportDelayStats();
+
+    /**
+     * \brief function to get the synchronization error statistics
+     */
+    epos_sync_error getSyncError();
+
+    /**
+     * \brief function to reset the delay and error statistics
+     */
+    void resetStatistics();
+
+    /**
+     * \brief function to get the cycle runner of the loop
+     *
+     *  To set the real-time settings before start and read the timing.
+     */
+    CEpos2CycleRunner &getRunner();
+
+  private:
+
+    /**
+     * \brief one cycle of the loop, called by the runner
+     */
+    void cycle();
+
+    /**
+     * \brief transaction of a pre-encoded frame, link must be held
+     */
+    void transact(CEpos2 &axis, const uint8_t *frame, int16_t length, uint16_t *ans_frame);
+
+    CEpos2 &master;
+    CEpos2 &slave;
+
+    // cam: table[i] at master i*period/(table.size()-1)
+    std::vector<int32_t> table;
+    int64_t master_period_q;    // [qc/256]
+    long phase;
+
+    bool compensate;
+    long extra_delay_us;
+    unsigned long error_sampling;
+
+    uint8_t master_read_frame[32];
+    int16_t master_read_frame_len;
+    uint8_t slave_read_frame[32];
+    int16_t slave_read_frame_len;
+
+    // state of the loop thread
+    int64_t master_origin;      // unwrapped master at phase [qc]
+    int64_t slave_origin;       // slave at cam 0 [qc]
+    int64_t last_master;        // [qc]
+    double last_sample;         // [s since start]
+    double velocity;            // master [qc/s]
+    double delay;               // filtered transport delay [s]
+    unsigned long cycles;
+    std::chrono::steady_clock::time_point start_time;
+
+    // guards the statistics
+    std::mutex mutex;
+    CEpos2::epos_latency delay_stats;
+    epos_sync_error error;
+    long filtered_delay_us;
+
+    CEpos2CycleRunner runner;
+};
+
+#endif
@@ -0,0 +1,248 @@
+// Copyright (C) 2009-2010 Institut de Robòtica i Informàtica Industrial, CSIC-UPC.
+// Author Martí Morta Garriga  (mmorta@iri.upc.edu)
+// All rights reserved.
+//
+// Copyright (C) 2013 Jochen Sprickerhof <jochen@sprickerhof.de>
+//
+// This file is part of IRI EPOS2 Driver
+// IRI EPOS2 Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef Epos2ControlLoop_H
+#define Epos2ControlLoop_H
+
+#include <vector>
+#include <string>
+#include <chrono>
+#include <mutex>
+#include <functional>
+#include "epos2_motor_controller/Epos2.h"
+#include "epos2_motor_controller/Epos2CycleRunner.h"
+#include "epos2_motor_controller/Epos2StateEstimator.h"
+
+/*! \class CEpos2ControlLoop
+ \brief Host side position controller of several EPOS2 in velocity mode
+
+ Every cycle a CEpos2CycleRunner thread reads the position of all axes, computes a PID with
+ velocity feedforward for each of them and writes the result with
+ setTargetVelocity (0x206B).
+
+ The state of the controllers is kept as a structure of arrays (one array
+ per gain or state variable, one element per axis) so the PID of all axes is
+ computed by a few loops without branches the compiler can vectorize.
+
+ The PID works in [qc] and [qc/s]:
+ u = kff*v_ref + kp*e + I - kd*v, with e = x_ref - x and I the integral
+ of ki*e. The derivative is taken on the measurement so setpoint steps
+ don't kick the output: v is the velocity estimated by a
+ CEpos2StateEstimator from the timestamped position samples, so the only
+ transaction per axis and cycle besides the output is the position read. u is limited to +-max_output and, against windup,
+ the integral is driven back by kt times the part of u cut by the limit
+ (back-calculation).
+
+ Custom control laws hook in through two callbacks called every cycle from
+ the loop thread without locks held: the setpoint source (e.g. a sampled
+ CEpos2Trajectory) and the output filter, which sees the measured positions
+ and may change the outputs before they are written (gain scheduling with
+ setGains, disturbance observers, ...).
+
+ Timing (wakeup latency, execution time, overruns) is measured every cycle
+ by the runner, which also gives access to the real-time settings and the
+ histograms.
+*/
+
+class CEpos2ControlLoop {
+
+  public:
+
+    /*! \brief gains of the PID of an axis
+     */
+    struct epos_pid_gains {
+      double kp;            // [1/s]
+      double ki;            // [1/s^2]
+      double kd;            // [-]
+      double kff;           // velocity feedforward [-]
+      double kt;            // anti-windup tracking gain [1/s]
+      double max_output;    // [qc/s]
+    };
+
+    /*! \brief Constructor
+     *
+     *  \param period_us cycle period [us]
+     */
+    CEpos2ControlLoop(long period_us = 2000);
+
+    /*! \brief Destructor, stops the loop
+     */
+    ~CEpos2ControlLoop();
+
+    /**
+     * \brief function to add an axis
+     *
+     *  \pre loop stopped, axis in velocity mode and enabled
+     *  \param axis initialized EPOS2
+     *  \param gains PID gains
+     *  \return axis number
+     */
+    size_t add(CEpos2 *axis, const epos_pid_gains &gains);
+
+    /**
+     * \brief function to SET the gains of an axis
+     *
+     *  Bumpless: the integral is kept as a velocity.
+     *
+     *  \param i axis number
+     *  \param gains PID gains
+     */
+    void setGains(size_t i, const epos_pid_gains &gains);
+
+    /**
+     * \brief function to GET the gains of an axis
+     *
+     *  \param i axis number
+     *  \return PID gains
+     */
+    epos_pid_gains getGains(size_t i);
+
+    /**
+     * \brief function to SET the setpoint of an axis
+     *
+     *  \param i axis number
+     *  \param position [qc]
+     *  \param velocity feedforward velocity [qc/s]
+     */
+    void setSetpoint(size_t i, double position, double velocity = 0.0);
+
+    /**
+     * \brief function to SET a source of setpoints for every cycle
+     *
+     *  It is called with the time since start [s] and arrays of one position
+     *  [qc] and velocity [qc/s] per axis to fill, replacing setSetpoint.
+     *
+     *  \param source setpoint callback, empty to use setSetpoint
+     */
+    void setSetpointSource(const std::function<void(double, double*, double*)> &source);
+
+    /**
+     * \brief function to SET a filter of the outputs of every cycle
+     *
+     *  It is called with the time since start [s], the measured positions
+     *  [qc] and the outputs [qc/s] of all axes, which it may change.
+     *
+     *  \param filter output callback, empty for none
+     */
+    void setOutputFilter(const std::function<void(double, const double*, double*)> &filter);
+
+    /**
+     * \brief function to start the loop
+     *
+     *  The setpoints of the axes without one are set to their actual position.
+     */
+    void start();
+
+    /**
+     * \brief function to stop the loop
+     *
+     *  The velocity of all axes is set to 0. An error of the loop thread is
+     *  thrown here.
+     */
+    void stop();
+
+    /**
+     * \brief function to know if the loop is running
+     *
+     *  \return false if stopped or stopped by an error
+     */
+    bool isRunning();
+
+    /**
+     * \brief function to get the last position measured of an axis
+     *
+     *  \param i axis number
+     *  \return position [qc]
+     */
+    double getPosition(size_t i);
+
+    /**
+     * \brief function to get the estimated velocity of an axis
+     *
+     *  \param i axis number
+     *  \return velocity [qc/s]
+     */
+    double getVelocity(size_t i);
+
+    /**
+     * \brief function to SET the noise of the velocity estimator of an axis
+     *
+     *  \param i axis number
+     *  \param position_variance [qc^2]
+     *  \param jerk_density [qc^2/s^5]
+     */
+    void setEstimatorNoise(size_t i, double position_variance, double jerk_density);
+
+    /**
+     * \brief function to get the timing statistics
+     */
+    CEpos2CycleRunner::epos_cycle_stats getTiming();
+
+    /**
+     * \brief function to reset the timing statistics
+     */
+    void resetTiming();
+
+    /**
+     * \brief function to get the cycle runner of the loop
+     *
+     *  To set the real-time settings before start and read the histograms.
+     */
+    CEpos2CycleRunner &getRunner();
+
+  private:
+
+    /**
+     * \brief one cycle of the loop, called by the runner
+     */
+    void cycle();
+
+    /**
+     * \brief one PID step of all axes, mutex must be held
+     */
+    void compute(double dt);
+
+    std::vector<CEpos2*> axes;
+
+    // structure of arrays, one element per axis
+    std::vector<double> kp, ki, kd, kff, kt, max_output;
+    std::vector<double> x_ref, v_ref;     // setpoint
+    std::vector<double> x;                // measurement
+    std::vector<double> integral;
+    std::vector<double> output;           // [qc/s]
+    std::vector<double> rpm_per_qcs;
+    std::vector<char>   has_setpoint;
+    CEpos2StateEstimator estimator;       // velocity of the measurement
+
+    // buffers of the cycle, only used by the loop thread
+    std::vector<double> cycle_x, cycle_x_ref, cycle_v_ref, cycle_output;
+    std::vector<CEpos2::epos_sample> cycle_samples;
+    std::chrono::steady_clock::time_point start_time, last_read;
+
+    std::function<void(double, double*, double*)> setpoint_source;
+    std::function<void(double, const double*, double*)> output_filter;
+
+    // guards everything above but the cycle buffers
+    std::mutex mutex;
+
+    CEpos2CycleRunner runner;
+};
+
+#endif
@@ -0,0 +1,224 @@
+// Copyright (C) 2009-2010 Institut de Robòtica i Informàtica Industrial, CSIC-UPC.
+// Author Martí Morta Garriga  (mmorta@iri.upc.edu)
+// All rights reserved.
+//
+// Copyright (C) 2013 Jochen Sprickerhof <jochen@sprickerhof.de>
+//
+// This file is part of IRI EPOS2 Driver
+// IRI EPOS2 Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef Epos2CycleRunner_H
+#define Epos2CycleRunner_H
+
+#include <vector>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <future>
+#include <ostream>
+#include <functional>
+
+/*! \class CEpos2CycleRunner
+ \brief Runs a callback at a fixed period in a (optionally real-time) thread
+
+ The thread sleeps with clock_nanosleep until absolute deadlines on
+ CLOCK_MONOTONIC, so the period doesn't drift with the execution time of
+ the callback. A cycle that ends after the deadline of the next one counts
+ as an overrun and the next deadline is one period after its end (missed
+ cycles are not run late).
+
+ Before the first cycle the thread can switch to SCHED_FIFO, pin itself to
+ a CPU and pre-fault its stack, and the process can lock its memory
+ (mlockall) to avoid page faults in the loop. These usually need
+ privileges: a request that fails is reported by getRealtimeError and the
+ runner goes on without it.
+
+ The wakeup latency (time from the deadline until the thread runs) and the
+ execution time of the callback are recorded in histograms. They are
+ updated by the loop thread with relaxed atomics, so reading them never
+ blocks the loop.
+
+ If the callback throws, the loop stops and stop() throws the error (its
+ message, or a generic one for an exception not derived from std::exception).
+*/
+
+class CEpos2CycleRunner {
+
+  public:
+
+    /*! \brief real-time settings of the loop thread
+     */
+    struct epos_rt_config {
+      int    priority;        // SCHED_FIFO priority, 0 keeps the default policy
+      int    cpu;             // CPU to pin the thread to, -1 for any
+      bool   lock_memory;     // mlockall(MCL_CURRENT | MCL_FUTURE)
+      size_t stack_prefault;  // bytes of stack to touch before the loop
+    };
+
+    /*! \brief summary of the cycles run [us]
+     */
+    struct epos_cycle_stats {
+      unsigned long cycles;
+      unsigned long overruns;
+      long last_wakeup_us;
+      long worst_wakeup_us;
+      long total_wakeup_us;
+      long last_exec_us;
+      long worst_exec_us;
+      long total_exec_us;
+    };
+
+    /*! \brief Constructor
+     *
+     *  \param period_us cycle period [us]
+     *  \param callback function called every cycle
+     *  \param bin_us histogram bin width [us]
+     *  \param bins number of histogram bins, the last one counts everything
+     *    longer
+     */
+    CEpos2CycleRunner(long period_us, const std::function<void()> &callback,
+                      long bin_us = 10, size_t bins = 1000);
+
+    /*! \brief Destructor, stops the loop
+     */
+    ~CEpos2CycleRunner();
+
+    /**
+     * \brief function to SET the real-time settings
+     *
+     *  They are applied on the next start.
+     *
+     *  \param config settings
+     */
+    void setRealtime(const epos_rt_config &config);
+
+    /**
+     * \brief function to GET the cycle period
+     *
+     *  \return period [us]
+     */
+    long getPeriod();
+
+    /**
+     * \brief function to start the loop
+     *
+     *  It returns when the real-time settings are applied.
+     */
+    void start();
+
+    /**
+     * \brief function to stop the loop
+     *
+     *  An error thrown by the callback is thrown here.
+     */
+    void stop();
+
+    /**
+     * \brief function to know if the loop is running
+     *
+     *  \return false if stopped or stopped by an error
+     */
+    bool isRunning();
+
+    /**
+     * \brief function to get why real-time settings couldn't be applied
+     *
+     *  \return description of the failed requests, empty if none failed
+     */
+    std::string getRealtimeError();
+
+    /**
+     * \brief function to get the summary of the cycles run
+     */
+    epos_cycle_stats getStatistics();
+
+    /**
+     * \brief function to get the wakeup latency histogram
+     *
+     *  \return cycles per bin, bin i counts [i*bin_us, (i+1)*bin_us)
+     */
+    std::vector<unsigned long> getWakeupHistogram();
+
+    /**
+     * \brief function to get the execution time histogram
+     *
+     *  \return cycles per bin, bin i counts [i*bin_us, (i+1)*bin_us)
+     */
+    std::vector<unsigned long> getExecutionHistogram();
+
+    /**
+     * \brief function to GET the histogram bin width
+     *
+     *  \return bin width [us]
+     */
+    long getBinWidth();
+
+    /**
+     * \brief function to write the histograms as CSV
+     *
+     *  One line per non empty bin: "bin_start_us,wakeup,execution".
+     *
+     *  \param out output stream
+     */
+    void exportHistograms(std::ostream &out);
+
+    /**
+     * \brief function to reset statistics and histograms
+     *
+     *  While the loop runs, a cycle in progress may be counted partially.
+     */
+    void resetStatistics();
+
+  private:
+
+    /**
+     * \brief cycle loop
+     */
+    void run(std::promise<void> *ready);
+
+    /**
+     * \brief applies the real-time settings to the calling thread
+     */
+    std::string applyRealtime();
+
+    /**
+     * \brief adds a value to a histogram
+     */
+    void account(std::atomic<unsigned long> *histogram, long value_us);
+
+    std::function<void()> callback;
+    long period_us;
+    long bin_us;
+    size_t bins;
+    epos_rt_config config;
+
+    std::unique_ptr<std::atomic<unsigned long>[]> wakeup_histogram;
+    std::unique_ptr<std::atomic<unsigned long>[]> exec_histogram;
+    std::atomic<unsigned long> cycles;
+    std::atomic<unsigned long> overruns;
+    std::atomic<long> last_wakeup_us, worst_wakeup_us, total_wakeup_us;
+    std::atomic<long> last_exec_us, worst_exec_us, total_exec_us;
+
+    std::thread thread;
+    std::atomic<bool> running;
+
+    // guards error and rt_error
+    std::mutex mutex;
+    std::string error;
+    std::string rt_error;
+};
+
+#endif
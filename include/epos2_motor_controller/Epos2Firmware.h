@@ -0,0 +1,164 @@
+// Copyright (C) 2009-2010 Institut de Robòtica i Informàtica Industrial, CSIC-UPC.
+// Author Martí Morta Garriga  (mmorta@iri.upc.edu)
+// All rights reserved.
+//
+// Copyright (C) 2013 Jochen Sprickerhof <jochen@sprickerhof.de>
+//
+// This file is part of IRI EPOS2 Driver
+// IRI EPOS2 Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef Epos2Firmware_H
+#define Epos2Firmware_H
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <functional>
+#include "epos2_motor_controller/Epos2.h"
+
+/*! \class CEpos2Firmware
+ \brief Download of a firmware image to EPOS2
+
+ The program download objects of CiA 302-3 are used:
+   - 0x1F51-01 program control: stop (0), clear (3), start (1)
+   - 0x1F50-01 program data: the image, by a segmented download
+   - 0x1F57-01 flash status: bit 0 while programming, bits 1-7 error
+   - 0x1F56-01 program software identification: CRC-32 of the program
+   .
+
+ The image is never loaded: every segment is read from the file while the
+ EPOS2 answers the previous one (see CEpos2::writeObjectSegmented), so the
+ download runs at the pace of the link. Once programmed, the CRC-32 the
+ EPOS2 reports is compared with the one of the file before the program is
+ started.
+
+ flash downloads to several EPOS2 at once: each USB device (serial number)
+ is its own link and gets its own thread, the nodes behind the same
+ device are flashed one after the other.
+*/
+
+class CEpos2Firmware {
+
+  public:
+
+    /*! \brief an EPOS2 to flash
+     */
+    struct epos_flash_target {
+      std::string serial;     // USB device, empty for the first one found
+      int8_t node_id;
+    };
+
+    /*! \brief outcome of the download to an EPOS2
+     */
+    struct epos_flash_result {
+      bool ok;
+      std::string error;      // if not ok
+      uint32_t bytes;         // downloaded
+      long download_us;       // segmented download only
+      long total_us;          // stop to start, flash programming included
+      double bytes_per_s;     // of the segmented download
+      double efficiency;      // bytes_per_s / linkLimit()
+    };
+
+    /*! \brief progress of a download: target number, bytes sent, image size
+     *
+     *  Called from the thread of the link of the target, for every segment.
+     */
+    typedef std::function<void(size_t, uint32_t, uint32_t)> progress_callback;
+
+    /*! \brief Constructor, computes the size and CRC-32 of the image
+     *
+     *  \param path firmware image (binary)
+     */
+    CEpos2Firmware(const std::string &path);
+
+    /**
+     * \brief function to get the size of the image
+     *
+     *  \return [bytes]
+     */
+    uint32_t getSize();
+
+    /**
+     * \brief function to get the CRC-32 of the image
+     *
+     *  \return CRC-32 (IEEE 802.3, as zlib)
+     */
+    uint32_t getCrc();
+
+    /**
+     * \brief function to download the image to an EPOS2
+     *
+     *  Stops the program, clears it, downloads the image, waits for the
+     *  flash to be programmed, checks the CRC-32 and starts the program.
+     *
+     *  \param axis initialized EPOS2
+     *  \param progress called for every segment with target 0, may be empty
+     *  \param timeout_ms limit of the flash programming
+     *  \return the measures of the download, ok (errors are thrown)
+     */
+    epos_flash_result download(CEpos2 &axis, const progress_callback &progress = progress_callback(),
+                               long timeout_ms = 30000);
+
+    /**
+     * \brief function to download the image to several EPOS2 in parallel
+     *
+     *  One thread per USB device, the errors are returned per target.
+     *
+     *  \param targets EPOS2 to flash
+     *  \param progress called for every segment, may be empty
+     *  \param timeout_ms limit of the flash programming of a target
+     *  \return one result per target
+     */
+    std::vector<epos_flash_result> flash(const std::vector<epos_flash_target> &targets,
+                                         const progress_callback &progress = progress_callback(),
+                                         long timeout_ms = 30000);
+
+    /**
+     * \brief function to get the theoretical maximum throughput of a download
+     *
+     *  A segment of 63 bytes costs a request of 70 bytes and an answer of
+     *  10 bytes on the UART (10 bits per byte), without any turnaround
+     *  time or 0x90 stuffing.
+     *
+     *  \param baud_rate of the link
+     *  \return [bytes/s]
+     */
+    static double linkLimit(long baud_rate = 1000000);
+
+    /**
+     * \brief function to compute the CRC-32 of a buffer
+     *
+     *  \param crc CRC-32 of the previous bytes (0 for the first ones)
+     *  \param data bytes
+     *  \param size number of bytes
+     *  \return CRC-32 of the previous bytes and these
+     */
+    static uint32_t crc32(uint32_t crc, const uint8_t *data, size_t size);
+
+  private:
+
+    /**
+     * \brief function to download the image to target i, errors returned
+     */
+    void flashTarget(const epos_flash_target &target, size_t i,
+                     const progress_callback &progress, long timeout_ms,
+                     epos_flash_result &result);
+
+    std::string path;
+    uint32_t size;
+    uint32_t crc;
+};
+
+#endif
@@ -0,0 +1,225 @@
+// Copyright (C) 2009-2010 Institut de Robòtica i Informàtica Industrial, CSIC-UPC.
+// Author Martí Morta Garriga  (mmorta@iri.upc.edu)
+// All rights reserved.
+//
+// Copyright (C) 2013 Jochen Sprickerhof <jochen@sprickerhof.de>
+//
+// This file is part of IRI EPOS2 Driver
+// IRI EPOS2 Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef Epos2Ipm_H
+#define Epos2Ipm_H
+
+#include <deque>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "epos2_motor_controller/Epos2.h"
+
+/*! \class CEpos2Ipm
+ \brief PVT streaming engine for the Interpolated Position Mode of one EPOS2
+
+ Trajectories are pushed as arrays of position/velocity/time points into a
+ host queue. A thread keeps the interpolation buffer of the EPOS2 topped up
+ from it.
+
+ The fill level of the buffer is tracked on the host: every point written
+ adds one, and once the motion is started a point leaves the buffer when its
+ time has elapsed. This avoids reading the buffer level for every point. The
+ Interpolation Buffer Status is only read every status period to count
+ underflow/overflow warnings and to stop on buffer errors.
+
+ Every point costs one segmented transfer (two transactions), the status
+ read is shared by all the points written in a status period.
+*/
+
+class CEpos2Ipm {
+
+  public:
+
+    /*! \brief a PVT point
+     */
+    struct epos_pvt_point {
+      long          position;   // [qc]
+      long          velocity;   // [rev/min]
+      unsigned char time_ms;    // time since the previous point [ms]
+    };
+
+    /*! \brief Constructor
+     *
+     *  \param axis initialized EPOS2
+     *  \param period_us refill period [us]
+     *  \param status_period_us buffer status read period [us]
+     */
+    CEpos2Ipm(CEpos2 *axis, long period_us = 5000, long status_period_us = 50000);
+
+    /*! \brief Destructor, stops the motion and the thread
+     */
+    ~CEpos2Ipm();
+
+    /**
+     * \brief function to prepare the axis
+     *
+     *  Sets the operation mode, clears the interpolation buffer and the host
+     *  queue and reads the buffer size.
+     *
+     *  \pre axis enabled (CEpos2::enableController)
+     */
+    void configure();
+
+    /**
+     * \brief function to add a trajectory at the end of the queue
+     *
+     *  \param points PVT points
+     *  \param n number of points
+     */
+    void push(const epos_pvt_point *points, size_t n);
+
+    /**
+     * \brief function to add a trajectory at the end of the queue
+     *
+     *  \param position positions [qc]
+     *  \param velocity velocities [rev/min]
+     *  \param time_ms times since the previous point [ms]
+     *  \param n number of points
+     */
+    void push(const long *position, const long *velocity,
+              const unsigned char *time_ms, size_t n);
+
+    /**
+     * \brief function to fill the interpolation buffer with the queued points
+     *
+     *  Done by start, separately to load several axes before starting them.
+     */
+    void prefill();
+
+    /**
+     * \brief function to start the motion
+     *
+     *  It fills the interpolation buffer with the queued points, starts the
+     *  motion and the refill thread.
+     */
+    void start();
+
+    /**
+     * \brief function to start the motion of several axes together
+     *
+     *  All the buffers are filled first, then the start controlwords,
+     *  pre-encoded, are written back to back (see CEpos2::transactTogether),
+     *  so no axis moves while another one is still loading its buffer.
+     *  If an axis refuses to start, the others are stopped and the error
+     *  is thrown.
+     *
+     *  \pre none of the engines running
+     *  \param ipms engines of different axes
+     */
+    static void startAll(const std::vector<CEpos2Ipm*> &ipms);
+
+    /**
+     * \brief function to stop the motion and the refill thread
+     *
+     *  The IPM of the EPOS2 is stopped whenever it was started and didn't
+     *  finish its points, also after an error of the refill thread.
+     */
+    void stop();
+
+    /**
+     * \brief function to wait until all points are executed
+     *
+     *  \param timeout_ms maximum waiting time, -1 waits forever
+     *  \return false on timeout
+     */
+    bool waitFinished(long timeout_ms = -1);
+
+    /**
+     * \brief function to get the estimated number of points in the buffer
+     */
+    long getFillLevel();
+
+    /**
+     * \brief function to get the number of points in the host queue
+     */
+    size_t getQueued();
+
+    /**
+     * \brief function to get when the start controlword was written
+     *
+     *  The time the first point starts from, as seen by the EPOS2 (not when
+     *  start or startAll returned).
+     */
+    std::chrono::steady_clock::time_point getMotionStart();
+
+    /**
+     * \brief function to get the last Interpolation Buffer Status read
+     */
+    long getBufferStatus();
+
+    /**
+     * \brief function to get the number of status reads with underflow warning
+     */
+    unsigned long getUnderflowWarnings();
+
+    /**
+     * \brief function to get the number of status reads with overflow warning
+     */
+    unsigned long getOverflowWarnings();
+
+  private:
+
+    /**
+     * \brief refill loop
+     */
+    void run();
+
+    /**
+     * \brief points whose time elapsed leave the buffer, mutex must be held
+     */
+    void consume(std::chrono::steady_clock::time_point now);
+
+    /**
+     * \brief writes queued points while there is room in the buffer
+     */
+    void fill();
+
+    CEpos2 *axis;
+
+    // guards everything below
+    std::mutex mutex;
+    std::condition_variable cond;
+
+    std::deque<epos_pvt_point> queue;
+    // end time of the points in the buffer, relative to motion start [ms]
+    std::deque<long> buffered;
+    long buffered_end_ms;
+    long buffer_size;
+
+    std::thread thread;
+    bool running;
+    bool moving;
+    // started on the EPOS2 and not known finished: stop sends stopIpm even
+    // when moving was cleared by an error, the buffered points may still run
+    bool started;
+    std::chrono::steady_clock::time_point motion_start;
+    long period_us;
+    long status_period_us;
+    long buffer_status;
+    unsigned long underflow_warnings;
+    unsigned long overflow_warnings;
+    std::string error;
+};
+
+#endif
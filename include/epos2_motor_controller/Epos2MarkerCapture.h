@@ -0,0 +1,163 @@
+// Copyright (C) 2009-2010 Institut de Robòtica i Informàtica Industrial, CSIC-UPC.
+// Author Martí Morta Garriga  (mmorta@iri.upc.edu)
+// All rights reserved.
+//
+// Copyright (C) 2013 Jochen Sprickerhof <jochen@sprickerhof.de>
+//
+// This file is part of IRI EPOS2 Driver
+// IRI EPOS2 Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef Epos2MarkerCapture_H
+#define Epos2MarkerCapture_H
+
+#include <deque>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include "epos2_motor_controller/Epos2.h"
+
+/*! \class CEpos2MarkerCapture
+ \brief Position marker capture stream of one EPOS2
+
+ A thread reads the position marker counter (0x2074-04) every poll period.
+ When it changed, the captured position (0x2074-01) and as many history
+ buffers (0x2074-05, 0x2074-06) as new markers are read, so each marker is
+ emitted exactly once, oldest first, even if several edges happened between
+ two polls. The EPOS2 keeps the last three markers only: if more arrived
+ since the last poll the lost ones are counted as overruns.
+
+ The position marker has to be configured with CEpos2::setPositionMarker.
+*/
+
+class CEpos2MarkerCapture {
+
+  public:
+
+    /*! \brief a captured position marker
+     */
+    struct epos_marker {
+      long          position;     // captured position [qc]
+      unsigned long counter;      // value of the marker counter for this marker
+      std::chrono::steady_clock::time_point stamp;   // host time it was seen
+    };
+
+    /*! \brief Constructor
+     *
+     *  \param axis initialized EPOS2
+     *  \param period_us poll period [us]
+     *  \param queue_size maximum number of markers waiting in the queue
+     */
+    CEpos2MarkerCapture(CEpos2 *axis, long period_us = 1000, size_t queue_size = 1024);
+
+    /*! \brief Destructor, stops the thread
+     */
+    ~CEpos2MarkerCapture();
+
+    /**
+     * \brief function to start capturing
+     *
+     *  Markers captured before the call are not emitted.
+     */
+    void start();
+
+    /**
+     * \brief function to stop capturing
+     */
+    void stop();
+
+    /**
+     * \brief function to GET the poll period
+     *
+     *  \return poll period [us]
+     */
+    long getPeriod();
+
+    /**
+     * \brief function to SET the poll period
+     *
+     *  \param period_us poll period [us]
+     */
+    void setPeriod(long period_us);
+
+    /**
+     * \brief function to SET a subscriber callback
+     *
+     *  It is called from the capture thread for every marker, before the
+     *  marker is queued.
+     *
+     *  \param callback function called with each marker
+     */
+    void setCallback(const std::function<void(const epos_marker&)> &callback);
+
+    /**
+     * \brief function to take the oldest marker of the queue
+     *
+     *  \param marker output
+     *  \param timeout_ms maximum waiting time, -1 waits forever, 0 doesn't wait
+     *  \return false if no marker arrived in time
+     */
+    bool pop(epos_marker &marker, long timeout_ms = -1);
+
+    /**
+     * \brief function to get the number of markers waiting in the queue
+     */
+    size_t pending();
+
+    /**
+     * \brief function to get the number of markers overwritten in the EPOS2
+     *   history before they could be read
+     */
+    unsigned long getOverruns();
+
+    /**
+     * \brief function to get the number of markers dropped because the
+     *   queue was full
+     */
+    unsigned long getDropped();
+
+  private:
+
+    /**
+     * \brief capture loop
+     */
+    void run();
+
+    /**
+     * \brief reads the markers new since counter, returns the actual counter
+     */
+    unsigned long poll(unsigned long counter, std::vector<epos_marker> &markers);
+
+    CEpos2 *axis;
+
+    // guards everything below
+    std::mutex mutex;
+    std::condition_variable cond;
+
+    std::deque<epos_marker> queue;
+    size_t queue_size;
+    std::function<void(const epos_marker&)> callback;
+
+    std::thread thread;
+    bool running;
+    long period_us;
+    unsigned long overruns;
+    unsigned long dropped;
+    std::string error;
+};
+
+#endif
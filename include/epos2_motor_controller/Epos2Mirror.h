@@ -0,0 +1,127 @@
+// Copyright (C) 2009-2010 Institut de Robòtica i Informàtica Industrial, CSIC-UPC.
+// Author Martí Morta Garriga  (mmorta@iri.upc.edu)
+// All rights reserved.
+//
+// Copyright (C) 2013 Jochen Sprickerhof <jochen@sprickerhof.de>
+//
+// This file is part of IRI EPOS2 Driver
+// IRI EPOS2 Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef Epos2Mirror_H
+#define Epos2Mirror_H
+
+#include <string>
+#include <mutex>
+#include <chrono>
+#include "epos2_motor_controller/Epos2.h"
+#include "epos2_motor_controller/Epos2MirrorShm.h"
+
+/*! \class CEpos2Mirror
+ \brief Shared memory mirror of the object dictionary of an axis
+
+ While attached, every object the driver reads or writes on the axis is
+ copied to a POSIX shared memory object with its time, together with the
+ unwrapped position. Diagnostic tools (see CEpos2MirrorView) read gains,
+ limits and the last telemetry from it at any rate without a transaction
+ on the link and without stopping the process owning it.
+
+ The values are the ones the driver saw: an object never read or written
+ since attaching is not in the mirror, and a value read long ago may be
+ stale (its time tells). Objects read or written with pre-encoded frames
+ by the cyclic helpers (CEpos2StatusPoller, CEpos2AxisGroup,
+ CEpos2CamFollower) are not mirrored.
+
+ An update costs a mutex and a few stores, the link is never touched.
+*/
+
+class CEpos2Mirror {
+
+  public:
+
+    /*! \brief Constructor, creates the shared memory and attaches the axis
+     *
+     *  The values the axis has cached (see CEpos2::setReadFreshness) are
+     *  copied at once.
+     *
+     *  A segment of the same name whose owner is alive (another axis of
+     *  the same name or another process) is not replaced, EPOS2IOException
+     *  is thrown; the one of a dead process is.
+     *
+     *  \param axis EPOS2 to mirror, not attached to another mirror
+     *  \param name name of the shared memory object, empty for
+     *    defaultName of the node and the serial of the axis
+     */
+    CEpos2Mirror(CEpos2 *axis, const std::string &name = "");
+
+    /*! \brief Destructor, detaches the axis and removes the shared memory
+     */
+    ~CEpos2Mirror();
+
+    /**
+     * \brief function to GET the name of the shared memory object
+     */
+    std::string getName();
+
+    /**
+     * \brief function to GET the default name of the mirror of a node
+     *
+     *  The node ids of different USB devices may be the same, the serial
+     *  tells them apart.
+     *
+     *  \param node_id node id of the axis
+     *  \param serial serial of the USB device of the axis (empty if unknown)
+     *  \return "/epos2_mirror_<serial>_<node id>", "/epos2_mirror_<node id>"
+     *    without serial
+     */
+    static std::string defaultName(long node_id, const std::string &serial = "");
+
+  private:
+
+    friend class CEpos2;
+
+    /**
+     * \brief function to know if the segment of a name has a live owner
+     *
+     *  \param owner its pid, if any
+     */
+    static bool ownerAlive(const std::string &name, pid_t &owner);
+
+    /**
+     * \brief function to store a value, called by the axis
+     *
+     *  \param index object index
+     *  \param subindex object subindex
+     *  \param value value read or written
+     *  \param time time of the value
+     *  \param write true if written
+     */
+    void update(int16_t index, int8_t subindex, int32_t value,
+                const std::chrono::steady_clock::time_point &time, bool write);
+
+    /**
+     * \brief function to store the unwrapped position, called by the axis
+     */
+    void updatePosition(int64_t position, const std::chrono::steady_clock::time_point &time);
+
+    CEpos2 *axis;
+    std::string name;
+    epos2_mirror_segment *shm;
+    int fd;
+
+    // serializes the writers of the segment (the threads using the axis)
+    std::mutex mutex;
+};
+
+#endif
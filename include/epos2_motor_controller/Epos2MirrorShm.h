@@ -0,0 +1,89 @@
+// Copyright (C) 2009-2010 Institut de Robòtica i Informàtica Industrial, CSIC-UPC.
+// Author Martí Morta Garriga  (mmorta@iri.upc.edu)
+// All rights reserved.
+//
+// Copyright (C) 2013 Jochen Sprickerhof <jochen@sprickerhof.de>
+//
+// This file is part of IRI EPOS2 Driver
+// IRI EPOS2 Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef Epos2MirrorShm_H
+#define Epos2MirrorShm_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+/*! \file Epos2MirrorShm.h
+ \brief Layout of the shared memory of CEpos2Mirror and CEpos2MirrorView
+
+ One POSIX shared memory object per axis holds the last value read from or
+ written to every object of its dictionary, and the unwrapped position.
+
+ The whole segment is a seqlock: the driver makes seq odd, changes the
+ values and makes it even again, so a reader copying anything between two
+ equal even reads of seq has a consistent snapshot. Only the driver
+ process writes; readers never write the segment and never block it.
+
+ Values live in an open addressing table keyed by epos2MirrorKey, at the
+ first free entry from epos2MirrorHash(key) on (linear probing). Keys are never removed. Times are of CLOCK_MONOTONIC
+ (std::chrono::steady_clock) [ns].
+*/
+
+#define EPOS2_MIRROR_MAGIC    0x45503244u   // "EP2D", set when the segment is ready
+#define EPOS2_MIRROR_VERSION  1u
+#define EPOS2_MIRROR_WRITE_TIMEOUT_MS 100   // an update lasting longer is stuck
+
+static const size_t EPOS2_MIRROR_ENTRIES = 512;   // power of 2
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "the mirror needs lock-free 64 bit atomics");
+
+/*! \brief key of an object
+ */
+inline uint32_t epos2MirrorKey(int16_t index, int8_t subindex)
+{
+  return ((uint32_t)(uint16_t)index << 8 | (uint8_t)subindex) + 1;
+}
+
+/*! \brief first entry to look a key up at
+ */
+inline size_t epos2MirrorHash(uint32_t key)
+{
+  return ((key * 2654435761u) >> 16) & (EPOS2_MIRROR_ENTRIES - 1);
+}
+
+struct epos2_mirror_entry {
+  uint32_t key;           // (index << 8 | subindex) + 1, 0 if free
+  int32_t  value;
+  int64_t  time_ns;       // sampling time of a read, answer time of a write
+  uint32_t reads;
+  uint32_t writes;
+};
+
+struct epos2_mirror_segment {
+  std::atomic<uint32_t> magic;
+  uint32_t version;
+  int32_t  owner_pid;
+  int32_t  node_id;
+
+  std::atomic<uint64_t> seq;    // odd while written, +2 per change
+  uint32_t used;                // keys in the table
+  uint32_t dropped;             // updates of new keys with the table full
+  int64_t  position;            // unwrapped [qc]
+  int64_t  position_time_ns;
+  epos2_mirror_entry entries[EPOS2_MIRROR_ENTRIES];
+};
+
+#endif
@@ -0,0 +1,136 @@
+// Copyright (C) 2009-2010 Institut de Robòtica i Informàtica Industrial, CSIC-UPC.
+// Author Martí Morta Garriga  (mmorta@iri.upc.edu)
+// All rights reserved.
+//
+// Copyright (C) 2013 Jochen Sprickerhof <jochen@sprickerhof.de>
+//
+// This file is part of IRI EPOS2 Driver
+// IRI EPOS2 Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef Epos2MirrorView_H
+#define Epos2MirrorView_H
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include "epos2_motor_controller/Epos2.h"
+#include "epos2_motor_controller/Epos2MirrorShm.h"
+
+/*! \class CEpos2MirrorView
+ \brief Read only access to the CEpos2Mirror of an axis from any process
+
+ Reads are lock free copies out of the shared memory, retried while the
+ driver is changing it; they never touch the link or block the driver.
+ A change lasting more than EPOS2_MIRROR_WRITE_TIMEOUT_MS (a driver that
+ died or stopped in the middle of it) throws EPOS2IOException.
+*/
+
+class CEpos2MirrorView {
+
+  public:
+
+    /*! \brief value of an object as last seen by the driver
+     */
+    struct epos_mirror_value {
+      int16_t  index;
+      int8_t   subindex;
+      int32_t  value;
+      int64_t  time_ns;       // steady clock [ns]
+      uint32_t reads;
+      uint32_t writes;
+    };
+
+    /*! \brief consistent copy of the mirror
+     */
+    struct epos_mirror_snapshot {
+      uint64_t generation;    // changes made by the driver, x2
+      int64_t  position;      // unwrapped [qc]
+      int64_t  position_time_ns;
+      uint32_t dropped;
+      std::vector<epos_mirror_value> values;  // sorted by index, subindex
+    };
+
+    /*! \brief Constructor
+     *
+     *  \param name name of the shared memory object (see
+     *    CEpos2Mirror::defaultName)
+     */
+    CEpos2MirrorView(const std::string &name);
+
+    /*! \brief Destructor
+     */
+    ~CEpos2MirrorView();
+
+    /**
+     * \brief function to GET the node id of the axis
+     */
+    long getNodeId();
+
+    /**
+     * \brief function to know if the process owning the mirror is alive
+     */
+    bool isOwnerAlive();
+
+    /**
+     * \brief function to GET the generation of the mirror
+     *
+     *  It grows with every change, a tool can poll it to see if anything
+     *  changed.
+     */
+    uint64_t getGeneration();
+
+    /**
+     * \brief function to get the last value of an object
+     *
+     *  \param index the hexadecimal index of the object
+     *  \param subindex hexadecimal value of the object (usually 0x00)
+     *  \param value the value with its time
+     *  \return false if the driver didn't read or write it
+     */
+    bool get(int16_t index, int8_t subindex, epos_mirror_value &value);
+
+    /**
+     * \brief function to get the last unwrapped position
+     *
+     *  \param position [qc]
+     *  \param time_ns steady clock [ns], 0 if never read
+     */
+    void getPosition(int64_t &position, int64_t &time_ns);
+
+    /**
+     * \brief function to get a consistent copy of all the values
+     */
+    epos_mirror_snapshot snapshot();
+
+  private:
+
+    /**
+     * \brief waits for an even seq
+     *
+     *  Throws EPOS2IOException if seq stays odd, telling if the owner died.
+     */
+    uint64_t beginRead();
+
+    /**
+     * \brief true if nothing changed since beginRead
+     */
+    bool endRead(uint64_t seq);
+
+    std::string name;
+    const epos2_mirror_segment *shm;
+    int fd;
+};
+
+#endif
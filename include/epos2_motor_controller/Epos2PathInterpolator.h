@@ -0,0 +1,228 @@
+// Copyright (C) 2009-2010 Institut de Robòtica i Informàtica Industrial, CSIC-UPC.
+// Author Martí Morta Garriga  (mmorta@iri.upc.edu)
+// All rights reserved.
+//
+// Copyright (C) 2013 Jochen Sprickerhof <jochen@sprickerhof.de>
+//
+// This file is part of IRI EPOS2 Driver
+// IRI EPOS2 Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef Epos2PathInterpolator_H
+#define Epos2PathInterpolator_H
+
+#include <vector>
+#include <atomic>
+#include "epos2_motor_controller/Epos2.h"
+#include "epos2_motor_controller/Epos2AxisGroup.h"
+#include "epos2_motor_controller/Epos2Ipm.h"
+
+/*! \class CEpos2PathInterpolator
+ \brief Linear and circular interpolation across the axes of a group
+
+ The path is a sequence of lines and arcs in the cartesian space of the
+ group, one coordinate per axis in user units (e.g. mm) converted to [qc]
+ with a scale per axis. Arcs lie in the plane of two axes, the other axes
+ move linearly along them (helix).
+
+ plan() computes a velocity profile along the path with lookahead over all
+ queued segments: the velocity at every junction is limited by the corner
+ angle (junction deviation) and by the distance needed to brake for the
+ following segments, so the path only stops where it has to. Arcs are also
+ limited by their centripetal acceleration.
+
+ The planned path is sampled at a fixed cycle and streamed either as PVT
+ points through one CEpos2Ipm per axis, or as setTargetVelocity setpoints
+ (feedforward plus a proportional position correction). In both cases the
+ positions of all axes are read every cycle and the path following error
+ (distance between the read and the planned point) is accounted.
+*/
+
+class CEpos2PathInterpolator {
+
+  public:
+
+    /*! \brief path following error statistics [unit]
+     */
+    struct epos_path_error {
+      unsigned long count;
+      double last;
+      double worst;
+      double total;
+    };
+
+    /*! \brief Constructor
+     *
+     *  \param group axes of the path, one coordinate per axis
+     *  \param cycle_us setpoint cycle [us], a multiple of 1 ms up to 255 ms
+     *    for IPM
+     */
+    CEpos2PathInterpolator(CEpos2AxisGroup &group, long cycle_us = 10000);
+
+    /**
+     * \brief function to SET the scale of an axis
+     *
+     *  \param axis axis number in the group
+     *  \param qc_per_unit [qc/unit]
+     */
+    void setScale(size_t axis, double qc_per_unit);
+
+    /**
+     * \brief function to SET the path limits
+     *
+     *  \param acceleration maximum path acceleration [unit/s^2]
+     *  \param deviation junction deviation, distance by which a corner
+     *    may be rounded at speed [unit]
+     */
+    void setLimits(double acceleration, double deviation);
+
+    /**
+     * \brief function to set the start of the path at the actual position
+     *
+     *  It clears the queued segments.
+     */
+    void setStart();
+
+    /**
+     * \brief function to set the start of the path
+     *
+     *  It clears the queued segments.
+     *
+     *  \param position start point [unit]
+     */
+    void setStart(const std::vector<double> &position);
+
+    /**
+     * \brief function to add a straight line
+     *
+     *  \param end end point [unit]
+     *  \param feed path velocity [unit/s]
+     */
+    void lineTo(const std::vector<double> &end, double feed);
+
+    /**
+     * \brief function to add an arc
+     *
+     *  The start and end points must be at the same distance of the center
+     *  in the plane. An end equal to the start is a full circle.
+     *
+     *  \param end end point [unit]
+     *  \param x first axis of the plane
+     *  \param y second axis of the plane
+     *  \param cx center on the first axis [unit]
+     *  \param cy center on the second axis [unit]
+     *  \param ccw counterclockwise from x to y
+     *  \param feed path velocity [unit/s]
+     */
+    void arcTo(const std::vector<double> &end, size_t x, size_t y,
+               double cx, double cy, bool ccw, double feed);
+
+    /**
+     * \brief function to plan the velocity along the queued path
+     *
+     *  \return duration [s]
+     */
+    double plan();
+
+    /**
+     * \brief function to evaluate the planned path
+     *
+     *  \param t time since start [s]
+     *  \param position output, one coordinate per axis [unit]
+     *  \param velocity output, one coordinate per axis [unit/s], may be NULL
+     */
+    void evaluate(double t, double *position, double *velocity = NULL) const;
+
+    /**
+     * \brief function to run the planned path in Interpolated Position Mode
+     *
+     *  It pushes the whole path as PVT points, starts the axes and reads the
+     *  positions every cycle until the last point is executed.
+     *
+     *  \pre ipm[i] configured for axis i of the group, axes enabled
+     *  \param ipm one IPM engine per axis
+     *  \return false if stopped
+     */
+    bool runIpm(const std::vector<CEpos2Ipm*> &ipm);
+
+    /**
+     * \brief function to run the planned path in velocity mode
+     *
+     *  Every cycle it reads the positions and sets the velocity of every
+     *  axis to the planned one plus gain times the position error. The axes
+     *  are set to 0 at the end, on stop and on errors.
+     *
+     *  \pre axes in velocity mode and enabled
+     *  \param gain position gain [1/s]
+     *  \return false if stopped
+     */
+    bool runVelocity(double gain);
+
+    /**
+     * \brief function to stop a run in progress from another thread
+     */
+    void stop();
+
+    /**
+     * \brief function to get the path following error statistics
+     */
+    epos_path_error getPathError();
+
+    /**
+     * \brief function to reset the path following error statistics
+     */
+    void resetPathError();
+
+  private:
+
+    struct path_segment {
+      bool   arc;
+      std::vector<double> start;
+      std::vector<double> end;
+      size_t x, y;            // arc plane
+      double cx, cy;          // arc center
+      double radius;
+      double angle, sweep;    // start angle and signed sweep [rad]
+      double length;
+      double feed;            // maximum velocity
+      // planned profile
+      double t;               // start time
+      double v_entry, v_peak, v_exit;
+      double t_acc, t_cruise, t_dec;
+    };
+
+    /**
+     * \brief point and unit tangent at path distance s of a segment
+     */
+    void point(const path_segment &seg, double s, double *position, double *tangent) const;
+
+    /**
+     * \brief adds the error of the positions read, t is the time of the read
+     */
+    void accountError(const std::vector<double> &read, double t);
+
+    std::vector<CEpos2*> axes;
+    std::vector<double> scale;
+    std::vector<double> rpm_per_qcs;
+    std::vector<path_segment> segments;
+    std::vector<double> last;
+    long cycle_us;
+    double acceleration;
+    double deviation;
+    double duration;
+    bool planned;
+    std::atomic<bool> stop_requested;
+    epos_path_error error;
+};
+
+#endif
@@ -0,0 +1,156 @@
+// Copyright (C) 2009-2010 Institut de Robòtica i Informàtica Industrial, CSIC-UPC.
+// Author Martí Morta Garriga  (mmorta@iri.upc.edu)
+// All rights reserved.
+//
+// Copyright (C) 2013 Jochen Sprickerhof <jochen@sprickerhof.de>
+//
+// This file is part of IRI EPOS2 Driver
+// IRI EPOS2 Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef Epos2PositionTracker_H
+#define Epos2PositionTracker_H
+
+#include <string>
+#include <mutex>
+#include <cstdint>
+
+/*! \class CEpos2PositionTracker
+ \brief Unwraps a wrapping position counter into a 64 bit position
+
+ Every sample is compared with the previous one modulo the counter range
+ and the shortest difference is added to the 64 bit position. This is
+ reliable as long as the counter moves less than half its range between
+ samples; steps larger than a configurable maximum are counted as
+ discontinuities and not added (the position stays continuous, e.g. when
+ the controller was reset and its counter restarted).
+
+ The state (64 bit position and last counter value) can be saved to a file
+ and loaded after a restart, so the position survives reconnects as long as
+ the axis doesn't move more than the maximum step while nobody tracks it.
+
+ Each CEpos2 has a tracker fed by every readPosition, so users of
+ readPosition (control loops, telemetry) keep it up to date without extra
+ transactions. It is thread safe.
+*/
+
+class CEpos2PositionTracker {
+
+  public:
+
+    /*! \brief state of the tracker, to persist it
+     */
+    struct epos_tracker_state {
+      int64_t  position;      // unwrapped position of last_raw
+      uint32_t last_raw;      // last counter value
+      bool     valid;         // false until the first sample
+    };
+
+    /*! \brief Constructor
+     *
+     *  \param bits width of the counter, 1...32
+     *  \param max_step largest step between two samples taken as movement,
+     *    at most half the counter range
+     */
+    CEpos2PositionTracker(unsigned int bits = 32, uint32_t max_step = 0x40000000);
+
+    /**
+     * \brief function to add a counter sample
+     *
+     *  The first sample (after construction or reset) is taken as the
+     *  position, sign extended.
+     *
+     *  \param raw counter value, higher bits are ignored
+     *  \return unwrapped position
+     */
+    int64_t update(uint32_t raw);
+
+    /**
+     * \brief function to get the last unwrapped position
+     *
+     *  \return position, 0 if no sample yet
+     */
+    int64_t getPosition() const;
+
+    /**
+     * \brief function to know if the tracker has a sample
+     */
+    bool isValid() const;
+
+    /**
+     * \brief function to SET the largest step taken as movement
+     *
+     *  \param max_step counter units, at most half the counter range
+     */
+    void setMaxStep(uint32_t max_step);
+
+    /**
+     * \brief function to get the number of steps too large to unwrap
+     */
+    unsigned long getDiscontinuities() const;
+
+    /**
+     * \brief function to forget the position
+     */
+    void reset();
+
+    /**
+     * \brief function to GET the state
+     */
+    epos_tracker_state getState() const;
+
+    /**
+     * \brief function to SET the state
+     *
+     *  \param state state as returned by getState
+     */
+    void setState(const epos_tracker_state &state);
+
+    /**
+     * \brief function to save the state to a file
+     *
+     *  It is written to a temporary file renamed over the old one, so a
+     *  crash while saving leaves the previous state.
+     *
+     *  \param path file name
+     *  \return false if it couldn't be written
+     */
+    bool save(const std::string &path) const;
+
+    /**
+     * \brief function to load the state from a file
+     *
+     *  \param path file name
+     *  \return false if it doesn't exist or can't be parsed, the state is
+     *    unchanged then
+     */
+    bool load(const std::string &path);
+
+  private:
+
+    int64_t signExtend(uint32_t value) const;
+
+    unsigned int bits;
+    uint32_t mask;
+    uint32_t max_step;
+
+    int64_t  position;
+    uint32_t last_raw;
+    bool     valid;
+    unsigned long discontinuities;
+
+    mutable std::mutex mutex;
+};
+
+#endif
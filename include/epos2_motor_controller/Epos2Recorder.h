@@ -0,0 +1,179 @@
+// Copyright (C) 2009-2010 Institut de Robòtica i Informàtica Industrial, CSIC-UPC.
+// Author Martí Morta Garriga  (mmorta@iri.upc.edu)
+// All rights reserved.
+//
+// Copyright (C) 2013 Jochen Sprickerhof <jochen@sprickerhof.de>
+//
+// This file is part of IRI EPOS2 Driver
+// IRI EPOS2 Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef Epos2Recorder_H
+#define Epos2Recorder_H
+
+#include <vector>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <cstdint>
+#include "epos2_motor_controller/Epos2RecordingFormat.h"
+
+/*! \class CEpos2Recorder
+ \brief Append only columnar recording of telemetry to a memory mapped file
+
+ Rows of int64 columns (column 0 the time [ns], e.g. the sampled time of
+ CEpos2::epos_sample, then position, velocity, current, StatusWord of
+ every axis...) are appended by one sampler thread and stored in the
+ format of Epos2RecordingFormat.h, read with CEpos2RecordingReader.
+
+ append never blocks: it copies the row into a lock-free single producer
+ ring and returns. A writer thread takes the rows, encodes a chunk every
+ chunk_rows rows and copies it into the file, which is memory mapped and
+ grown in extents (no write system call per chunk). If the writer falls
+ behind and the ring is full, the row is dropped and counted.
+
+ Encoding costs the writer thread a few ns per value; at 1 kHz with 6 axes
+ the file takes a few bytes per sample instead of the tens of CSV.
+
+ A recording can be reopened to append to it: the chunks already in the
+ file are kept (up to the first incomplete one if its writer died), the new
+ ones are written after them and close writes the index of all of them.
+*/
+
+class CEpos2Recorder {
+
+  public:
+
+    /*! \brief statistics of the recording
+     */
+    struct epos_recorder_stats {
+      unsigned long rows;         // appended
+      unsigned long dropped;      // ring full
+      unsigned long chunks;       // written
+      uint64_t bytes;             // of the file
+      uint64_t raw_bytes;         // of the rows written, 8 per value
+    };
+
+    /*! \brief Constructor, creates (or truncates) the file and starts the writer
+     *
+     *  \param path file name
+     *  \param columns names of the columns, the first is the time [ns]
+     *  \param chunk_rows rows per chunk, the granularity of the seeks
+     *  \param queue_rows rows the ring holds for the writer
+     *  \param reopen true to append to an existing recording of the same
+     *    columns instead of truncating it (created if missing or empty)
+     */
+    CEpos2Recorder(const std::string &path, const std::vector<std::string> &columns,
+                   size_t chunk_rows = 4096, size_t queue_rows = 65536, bool reopen = false);
+
+    /*! \brief Destructor, closes the recording
+     */
+    ~CEpos2Recorder();
+
+    /**
+     * \brief function to append a row
+     *
+     *  Only one thread may append. Lock and allocation free.
+     *
+     *  \param row one value per column
+     *  \return false if dropped (ring full or recording closed)
+     */
+    bool append(const int64_t *row);
+
+    /**
+     * \brief function to finish the recording
+     *
+     *  Writes the rows in the ring, the last chunk and the index. An error
+     *  of the writer (e.g. disk full) is thrown here.
+     */
+    void close();
+
+    /**
+     * \brief function to GET the number of columns
+     */
+    size_t getColumnCount();
+
+    /**
+     * \brief function to get the statistics
+     */
+    epos_recorder_stats getStatistics();
+
+  private:
+
+    /**
+     * \brief maps an existing recording and takes its chunks into the index
+     *
+     *  \param path file name, for the errors
+     *  \param names names of the columns as stored in the header
+     *  \return false if the file is empty
+     */
+    bool reopen(const std::string &path, const std::string &names);
+
+    /**
+     * \brief writer loop
+     */
+    void run();
+
+    /**
+     * \brief encodes the rows of the chunk buffer and writes them
+     */
+    void writeChunk();
+
+    /**
+     * \brief writes bytes at the end of the file, growing the mapping
+     */
+    void put(const void *data, size_t size);
+
+    /**
+     * \brief grows the file and the mapping to hold size bytes
+     */
+    void reserve(uint64_t size);
+
+    size_t columns;
+    size_t chunk_rows;
+    size_t queue_rows;
+
+    // single producer ring, queue_rows rows
+    std::unique_ptr<int64_t[]> ring;
+    std::atomic<uint64_t> ring_head;    // rows appended
+    std::atomic<uint64_t> ring_tail;    // rows taken by the writer
+
+    // writer thread only
+    std::vector<int64_t> chunk;         // column major, chunk_rows per column
+    size_t chunk_fill;
+    std::vector<uint8_t> encoded;
+    std::vector<uint32_t> offsets;
+    std::vector<epos2_rec_index_entry> index;
+
+    int fd;
+    uint8_t *map;
+    uint64_t capacity;                  // of the file and the mapping
+    std::atomic<uint64_t> length;       // bytes written
+
+    std::atomic<unsigned long> dropped;
+    std::atomic<unsigned long> chunks;
+    std::atomic<uint64_t> raw_bytes;
+
+    std::thread thread;
+    std::atomic<bool> running;
+    bool closed;
+
+    // guards error
+    std::mutex mutex;
+    std::string error;
+};
+
+#endif
@@ -0,0 +1,98 @@
+// Copyright (C) 2009-2010 Institut de Robòtica i Informàtica Industrial, CSIC-UPC.
+// Author Martí Morta Garriga  (mmorta@iri.upc.edu)
+// All rights reserved.
+//
+// Copyright (C) 2013 Jochen Sprickerhof <jochen@sprickerhof.de>
+//
+// This file is part of IRI EPOS2 Driver
+// IRI EPOS2 Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef Epos2RecordingFormat_H
+#define Epos2RecordingFormat_H
+
+#include <cstdint>
+#include <cstddef>
+
+/*! \file Epos2RecordingFormat.h
+ \brief File format of CEpos2Recorder and CEpos2RecordingReader
+
+ A recording is a table of int64 columns, column 0 being the time [ns]
+ (non decreasing). The file is append only:
+
+   file header, column names
+   chunk, chunk, ...                  (chunk_rows rows each, the last may be shorter)
+   chunk index, footer                (written on close)
+
+ A chunk holds its rows column by column: a table of column offsets, then
+ every column encoded on its own, so a reader decodes only the columns it
+ needs. Each column of each chunk uses the smaller of:
+   - EPOS2_REC_DELTA: zig-zag LEB128 varints of the differences with the
+     previous value (the first one with 0); counters and slow signals take
+     1-2 bytes per value,
+   - EPOS2_REC_FOR: frame of reference, the minimum as a zig-zag varint,
+     the bit width of max - min and the differences with the minimum
+     bit-packed (little-endian, LSB first); a constant column takes no
+     bytes per value.
+
+ The index holds the offset and time range of every chunk for time
+ seeks. A file without footer (writer killed) is read by walking the
+ chunk headers up to the first incomplete one.
+
+ Integers are little-endian.
+*/
+
+#define EPOS2_REC_MAGIC           "EP2REC1"   // 8 bytes with the terminator
+#define EPOS2_REC_INDEX_MAGIC     "EP2IDX1"
+#define EPOS2_REC_CHUNK_MAGIC     0x43325045u // "EP2C"
+#define EPOS2_REC_VERSION         1u
+
+enum epos2_rec_encodings {
+  EPOS2_REC_DELTA = 0,
+  EPOS2_REC_FOR   = 1
+};
+
+struct epos2_rec_file_header {
+  char     magic[8];
+  uint32_t version;
+  uint32_t columns;
+  uint32_t chunk_rows;
+  uint32_t names_size;          // bytes of the names after the header, multiple of 8
+  int64_t  created_ns;          // system clock [ns since the epoch]
+};
+
+// followed by uint32_t offsets[columns + 1] relative to the end of that
+// table, offsets[columns] being the size of all the columns
+struct epos2_rec_chunk_header {
+  uint32_t magic;
+  uint32_t rows;
+  uint64_t size;                // bytes after this header
+  int64_t  t_first;
+  int64_t  t_last;
+};
+
+struct epos2_rec_index_entry {
+  uint64_t offset;              // of the chunk header
+  int64_t  t_first;
+  int64_t  t_last;
+  uint64_t rows;
+};
+
+struct epos2_rec_footer {
+  uint64_t index_offset;
+  uint64_t chunks;
+  char     magic[8];
+};
+
+#endif
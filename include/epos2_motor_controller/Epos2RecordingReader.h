@@ -0,0 +1,153 @@
+// Copyright (C) 2009-2010 Institut de Robòtica i Informàtica Industrial, CSIC-UPC.
+// Author Martí Morta Garriga  (mmorta@iri.upc.edu)
+// All rights reserved.
+//
+// Copyright (C) 2013 Jochen Sprickerhof <jochen@sprickerhof.de>
+//
+// This file is part of IRI EPOS2 Driver
+// IRI EPOS2 Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef Epos2RecordingReader_H
+#define Epos2RecordingReader_H
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <functional>
+#include "epos2_motor_controller/Epos2RecordingFormat.h"
+
+/*! \class CEpos2RecordingReader
+ \brief Reader of the recordings of CEpos2Recorder
+
+ The file is memory mapped; a time range is found in the chunk index with
+ a binary search and only the chunks and columns asked for are decoded,
+ so scanning a few columns of a day of data costs mostly the varint
+ decoding of those columns.
+
+ A recording being written or whose writer died has no index: the chunks
+ written are found by walking their headers. Such a file can be reopened
+ to see the chunks written since. An index whose entries don't point at
+ whole chunks of the file is ignored the same way.
+*/
+
+class CEpos2RecordingReader {
+
+  public:
+
+    /*! \brief chunk of a recording
+     */
+    struct epos_chunk_info {
+      uint64_t offset;
+      int64_t  t_first;
+      int64_t  t_last;
+      uint64_t rows;
+    };
+
+    /*! \brief Constructor, maps the file and loads the index
+     *
+     *  \param path file name
+     */
+    CEpos2RecordingReader(const std::string &path);
+
+    /*! \brief Destructor
+     */
+    ~CEpos2RecordingReader();
+
+    /**
+     * \brief function to GET the column names
+     */
+    const std::vector<std::string> &getColumns();
+
+    /**
+     * \brief function to GET the number of a column
+     *
+     *  \param name column name
+     *  \return column number, throws std::invalid_argument if none
+     */
+    size_t getColumn(const std::string &name);
+
+    /**
+     * \brief function to know if the file was closed by the writer
+     *
+     *  \return true if it has an index
+     */
+    bool isComplete();
+
+    /**
+     * \brief function to get the chunks
+     */
+    const std::vector<epos_chunk_info> &getChunks();
+
+    /**
+     * \brief function to GET the number of rows
+     */
+    uint64_t getRowCount();
+
+    /**
+     * \brief function to GET the creation time of the recording
+     *
+     *  \return [ns since the epoch]
+     */
+    int64_t getCreationTime();
+
+    /**
+     * \brief function to decode the rows of a time range chunk by chunk
+     *
+     *  \param from first time [ns]
+     *  \param to end time [ns], not included
+     *  \param columns column numbers to decode
+     *  \param callback called per chunk with rows values of each column
+     *    asked for (in the order asked for), valid until it returns
+     *  \return rows passed to the callback
+     */
+    uint64_t scan(int64_t from, int64_t to, const std::vector<size_t> &columns,
+                  const std::function<void(const int64_t *const *values, size_t rows)> &callback);
+
+    /**
+     * \brief function to read the rows of a time range
+     *
+     *  \param from first time [ns]
+     *  \param to end time [ns], not included
+     *  \param columns column numbers to read
+     *  \param values filled with one vector per column asked for
+     *  \return rows read
+     */
+    uint64_t read(int64_t from, int64_t to, const std::vector<size_t> &columns,
+                  std::vector<std::vector<int64_t> > &values);
+
+  private:
+
+    /**
+     * \brief loads the index from the footer or by walking the chunks
+     */
+    void loadIndex(uint64_t data_offset);
+
+    /**
+     * \brief decodes a column of a chunk
+     */
+    void decodeColumn(const epos_chunk_info &chunk, size_t column, int64_t *values);
+
+    std::string path;
+    int fd;
+    const uint8_t *map;
+    uint64_t size;
+
+    epos2_rec_file_header header;
+    std::vector<std::string> names;
+    std::vector<epos_chunk_info> chunks;
+    bool complete;
+};
+
+#endif
@@ -0,0 +1,200 @@
+// Copyright (C) 2009-2010 Institut de Robòtica i Informàtica Industrial, CSIC-UPC.
+// Author Martí Morta Garriga  (mmorta@iri.upc.edu)
+// All rights reserved.
+//
+// Copyright (C) 2013 Jochen Sprickerhof <jochen@sprickerhof.de>
+//
+// This file is part of IRI EPOS2 Driver
+// IRI EPOS2 Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef Epos2Remote_H
+#define Epos2Remote_H
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include "epos2_motor_controller/Epos2.h"
+#include "epos2_motor_controller/Epos2BrokerShm.h"
+
+/*! \class CEpos2Remote
+ \brief Axis of a CEpos2Broker used from another process
+
+ Mirrors the CEpos2 functions most applications use. Telemetry functions
+ (readPosition, readVelocityActual, readCurrent, readStatusWord) return the
+ last record the broker published, without any transaction: they cost a few
+ memory loads and are as old as the broker period at most. All the other
+ functions are commands executed by the broker, which wait for its answer.
+
+ Errors of the broker side are thrown as EPOS2IOException with the message
+ of the original error. A command without answer within the timeout (broker
+ dead, stopped or busy) throws too: if the broker didn't take it yet it is
+ cancelled, else it may still be executed after the timeout, so a timed out
+ relative movement must not just be retried.
+
+ quickStop and disableVoltage use the stop slot of the axis instead of the
+ command queue, so they are served before any queued command.
+*/
+
+class CEpos2Remote {
+
+  public:
+
+    /*! \brief Constructor
+     *
+     *  \param axis axis number of the broker
+     *  \param name name of the shared memory object of the broker
+     */
+    CEpos2Remote(size_t axis, const std::string &name = "/epos2_broker");
+
+    /*! \brief Destructor
+     */
+    ~CEpos2Remote();
+
+    /**
+     * \brief function to SET the timeout of the commands
+     *
+     *  \param timeout_ms [ms]
+     */
+    void setTimeout(long timeout_ms);
+
+    /**
+     * \brief function to know if the broker is alive
+     *
+     *  \return true if the broker ran a cycle within 10 periods
+     */
+    bool isBrokerAlive();
+
+    /**
+     * \brief function to GET the node id of the axis
+     */
+    long getNodeId();
+
+    // ------------------------------------------------------------------------
+    //   TELEMETRY
+    // ------------------------------------------------------------------------
+
+    /**
+     * \brief function to get the last telemetry record
+     *
+     *  \param t record
+     *  \return false if nothing was published yet
+     */
+    bool getTelemetry(epos2_shm_telemetry &t);
+
+    /**
+     * \brief function to get the records published since a record number
+     *
+     *  Records overwritten by the broker before they are read are skipped.
+     *
+     *  \param since number of records already seen, updated to the head
+     *  \return records, oldest first
+     */
+    std::vector<epos2_shm_telemetry> readHistory(uint64_t &since);
+
+    /**
+     * \brief functions to get the last published values
+     *
+     *  Same units as CEpos2. They throw if the last poll of the broker failed.
+     */
+    long readPosition();
+    int64_t readPosition64();
+    long readVelocityActual();
+    long readCurrent();
+    long readStatusWord();
+
+    /**
+     * \brief function to wait until target reached (StatusWord bit 10)
+     *
+     *  \param timeout_ms -1 waits forever
+     *  \return true if reached, false on timeout
+     */
+    bool waitTargetReached(long timeout_ms = -1);
+
+    // ------------------------------------------------------------------------
+    //   COMMANDS
+    // ------------------------------------------------------------------------
+
+    /**
+     * \brief functions executed by the broker, see CEpos2
+     */
+    int32_t readObject(int16_t index, int8_t subindex);
+    int writeObject(int16_t index, int8_t subindex, int32_t data);
+
+    long getState();
+    void enableController();
+    void enableMotor(long opmode);
+    void disableOperation();
+    void quickStop();
+    void disableVoltage();
+    void faultReset();
+
+    long getOperationMode();
+    void setOperationMode(long opmode);
+
+    void setTargetVelocity(long velocity);
+    void startVelocity();
+    void stopVelocity();
+
+    void setTargetProfilePosition(long position);
+    /**
+     * \brief function to start a profile position movement
+     *
+     *  Never blocks the broker; to wait use waitTargetReached.
+     */
+    void startProfilePosition(CEpos2::epos_posmodes mode, bool blocking = true,
+                              bool wait = true, bool new_point = true);
+    void setTargetProfileVelocity(long velocity);
+    void startProfileVelocity();
+    void stopProfileVelocity();
+    void setProfileVelocity(long velocity);
+    void setProfileAcceleration(long acceleration);
+    void setProfileDeceleration(long deceleration);
+
+    long setTargetCurrent(long current);
+    void startCurrent();
+    void stopCurrent();
+
+  private:
+
+    /**
+     * \brief sends a command to the broker and waits for its result
+     */
+    int32_t call(uint32_t opcode, int32_t index = 0, int32_t subindex = 0, int32_t value = 0);
+
+    /**
+     * \brief requests a stop in the stop slot of the axis and waits for it
+     *
+     *  \param request epos2_shm_stops bits
+     */
+    void stop(uint32_t request);
+
+    /**
+     * \brief reads a telemetry slot, false if it is being written or was reused
+     */
+    bool readSlot(uint64_t record, epos2_shm_telemetry &t);
+
+    /**
+     * \brief last telemetry record, throws if none or the poll failed
+     */
+    epos2_shm_telemetry latest();
+
+    size_t axis;
+    std::string name;
+    long timeout_ms;
+    epos2_shm_segment *shm;
+    int fd;
+};
+
+#endif
@@ -0,0 +1,169 @@
+// Copyright (C) 2009-2010 Institut de Robòtica i Informàtica Industrial, CSIC-UPC.
+// Author Martí Morta Garriga  (mmorta@iri.upc.edu)
+// All rights reserved.
+//
+// Copyright (C) 2013 Jochen Sprickerhof <jochen@sprickerhof.de>
+//
+// This file is part of IRI EPOS2 Driver
+// IRI EPOS2 Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef Epos2Rollup_H
+#define Epos2Rollup_H
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <cstdint>
+#include "epos2_motor_controller/Epos2Recorder.h"
+
+/*! \class CEpos2Rollup
+ \brief Downsampled tiers of telemetry for long term retention
+
+ Fed with the samples of the telemetry sampler, it keeps for several
+ resolutions (10 ms, 1 s and 1 min by default) the min, max, mean and RMS
+ of every signal over buckets aligned to multiples of the resolution.
+
+ Each tier only keeps the bucket being filled (O(1) memory): the finest
+ one accumulates the samples and, when its bucket closes, its sums are
+ merged into the bucket of the next tier, so a sample costs the same
+ whatever the number of tiers and the coarse tiers are exact. Every
+ resolution must be a multiple of the previous one.
+
+ Every tier is written to its own recording (see CEpos2Recorder) at
+ tierPath(base, resolution) with the columns "time" (start of the bucket
+ [ns]), "count", and per signal "<signal>.min", ".max", ".mean", ".rms";
+ mean and RMS in 1/EPOS2_ROLLUP_SCALE units. Buckets without samples are
+ not written. query reads the coarsest tier detailed enough, so a trend
+ over months touches only the 1 min file. The files of an earlier run are
+ appended to, not truncated.
+*/
+
+#define EPOS2_ROLLUP_SCALE 1000
+
+class CEpos2Rollup {
+
+  public:
+
+    /*! \brief a bucket of a signal
+     */
+    struct epos_rollup_point {
+      int64_t  time_ns;       // start of the bucket
+      uint64_t count;
+      double   min;
+      double   max;
+      double   mean;
+      double   rms;
+    };
+
+    /*! \brief Constructor, creates the files of the tiers or appends to them
+     *
+     *  \param base path of the files without suffix
+     *  \param signals names of the signals
+     *  \param resolutions_ns bucket widths, increasing, each a multiple of
+     *    the previous one
+     */
+    CEpos2Rollup(const std::string &base, const std::vector<std::string> &signals,
+                 const std::vector<int64_t> &resolutions_ns = defaultResolutions());
+
+    /*! \brief Destructor, closes the tiers
+     */
+    ~CEpos2Rollup();
+
+    /**
+     * \brief function to add a sample
+     *
+     *  Only one thread may add; it never blocks (see CEpos2Recorder::append).
+     *
+     *  \param time_ns time of the sample, non decreasing [ns]
+     *  \param values one value per signal
+     */
+    void add(int64_t time_ns, const int64_t *values);
+
+    /**
+     * \brief function to write the open buckets and close the tiers
+     *
+     *  Errors of the writers are thrown here.
+     */
+    void close();
+
+    /**
+     * \brief function to get the statistics of the writer of a tier
+     *
+     *  \param tier tier number, 0 the finest
+     */
+    CEpos2Recorder::epos_recorder_stats getStatistics(size_t tier);
+
+    /**
+     * \brief function to get the default resolutions: 10 ms, 1 s, 1 min
+     */
+    static std::vector<int64_t> defaultResolutions();
+
+    /**
+     * \brief function to get the file of a tier
+     *
+     *  \return "<base>.<resolution in ms>ms.rec" for whole milliseconds,
+     *    "<base>.<resolution in ns>ns.rec" otherwise
+     */
+    static std::string tierPath(const std::string &base, int64_t resolution_ns);
+
+    /**
+     * \brief function to read the buckets of a signal
+     *
+     *  Reads the finest tier with at most max_points buckets in the range
+     *  (the coarsest if none).
+     *
+     *  \param base path of the files without suffix
+     *  \param signal name of the signal
+     *  \param from first time [ns]
+     *  \param to end time [ns], not included
+     *  \param max_points maximum number of buckets wanted
+     *  \param points filled with the buckets starting in the range
+     *  \param resolutions_ns resolutions of the tiers
+     *  \return resolution of the tier read [ns]
+     */
+    static int64_t query(const std::string &base, const std::string &signal,
+                         int64_t from, int64_t to, size_t max_points,
+                         std::vector<epos_rollup_point> &points,
+                         const std::vector<int64_t> &resolutions_ns = defaultResolutions());
+
+  private:
+
+    /*! \brief open bucket of a tier, one element per signal
+     */
+    struct tier {
+      int64_t resolution;
+      int64_t bucket;         // start of the open bucket
+      uint64_t count;         // samples in it, 0 if none
+      std::vector<double> min, max, sum, sumsq;
+      std::vector<int64_t> row;
+      std::unique_ptr<CEpos2Recorder> recorder;
+    };
+
+    /**
+     * \brief closes the bucket of tier k if t is in another one
+     */
+    void roll(size_t k, int64_t t);
+
+    /**
+     * \brief writes the bucket of tier k and merges it into tier k + 1
+     */
+    void emit(size_t k);
+
+    size_t signals;
+    std::vector<tier> tiers;
+    bool closed;
+};
+
+#endif
@@ -0,0 +1,175 @@
+// Copyright (C) 2009-2010 Institut de Robòtica i Informàtica Industrial, CSIC-UPC.
+// Author Martí Morta Garriga  (mmorta@iri.upc.edu)
+// All rights reserved.
+//
+// Copyright (C) 2013 Jochen Sprickerhof <jochen@sprickerhof.de>
+//
+// This file is part of IRI EPOS2 Driver
+// IRI EPOS2 Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef Epos2StateEstimator_H
+#define Epos2StateEstimator_H
+
+#include <vector>
+#include <chrono>
+#include "epos2_motor_controller/Epos2.h"
+
+/*! \class CEpos2StateEstimator
+ \brief Kalman filter of position, velocity and acceleration of several axes
+
+ Velocity and acceleration are estimated from timestamped position samples
+ (CEpos2::readPositionSample), so a cycle doesn't need to read the velocity
+ of the axes: one transaction per axis instead of two.
+
+ The model of every axis is constant acceleration driven by white jerk of
+ spectral density q [qc^2/s^5]. The position is measured with variance r
+ [qc^2] at the estimated sampling time of the sample; its uncertainty
+ (CEpos2::epos_sample::uncertainty_us) is added to r as the position the
+ axis moves in that time at the estimated velocity. Each axis has its own
+ sampling times, so the time step can change from sample to sample.
+
+ The position is kept as an integer origin plus a small offset, and samples
+ are taken unwrapped (CEpos2::epos_sample::position), so the precision
+ doesn't depend on the absolute position and a wrap of the counter of the
+ EPOS2 is not seen as a jump.
+
+ State and covariance are kept as a structure of arrays (one array per
+ element, one entry per axis) and all axes are predicted and updated by one
+ loop without branches the compiler can vectorize.
+
+ It is not thread safe.
+*/
+
+class CEpos2StateEstimator {
+
+  public:
+
+    /*! \brief estimate of an axis
+     */
+    struct epos_axis_state {
+      double position;        // [qc]
+      double velocity;        // [qc/s]
+      double acceleration;    // [qc/s^2]
+      double covariance[6];   // pp, pv, pa, vv, va, aa
+      bool   valid;           // false until the first sample
+    };
+
+    /*! \brief Constructor
+     */
+    CEpos2StateEstimator();
+
+    /**
+     * \brief function to add an axis
+     *
+     *  \param position_variance r [qc^2]
+     *  \param jerk_density q [qc^2/s^5]
+     *  \return axis number
+     */
+    size_t add(double position_variance = 1.0, double jerk_density = 1e12);
+
+    /**
+     * \brief function to get the number of axes
+     */
+    size_t size() const;
+
+    /**
+     * \brief function to SET the noise of an axis
+     *
+     *  \param i axis number
+     *  \param position_variance r [qc^2]
+     *  \param jerk_density q [qc^2/s^5]
+     */
+    void setNoise(size_t i, double position_variance, double jerk_density);
+
+    /**
+     * \brief function to SET the initial uncertainty of velocity and acceleration
+     *
+     *  The first sample of an axis sets its position, velocity and
+     *  acceleration start at 0 with these standard deviations.
+     *
+     *  \param velocity_sigma [qc/s]
+     *  \param acceleration_sigma [qc/s^2]
+     */
+    void setInitialUncertainty(double velocity_sigma, double acceleration_sigma);
+
+    /**
+     * \brief function to forget the state of all axes
+     *
+     *  The next sample of every axis initializes it.
+     */
+    void reset();
+
+    /**
+     * \brief function to update all axes with one sample each
+     *
+     *  \param position measured positions [qc]
+     *  \param time sampling times [s], increasing per axis
+     *  \param time_uncertainty half width of the sampling interval [s], NULL
+     *    if exact
+     */
+    void update(const double *position, const double *time,
+                const double *time_uncertainty = NULL);
+
+    /**
+     * \brief function to update all axes with position samples
+     *
+     *  \param samples one readPositionSample per axis
+     */
+    void update(const std::vector<CEpos2::epos_sample> &samples);
+
+    /**
+     * \brief function to get the estimate of an axis
+     *
+     *  \param i axis number
+     */
+    epos_axis_state getState(size_t i) const;
+
+    /**
+     * \brief functions to get the estimates of all axes
+     *
+     *  \return one entry per axis, valid until the next add (positions:
+     *    until the next update or call)
+     */
+    const double *getPositions() const;
+    const double *getVelocities() const;
+    const double *getAccelerations() const;
+
+  private:
+
+    /**
+     * \brief predict and update of all axes, positions relative to origin
+     */
+    void step(const double *position, const double *time, const double *time_uncertainty);
+
+    // structure of arrays, one element per axis
+    std::vector<int64_t> origin;                    // [qc], p is relative to it
+    std::vector<double> r, q;
+    std::vector<double> p, v, a;                    // state
+    std::vector<double> p00, p01, p02, p11, p12, p22;  // covariance
+    std::vector<double> t_last;
+    std::vector<double> gain;                       // 0 while initializing
+    std::vector<char>   valid;
+
+    // buffers of update(samples)
+    std::vector<double> sample_p, sample_t, sample_dt;
+
+    // absolute positions of getPositions
+    mutable std::vector<double> positions;
+
+    double velocity_sigma, acceleration_sigma;
+    std::chrono::steady_clock::time_point epoch;
+};
+
+#endif
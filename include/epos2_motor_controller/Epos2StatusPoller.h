@@ -0,0 +1,280 @@
+// Copyright (C) 2009-2010 Institut de Robòtica i Informàtica Industrial, CSIC-UPC.
+// Author Martí Morta Garriga  (mmorta@iri.upc.edu)
+// All rights reserved.
+//
+// Copyright (C) 2013 Jochen Sprickerhof <jochen@sprickerhof.de>
+//
+// This file is part of IRI EPOS2 Driver
+// IRI EPOS2 Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef Epos2StatusPoller_H
+#define Epos2StatusPoller_H
+
+#include <vector>
+#include <string>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include "epos2_motor_controller/Epos2.h"
+
+/*! \class CEpos2StatusPoller
+ \brief Shared StatusWord poller for several EPOS2 axes
+
+ One thread reads the StatusWord of every attached axis once per poll period
+ and wakes up the threads waiting for a condition on them. Waiting for N axes
+ costs one StatusWord read per axis and period, independently of the number
+ of waiting threads.
+
+ When the expected arrival time of a movement is known (expectTargetReached)
+ the axis is polled sparsely at the start of the movement, halving the poll
+ interval as the arrival approaches, and every poll period once it is closer
+ than two periods. This leaves the link free for other axes while keeping the
+ detection latency of target reached at one poll period.
+
+ An axis can only be attached to one poller. While attached, blocking calls of
+ CEpos2 (startProfilePosition, waitTargetReached) wait on the poller instead
+ of polling the link themselves.
+*/
+
+class CEpos2StatusPoller {
+
+  public:
+
+    /*! \brief Constructor
+     *
+     *  \param period_us poll period [us]
+     */
+    CEpos2StatusPoller(long period_us = 5000);
+
+    /*! \brief Destructor, stops the thread and detaches all axes
+     */
+    ~CEpos2StatusPoller();
+
+    /**
+     * \brief function to attach an axis to the poller
+     *
+     *  \param axis initialized EPOS2
+     */
+    void add(CEpos2 *axis);
+
+    /**
+     * \brief function to detach an axis from the poller
+     *
+     *  It returns after the poll of the axis in progress (if any) finished.
+     *  An axis destroyed while attached is removed by its destructor.
+     *
+     *  \param axis attached EPOS2
+     */
+    void remove(CEpos2 *axis);
+
+    /**
+     * \brief function to start the poll thread
+     */
+    void start();
+
+    /**
+     * \brief function to stop the poll thread
+     */
+    void stop();
+
+    /**
+     * \brief function to GET the poll period
+     *
+     *  \return poll period [us]
+     */
+    long getPeriod();
+
+    /**
+     * \brief function to SET the poll period
+     *
+     *  \param period_us poll period [us]
+     */
+    void setPeriod(long period_us);
+
+    /**
+     * \brief function to GET the maximum poll interval of a moving axis
+     *
+     *  \return maximum interval [us]
+     */
+    long getMaxInterval();
+
+    /**
+     * \brief function to SET the maximum poll interval of a moving axis
+     *
+     *  Bounds the time until a fault during a long movement is seen.
+     *
+     *  \param interval_us maximum interval [us]
+     */
+    void setMaxInterval(long interval_us);
+
+    /**
+     * \brief function to announce when an axis will reach its target
+     *
+     *  The poll rate of the axis adapts to the expected arrival until bit 10
+     *  of the StatusWord is seen.
+     *
+     *  \param axis attached EPOS2
+     *  \param seconds expected time from now until target reached [s]
+     */
+    void expectTargetReached(CEpos2 *axis, double seconds);
+
+    /**
+     * \brief function to get the last StatusWord polled
+     *
+     *  \param axis attached EPOS2
+     *  \return StatusWord, -1 if it has not been polled yet
+     */
+    long getStatusWord(CEpos2 *axis);
+
+    /**
+     * \brief function to get the last StatusWord polled with its timestamps
+     *
+     *  \param axis attached EPOS2
+     *  \return StatusWord (-1 if it has not been polled yet) and the time it
+     *    was sent, received and sampled
+     */
+    CEpos2::epos_sample getStatusSample(CEpos2 *axis);
+
+    /**
+     * \brief function to wait until all bits of a mask are set in the StatusWord
+     *
+     *  Only StatusWords read in poll cycles started after the call are taken
+     *  into account, so a bit still set from a previous movement doesn't
+     *  count if the movement was started before calling.
+     *
+     *  \param axis attached EPOS2
+     *  \param mask StatusWord bits
+     *  \param timeout_ms maximum waiting time, -1 waits forever
+     *  \return false on timeout
+     */
+    bool waitStatus(CEpos2 *axis, long mask, long timeout_ms = -1);
+
+    /**
+     * \brief function to wait until all bits of a mask are set on several axes
+     *
+     *  \param axes attached EPOS2s
+     *  \param mask StatusWord bits
+     *  \param timeout_ms maximum waiting time, -1 waits forever
+     *  \return false on timeout
+     */
+    bool waitStatus(const std::vector<CEpos2*> &axes, long mask, long timeout_ms = -1);
+
+    /**
+     * \brief function to wait for target reached (StatusWord bit 10)
+     *
+     *  \param axis attached EPOS2
+     *  \param timeout_ms maximum waiting time, -1 waits forever
+     *  \return false on timeout
+     */
+    bool waitTargetReached(CEpos2 *axis, long timeout_ms = -1);
+
+    /**
+     * \brief function to wait for target reached on several axes
+     *
+     *  \param axes attached EPOS2s
+     *  \param timeout_ms maximum waiting time, -1 waits forever
+     *  \return false on timeout
+     */
+    bool waitTargetReached(const std::vector<CEpos2*> &axes, long timeout_ms = -1);
+
+    /**
+     * \brief function to be notified when bits of the StatusWord are set
+     *
+     *  The callback is called once from the poll thread, with the StatusWord
+     *  that has all bits of mask or any bit of error_mask set, or with -1 if
+     *  the watch is cancelled. Only StatusWords read in poll cycles started
+     *  after the call count.
+     *
+     *  Bits of stale_mask may still be left from a previous operation when
+     *  the watch starts (bit 12 of a previous homing): completion only
+     *  counts once they were read clear, or after a second (the operation
+     *  may end within a poll).
+     *
+     *  \param axis attached EPOS2
+     *  \param mask StatusWord bits of completion
+     *  \param error_mask StatusWord bits of error
+     *  \param callback function called with the StatusWord
+     *  \param stale_mask bits of mask that must be seen clear first
+     */
+    void watchStatus(CEpos2 *axis, long mask, long error_mask,
+                     const std::function<void(long)> &callback, long stale_mask = 0);
+
+    /**
+     * \brief function to cancel the watches of an axis
+     *
+     *  Their callbacks are called with -1.
+     *
+     *  \param axis attached EPOS2
+     */
+    void cancelWatch(CEpos2 *axis);
+
+  private:
+
+    struct axis_status {
+      CEpos2        *axis;
+      long          status;
+      unsigned long sample;   // poll cycle of the last StatusWord, 0 if none
+      CEpos2::epos_sample status_sample;
+      bool          moving;   // eta is valid
+      std::chrono::steady_clock::time_point eta;
+      std::chrono::steady_clock::time_point next_poll;
+    };
+
+    struct status_watch {
+      CEpos2        *axis;
+      long          mask;
+      long          error_mask;
+      unsigned long first;    // first poll cycle that counts
+      long          stale_mask;   // bits not seen clear yet
+      std::chrono::steady_clock::time_point stale_until;
+      std::function<void(long)> callback;
+    };
+
+    /**
+     * \brief poll loop
+     */
+    void run();
+
+    /**
+     * \brief computes next_poll of an axis after a poll, mutex must be held
+     */
+    void schedule(axis_status *a, std::chrono::steady_clock::time_point now);
+
+    /**
+     * \brief finds an attached axis, mutex must be held
+     */
+    axis_status *find(CEpos2 *axis);
+
+    std::vector<axis_status> axes;
+    std::vector<status_watch> watches;
+
+    // guards axes, watches, period_us, running and error
+    std::mutex mutex;
+    std::condition_variable cond;
+
+    // held by the poll thread while it reads, so remove can wait for it
+    std::mutex poll_mutex;
+
+    std::thread thread;
+    bool running;
+    bool rescheduled;         // wakes the poll thread after a schedule change
+    unsigned long cycle;      // poll cycles started, a cycle reads after it starts
+    long period_us;
+    long max_interval_us;
+    std::string error;
+};
+
+#endif
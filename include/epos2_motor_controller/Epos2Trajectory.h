@@ -0,0 +1,152 @@
+// Copyright (C) 2009-2010 Institut de Robòtica i Informàtica Industrial, CSIC-UPC.
+// Author Martí Morta Garriga  (mmorta@iri.upc.edu)
+// All rights reserved.
+//
+// Copyright (C) 2013 Jochen Sprickerhof <jochen@sprickerhof.de>
+//
+// This file is part of IRI EPOS2 Driver
+// IRI EPOS2 Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef Epos2Trajectory_H
+#define Epos2Trajectory_H
+
+#include <cstddef>
+#include "epos2_motor_controller/Epos2.h"
+
+/*! \class CEpos2Trajectory
+ \brief Host side time optimal point to point trajectory
+
+ Plans trapezoidal (velocity and acceleration limited) and S-curve (also jerk
+ limited, 7 phases) profiles from standstill to standstill, reducing the peak
+ velocity and acceleration when the distance is too short to reach them. The
+ plan is closed form and the object has a fixed size, so planning a new
+ target doesn't allocate and takes a few microseconds.
+
+ Every phase has a constant jerk, so the trajectory is stored as up to 7
+ cubic polynomials. sample() evaluates many equidistant instants at once:
+ for each phase it computes the range of samples inside it and evaluates the
+ polynomial in a branch free loop the compiler can vectorize.
+
+ Units are [qc], [qc/s], [qc/s^2] and [qc/s^3]; readLimits converts the EPOS2
+ profile limits to them.
+*/
+
+class CEpos2Trajectory {
+
+  public:
+
+    /*! \brief kinematic limits of the trajectory
+     */
+    struct epos_limits {
+      double velocity;        // [qc/s]
+      double acceleration;    // [qc/s^2]
+      double jerk;            // [qc/s^3], only used by planSCurve
+      double min_position;    // [qc]
+      double max_position;    // [qc]
+    };
+
+    /*! \brief Constructor, the trajectory stays at 0
+     */
+    CEpos2Trajectory();
+
+    /**
+     * \brief function to read the limits of an EPOS2
+     *
+     *  It uses Max Profile Velocity, Max Acceleration, the position limits
+     *  and the encoder pulse number. The EPOS2 has no jerk limit.
+     *
+     *  \param axis initialized EPOS2
+     *  \param jerk jerk limit [qc/s^3]
+     *  \return limits
+     */
+    static epos_limits readLimits(CEpos2 &axis, double jerk);
+
+    /**
+     * \brief function to plan a trapezoidal velocity profile
+     *
+     *  \param start start position [qc]
+     *  \param target target position [qc], clamped to the position limits
+     *  \param limits velocity and acceleration limits
+     */
+    void planTrapezoid(double start, double target, const epos_limits &limits);
+
+    /**
+     * \brief function to plan a jerk limited S-curve profile
+     *
+     *  \param start start position [qc]
+     *  \param target target position [qc], clamped to the position limits
+     *  \param limits velocity, acceleration and jerk limits
+     */
+    void planSCurve(double start, double target, const epos_limits &limits);
+
+    /**
+     * \brief function to get the duration of the trajectory
+     *
+     *  \return duration [s]
+     */
+    double getDuration() const;
+
+    /**
+     * \brief function to get the target after clamping
+     *
+     *  \return target position [qc]
+     */
+    double getTarget() const;
+
+    /**
+     * \brief function to evaluate the trajectory at one instant
+     *
+     *  \param t time since start [s]
+     *  \retval position [qc]
+     *  \retval velocity [qc/s]
+     *  \retval acceleration [qc/s^2]
+     */
+    void evaluate(double t, double &position, double &velocity, double &acceleration) const;
+
+    /**
+     * \brief function to evaluate the trajectory at equidistant instants
+     *
+     *  Sample i is at t0 + i*dt. Before the start and after the end the
+     *  trajectory stays at the start and target positions.
+     *
+     *  \param t0 time of the first sample [s]
+     *  \param dt time between samples [s]
+     *  \param n number of samples
+     *  \param position output array of n positions [qc]
+     *  \param velocity output array of n velocities [qc/s], may be NULL
+     *  \param acceleration output array of n accelerations [qc/s^2], may be NULL
+     */
+    void sample(double t0, double dt, size_t n, double *position,
+                double *velocity = NULL, double *acceleration = NULL) const;
+
+  private:
+
+    /*! \brief a constant jerk phase starting at t */
+    struct epos_phase {
+      double t, p, v, a, j;
+    };
+
+    /**
+     * \brief appends a phase integrating the end state of the previous one
+     */
+    void addPhase(double duration, double a, double j);
+
+    epos_phase phases[7];
+    int num_phases;
+    double duration;
+    double start;
+    double target;
+};
+
+#endif
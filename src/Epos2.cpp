@@ -21,23 +21,92 @@
 #include <iostream>
 #include <cstdio>
 #include <sstream>
+#include <cmath>
+#include <chrono>
+#include <thread>
+#include <cstdint>
+#include <stdexcept>
+#include <algorithm>
+#include <unistd.h>
 #include "epos2_motor_controller/Epos2.h"
+#include "epos2_motor_controller/Epos2StatusPoller.h"
+#include "epos2_motor_controller/Epos2Mirror.h"
 //#define DEBUG
 
+// CRC of the EPOS2 Communication Guide continued over more words, so the
+// CRC of the constant start of a frame can be kept
+static uint16_t updateChecksum(uint16_t CRC, const int16_t *pDataArray, int16_t numberOfWords)
+{
+  uint16_t shifter, c;
+  uint16_t carry;
+
+  //Calculate pDataArray Word by Word
+  while(numberOfWords--)
+  {
+    shifter = 0x8000;                 //Initialize BitX to Bit15
+    c = *pDataArray++;                //Copy next DataWord to c
+    do
+    {
+      carry = CRC & 0x8000;    //Check if Bit15 of CRC is set
+      CRC <<= 1;               //CRC = CRC * 2
+      if(c & shifter) CRC++;   //CRC = CRC + 1, if BitX is set in c
+      if(carry) CRC ^= 0x1021; //CRC = CRC XOR G(x), if carry is true
+      shifter >>= 1;           //Set BitX to next lower Bit, shifter = shifter/2
+    } while(shifter);
+  }
+
+  return CRC;
+}
+
+// appends one byte to a transmission frame, doubling 0x90
+static void stuffByte(uint8_t byte, uint8_t *trans_frame, int16_t &length)
+{
+  trans_frame[length++] = byte;
+  if(byte == 0x90)
+    trans_frame[length++] = 0x90;
+}
+
 // ----------------------------------------------------------------------------
 //   CLASS
 // ----------------------------------------------------------------------------
 //     CONSTRUCTOR
 // ----------------------------------------------------------------------------
 
-CEpos2::CEpos2(int8_t nodeId) : node_id(nodeId), verbose(false)
-{ }
+CEpos2::CEpos2(int8_t nodeId, const std::string &serial) : node_id(nodeId),
+  status_poller(NULL), mirror(NULL), mirror_users(0), link(CEpos2::getLink(serial)), verbose(false),
+  profile_velocity(-1), profile_acceleration(-1), profile_deceleration(-1),
+  profile_type(-1), encoder_pulses(-1), target_position(0),
+  target_position_valid(false), continuous_current_limit(-1),
+  output_current_limit(-1), homing_poll_us(10000)
+{
+  this->current_frame.valid = false;
+
+  // pre-encode the emergency stop controlwords (see sendPriorityFrame)
+  this->quick_stop_frame_len =
+    this->encodeWriteObject(0x6040, 0x00, 0x0002, this->quick_stop_frame);
+  this->disable_voltage_frame_len =
+    this->encodeWriteObject(0x6040, 0x00, 0x0000, this->disable_voltage_frame);
+
+  this->resetStopLatency();
+  this->min_round_trip_us = -1.0;
+  this->resetRoundTrip();
+  this->resetTransferStats();
+  this->read_freshness_us = 0;
+  this->resetReadStats();
+}
 
 //     DESTRUCTOR
 // ----------------------------------------------------------------------------
 
 CEpos2::~CEpos2()
 {
+  // the homing thread polls through this object
+  this->joinHoming();
+
+  // the poll thread must not find this axis any more; remove waits for the
+  // poll in progress
+  if(this->status_poller != NULL)
+    this->status_poller->remove(this);
 }
 
 // ----------------------------------------------------------------------------
@@ -99,22 +168,108 @@ void CEpos2::setVerbose(bool verbose)
 //     OPEN DEVICE
 // ----------------------------------------------------------------------------
 
-bool CEpos2::ftdi_initialized = false;
-Ftdi::Context CEpos2::ftdi;
+std::mutex CEpos2::links_mutex;
+std::map<std::string, std::weak_ptr<CEpos2::epos_link> > CEpos2::links;
+
+std::shared_ptr<CEpos2::epos_link> CEpos2::getLink(const std::string &serial)
+{
+  std::lock_guard<std::mutex> lock(CEpos2::links_mutex);
+
+  std::shared_ptr<epos_link> link = CEpos2::links[serial].lock();
+  if(!link)
+  {
+    link = std::make_shared<epos_link>();
+    link->serial       = serial;
+    link->initialized  = false;
+    link->busy         = false;
+    link->stop_pending = 0;
+    link->rx_begin     = 0;
+    link->rx_end       = 0;
+    CEpos2::links[serial] = link;
+  }
+
+  return link;
+}
+
+std::string CEpos2::firstSerial()
+{
+  Ftdi::Context context;
+  std::unique_ptr<Ftdi::List> list(Ftdi::List::find_all(context, 0x403, 0xa8b0));
+
+  if(!list || list->empty())
+    throw EPOS2OpenException("No FTDI devices connected");
+
+  return list->begin()->serial();
+}
 
 void CEpos2::openDevice()
 {
-    if(CEpos2::ftdi_initialized)
+    // the first device is opened by its serial, on the link of the objects
+    // naming it; open before use, the link of the object changes here
+    if(this->link->serial.empty())
+      this->link = CEpos2::getLink(CEpos2::firstSerial());
+
+    LinkGuard guard(*this->link);
+
+    if(this->link->initialized)
       return;
-    if(CEpos2::ftdi.open(0x403, 0xa8b0) != 0)
+    if(this->link->serial.empty())
+    {
+      if(this->link->ftdi.open(0x403, 0xa8b0) != 0)
         throw EPOS2OpenException("No FTDI devices connected");
+    }else{
+      if(this->link->ftdi.open(0x403, 0xa8b0, std::string(), this->link->serial) != 0)
+        throw EPOS2OpenException("No FTDI device with serial " + this->link->serial);
+    }
+
+    this->link->ftdi.set_baud_rate(1000000);
+    this->link->ftdi.set_line_property(BITS_8, STOP_BIT_1, NONE);
+    this->link->ftdi.set_usb_read_timeout(10000);
+    this->link->ftdi.set_usb_write_timeout(10000);
+    this->link->ftdi.set_latency(1);
+    this->link->initialized = true;
+}
+
+//     LINK GUARD
+// ----------------------------------------------------------------------------
+
+CEpos2::LinkGuard::LinkGuard(epos_link &link, bool priority) : link(link)
+{
+  std::unique_lock<std::mutex> lock(link.mutex);
+
+  if(priority)
+  {
+    link.stop_pending++;
+    link.cond.wait(lock, [&link]{ return !link.busy; });
+    link.stop_pending--;
+  }else{
+    link.cond.wait(lock, [&link]{
+        return !link.busy && link.stop_pending == 0; });
+  }
+  link.busy = true;
+}
+
+CEpos2::LinkGuard::~LinkGuard()
+{
+  {
+    std::lock_guard<std::mutex> lock(this->link.mutex);
+    this->link.busy = false;
+  }
+  this->link.cond.notify_all();
+}
+
+void CEpos2::LinkGuard::yield()
+{
+  std::unique_lock<std::mutex> lock(this->link.mutex);
+
+  if(this->link.stop_pending == 0)
+    return;
 
-    CEpos2::ftdi.set_baud_rate(1000000);
-    CEpos2::ftdi.set_line_property(BITS_8, STOP_BIT_1, NONE);
-    CEpos2::ftdi.set_usb_read_timeout(10000);
-    CEpos2::ftdi.set_usb_write_timeout(10000);
-    CEpos2::ftdi.set_latency(1);
-    CEpos2::ftdi_initialized = true;
+  this->link.busy = false;
+  this->link.cond.notify_all();
+  this->link.cond.wait(lock, [this]{
+      return !this->link.busy && this->link.stop_pending == 0; });
+  this->link.busy = true;
 }
 
 //     READ OBJECT
@@ -122,34 +277,259 @@ void CEpos2::openDevice()
 
 int32_t CEpos2::readObject(int16_t index, int8_t subindex)
 {
-  int32_t result = 0x00000000;
+  return this->readObjectSample(index, subindex).value;
+}
+
+//     READ OBJECT SAMPLE
+// ----------------------------------------------------------------------------
+
+CEpos2::epos_sample CEpos2::readObjectSample(int16_t index, int8_t subindex)
+{
+  std::shared_ptr<read_flight> flight;
+
+  {
+    std::unique_lock<std::mutex> lock(this->read_mutex);
+    bool window = this->read_freshness_us > 0;
+
+    if(window)
+    {
+      std::chrono::steady_clock::time_point oldest = std::chrono::steady_clock::now() -
+        std::chrono::microseconds(this->read_freshness_us);
+      for(size_t i = 0; i < this->read_values.size(); i++)
+      {
+        const read_flight &v = this->read_values[i];
+        if(v.index == index && v.subindex == subindex && v.done && v.sample.received >= oldest)
+        {
+          this->read_stats.cached++;
+          return v.sample;
+        }
+      }
+    }
+
+    for(size_t i = 0; i < this->read_flights.size(); i++)
+    {
+      std::shared_ptr<read_flight> f = this->read_flights[i];
+      if(f->index == index && f->subindex == subindex && (!f->sent || window))
+      {
+        this->read_stats.shared++;
+        this->read_cond.wait(lock, [&f]{ return f->done; });
+        if(f->error)
+          std::rethrow_exception(f->error);
+        return f->sample;
+      }
+    }
+
+    flight = std::make_shared<read_flight>();
+    flight->index    = index;
+    flight->subindex = subindex;
+    flight->sent     = false;
+    flight->done     = false;
+    flight->current  = true;
+    this->read_flights.push_back(flight);
+    this->read_stats.transactions++;
+  }
+
+  epos_sample sample;
   int16_t req_frame[4];
-  uint16_t ans_frame[4];
+  uint16_t ans_frame[40];
 
   req_frame[0] = 0x0210;     // header (LEN,OPCODE)
   req_frame[1] = index;      // data
   req_frame[2] = ((0x0000 | this->node_id) << 8) | subindex; // node_id subindex
   req_frame[3] = 0x0000;     // CRC
 
-  //p("readObject: sendFrame");
-  this->sendFrame(req_frame);
+  try
+  {
+    LinkGuard guard(*this->link);
 
-  //printf("RF: %.2X %.2X %.2X %.2X\n",req_frame[0],req_frame[1],req_frame[2],req_frame[3]);
+    {
+      std::lock_guard<std::mutex> lock(this->read_mutex);
+      flight->sent = true;
+    }
 
-  //p("readObject: receiveFrame");
-  this->receiveFrame(ans_frame);
+    sample.sent = std::chrono::steady_clock::now();
+    this->sendFrame(req_frame);
+    this->receiveFrame(ans_frame);
+    sample.received = std::chrono::steady_clock::now();
 
-  //printf("AF: %.2X %.2X %.2X %.2X\n",ans_frame[0],ans_frame[1],ans_frame[2],ans_frame[3]);
+    // an error answer is neither mirrored nor kept
+    this->checkAnswer(ans_frame);
 
-  // if 0x8090, its 16 bit answer else is 32 bit
-  if(ans_frame[3]==0x8090)
-    result = ans_frame[2];
-  else
-    result = (ans_frame[3] << 16) | ans_frame[2];
+    // if 0x8090, its 16 bit answer else is 32 bit
+    if(ans_frame[3]==0x8090)
+      sample.value = ans_frame[2];
+    else
+      sample.value = ((uint32_t)ans_frame[3] << 16) | ans_frame[2];
+    sample.position = sample.value;
+  }
+  catch(...)
+  {
+    flight->error = std::current_exception();
+  }
 
-  //printf("result: %d %d -> %d\n",ans_frame[3],ans_frame[2],result);
+  if(!flight->error)
+  {
+    this->estimateSampleTime(sample);
+    this->mirrorValue(index, subindex, sample.value, sample.sampled, false);
+  }
 
-  return result;
+  {
+    std::lock_guard<std::mutex> lock(this->read_mutex);
+    flight->sample = sample;
+    flight->done   = true;
+    this->read_flights.erase(std::find(this->read_flights.begin(),
+                                       this->read_flights.end(), flight));
+
+    if(!flight->error && flight->current &&
+       std::find(this->read_writes.begin(), this->read_writes.end(),
+                 std::make_pair(index, subindex)) == this->read_writes.end())
+    {
+      size_t i = 0;
+      while(i < this->read_values.size() && (this->read_values[i].index != index ||
+                                             this->read_values[i].subindex != subindex))
+        i++;
+      if(i == this->read_values.size())
+        this->read_values.push_back(*flight);
+      else
+        this->read_values[i] = *flight;
+    }
+  }
+  this->read_cond.notify_all();
+
+  if(flight->error)
+    std::rethrow_exception(flight->error);
+
+  return sample;
+}
+
+//     MIRROR
+// ----------------------------------------------------------------------------
+
+// mirror_users is raised before mirror is loaded: the detach (clear mirror,
+// then wait for mirror_users to drop) either sees this update or is seen by it
+void CEpos2::mirrorValue(int16_t index, int8_t subindex, int32_t value,
+                         const std::chrono::steady_clock::time_point &time, bool write)
+{
+  this->mirror_users++;
+  CEpos2Mirror *mirror = this->mirror.load();
+  if(mirror != NULL)
+    mirror->update(index, subindex, value, time, write);
+  this->mirror_users--;
+}
+
+void CEpos2::mirrorPosition(int64_t position, const std::chrono::steady_clock::time_point &time)
+{
+  this->mirror_users++;
+  CEpos2Mirror *mirror = this->mirror.load();
+  if(mirror != NULL)
+    mirror->updatePosition(position, time);
+  this->mirror_users--;
+}
+
+//     INVALIDATE READ
+// ----------------------------------------------------------------------------
+
+void CEpos2::invalidateRead(int16_t index, int8_t subindex)
+{
+  std::lock_guard<std::mutex> lock(this->read_mutex);
+  for(size_t i = 0; i < this->read_values.size(); i++)
+    if(this->read_values[i].index == index && this->read_values[i].subindex == subindex)
+      this->read_values[i].done = false;
+  // a read on the link may have sampled the old value
+  for(size_t i = 0; i < this->read_flights.size(); i++)
+    if(this->read_flights[i]->index == index && this->read_flights[i]->subindex == subindex)
+      this->read_flights[i]->current = false;
+}
+
+CEpos2::PendingWrite::PendingWrite(CEpos2 &axis, int16_t index, int8_t subindex)
+  : axis(axis), object(index, subindex)
+{
+  {
+    std::lock_guard<std::mutex> lock(axis.read_mutex);
+    axis.read_writes.push_back(this->object);
+  }
+  axis.invalidateRead(index, subindex);
+}
+
+CEpos2::PendingWrite::~PendingWrite()
+{
+  {
+    std::lock_guard<std::mutex> lock(this->axis.read_mutex);
+    this->axis.read_writes.erase(std::find(this->axis.read_writes.begin(),
+                                           this->axis.read_writes.end(), this->object));
+  }
+  // a read completed before the write answer may still be on the link
+  this->axis.invalidateRead(this->object.first, this->object.second);
+}
+
+//     READ FRESHNESS
+// ----------------------------------------------------------------------------
+
+void CEpos2::setReadFreshness(long window_us)
+{
+  std::lock_guard<std::mutex> lock(this->read_mutex);
+  this->read_freshness_us = window_us;
+}
+
+long CEpos2::getReadFreshness()
+{
+  std::lock_guard<std::mutex> lock(this->read_mutex);
+  return this->read_freshness_us;
+}
+
+CEpos2::epos_read_stats CEpos2::getReadStats()
+{
+  std::lock_guard<std::mutex> lock(this->read_mutex);
+  return this->read_stats;
+}
+
+void CEpos2::resetReadStats()
+{
+  std::lock_guard<std::mutex> lock(this->read_mutex);
+  this->read_stats.transactions = 0;
+  this->read_stats.shared       = 0;
+  this->read_stats.cached       = 0;
+}
+
+//     ESTIMATE SAMPLE TIME
+// ----------------------------------------------------------------------------
+
+void CEpos2::estimateSampleTime(epos_sample &sample)
+{
+  // bytes on the link of a read request and its answer, sync included
+  static const double request_bytes = 10.0;
+  static const double answer_bytes  = 14.0;
+
+  double rtt = std::chrono::duration<double, std::micro>(sample.received - sample.sent).count();
+  double min_rtt;
+
+  {
+    std::lock_guard<std::mutex> lock(this->link->mutex);
+
+    long rtt_us = std::lround(rtt);
+    this->round_trip.count++;
+    this->round_trip.last_us   = rtt_us;
+    this->round_trip.total_us += rtt_us;
+    if(rtt_us > this->round_trip.worst_us)
+      this->round_trip.worst_us = rtt_us;
+
+    // lower envelope, rising slowly so it follows a slower link
+    if(this->min_round_trip_us < 0.0 || rtt < this->min_round_trip_us)
+      this->min_round_trip_us = rtt;
+    else
+      this->min_round_trip_us += (rtt - this->min_round_trip_us) / 64.0;
+    min_rtt = this->min_round_trip_us;
+  }
+
+  // the sample was taken after the request arrived and before the answer left
+  double first = min_rtt * request_bytes / (request_bytes + answer_bytes);
+  double last  = rtt - min_rtt * answer_bytes / (request_bytes + answer_bytes);
+  if(last < first)
+    last = first;
+
+  sample.sampled = sample.sent + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+      std::chrono::duration<double, std::micro>(0.5*(first + last)));
+  sample.uncertainty_us = std::lround(0.5*(last - first));
 }
 
 //     WRITE OBJECT
@@ -159,7 +539,8 @@ int32_t CEpos2::writeObject(int16_t index, int8_t subindex, int32_t data)
 {
   int32_t result = 0;
   int16_t req_frame[6]={0,0,0,0,0,0};
-  uint16_t ans_frame[40]={0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0};
+  // zeroed: a write answer has no data words after the error code
+  uint16_t ans_frame[EPOS2_MAX_ANSWER_WORDS] = {0};
 
   req_frame[0] = 0x0411;     // header (LEN,OPCODE)
   req_frame[1] = index;      // data
@@ -168,8 +549,13 @@ int32_t CEpos2::writeObject(int16_t index, int8_t subindex, int32_t data)
   req_frame[4] = data >> 16;
   req_frame[5] = 0x0000;     // checksum
 
-  this->sendFrame(req_frame);
-  this->receiveFrame(ans_frame);
+  PendingWrite pending(*this, index, subindex);
+
+  {
+    LinkGuard guard(*this->link);
+    this->sendFrame(req_frame);
+    this->receiveFrame(ans_frame);
+  }
 
   // if 0x8090, its 16 bit answer else is 32 bit
   if(ans_frame[3]==0x8090)
@@ -177,7 +563,349 @@ int32_t CEpos2::writeObject(int16_t index, int8_t subindex, int32_t data)
   else
     result = (ans_frame[3] << 16) | ans_frame[2];
 
-  return result;
+  // only an accepted write is mirrored, the error code is in the first words
+  if(((ans_frame[1] << 16) | ans_frame[0]) == 0)
+    this->mirrorValue(index, subindex, data, std::chrono::steady_clock::now(), true);
+
+  return result;
+}
+
+//     WRITE OBJECT CACHED
+// ----------------------------------------------------------------------------
+
+void CEpos2::writeObjectCached(epos_frame_cache &cache, int16_t index,
+                               int8_t subindex, int32_t data)
+{
+  uint16_t ans_frame[EPOS2_MAX_ANSWER_WORDS];
+  uint8_t trans_frame[32];
+  int16_t length;
+  uint16_t crc;
+
+  {
+    std::lock_guard<std::mutex> lock(cache.mutex);
+    if(!cache.valid || cache.index != index || cache.subindex != subindex)
+    {
+      int16_t req_frame[3];
+      req_frame[0] = 0x0411;     // header (LEN,OPCODE)
+      req_frame[1] = index;      // data
+      req_frame[2] = ((0x0000 | this->node_id) << 8) | subindex;
+
+      cache.prefix_length = 0;
+      cache.prefix[cache.prefix_length++] = 0x90;   // DLE
+      cache.prefix[cache.prefix_length++] = 0x02;   // STX
+      for(int i = 0; i < 3; i++)
+      {
+        stuffByte(req_frame[i] & 0x00FF, cache.prefix, cache.prefix_length);
+        stuffByte((req_frame[i] & 0xFF00) >> 8, cache.prefix, cache.prefix_length);
+      }
+      cache.crc_prefix = updateChecksum(0, req_frame, 3);
+      cache.index      = index;
+      cache.subindex   = subindex;
+      cache.valid      = true;
+    }
+    std::copy(cache.prefix, cache.prefix + cache.prefix_length, trans_frame);
+    length = cache.prefix_length;
+    crc    = cache.crc_prefix;
+  }
+
+  // only the data words and the checksum depend on the value; the length
+  // does too, through the stuffing
+  int16_t tail[3];
+  tail[0] = data & 0x0000FFFF;
+  tail[1] = data >> 16;
+  tail[2] = 0x0000;
+  tail[2] = updateChecksum(crc, tail, 3);
+  for(int i = 0; i < 3; i++)
+  {
+    stuffByte(tail[i] & 0x00FF, trans_frame, length);
+    stuffByte((tail[i] & 0xFF00) >> 8, trans_frame, length);
+  }
+
+  PendingWrite pending(*this, index, subindex);
+
+  {
+    LinkGuard guard(*this->link);
+    this->sendEncodedFrame(trans_frame, length);
+    this->receiveFrame(ans_frame);
+  }
+
+  this->checkAnswer(ans_frame);
+
+  this->mirrorValue(index, subindex, data, std::chrono::steady_clock::now(), true);
+}
+
+//     WRITE OBJECT SEGMENTED
+// ----------------------------------------------------------------------------
+
+void CEpos2::writeObjectSegmented(int16_t index, int8_t subindex, uint32_t length,
+                                  const std::function<void(uint8_t*, size_t)> &source)
+{
+  int16_t req_frame[35];
+  uint16_t ans_frame[EPOS2_MAX_ANSWER_WORDS];
+  uint8_t trans_frame[2][160];     // the segment in flight and the next one
+  int16_t trans_length[2];
+  uint8_t segment[63];
+
+  PendingWrite pending(*this, index, subindex);
+
+  LinkGuard guard(*this->link);
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+  req_frame[0] = 0x0413;     // header (LEN,OPCODE) InitiateSegmentedWrite
+  req_frame[1] = index;      // data
+  req_frame[2] = ((0x0000 | this->node_id) << 8) | subindex;
+  req_frame[3] = length & 0x0000FFFF;
+  req_frame[4] = length >> 16;
+  req_frame[5] = 0x0000;     // checksum
+
+  this->sendFrame(req_frame);
+
+  // encodes the segment starting at byte sent into trans_frame[slot]
+  auto encode = [&](uint32_t sent, uint8_t toggle, int slot)
+  {
+    // control byte: bit 0-5 length, bit 6 toggle, bit 7 more segments
+    uint8_t n = length - sent > 63 ? 63 : length - sent;
+    uint8_t control = n | (toggle << 6) | (sent + n < length ? 0x80 : 0x00);
+    int16_t words = (n + 2) / 2;
+
+    source(segment, n);
+
+    req_frame[0] = (words << 8) | 0x15;   // header (LEN,OPCODE) SegmentedWrite
+    for(int16_t i = 0; i < words; i++)
+    {
+      int16_t b = 2*i;   // byte b-1 of data is byte b of the segment
+      uint8_t lsb = b == 0 ? control : segment[b - 1];
+      uint8_t msb = b + 1 <= n ? segment[b] : 0x00;
+      req_frame[1+i] = (msb << 8) | lsb;
+    }
+    req_frame[1+words] = 0x0000;          // checksum
+
+    trans_length[slot] = this->encodeFrame(req_frame, trans_frame[slot]);
+    return n;
+  };
+
+  // the protocol allows one request in flight: the next segment is encoded
+  // while the EPOS2 answers the previous request
+  uint32_t sent = 0;
+  uint8_t toggle = 0;
+  int slot = 0;
+  uint8_t n = 0;
+  try
+  {
+    if(length > 0)
+      n = encode(0, 0, slot);
+  }
+  catch(...)
+  {
+    this->drainAnswer(ans_frame);
+    throw;
+  }
+  this->receiveFrame(ans_frame);
+  this->checkAnswer(ans_frame);
+
+  while(sent < length)
+  {
+    // no request in flight: a stop may go first
+    guard.yield();
+    this->sendEncodedFrame(trans_frame[slot], trans_length[slot]);
+    sent += n;
+    toggle ^= 1;
+    slot ^= 1;
+
+    try
+    {
+      if(sent < length)
+        n = encode(sent, toggle, slot);
+    }
+    catch(...)
+    {
+      this->drainAnswer(ans_frame);
+      throw;
+    }
+
+    this->receiveFrame(ans_frame);
+    this->checkAnswer(ans_frame);
+  }
+
+  this->accountTransfer(length, start);
+}
+
+void CEpos2::writeObjectSegmented(int16_t index, int8_t subindex,
+                                  const uint8_t *data, uint32_t length)
+{
+  uint32_t offset = 0;
+
+  this->writeObjectSegmented(index, subindex, length,
+    [&](uint8_t *segment, size_t size)
+    {
+      std::copy(data + offset, data + offset + size, segment);
+      offset += size;
+    });
+}
+
+//     READ OBJECT SEGMENTED
+// ----------------------------------------------------------------------------
+
+uint32_t CEpos2::readObjectSegmented(int16_t index, int8_t subindex,
+    const std::function<void(const uint8_t*, size_t, uint32_t)> &sink)
+{
+  int16_t req_frame[4];
+  uint16_t ans_frame[EPOS2_MAX_ANSWER_WORDS];
+  uint8_t trans_frame[2][16];      // SegmentRead with toggle 0 and 1
+  int16_t trans_length[2];
+  uint8_t segment[63];
+
+  LinkGuard guard(*this->link);
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+  req_frame[0] = 0x0212;     // header (LEN,OPCODE) InitiateSegmentedRead
+  req_frame[1] = index;      // data
+  req_frame[2] = ((0x0000 | this->node_id) << 8) | subindex;
+  req_frame[3] = 0x0000;     // checksum
+
+  this->sendFrame(req_frame);
+
+  // the requests only differ in the toggle, encode both while the EPOS2 answers
+  for(uint8_t toggle = 0; toggle < 2; toggle++)
+  {
+    req_frame[0] = 0x0114;          // header (LEN,OPCODE) SegmentRead
+    req_frame[1] = toggle << 6;     // control byte: bit 6 toggle
+    req_frame[2] = 0x0000;          // checksum
+    trans_length[toggle] = this->encodeFrame(req_frame, trans_frame[toggle]);
+  }
+
+  this->receiveFrame(ans_frame);
+  this->checkAnswer(ans_frame);
+
+  // the answer has the length of the object
+  uint32_t length = ((uint32_t)ans_frame[3] << 16) | ans_frame[2];
+
+  uint32_t received = 0;
+  uint8_t toggle = 0;
+  if(length > 0)
+  {
+    guard.yield();
+    this->sendEncodedFrame(trans_frame[toggle], trans_length[toggle]);
+  }
+
+  while(received < length)
+  {
+    this->receiveFrame(ans_frame);
+    this->checkAnswer(ans_frame);
+
+    // control byte: bit 0-5 length, bit 6 toggle, bit 7 more segments
+    uint8_t control = ans_frame[2] & 0x00FF;
+    uint8_t n = control & 0x3F;
+    if(((control >> 6) & 0x01) != toggle || n == 0 || received + n > length)
+      throw EPOS2IOException("EPOS2 segmented read out of sequence");
+
+    // byte 4 of the answer is the control byte, the data follows it
+    for(uint8_t i = 0; i < n; i++)
+    {
+      int b = 5 + i;
+      segment[i] = b % 2 ? ans_frame[b/2] >> 8 : ans_frame[b/2] & 0x00FF;
+    }
+    received += n;
+    toggle ^= 1;
+
+    // the next request is in flight while the sink runs; before it, with
+    // no request in flight, a stop may go first
+    if(received < length)
+    {
+      guard.yield();
+      this->sendEncodedFrame(trans_frame[toggle], trans_length[toggle]);
+    }
+
+    try
+    {
+      sink(segment, n, length);
+    }
+    catch(...)
+    {
+      if(received < length)
+        this->drainAnswer(ans_frame);
+      throw;
+    }
+  }
+
+  this->accountTransfer(length, start);
+
+  return length;
+}
+
+uint32_t CEpos2::readObjectSegmented(int16_t index, int8_t subindex,
+                                     uint8_t *data, uint32_t capacity)
+{
+  uint32_t offset = 0;
+
+  return this->readObjectSegmented(index, subindex,
+    [&](const uint8_t *segment, size_t size, uint32_t length)
+    {
+      if(length > capacity)
+        throw std::length_error("EPOS2 object larger than the buffer");
+      std::copy(segment, segment + size, data + offset);
+      offset += size;
+    });
+}
+
+void CEpos2::readObjectSegmented(int16_t index, int8_t subindex, std::vector<uint8_t> &data)
+{
+  data.clear();
+
+  this->readObjectSegmented(index, subindex,
+    [&](const uint8_t *segment, size_t size, uint32_t length)
+    {
+      if(data.empty())
+        data.reserve(length);
+      data.insert(data.end(), segment, segment + size);
+    });
+}
+
+//     DRAIN ANSWER
+// ----------------------------------------------------------------------------
+
+void CEpos2::drainAnswer(uint16_t *ans_frame)
+{
+  // the link stays in sequence for the next transaction, the error of the
+  // aborted transfer is the one thrown
+  try
+  {
+    this->receiveFrame(ans_frame);
+  }
+  catch(...)
+  {
+  }
+}
+
+//     ACCOUNT TRANSFER
+// ----------------------------------------------------------------------------
+
+void CEpos2::accountTransfer(uint32_t bytes, std::chrono::steady_clock::time_point start)
+{
+  long elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - start).count();
+
+  std::lock_guard<std::mutex> lock(this->link->mutex);
+  this->transfer_stats.count++;
+  this->transfer_stats.bytes     += bytes;
+  this->transfer_stats.last_bytes = bytes;
+  this->transfer_stats.last_us    = elapsed;
+  this->transfer_stats.total_us  += elapsed;
+}
+
+//     CHECK ANSWER
+// ----------------------------------------------------------------------------
+
+void CEpos2::checkAnswer(const uint16_t *ans_frame)
+{
+  uint32_t error = (ans_frame[1] << 16) | ans_frame[0];
+
+  if(error != 0)
+  {
+    std::stringstream s;
+    s << "EPOS2 communication error 0x" << std::hex << error;
+    throw EPOS2IOException(s.str());
+  }
 }
 
 //     SEND FRAME
@@ -185,7 +913,16 @@ int32_t CEpos2::writeObject(int16_t index, int8_t subindex, int32_t data)
 
 void CEpos2::sendFrame(int16_t *frame)
 {
-  uint8_t trans_frame[80];                  // transmission frame
+  uint8_t trans_frame[160];                 // transmission frame
+
+  this->sendEncodedFrame(trans_frame, this->encodeFrame(frame, trans_frame));
+}
+
+//     ENCODE FRAME
+// ----------------------------------------------------------------------------
+
+int16_t CEpos2::encodeFrame(int16_t *frame, uint8_t *trans_frame)
+{
   int16_t length = ((frame[0] & 0xFF00) >> 8 ) + 2;   // frame length
 
   // Add checksum to the frame
@@ -219,59 +956,202 @@ void CEpos2::sendFrame(int16_t *frame)
       i++;
   }
 
-    if(CEpos2::ftdi.write(trans_frame, tf_i) < 0)
+  return tf_i;
+}
+
+//     ENCODE READ OBJECT
+// ----------------------------------------------------------------------------
+
+int16_t CEpos2::encodeReadObject(int16_t index, int8_t subindex, uint8_t *trans_frame)
+{
+  int16_t req_frame[4];
+
+  req_frame[0] = 0x0210;     // header (LEN,OPCODE)
+  req_frame[1] = index;      // data
+  req_frame[2] = ((0x0000 | this->node_id) << 8) | subindex;
+  req_frame[3] = 0x0000;     // checksum
+
+  return this->encodeFrame(req_frame, trans_frame);
+}
+
+//     ENCODE WRITE OBJECT
+// ----------------------------------------------------------------------------
+
+int16_t CEpos2::encodeWriteObject(int16_t index, int8_t subindex, int32_t data,
+                                  uint8_t *trans_frame)
+{
+  int16_t req_frame[6];
+
+  req_frame[0] = 0x0411;     // header (LEN,OPCODE)
+  req_frame[1] = index;      // data
+  req_frame[2] = ((0x0000 | this->node_id) << 8) | subindex;
+  req_frame[3] = data & 0x0000FFFF;
+  req_frame[4] = data >> 16;
+  req_frame[5] = 0x0000;     // checksum
+
+  return this->encodeFrame(req_frame, trans_frame);
+}
+
+//     SEND ENCODED FRAME
+// ----------------------------------------------------------------------------
+
+void CEpos2::sendEncodedFrame(const uint8_t *trans_frame, int16_t length)
+{
+    if(this->link->ftdi.write(trans_frame, length) < 0)
         throw EPOS2IOException("Impossible to write Status Word.\nIs the controller powered ?");
 }
 
+//     SEND PRIORITY FRAME
+// ----------------------------------------------------------------------------
+
+void CEpos2::sendPriorityFrame(const uint8_t *trans_frame, int16_t length)
+{
+  uint16_t ans_frame[40];
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+  {
+    LinkGuard guard(*this->link, true);
+    this->sendEncodedFrame(trans_frame, length);
+    this->receiveFrame(ans_frame);
+  }
+
+  long latency = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - start).count();
+
+  {
+    std::lock_guard<std::mutex> lock(this->link->mutex);
+    this->stop_latency.count++;
+    this->stop_latency.last_us   = latency;
+    this->stop_latency.total_us += latency;
+    if(latency > this->stop_latency.worst_us)
+      this->stop_latency.worst_us = latency;
+  }
+
+  // a refused stop must not pass for a stop
+  this->checkAnswer(ans_frame);
+}
+
+//     TRANSACT TOGETHER
+// ----------------------------------------------------------------------------
+
+void CEpos2::transactTogether(const std::vector<CEpos2*> &axes,
+                              const std::vector<const uint8_t*> &frames,
+                              const std::vector<int16_t> &lengths,
+                              std::vector<std::chrono::steady_clock::time_point> &sent,
+                              std::vector<uint16_t> &answers)
+{
+  std::vector<epos_link*> links;
+  for(size_t i = 0; i < axes.size(); i++)
+    links.push_back(axes[i]->link.get());
+  std::sort(links.begin(), links.end());
+  links.erase(std::unique(links.begin(), links.end()), links.end());
+
+  sent.resize(axes.size());
+  answers.resize(EPOS2_MAX_ANSWER_WORDS * axes.size());
+
+  std::vector<std::unique_ptr<LinkGuard> > guards;
+  for(size_t i = 0; i < links.size(); i++)
+    guards.push_back(std::unique_ptr<LinkGuard>(new LinkGuard(*links[i])));
+
+  size_t written = 0, received = 0;
+  try
+  {
+    for(; written < axes.size(); written++)
+    {
+      axes[written]->sendEncodedFrame(frames[written], lengths[written]);
+      sent[written] = std::chrono::steady_clock::now();
+    }
+    for(; received < axes.size(); received++)
+      axes[received]->receiveFrame(&answers[EPOS2_MAX_ANSWER_WORDS*received]);
+  }
+  catch(...)
+  {
+    // the answers of the frames written and not received yet are still
+    // coming, the links stay in sequence for the next transactions
+    uint16_t ans_frame[EPOS2_MAX_ANSWER_WORDS];
+    for(size_t i = received + (written == axes.size() ? 1 : 0); i < written; i++)
+      axes[i]->drainAnswer(ans_frame);
+    throw;
+  }
+}
+
+//     WRITE TOGETHER
+// ----------------------------------------------------------------------------
+
+void CEpos2::writeTogether(const std::vector<CEpos2*> &axes, int16_t index, int8_t subindex,
+                           const std::vector<int32_t> &values,
+                           const std::vector<const uint8_t*> &frames,
+                           const std::vector<int16_t> &lengths,
+                           std::vector<std::chrono::steady_clock::time_point> &sent,
+                           std::vector<uint16_t> &answers)
+{
+  // as writeObject: reads racing the writes are not kept
+  std::vector<std::unique_ptr<PendingWrite> > pending;
+  for(size_t i = 0; i < axes.size(); i++)
+    pending.push_back(std::unique_ptr<PendingWrite>(new PendingWrite(*axes[i], index, subindex)));
+
+  CEpos2::transactTogether(axes, frames, lengths, sent, answers);
+
+  for(size_t i = 0; i < axes.size(); i++)
+  {
+    const uint16_t *ans_frame = &answers[EPOS2_MAX_ANSWER_WORDS*i];
+    if(((ans_frame[1] << 16) | ans_frame[0]) == 0)
+      axes[i]->mirrorValue(index, subindex, values[i], sent[i], true);
+  }
+}
+
 //     RECEIVE FRAME
 // ----------------------------------------------------------------------------
 
 void CEpos2::receiveFrame(uint16_t* ans_frame)
 {
+  epos_link &link = *this->link;
+
   // length variables
   uint16_t read_desired         = 0;       // length of data that must read
-  uint16_t read_real            = 0;       // length of data read actually
+  int read_real                 = 0;       // length of data read actually
   uint16_t Len                  = 0;       // Len header part in epos2 usb frame
   uint16_t read_point           = 0;       // Position of the data read
   uint16_t state                = 0;       // state of the parsing state machine
   bool packet_complete     = false;
 
   // data holders
-  uint8_t *read_buffer = NULL;  // frame buffer stuffed
-  uint8_t *data        = NULL;  // frame buffer unstuffed
+  uint8_t data[2*EPOS2_MAX_ANSWER_WORDS];           // frame buffer unstuffed
   uint8_t cheksum[2];
 
-  // get data packet
+  // get data packet; the bytes after it (answers of requests sent back to
+  // back) stay in the buffer of the link for the next call
   do{
 
-    read_desired = CEpos2::ftdi.read_chunk_size();
+    if(link.rx_begin == link.rx_end)
+    {
+      read_desired = std::min<unsigned int>(link.ftdi.read_chunk_size(), sizeof(link.rx_buffer));
 
-    read_buffer = new uint8_t[read_desired];
+      read_real    = link.ftdi.read(link.rx_buffer, read_desired);
 
-    read_real    = CEpos2::ftdi.read(read_buffer, read_desired);
+      if(read_real < 0)
+        throw EPOS2IOException("Impossible to read Status Word.\nIs the controller powered ?");
 
-    if(read_real < 0)
-    {
-      delete[] read_buffer;
-      if(data!=NULL)
-        delete[] data;
-      throw EPOS2IOException("Impossible to read Status Word.\nIs the controller powered ?");
+      link.rx_begin = 0;
+      link.rx_end   = read_real;
     }
 
-    for(uint16_t i=0;i<read_real;i++)
+    while(link.rx_begin < link.rx_end && !packet_complete)
     {
+      uint8_t byte = link.rx_buffer[link.rx_begin++];
+
       switch (state)
       {
         case 0:
         // no sync
-          if(read_buffer[i] == 0x90)
+          if(byte == 0x90)
             state = 1;
           else
             state = 0;
           break;
         case 1:
           // sync stx
-          if(read_buffer[i] == 0x02)
+          if(byte == 0x02)
             state = 2;
           else
             state = 0;
@@ -282,16 +1162,15 @@ void CEpos2::receiveFrame(uint16_t* ans_frame)
          break;
         case 3:
           // len (16 bits)
-          Len = read_buffer[i];
-          if(data!=NULL)
-            delete[] data;
-          data = new uint8_t[Len*2];
+          Len = byte;
+          if(Len > EPOS2_MAX_ANSWER_WORDS)
+            throw EPOS2IOException("EPOS2 answer longer than expected");
           read_point = -1;
           state = 4;
           break;
         case 4:
           read_point++;
-          data[read_point] = read_buffer[i];
+          data[read_point] = byte;
           if(data[read_point]==0x90)
           {
             state = 5;
@@ -308,7 +1187,7 @@ void CEpos2::receiveFrame(uint16_t* ans_frame)
             break;
         case 6:
           // checksum 1
-          cheksum[1] = read_buffer[i];
+          cheksum[1] = byte;
           if(cheksum[1]==0x90){
             state = 8;
           }else{
@@ -317,7 +1196,7 @@ void CEpos2::receiveFrame(uint16_t* ans_frame)
           break;
         case 7:
           // checksum 0
-          cheksum[0] = read_buffer[i];
+          cheksum[0] = byte;
           if(cheksum[0]==0x90){
             state = 9;
           }else{
@@ -337,8 +1216,6 @@ void CEpos2::receiveFrame(uint16_t* ans_frame)
       }
     }
 
-    delete[] read_buffer;
-
   }while(!packet_complete);
 
 
@@ -354,10 +1231,6 @@ void CEpos2::receiveFrame(uint16_t* ans_frame)
     ans_frame[i] = (data[tf_i]<<8) | ans_frame[i];
     tf_i++;
   }
-
-  if(data!=NULL)
-    delete[] data;
-
 }
 
 //     COMPUTE CHECKSUM
@@ -365,26 +1238,7 @@ void CEpos2::receiveFrame(uint16_t* ans_frame)
 
 int16_t CEpos2::computeChecksum(int16_t *pDataArray, int16_t numberOfWords)
 {
-  uint16_t shifter, c;
-  uint16_t carry;
-  uint16_t CRC = 0;
-
-  //Calculate pDataArray Word by Word
-  while(numberOfWords--)
-  {
-    shifter = 0x8000;                 //Initialize BitX to Bit15
-    c = *pDataArray++;                //Copy next DataWord to c
-    do
-    {
-      carry = CRC & 0x8000;    //Check if Bit15 of CRC is set
-      CRC <<= 1;               //CRC = CRC * 2
-      if(c & shifter) CRC++;   //CRC = CRC + 1, if BitX is set in c
-      if(carry) CRC ^= 0x1021; //CRC = CRC XOR G(x), if carry is true
-      shifter >>= 1;           //Set BitX to next lower Bit, shifter = shifter/2
-    } while(shifter);
-  }
-
-  return (int16_t)CRC;
+  return (int16_t)updateChecksum(0, pDataArray, numberOfWords);
 }
 
 
@@ -532,7 +1386,7 @@ void CEpos2::switchOn()
 
 void CEpos2::disableVoltage()
 {
-  this->writeObject(0x6040, 0x00, 0x00);
+  this->sendPriorityFrame(this->disable_voltage_frame, this->disable_voltage_frame_len);
 }
 
 //     QUICK STOP (transition)
@@ -540,7 +1394,25 @@ void CEpos2::disableVoltage()
 
 void CEpos2::quickStop()
 {
-  this->writeObject(0x6040, 0x00, 0x02);
+  this->sendPriorityFrame(this->quick_stop_frame, this->quick_stop_frame_len);
+}
+
+//     STOP LATENCY
+// ----------------------------------------------------------------------------
+
+CEpos2::epos_latency CEpos2::getStopLatency()
+{
+  std::lock_guard<std::mutex> lock(this->link->mutex);
+  return this->stop_latency;
+}
+
+void CEpos2::resetStopLatency()
+{
+  std::lock_guard<std::mutex> lock(this->link->mutex);
+  this->stop_latency.count    = 0;
+  this->stop_latency.last_us  = 0;
+  this->stop_latency.worst_us = 0;
+  this->stop_latency.total_us = 0;
 }
 
 //     DISABLE OPERATION (transition)
@@ -594,6 +1466,15 @@ std::string CEpos2::getOpModeDescription(long opmode)
 	std::string       name;
 
 	switch(opmode){
+		case STEP_DIRECTION:
+			name="Step/Direction";
+		break;
+		case MASTER_ENCODER:
+			name="Master Encoder";
+		break;
+		case CURRENT:
+			name="Current";
+		break;
 		case VELOCITY:
 			name="Velocity";
 		break;
@@ -723,145 +1604,401 @@ bool CEpos2::isTargetReached()
   long ans = this->readObject(0x6041, 0x00);
   std::stringstream s;
 
-	//s << "Estat: std::hex=" <<std::hex<< ans << " /  std::dec=" <<std::dec << ans;
-  //this->p(s);
-	// OBTENIR EL NUMERO D'ESTAT
+	//s << "Estat: std::hex=" <<std::hex<< ans << " /  std::dec=" <<std::dec << ans;
+  //this->p(s);
+	// OBTENIR EL NUMERO D'ESTAT
+
+	// bit10 = 0 , not reached
+	// bit10 = 1 , reached
+
+	return((bool)(ans & 0x0400));
+}
+
+//     WAIT TARGET REACHED
+// ----------------------------------------------------------------------------
+
+bool CEpos2::waitTargetReached(long timeout_ms)
+{
+  if(this->status_poller != NULL)
+    return this->status_poller->waitTargetReached(this, timeout_ms);
+
+  std::chrono::steady_clock::time_point deadline =
+    std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+
+  while( !this->isTargetReached() )
+  {
+    if(timeout_ms >= 0 && std::chrono::steady_clock::now() >= deadline)
+      return false;
+    if(this->verbose) this->getMovementInfo();
+    else usleep(1000);
+  }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+//   MODE VELOCITY
+// ----------------------------------------------------------------------------
+//     GET TARGET VELOCITY
+// ----------------------------------------------------------------------------
+
+long CEpos2::getTargetVelocity()
+{
+  return this->readObject(0x206B, 0x00);
+}
+
+//     SET TARGET VELOCITY
+// ----------------------------------------------------------------------------
+
+void CEpos2::setTargetVelocity(long velocity)
+{
+  this->writeObject(0x206B, 0x00,velocity);
+}
+
+//     START VELOCITY
+// ----------------------------------------------------------------------------
+
+void CEpos2::startVelocity()
+{
+  this->writeObject(0x6040, 0x00, 0x010f);
+}
+
+//     STOP VELOCITY
+// ----------------------------------------------------------------------------
+
+void CEpos2::stopVelocity()
+{
+  // just velocity command = 0
+  this->writeObject(0x206B, 0x00,0x0000);
+}
+
+//----------------------------------------------------------------------------
+//   MODE PROFILE VELOCITY
+// ----------------------------------------------------------------------------
+//     GET TARGET PROFILE VELOCITY
+// ----------------------------------------------------------------------------
+
+long CEpos2::getTargetProfileVelocity()
+{
+
+  return this->readObject(0x60FF, 0x00);
+}
+
+//     SET TARGET PROFILE VELOCITY
+// ----------------------------------------------------------------------------
+
+void CEpos2::setTargetProfileVelocity(long velocity)
+{
+  this->writeObject(0x60FF, 0x00, velocity);
+}
+
+//     START PROFILE VELOCITY
+// ----------------------------------------------------------------------------
+
+void CEpos2::startProfileVelocity()
+{
+	int intmode = 0x000F;
+
+  this->writeObject(0x6040, 0x00,intmode);
+}
+
+//     STOP PROFILE VELOCITY
+// ----------------------------------------------------------------------------
+
+void CEpos2::stopProfileVelocity()
+{
+	int intmode = 0x010F;
+  this->writeObject(0x6040, 0x00,intmode);
+}
+
+//----------------------------------------------------------------------------
+//   MODE PROFILE POSITION
+// ----------------------------------------------------------------------------
+//     GET TARGET PROFILE POSITION
+// ----------------------------------------------------------------------------
+
+long CEpos2::getTargetProfilePosition()
+{
+  this->target_position = this->readObject(0x607A, 0x00);
+  this->target_position_valid = true;
+  return this->target_position;
+}
+
+//     SET TARGET PROFILE POSITION
+// ----------------------------------------------------------------------------
+
+void CEpos2::setTargetProfilePosition(long position)
+{
+  this->writeObject(0x607A, 0x00,position);
+  this->target_position = position;
+  this->target_position_valid = true;
+}
+
+// 0 halt, 1 abs, 2 rel
+void CEpos2::startProfilePosition(epos_posmodes mode, bool blocking, bool wait, bool new_point)
+ {
+
+  int halt        = mode==HALT ?      0x0100 : 0x0000;
+  int rel         = mode==RELATIVE ?  0x0040 : 0x0000;
+  int nowait      = !wait ?           0x0020 : 0x0000;
+  int newsetpoint = new_point ?       0x0010 : 0x0000;
+
+  int intmode = 0x000F | halt | rel | nowait | newsetpoint;
+
+  // expected duration for the adaptive polling of the status poller
+  double eta = -1.0;
+  if( this->status_poller != NULL && mode != HALT )
+    eta = this->estimateProfilePositionTime(mode);
+
+  this->writeObject(0x6040, 0x00,intmode);
+
+  if( eta >= 0.0 )
+    this->status_poller->expectTargetReached(this, eta);
+
+  if( blocking )
+    this->waitTargetReached();
+
+}
+
+
+
+//     COMPUTE PROFILE TIME
+// ----------------------------------------------------------------------------
+
+double CEpos2::computeProfileTime(long distance, long velocity, long acceleration,
+                                  long deceleration, long type, long encoder_pulses)
+{
+  // [rev/min] and [rev/min/s] to [qc/s] and [qc/s^2]
+  double qc_rpm = 4.0 * encoder_pulses / 60.0;
+  double d = std::fabs((double)distance);
+  double v = velocity * qc_rpm;
+  double a = acceleration * qc_rpm;
+  double b = deceleration * qc_rpm;
+
+  if( d == 0.0 )
+    return 0.0;
+  if( v <= 0.0 || a <= 0.0 || b <= 0.0 )
+    return -1.0;
+
+  // a sin^2 ramp with the same peak acceleration lasts twice as long as a
+  // linear one, which is a linear ramp with half the acceleration
+  if( type != 0 )
+  {
+    a /= 2.0;
+    b /= 2.0;
+  }
+
+  double d_ramps = v*v / (2.0*a) + v*v / (2.0*b);
+
+  if( d_ramps >= d )
+  {
+    // triangular profile, profile velocity not reached
+    double v_peak = std::sqrt(2.0 * d * a * b / (a + b));
+    return v_peak / a + v_peak / b;
+  }
+
+  return v / a + v / b + (d - d_ramps) / v;
+}
+
+//     ESTIMATE PROFILE POSITION TIME
+// ----------------------------------------------------------------------------
 
-	// bit10 = 0 , not reached
-	// bit10 = 1 , reached
+double CEpos2::estimateProfilePositionTime(epos_posmodes mode)
+{
+  // the values set or read before are used, unknown ones are read once
+  if( this->profile_velocity < 0 )     this->getProfileVelocity();
+  if( this->profile_acceleration < 0 ) this->getProfileAcceleration();
+  if( this->profile_deceleration < 0 ) this->getProfileDeceleration();
+  if( this->profile_type < 0 )         this->getProfileType();
+  if( this->encoder_pulses < 0 )       this->getEncoderPulseNumber();
+  if( !this->target_position_valid )   this->getTargetProfilePosition();
 
-	return((bool)(ans & 0x0400));
+  long distance = this->target_position;
+  if( mode == ABSOLUTE )
+    distance -= this->readPosition();
+
+  return computeProfileTime(distance, this->profile_velocity,
+                            this->profile_acceleration, this->profile_deceleration,
+                            this->profile_type, this->encoder_pulses);
 }
 
 //----------------------------------------------------------------------------
-//   MODE VELOCITY
-// ----------------------------------------------------------------------------
-//     GET TARGET VELOCITY
+//   MODE INTERPOLATED PROFILE POSITION
 // ----------------------------------------------------------------------------
 
-long CEpos2::getTargetVelocity()
+void CEpos2::clearIpmBuffer()
 {
-  return this->readObject(0x206B, 0x00);
+  // sub mode PVT
+  this->writeObject(0x20C0, 0x00, 0x0000);
+  // clear buffer (disables access) and enable it again
+  this->writeObject(0x60C4, 0x06, 0x0000);
+  this->writeObject(0x60C4, 0x06, 0x0001);
 }
 
-//     SET TARGET VELOCITY
-// ----------------------------------------------------------------------------
-
-void CEpos2::setTargetVelocity(long velocity)
+void CEpos2::addPvtPoint(long position, long velocity, unsigned char time_ms)
 {
-  this->writeObject(0x206B, 0x00,velocity);
+  uint8_t record[8];
+
+  // position (32 bit), velocity (24 bit), time (8 bit), little endian
+  record[0] = position & 0xFF;
+  record[1] = (position >> 8) & 0xFF;
+  record[2] = (position >> 16) & 0xFF;
+  record[3] = (position >> 24) & 0xFF;
+  record[4] = velocity & 0xFF;
+  record[5] = (velocity >> 8) & 0xFF;
+  record[6] = (velocity >> 16) & 0xFF;
+  record[7] = time_ms;
+
+  this->writeObjectSegmented(0x20C1, 0x00, record, 8);
 }
 
-//     START VELOCITY
-// ----------------------------------------------------------------------------
+long CEpos2::getIpmBufferStatus()
+{
+  return this->readObject(0x20C4, 0x01);
+}
 
-void CEpos2::startVelocity()
+long CEpos2::getIpmBufferSize()
 {
-  this->writeObject(0x6040, 0x00, 0x010f);
+  return this->readObject(0x60C4, 0x02);
 }
 
-//     STOP VELOCITY
-// ----------------------------------------------------------------------------
+void CEpos2::startIpm()
+{
+  this->writeObject(0x6040, 0x00, 0x001F);
+}
 
-void CEpos2::stopVelocity()
+void CEpos2::stopIpm()
 {
-  // just velocity command = 0
-  this->writeObject(0x206B, 0x00,0x0000);
+  this->writeObject(0x6040, 0x00, 0x010F);
 }
 
 //----------------------------------------------------------------------------
-//   MODE PROFILE VELOCITY
+//   MODE CURRENT
 // ----------------------------------------------------------------------------
-//     GET TARGET PROFILE VELOCITY
+//     GET TARGET CURRENT
 // ----------------------------------------------------------------------------
 
-long CEpos2::getTargetProfileVelocity()
+long CEpos2::getTargetCurrent()
 {
-
-  return this->readObject(0x60FF, 0x00);
+  return this->getNegativeLong(this->readObject(0x2030, 0x00));
 }
 
-//     SET TARGET PROFILE VELOCITY
+//     SET TARGET CURRENT
 // ----------------------------------------------------------------------------
 
-void CEpos2::setTargetProfileVelocity(long velocity)
+long CEpos2::setTargetCurrent(long current)
 {
-  this->writeObject(0x60FF, 0x00, velocity);
+  if( this->output_current_limit < 0 )
+    this->getMotorOutputCurrentLimit();
+
+  long limit = this->output_current_limit;
+  if( current > limit )
+    current = limit;
+  else if( current < -limit )
+    current = -limit;
+
+  this->writeObjectCached(this->current_frame, 0x2030, 0x00, current);
+
+  return current;
 }
 
-//     START PROFILE VELOCITY
+//     START CURRENT
 // ----------------------------------------------------------------------------
 
-void CEpos2::startProfileVelocity()
+void CEpos2::startCurrent()
 {
-	int intmode = 0x000F;
-
-  this->writeObject(0x6040, 0x00,intmode);
+  this->writeObject(0x6040, 0x00, 0x000F);
 }
 
-//     STOP PROFILE VELOCITY
+//     STOP CURRENT
 // ----------------------------------------------------------------------------
 
-void CEpos2::stopProfileVelocity()
+void CEpos2::stopCurrent()
 {
-	int intmode = 0x010F;
-  this->writeObject(0x6040, 0x00,intmode);
+  // just current command = 0
+  this->writeObjectCached(this->current_frame, 0x2030, 0x00, 0x0000);
 }
 
 //----------------------------------------------------------------------------
-//   MODE PROFILE POSITION
+//   MODES MASTER ENCODER AND STEP DIRECTION
 // ----------------------------------------------------------------------------
-//     GET TARGET PROFILE POSITION
+//     GEAR CONFIGURATION
 // ----------------------------------------------------------------------------
 
-long CEpos2::getTargetProfilePosition()
+void CEpos2::getGearFactor(long &numerator, long &denominator)
 {
-  return this->readObject(0x607A, 0x00);
+  numerator   = this->readObject(0x2300, 0x01);
+  denominator = this->readObject(0x2300, 0x02);
 }
 
-//     SET TARGET PROFILE POSITION
-// ----------------------------------------------------------------------------
-
-void CEpos2::setTargetProfilePosition(long position)
+void CEpos2::setGearFactor(long numerator, long denominator)
 {
-  this->writeObject(0x607A, 0x00,position);
-}
+  if( numerator < 1 || numerator > 65535 || denominator < 1 || denominator > 65535 )
+    throw std::invalid_argument("EPOS2 gear factor out of range");
 
-// 0 halt, 1 abs, 2 rel
-void CEpos2::startProfilePosition(epos_posmodes mode, bool blocking, bool wait, bool new_point)
- {
+  this->writeObject(0x2300, 0x01, numerator);
+  this->writeObject(0x2300, 0x02, denominator);
+}
 
-  int halt        = mode==HALT ?      0x0100 : 0x0000;
-  int rel         = mode==RELATIVE ?  0x0040 : 0x0000;
-  int nowait      = !wait ?           0x0020 : 0x0000;
-  int newsetpoint = new_point ?       0x0010 : 0x0000;
+long CEpos2::getGearMaxVelocity()
+{
+  return this->readObject(0x2300, 0x03);
+}
 
-  int intmode = 0x000F | halt | rel | nowait | newsetpoint;
+void CEpos2::setGearMaxVelocity(long velocity)
+{
+  this->writeObject(0x2300, 0x03, velocity);
+}
 
-  this->writeObject(0x6040, 0x00,intmode);
+//     DIGITAL POSITION INPUT
+// ----------------------------------------------------------------------------
 
-  if( blocking ){
+void CEpos2::getDigitalPositionInput(long &numerator, long &denominator, long &polarity)
+{
+  numerator   = this->readObject(0x2301, 0x01);
+  denominator = this->readObject(0x2301, 0x02);
+  polarity    = this->readObject(0x2301, 0x03);
+}
 
-    while( !this->isTargetReached() )
-    {
-      if(this->verbose) this->getMovementInfo();
-      else usleep(1000);
-    }
-  }
+void CEpos2::setDigitalPositionInput(long numerator, long denominator, long polarity)
+{
+  if( numerator < 1 || numerator > 65535 || denominator < 1 || denominator > 65535 )
+    throw std::invalid_argument("EPOS2 digital position input scaling out of range");
 
+  this->writeObject(0x2301, 0x01, numerator);
+  this->writeObject(0x2301, 0x02, denominator);
+  this->writeObject(0x2301, 0x03, polarity);
 }
 
+//     START / STOP FOLLOWING
+// ----------------------------------------------------------------------------
 
+void CEpos2::startFollowing()
+{
+  this->writeObject(0x6040, 0x00, 0x000F);
+}
 
-// Current
+void CEpos2::stopFollowing()
+{
+  // halt: stays enabled and holds; the priority lane is left to quickStop
+  this->writeObject(0x6040, 0x00, 0x010F);
+}
 
-long CEpos2::getTargetCurrent(){return 1;}
+//     GEARING STATUS
+// ----------------------------------------------------------------------------
 
-void CEpos2::setTargetCurrent(long current){}
+CEpos2::epos_gearing_status CEpos2::getGearingStatus()
+{
+  long ans = this->readObject(0x6041, 0x00);
+  epos_gearing_status status;
 
-void CEpos2::startCurrent(){}
+  // operation enabled: xxxx xxxx x01x 0111
+  status.following       = (ans & 0x006F) == 0x0027;
+  status.limit_active    = ans & 0x0800;
+  status.following_error = ans & 0x2000;
+  status.fault           = ans & 0x0008;
 
-void CEpos2::stopCurrent(){}
+  return status;
+}
 
 
 
@@ -1028,12 +2165,14 @@ void CEpos2::printControlParameters(long cp,long ci,long vp,long vi,long vspf,
 
 long CEpos2::getProfileVelocity(void)
 {
-  return this->readObject(0x6081, 0x00);
+  this->profile_velocity = this->readObject(0x6081, 0x00);
+  return this->profile_velocity;
 }
 
 void CEpos2::setProfileVelocity(long velocity)
 {
   this->writeObject(0x6081, 0x00,velocity);
+  this->profile_velocity = velocity;
 }
 
 long CEpos2::getProfileMaxVelocity(void)
@@ -1048,22 +2187,26 @@ void CEpos2::setProfileMaxVelocity(long velocity)
 
 long CEpos2::getProfileAcceleration(void)
 {
-  return this->readObject(0x6083, 0x00);
+  this->profile_acceleration = this->readObject(0x6083, 0x00);
+  return this->profile_acceleration;
 }
 
 void CEpos2::setProfileAcceleration(long acceleration)
 {
   this->writeObject(0x6083, 0x00,acceleration);
+  this->profile_acceleration = acceleration;
 }
 
 long CEpos2::getProfileDeceleration(void)
 {
-  return this->readObject(0x6084, 0x00);
+  this->profile_deceleration = this->readObject(0x6084, 0x00);
+  return this->profile_deceleration;
 }
 
 void CEpos2::setProfileDeceleration(long deceleration)
 {
   this->writeObject(0x6084, 0x00,deceleration);
+  this->profile_deceleration = deceleration;
 }
 
 long CEpos2::getProfileQuickStopDecel(void)
@@ -1078,12 +2221,14 @@ void CEpos2::setProfileQuickStopDecel(long deceleration)
 
 long CEpos2::getProfileType(void)
 {
-  return this->readObject(0x6086, 0x00);
+  this->profile_type = this->readObject(0x6086, 0x00);
+  return this->profile_type;
 }
 
 void CEpos2::setProfileType(long type)
 {
   this->writeObject(0x6086, 0x00,type);
+  this->profile_type = type;
 }
 
 long CEpos2::getMaxAcceleration(void)
@@ -1166,7 +2311,80 @@ long CEpos2::readCurrentDemanded()
 
 int32_t CEpos2::readPosition()
 {
-  return this->readObject(0x6064, 0x00);
+  return this->readPositionSample().value;
+}
+
+int64_t CEpos2::readPosition64()
+{
+  this->readPositionSample();
+  return this->position_tracker.getPosition();
+}
+
+int64_t CEpos2::getPosition64()
+{
+  return this->position_tracker.getPosition();
+}
+
+CEpos2PositionTracker &CEpos2::getPositionTracker()
+{
+  return this->position_tracker;
+}
+
+CEpos2::epos_sample CEpos2::readPositionSample()
+{
+  epos_sample sample = this->readObjectSample(0x6064, 0x00);
+  sample.position = this->position_tracker.update(sample.value);
+  this->mirrorPosition(sample.position, sample.sampled);
+  return sample;
+}
+
+CEpos2::epos_sample CEpos2::readVelocityActualSample()
+{
+  return this->readObjectSample(0x606C, 0x00);
+}
+
+CEpos2::epos_sample CEpos2::readCurrentSample()
+{
+  epos_sample sample = this->readObjectSample(0x6078, 0x00);
+  sample.value = this->getNegativeLong(sample.value);
+  sample.position = sample.value;
+  return sample;
+}
+
+CEpos2::epos_sample CEpos2::readStatusWordSample()
+{
+  return this->readObjectSample(0x6041, 0x00);
+}
+
+CEpos2::epos_latency CEpos2::getRoundTrip()
+{
+  std::lock_guard<std::mutex> lock(this->link->mutex);
+  return this->round_trip;
+}
+
+void CEpos2::resetRoundTrip()
+{
+  std::lock_guard<std::mutex> lock(this->link->mutex);
+  this->round_trip.count    = 0;
+  this->round_trip.last_us  = 0;
+  this->round_trip.worst_us = 0;
+  this->round_trip.total_us = 0;
+}
+
+CEpos2::epos_transfer_stats CEpos2::getTransferStats()
+{
+  std::lock_guard<std::mutex> lock(this->link->mutex);
+  return this->transfer_stats;
+}
+
+void CEpos2::resetTransferStats()
+{
+  std::lock_guard<std::mutex> lock(this->link->mutex);
+  this->transfer_stats.count      = 0;
+  this->transfer_stats.bytes      = 0;
+  this->transfer_stats.last_bytes = 0;
+  this->transfer_stats.last_us    = 0;
+  this->transfer_stats.total_us   = 0;
 }
 
 long CEpos2::readStatusWord()
@@ -1316,12 +2534,24 @@ long CEpos2::readVersionHardware()
 
 long CEpos2::getEncoderPulseNumber()
 {
-  return this->readObject(0x2210, 0x01);
+  this->encoder_pulses = this->readObject(0x2210, 0x01);
+  return this->encoder_pulses;
 }
 
 void CEpos2::setEncoderPulseNumber(long pulses)
 {
   this->writeObject(0x2210, 0x01, pulses);
+  this->encoder_pulses = pulses;
+}
+
+long CEpos2::getEncoder2PulseNumber()
+{
+  return this->readObject(0x2212, 0x01);
+}
+
+void CEpos2::setEncoder2PulseNumber(long pulses)
+{
+  this->writeObject(0x2212, 0x01, pulses);
 }
 
 long CEpos2::getEncoderType()
@@ -1348,13 +2578,29 @@ long CEpos2::getMotorType(){return 1;}
 
 void CEpos2::setMotorType(long type){}
 
-long CEpos2::getMotorContinuousCurrentLimit(){return 1;}
+long CEpos2::getMotorContinuousCurrentLimit()
+{
+  this->continuous_current_limit = this->readObject(0x6410, 0x01);
+  return this->continuous_current_limit;
+}
 
-void CEpos2::setMotorContinuousCurrentLimit(long current_mA){}
+void CEpos2::setMotorContinuousCurrentLimit(long current_mA)
+{
+  this->writeObject(0x6410, 0x01, current_mA);
+  this->continuous_current_limit = current_mA;
+}
 
-long CEpos2::getMotorOutputCurrentLimit(){return 1;}
+long CEpos2::getMotorOutputCurrentLimit()
+{
+  this->output_current_limit = this->readObject(0x6410, 0x02);
+  return this->output_current_limit;
+}
 
-void CEpos2::setMotorOutputCurrentLimit(long current_mA){}
+void CEpos2::setMotorOutputCurrentLimit(long current_mA)
+{
+  this->writeObject(0x6410, 0x02, current_mA);
+  this->output_current_limit = current_mA;
+}
 
 long CEpos2::getMotorPolePairNumber(){return 1;}
 
@@ -1511,7 +2757,7 @@ void CEpos2::setAnalogOutput1(long voltage_mV){}
 
 long CEpos2::getPositionMarker(int buffer)
 {
-  int obj;
+  int obj = 1;
   switch(buffer)
   {
     case 0:
@@ -1527,6 +2773,11 @@ long CEpos2::getPositionMarker(int buffer)
   return this->readObject(0x2074, obj);
 }
 
+long CEpos2::getPositionMarkerCounter()
+{
+  return this->readObject(0x2074, 0x04);
+}
+
 void CEpos2::setPositionMarker(char mode, char polarity, char edge_type, char digitalIN)
 {
   // set the digital input as position marker & options
@@ -1543,15 +2794,218 @@ void CEpos2::setPositionMarker(char mode, char polarity, char edge_type, char di
 
 }
 
-void CEpos2::waitPositionMarker()
+void CEpos2::waitPositionMarker(long period_us)
+{
+  long counter = this->getPositionMarkerCounter();
+
+  while(counter == this->getPositionMarkerCounter())
+    usleep(period_us);
+}
+
+
+// ##########################   DATA RECORDER   ###############################
+
+CEpos2::epos_recorder_variable CEpos2::recorderVariable(int16_t index, int8_t subindex)
+{
+  static const struct { int16_t index; uint8_t size; bool is_signed; } known[] = {
+    { 0x6041, 2, false },   // StatusWord
+    { 0x6040, 2, false },   // ControlWord
+    { 0x6064, 4, true  },   // position actual
+    { 0x6062, 4, true  },   // position demand
+    { 0x606C, 4, true  },   // velocity actual
+    { 0x2028, 4, true  },   // velocity actual averaged
+    { 0x606B, 4, true  },   // velocity demand
+    { 0x6078, 2, true  },   // current actual
+    { 0x2027, 2, true  },   // current actual averaged
+    { 0x2031, 2, true  },   // current demand
+    { 0x20F4, 2, true  },   // following error actual
+    { 0x2071, 2, false }    // digital inputs
+  };
+
+  epos_recorder_variable variable;
+  variable.index     = index;
+  variable.subindex  = subindex;
+  variable.size      = 4;
+  variable.is_signed = true;
+
+  for(size_t i = 0; i < sizeof(known)/sizeof(known[0]); i++)
+    if(known[i].index == index)
+    {
+      variable.size      = known[i].size;
+      variable.is_signed = known[i].is_signed;
+    }
+
+  return variable;
+}
+
+void CEpos2::setRecorderVariables(const std::vector<epos_recorder_variable> &variables)
+{
+  if(variables.empty() || variables.size() > 4)
+    throw std::invalid_argument("EPOS2 data recorder samples 1 to 4 variables");
+  for(size_t i = 0; i < variables.size(); i++)
+    if(variables[i].size != 1 && variables[i].size != 2 && variables[i].size != 4)
+      throw std::invalid_argument("EPOS2 data recorder variables have 1, 2 or 4 bytes");
+
+  this->writeObject(0x2015, 0x00, variables.size());
+  for(size_t i = 0; i < variables.size(); i++)
+  {
+    this->writeObject(0x2016, i + 1, (uint16_t)variables[i].index);
+    this->writeObject(0x2017, i + 1, (uint8_t)variables[i].subindex);
+  }
+
+  this->recorder_variables = variables;
+}
+
+std::vector<CEpos2::epos_recorder_variable> CEpos2::getRecorderVariables()
+{
+  std::vector<epos_recorder_variable> variables;
+  long n = this->readObject(0x2015, 0x00);
+
+  for(long i = 0; i < n && i < 4; i++)
+  {
+    int16_t index   = this->readObject(0x2016, i + 1);
+    int8_t subindex = this->readObject(0x2017, i + 1);
+
+    if((size_t)i < this->recorder_variables.size() &&
+       this->recorder_variables[i].index == index &&
+       this->recorder_variables[i].subindex == subindex)
+      variables.push_back(this->recorder_variables[i]);
+    else
+      variables.push_back(recorderVariable(index, subindex));
+  }
+
+  return variables;
+}
+
+void CEpos2::setRecorderSamplingPeriod(long period_us)
+{
+  // multiple of the current control period (100 us)
+  long cycles = (period_us + 50) / 100;
+  this->writeObject(0x2013, 0x00, cycles < 1 ? 1 : cycles);
+}
+
+long CEpos2::getRecorderSamplingPeriod()
+{
+  return this->readObject(0x2013, 0x00) * 100;
+}
+
+void CEpos2::setRecorderTrigger(long triggers, long preceding_samples)
+{
+  this->writeObject(0x2011, 0x00, triggers);
+  this->writeObject(0x2014, 0x00, preceding_samples);
+}
+
+void CEpos2::startRecorder()
+{
+  // bit 0: trigger enable (armed)
+  this->writeObject(0x2010, 0x00, 0x0001);
+}
+
+void CEpos2::stopRecorder()
+{
+  this->writeObject(0x2010, 0x00, 0x0000);
+}
+
+void CEpos2::forceRecorderTrigger()
+{
+  // bit 1: force trigger, keeping it armed
+  this->writeObject(0x2010, 0x00, 0x0003);
+}
+
+long CEpos2::getRecorderStatus()
+{
+  return this->readObject(0x2012, 0x00);
+}
+
+bool CEpos2::waitRecorderComplete(long timeout_ms, long period_us)
+{
+  std::chrono::steady_clock::time_point end =
+    std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+
+  while(true)
+  {
+    long status = this->getRecorderStatus();
+    // stopped with data
+    if(!(status & 0x0001) && (status & 0x0004))
+      return true;
+    if(timeout_ms >= 0 && std::chrono::steady_clock::now() >= end)
+      return false;
+    usleep(period_us);
+  }
+}
+
+long CEpos2::getRecorderSampleCount()
+{
+  return this->readObject(0x2018, 0x02);
+}
+
+long CEpos2::getRecorderCapacity()
+{
+  return this->readObject(0x2018, 0x01);
+}
+
+long CEpos2::getRecorderBufferOffset()
+{
+  return this->readObject(0x2018, 0x03);
+}
+
+CEpos2::epos_recorder_data CEpos2::readRecorder()
 {
-  long markpos = this->getPositionMarker();
+  epos_recorder_data recording;
+  std::vector<uint8_t> buffer;
+
+  recording.variables         = this->getRecorderVariables();
+  recording.period_us         = this->getRecorderSamplingPeriod();
+  recording.preceding_samples = this->readObject(0x2014, 0x00);
+  recording.trigger_sample    = -1;
+  long samples                = this->getRecorderSampleCount();
+  long capacity               = this->getRecorderCapacity();
+  long offset                 = this->getRecorderBufferOffset();
+  long status                 = this->getRecorderStatus();
+
+  if(recording.variables.empty())
+    throw std::logic_error("EPOS2 data recorder has no variables");
 
-  while(markpos == this->getPositionMarker())
+  size_t sample_size = 0;
+  for(size_t v = 0; v < recording.variables.size(); v++)
+    sample_size += recording.variables[v].size;
+
+  this->readObjectSegmented(0x201B, 0x00, buffer);
+
+  // samples of all the variables one after the other in a ring, the
+  // oldest at offset
+  size_t ring = buffer.size() / sample_size;
+  size_t n = std::min<size_t>(samples < 0 ? 0 : samples, ring);
+  size_t first = ring > 0 && offset > 0 ? offset % ring : 0;
+  recording.values.assign(recording.variables.size(), std::vector<int32_t>(n));
+  for(size_t i = 0; i < n; i++)
   {
-    // minimum freq = 0.05s = 20Hz
-    usleep(1000000*0.05);
+    const uint8_t *p = buffer.data() + ((first + i) % ring) * sample_size;
+    for(size_t v = 0; v < recording.variables.size(); v++)
+    {
+      const epos_recorder_variable &var = recording.variables[v];
+      uint32_t raw = 0;
+      for(uint8_t b = 0; b < var.size; b++)
+        raw |= (uint32_t)p[b] << (8*b);
+      p += var.size;
+
+      int32_t value;
+      if(var.size == 1)
+        value = var.is_signed ? (int32_t)(int8_t)raw : (int32_t)raw;
+      else if(var.size == 2)
+        value = var.is_signed ? (int32_t)(int16_t)raw : (int32_t)raw;
+      else
+        value = (int32_t)raw;
+      recording.values[v][i] = value;
+    }
   }
+
+  // triggered: capacity - preceding samples are taken after the trigger
+  long after = capacity - recording.preceding_samples;
+  if((status & 0x0002) && after >= 0 && (long)n >= after)
+    recording.trigger_sample = n - after;
+
+  return recording;
 }
 
 
@@ -1576,17 +3030,122 @@ void CEpos2::setHoming(int home_method, int speed_pos, int speed_zero,
 
 void CEpos2::doHoming(bool blocking)
 {
-  this->writeObject(0x6040, 0x00, 0x001F);
   if(blocking)
+    this->doHomingAsync().wait();
+  else
+    this->writeObject(0x6040, 0x00, 0x001F);
+}
+
+std::future<CEpos2::epos_homing_results> CEpos2::doHomingAsync(
+    std::function<void(epos_homing_results)> callback)
+{
+  std::shared_ptr<std::promise<epos_homing_results> > promise =
+    std::make_shared<std::promise<epos_homing_results> >();
+  std::future<epos_homing_results> result = promise->get_future();
+
+  // a polling thread of a previous homing is stopped before its flag is replaced
+  this->joinHoming();
+  this->homing_cancel = std::make_shared<std::atomic<bool> >(false);
+
+  this->writeObject(0x6040, 0x00, 0x001F);
+
+  if(this->status_poller != NULL)
+  {
+    // set after starting, and bit 12 of a previous homing has to clear
+    // first, so it is not taken for this one
+    this->status_poller->watchStatus(this, 0x1400, 0x2000,
+        [promise, callback](long status)
+        {
+          epos_homing_results r;
+          if(status < 0)             r = HOMING_CANCELLED;
+          else if(status & 0x2000)   r = HOMING_ERROR;
+          else                       r = HOMING_ATTAINED;
+          if(callback) callback(r);
+          promise->set_value(r);
+        }, 0x1000);
+    return result;
+  }
+
+  this->homing_thread = std::thread([this, promise, callback]()
+  {
+    try
+    {
+      epos_homing_results r =
+        (epos_homing_results)(intptr_t)CEpos2::threadTargetReached(this);
+      if(callback) callback(r);
+      promise->set_value(r);
+    }
+    catch(...)
+    {
+      promise->set_exception(std::current_exception());
+    }
+  });
+  return result;
+}
+
+void CEpos2::joinHoming()
+{
+  if(!this->homing_thread.joinable())
+    return;
+
+  if(this->homing_cancel)
+    *this->homing_cancel = true;
+  // a new homing started from the callback of the previous one
+  if(this->homing_thread.get_id() == std::this_thread::get_id())
+    this->homing_thread.detach();
+  else
+    this->homing_thread.join();
+}
+
+void *CEpos2::threadTargetReached(void *param)
+{
+  CEpos2 *epos = (CEpos2 *)param;
+  std::shared_ptr<std::atomic<bool> > cancel = epos->homing_cancel;
+
+  // bit 12 of a previous homing is still set right after the start, wait
+  // until the drive clears it (bounded, a homing may end within a poll)
+  std::chrono::steady_clock::time_point deadline =
+    std::chrono::steady_clock::now() + std::chrono::seconds(1);
+  while((!cancel || !*cancel) && std::chrono::steady_clock::now() < deadline)
+  {
+    long status = epos->readStatusWord();
+    if(status & 0x2000)
+      return (void *)(intptr_t)HOMING_ERROR;
+    if(!(status & 0x1000))
+      break;
+    usleep(epos->homing_poll_us);
+  }
+
+  while(!cancel || !*cancel)
   {
-    while(!this->isTargetReached())
-      usleep(1000000*0.05);
+    long status = epos->readStatusWord();
+    if(status & 0x2000)
+      return (void *)(intptr_t)HOMING_ERROR;
+    if((status & 0x1400) == 0x1400)
+      return (void *)(intptr_t)HOMING_ATTAINED;
+    usleep(epos->homing_poll_us);
   }
+  return (void *)(intptr_t)HOMING_CANCELLED;
 }
 
 void CEpos2::stopHoming()
 {
   this->writeObject(0x6040, 0x00, 0x010F);
+
+  if(this->homing_cancel)
+    *this->homing_cancel = true;
+  if(this->status_poller != NULL)
+    this->status_poller->cancelWatch(this);
+}
+
+long CEpos2::getHomingPollPeriod()
+{
+  return this->homing_poll_us;
+}
+
+void CEpos2::setHomingPollPeriod(long period_us)
+{
+  this->homing_poll_us = period_us;
 }
 
 // #############################   DIG IN   ###################################
@@ -0,0 +1,265 @@
+// Copyright (C) 2009-2010 Institut de Robòtica i Informàtica Industrial, CSIC-UPC.
+// Author Martí Morta Garriga  (mmorta@iri.upc.edu)
+// All rights reserved.
+//
+// Copyright (C) 2013 Jochen Sprickerhof <jochen@sprickerhof.de>
+//
+// This file is part of IRI EPOS2 Driver
+// IRI EPOS2 Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <cmath>
+#include <stdexcept>
+#include <algorithm>
+#include "epos2_motor_controller/Epos2AxisGroup.h"
+#include "epos2_motor_controller/Epos2StatusPoller.h"
+
+// ----------------------------------------------------------------------------
+//   CLASS
+// ----------------------------------------------------------------------------
+//     CONSTRUCTOR
+// ----------------------------------------------------------------------------
+
+CEpos2AxisGroup::CEpos2AxisGroup() : prepared(false), duration(0.0)
+{
+  this->resetStartSkew();
+}
+
+// ----------------------------------------------------------------------------
+//   AXES
+// ----------------------------------------------------------------------------
+
+void CEpos2AxisGroup::add(CEpos2 *axis)
+{
+  group_axis a;
+
+  a.axis            = axis;
+  a.velocity        = axis->getProfileVelocity();
+  a.acceleration    = axis->getProfileAcceleration();
+  a.deceleration    = axis->getProfileDeceleration();
+  a.start_frame_len = 0;
+  a.start_offset_us = 0;
+  axis->getProfileType();
+  axis->getEncoderPulseNumber();
+
+  this->axes.push_back(a);
+  this->prepared = false;
+}
+
+size_t CEpos2AxisGroup::size()
+{
+  return this->axes.size();
+}
+
+CEpos2 *CEpos2AxisGroup::getAxis(size_t i)
+{
+  if(i >= this->axes.size())
+    throw std::invalid_argument("EPOS2 axis group has no such axis");
+
+  return this->axes[i].axis;
+}
+
+void CEpos2AxisGroup::setProfile(size_t i, long velocity, long acceleration, long deceleration)
+{
+  if(i >= this->axes.size())
+    throw std::invalid_argument("EPOS2 axis group has no such axis");
+
+  this->axes[i].velocity     = velocity;
+  this->axes[i].acceleration = acceleration;
+  this->axes[i].deceleration = deceleration;
+}
+
+// ----------------------------------------------------------------------------
+//   MOVEMENT
+// ----------------------------------------------------------------------------
+//     PREPARE
+// ----------------------------------------------------------------------------
+
+double CEpos2AxisGroup::prepare(const std::vector<long> &targets,
+                                CEpos2::epos_posmodes mode, bool synchronize)
+{
+  if(targets.size() != this->axes.size())
+    throw std::invalid_argument("EPOS2 axis group needs one target per axis");
+  if(mode != CEpos2::ABSOLUTE && mode != CEpos2::RELATIVE)
+    throw std::invalid_argument("EPOS2 axis group movements are absolute or relative");
+
+  std::vector<double> times(this->axes.size());
+  this->prepared = false;
+  this->duration = 0.0;
+
+  // duration of every axis with its nominal profile
+  for(size_t i = 0; i < this->axes.size(); i++)
+  {
+    group_axis &a = this->axes[i];
+
+    long distance = targets[i];
+    if(mode == CEpos2::ABSOLUTE)
+      distance -= a.axis->readPosition();
+
+    times[i] = CEpos2::computeProfileTime(distance, a.velocity, a.acceleration,
+                                          a.deceleration, a.axis->profile_type,
+                                          a.axis->encoder_pulses);
+    if(times[i] < 0.0)
+      throw std::invalid_argument("EPOS2 axis group profile is invalid");
+    if(times[i] > this->duration)
+      this->duration = times[i];
+  }
+
+  int rel = mode == CEpos2::RELATIVE ? 0x0040 : 0x0000;
+
+  for(size_t i = 0; i < this->axes.size(); i++)
+  {
+    group_axis &a = this->axes[i];
+
+    // v*k and a*k^2 stretch the duration by 1/k
+    double k = 1.0;
+    if(synchronize && times[i] > 0.0 && this->duration > 0.0)
+      k = times[i] / this->duration;
+
+    long velocity     = std::max(1L, std::lround(a.velocity * k));
+    long acceleration = std::max(1L, std::lround(a.acceleration * k * k));
+    long deceleration = std::max(1L, std::lround(a.deceleration * k * k));
+
+    if(a.axis->profile_velocity != velocity)
+      a.axis->setProfileVelocity(velocity);
+    if(a.axis->profile_acceleration != acceleration)
+      a.axis->setProfileAcceleration(acceleration);
+    if(a.axis->profile_deceleration != deceleration)
+      a.axis->setProfileDeceleration(deceleration);
+    a.axis->setTargetProfilePosition(targets[i]);
+
+    // new setpoint is taken on the rising edge of bit 4
+    a.axis->writeObject(0x6040, 0x00, 0x000F | rel);
+    a.start_value     = 0x001F | rel;
+    a.start_frame_len =
+      a.axis->encodeWriteObject(0x6040, 0x00, a.start_value, a.start_frame);
+  }
+
+  this->prepared = true;
+  return this->duration;
+}
+
+//     START
+// ----------------------------------------------------------------------------
+
+void CEpos2AxisGroup::start(bool blocking)
+{
+  if(!this->prepared)
+    throw std::logic_error("EPOS2 axis group movement not prepared");
+  this->prepared = false;
+  if(this->axes.empty())
+    return;
+
+  std::vector<CEpos2*> axes;
+  std::vector<int32_t> values;
+  std::vector<const uint8_t*> frames;
+  std::vector<int16_t> lengths;
+  std::vector<std::chrono::steady_clock::time_point> sent;
+  std::vector<uint16_t> answers;
+  for(size_t i = 0; i < this->axes.size(); i++)
+  {
+    axes.push_back(this->axes[i].axis);
+    values.push_back(this->axes[i].start_value);
+    frames.push_back(this->axes[i].start_frame);
+    lengths.push_back(this->axes[i].start_frame_len);
+  }
+
+  // every link held once, all the frames written before any answer is
+  // waited for, the answers collected afterwards
+  CEpos2::writeTogether(axes, 0x6040, 0x00, values, frames, lengths, sent, answers);
+
+  long skew_us = 0;
+  for(size_t i = 0; i < this->axes.size(); i++)
+  {
+    this->axes[i].start_offset_us =
+      std::chrono::duration_cast<std::chrono::microseconds>(sent[i] - sent[0]).count();
+    skew_us = std::max(skew_us, this->axes[i].start_offset_us);
+  }
+
+  this->skew.count++;
+  this->skew.last_us   = skew_us;
+  this->skew.total_us += skew_us;
+  if(skew_us > this->skew.worst_us)
+    this->skew.worst_us = skew_us;
+
+  for(size_t i = 0; i < this->axes.size(); i++)
+  {
+    group_axis &a = this->axes[i];
+    a.axis->checkAnswer(&answers[EPOS2_MAX_ANSWER_WORDS*i]);
+    if(a.axis->status_poller != NULL)
+      a.axis->status_poller->expectTargetReached(a.axis, this->duration);
+  }
+
+  if(blocking)
+    this->waitTargetReached();
+}
+
+//     WAIT TARGET REACHED
+// ----------------------------------------------------------------------------
+
+bool CEpos2AxisGroup::waitTargetReached(long timeout_ms)
+{
+  if(this->axes.empty())
+    return true;
+
+  // all axes on the same poller: one wait for all of them
+  CEpos2StatusPoller *poller = this->axes[0].axis->status_poller;
+  std::vector<CEpos2*> axes;
+  for(size_t i = 0; i < this->axes.size(); i++)
+  {
+    if(this->axes[i].axis->status_poller != poller)
+      poller = NULL;
+    axes.push_back(this->axes[i].axis);
+  }
+  if(poller != NULL)
+    return poller->waitTargetReached(axes, timeout_ms);
+
+  std::chrono::steady_clock::time_point deadline =
+    std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+
+  for(size_t i = 0; i < axes.size(); i++)
+  {
+    long remaining_ms = -1;
+    if(timeout_ms >= 0)
+      remaining_ms = std::max(0L, (long)std::chrono::duration_cast<std::chrono::milliseconds>(
+          deadline - std::chrono::steady_clock::now()).count());
+    if(!axes[i]->waitTargetReached(remaining_ms))
+      return false;
+  }
+  return true;
+}
+
+// ----------------------------------------------------------------------------
+//   STATISTICS
+// ----------------------------------------------------------------------------
+
+CEpos2::epos_latency CEpos2AxisGroup::getStartSkew()
+{
+  return this->skew;
+}
+
+std::vector<long> CEpos2AxisGroup::getLastStartOffsets()
+{
+  std::vector<long> offsets;
+  for(size_t i = 0; i < this->axes.size(); i++)
+    offsets.push_back(this->axes[i].start_offset_us);
+  return offsets;
+}
+
+void CEpos2AxisGroup::resetStartSkew()
+{
+  this->skew.count    = 0;
+  this->skew.last_us  = 0;
+  this->skew.worst_us = 0;
+  this->skew.total_us = 0;
+}
@@ -0,0 +1,433 @@
+// Copyright (C) 2009-2010 Institut de Robòtica i Informàtica Industrial, CSIC-UPC.
+// Author Martí Morta Garriga  (mmorta@iri.upc.edu)
+// All rights reserved.
+//
+// Copyright (C) 2013 Jochen Sprickerhof <jochen@sprickerhof.de>
+//
+// This file is part of IRI EPOS2 Driver
+// IRI EPOS2 Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <new>
+#include <chrono>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <csignal>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "epos2_motor_controller/Epos2Broker.h"
+
+static uint64_t nowNs()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// ----------------------------------------------------------------------------
+//   CLASS
+// ----------------------------------------------------------------------------
+//     CONSTRUCTOR
+// ----------------------------------------------------------------------------
+
+CEpos2Broker::CEpos2Broker(const std::string &name, long period_us, long command_poll_us)
+  : name(name), period_us(period_us), command_poll_us(command_poll_us),
+    shm(NULL), fd(-1), running(false), commands(0)
+{ }
+
+//     DESTRUCTOR
+// ----------------------------------------------------------------------------
+
+CEpos2Broker::~CEpos2Broker()
+{
+  this->stop();
+
+  if(this->shm != NULL)
+  {
+    this->shm->magic.store(0);
+    munmap(this->shm, sizeof(epos2_shm_segment));
+    close(this->fd);
+    shm_unlink(this->name.c_str());
+  }
+}
+
+// ----------------------------------------------------------------------------
+//   AXES
+// ----------------------------------------------------------------------------
+
+size_t CEpos2Broker::add(CEpos2 *axis)
+{
+  if(this->running)
+    throw std::logic_error("EPOS2 broker is running");
+  if(this->axes.size() == EPOS2_SHM_MAX_AXES)
+    throw std::invalid_argument("EPOS2 broker has no room for more axes");
+
+  this->axes.push_back(axis);
+  return this->axes.size() - 1;
+}
+
+// ----------------------------------------------------------------------------
+//   SERVING
+// ----------------------------------------------------------------------------
+
+void CEpos2Broker::start()
+{
+  if(this->running)
+    return;
+
+  if(this->shm == NULL)
+  {
+    // a segment of a dead broker is replaced, clients map the new one; the
+    // one of a live broker is its own
+    int old = shm_open(this->name.c_str(), O_RDONLY, 0);
+    if(old >= 0)
+    {
+      struct stat st;
+      pid_t owner = 0;
+      bool alive = false;
+      if(fstat(old, &st) == 0 && (size_t)st.st_size >= sizeof(epos2_shm_segment))
+      {
+        void *p = mmap(NULL, sizeof(epos2_shm_segment), PROT_READ, MAP_SHARED, old, 0);
+        if(p != MAP_FAILED)
+        {
+          const epos2_shm_segment *seg = (const epos2_shm_segment*)p;
+          owner = seg->broker_pid;
+          alive = seg->magic.load(std::memory_order_acquire) == EPOS2_SHM_MAGIC &&
+                  (kill(owner, 0) == 0 || errno == EPERM);
+          munmap(p, sizeof(epos2_shm_segment));
+        }
+      }
+      close(old);
+      if(alive)
+      {
+        std::stringstream s;
+        s << "EPOS2 broker " << this->name << " is served by process " << owner;
+        throw EPOS2IOException(s.str());
+      }
+    }
+    shm_unlink(this->name.c_str());
+    this->fd = shm_open(this->name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0660);
+    if(this->fd < 0 || ftruncate(this->fd, sizeof(epos2_shm_segment)) != 0)
+    {
+      std::stringstream s;
+      s << "EPOS2 broker can't create shared memory " << this->name << ": " << strerror(errno);
+      if(this->fd >= 0)
+        close(this->fd);
+      throw EPOS2IOException(s.str());
+    }
+
+    void *p = mmap(NULL, sizeof(epos2_shm_segment), PROT_READ | PROT_WRITE, MAP_SHARED, this->fd, 0);
+    if(p == MAP_FAILED)
+    {
+      std::stringstream s;
+      s << "EPOS2 broker can't map shared memory " << this->name << ": " << strerror(errno);
+      close(this->fd);
+      throw EPOS2IOException(s.str());
+    }
+    this->shm = new (p) epos2_shm_segment;
+  }
+
+  epos2_shm_segment *shm = this->shm;
+  shm->magic.store(0);
+  shm->version    = EPOS2_SHM_VERSION;
+  shm->broker_pid = getpid();
+  shm->axes       = this->axes.size();
+  shm->period_ns  = (int64_t)this->period_us * 1000;
+  shm->heartbeat_ns.store(nowNs());
+  for(size_t i = 0; i < EPOS2_SHM_MAX_AXES; i++)
+  {
+    shm->axis[i].node_id = i < this->axes.size() ? this->axes[i]->node_id : 0;
+    shm->axis[i].stop.request.store(0);
+    shm->axis[i].stop.requests.store(0);
+    shm->axis[i].stop.served.store(0);
+    shm->axis[i].stop.error.store(0);
+    shm->axis[i].head.store(0);
+    for(size_t j = 0; j < EPOS2_SHM_TELEMETRY_SIZE; j++)
+      shm->axis[i].slots[j].seq.store(0);
+  }
+  shm->enqueue_pos.store(0);
+  shm->dequeue_pos.store(0);
+  for(size_t i = 0; i < EPOS2_SHM_COMMAND_SIZE; i++)
+  {
+    shm->commands[i].seq.store(i);
+    shm->results[i].ticket.store(0);
+  }
+  shm->magic.store(EPOS2_SHM_MAGIC, std::memory_order_release);
+
+  this->running = true;
+  this->thread = std::thread(&CEpos2Broker::run, this);
+  this->stop_thread = std::thread(&CEpos2Broker::runStops, this);
+}
+
+void CEpos2Broker::stop()
+{
+  this->running = false;
+  if(this->thread.joinable())
+    this->thread.join();
+  if(this->stop_thread.joinable())
+    this->stop_thread.join();
+}
+
+bool CEpos2Broker::isRunning()
+{
+  return this->running;
+}
+
+unsigned long CEpos2Broker::getCommandCount()
+{
+  return this->commands;
+}
+
+void CEpos2Broker::run()
+{
+  std::chrono::steady_clock::time_point next = std::chrono::steady_clock::now();
+
+  while(this->running)
+  {
+    for(size_t i = 0; i < this->axes.size(); i++)
+    {
+      this->publish(i);
+      // commands don't wait for the poll of all axes, one at most
+      this->serveCommands(std::chrono::steady_clock::now());
+    }
+    this->shm->heartbeat_ns.store(nowNs(), std::memory_order_release);
+
+    next += std::chrono::microseconds(this->period_us);
+    // don't try to catch up after a long stall
+    if(next < std::chrono::steady_clock::now())
+      next = std::chrono::steady_clock::now();
+
+    while(this->running && std::chrono::steady_clock::now() < next)
+    {
+      // a busy queue doesn't delay the telemetry
+      if(this->serveCommands(next) == 0)
+        std::this_thread::sleep_for(std::min(
+            std::chrono::microseconds(this->command_poll_us),
+            std::chrono::duration_cast<std::chrono::microseconds>(next - std::chrono::steady_clock::now())));
+    }
+  }
+}
+
+void CEpos2Broker::runStops()
+{
+  // the priority lane takes the link between two transactions of run, a
+  // stop doesn't wait for the command or the poll in progress
+  while(this->running)
+  {
+    this->serveStops();
+    std::this_thread::sleep_for(std::chrono::microseconds(this->command_poll_us));
+  }
+  this->serveStops();
+}
+
+void CEpos2Broker::publish(size_t i)
+{
+  epos2_shm_axis &a = this->shm->axis[i];
+  uint64_t head = a.head.load(std::memory_order_relaxed);
+  epos2_shm_telemetry_slot &slot = a.slots[head % EPOS2_SHM_TELEMETRY_SIZE];
+  const epos2_shm_telemetry &last =
+    a.slots[(head + EPOS2_SHM_TELEMETRY_SIZE - 1) % EPOS2_SHM_TELEMETRY_SIZE].data;
+  epos2_shm_telemetry t;
+
+  try
+  {
+    CEpos2::epos_sample position = this->axes[i]->readPositionSample();
+    t.time_ns     = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      position.sampled.time_since_epoch()).count();
+    t.position    = position.position;
+    t.velocity    = this->axes[i]->readVelocityActual();
+    t.current     = this->axes[i]->readCurrent();
+    t.status_word = this->axes[i]->readStatusWord();
+    t.error       = 0;
+  }
+  catch(std::exception &e)
+  {
+    t = head > 0 ? last : epos2_shm_telemetry();
+    t.error = 1;
+  }
+
+  // seqlock: odd while written
+  slot.seq.store(2*head + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  slot.data = t;
+  slot.seq.store(2*(head + 1), std::memory_order_release);
+  a.head.store(head + 1, std::memory_order_release);
+}
+
+size_t CEpos2Broker::serveCommands(const std::chrono::steady_clock::time_point &until)
+{
+  epos2_shm_segment *shm = this->shm;
+  size_t served = 0;
+
+  do
+  {
+    uint64_t pos = shm->dequeue_pos.load(std::memory_order_relaxed);
+    epos2_shm_command_cell &cell = shm->commands[pos % EPOS2_SHM_COMMAND_SIZE];
+    if(cell.seq.load(std::memory_order_acquire) != pos + 1)
+      break;
+
+    epos2_shm_command command = cell.command;
+    epos2_shm_result &result = shm->results[pos % EPOS2_SHM_COMMAND_SIZE];
+    uint32_t queued = EPOS2_SHM_COMMAND_QUEUED;
+
+    // a command cancelled by its client (timeout) is dropped
+    if(cell.state.compare_exchange_strong(queued, EPOS2_SHM_COMMAND_TAKEN,
+                                          std::memory_order_acq_rel))
+    {
+      result.error = 0;
+      result.message[0] = '\0';
+      try
+      {
+        result.value = this->execute(command);
+      }
+      catch(std::exception &e)
+      {
+        result.value = 0;
+        result.error = 1;
+        strncpy(result.message, e.what(), EPOS2_SHM_MESSAGE_SIZE - 1);
+        result.message[EPOS2_SHM_MESSAGE_SIZE - 1] = '\0';
+      }
+      result.ticket.store(pos + 1, std::memory_order_release);
+      this->commands++;
+    }
+
+    // free the cell for the producers
+    cell.seq.store(pos + EPOS2_SHM_COMMAND_SIZE, std::memory_order_release);
+    shm->dequeue_pos.store(pos + 1, std::memory_order_relaxed);
+    served++;
+  }
+  while(std::chrono::steady_clock::now() < until);
+
+  return served;
+}
+
+void CEpos2Broker::serveStops()
+{
+  for(size_t i = 0; i < this->axes.size(); i++)
+  {
+    epos2_shm_stop &stop = this->shm->axis[i].stop;
+    uint64_t requests = stop.requests.load(std::memory_order_acquire);
+    if(requests == stop.served.load(std::memory_order_relaxed))
+      continue;
+
+    // the bits of these requests, or taken by an earlier call after being set
+    uint32_t request = stop.request.exchange(0, std::memory_order_acq_rel);
+    int32_t error = 0;
+    try
+    {
+      // priority lane of CEpos2, ahead of the transactions run is waiting for
+      if(request & EPOS2_SHM_STOP_QUICK_STOP)
+        this->axes[i]->quickStop();
+      if(request & EPOS2_SHM_STOP_DISABLE_VOLTAGE)
+        this->axes[i]->disableVoltage();
+    }
+    catch(std::exception &e)
+    {
+      error = 1;
+    }
+    if(request != 0)
+      stop.error.store(error, std::memory_order_relaxed);
+    stop.served.store(requests, std::memory_order_release);
+  }
+}
+
+int32_t CEpos2Broker::execute(const epos2_shm_command &command)
+{
+  if(command.axis >= this->axes.size())
+    throw std::invalid_argument("EPOS2 broker has no such axis");
+
+  CEpos2 *axis = this->axes[command.axis];
+  long value = command.value;
+
+  switch(command.opcode)
+  {
+    case EPOS2_SHM_READ_OBJECT:
+      return axis->readObject(command.index, command.subindex);
+    case EPOS2_SHM_WRITE_OBJECT:
+      return axis->writeObject(command.index, command.subindex, value);
+    case EPOS2_SHM_GET_STATE:
+      return axis->getState();
+    case EPOS2_SHM_ENABLE_CONTROLLER:
+      axis->enableController();
+      return 0;
+    case EPOS2_SHM_ENABLE_MOTOR:
+      axis->enableMotor(value);
+      return 0;
+    case EPOS2_SHM_DISABLE_OPERATION:
+      axis->disableOperation();
+      return 0;
+    case EPOS2_SHM_QUICK_STOP:
+      axis->quickStop();
+      return 0;
+    case EPOS2_SHM_DISABLE_VOLTAGE:
+      axis->disableVoltage();
+      return 0;
+    case EPOS2_SHM_FAULT_RESET:
+      axis->faultReset();
+      return 0;
+    case EPOS2_SHM_GET_OPERATION_MODE:
+      return axis->getOperationMode();
+    case EPOS2_SHM_SET_OPERATION_MODE:
+      axis->setOperationMode(value);
+      return 0;
+    case EPOS2_SHM_SET_TARGET_VELOCITY:
+      axis->setTargetVelocity(value);
+      return 0;
+    case EPOS2_SHM_START_VELOCITY:
+      axis->startVelocity();
+      return 0;
+    case EPOS2_SHM_STOP_VELOCITY:
+      axis->stopVelocity();
+      return 0;
+    case EPOS2_SHM_SET_TARGET_PROFILE_POSITION:
+      axis->setTargetProfilePosition(value);
+      return 0;
+    case EPOS2_SHM_START_PROFILE_POSITION:
+      // never blocks the broker, the client waits on the telemetry
+      axis->startProfilePosition((CEpos2::epos_posmodes)(value & 0xFF), false,
+                                 value & 0x100, value & 0x200);
+      return 0;
+    case EPOS2_SHM_SET_TARGET_PROFILE_VELOCITY:
+      axis->setTargetProfileVelocity(value);
+      return 0;
+    case EPOS2_SHM_START_PROFILE_VELOCITY:
+      axis->startProfileVelocity();
+      return 0;
+    case EPOS2_SHM_STOP_PROFILE_VELOCITY:
+      axis->stopProfileVelocity();
+      return 0;
+    case EPOS2_SHM_SET_PROFILE_VELOCITY:
+      axis->setProfileVelocity(value);
+      return 0;
+    case EPOS2_SHM_SET_PROFILE_ACCELERATION:
+      axis->setProfileAcceleration(value);
+      return 0;
+    case EPOS2_SHM_SET_PROFILE_DECELERATION:
+      axis->setProfileDeceleration(value);
+      return 0;
+    case EPOS2_SHM_SET_TARGET_CURRENT:
+      return axis->setTargetCurrent(value);
+    case EPOS2_SHM_START_CURRENT:
+      axis->startCurrent();
+      return 0;
+    case EPOS2_SHM_STOP_CURRENT:
+      axis->stopCurrent();
+      return 0;
+  }
+
+  throw std::invalid_argument("EPOS2 broker unknown command");
+}
@@ -0,0 +1,342 @@
+// Copyright (C) 2009-2010 Institut de Robòtica i Informàtica Industrial, CSIC-UPC.
+// Author Martí Morta Garriga  (mmorta@iri.upc.edu)
+// All rights reserved.
+//
+// Copyright (C) 2013 Jochen Sprickerhof <jochen@sprickerhof.de>
+//
+// This file is part of IRI EPOS2 Driver
+// IRI EPOS2 Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <cmath>
+#include <stdexcept>
+#include <memory>
+#include "epos2_motor_controller/Epos2CamFollower.h"
+
+// ----------------------------------------------------------------------------
+//   CLASS
+// ----------------------------------------------------------------------------
+//     CONSTRUCTOR
+// ----------------------------------------------------------------------------
+
+CEpos2CamFollower::CEpos2CamFollower(CEpos2 &master, CEpos2 &slave, long period_us)
+  : master(master), slave(slave), phase(0), compensate(true), extra_delay_us(0),
+    error_sampling(10), runner(period_us, [this]{ this->cycle(); })
+{
+  this->setGear(1, 1);
+
+  this->master_read_frame_len =
+    this->master.encodeReadObject(0x6064, 0x00, this->master_read_frame);
+  this->slave_read_frame_len =
+    this->slave.encodeReadObject(0x6064, 0x00, this->slave_read_frame);
+
+  this->resetStatistics();
+}
+
+//     DESTRUCTOR
+// ----------------------------------------------------------------------------
+
+CEpos2CamFollower::~CEpos2CamFollower()
+{
+  try
+  {
+    this->stop();
+  }
+  catch(...)
+  {
+  }
+}
+
+// ----------------------------------------------------------------------------
+//   CAM
+// ----------------------------------------------------------------------------
+
+void CEpos2CamFollower::setGear(long numerator, long denominator)
+{
+  std::vector<int32_t> table(2);
+  table[0] = 0;
+  table[1] = numerator;
+  this->setCamTable(table, denominator);
+}
+
+void CEpos2CamFollower::setCamTable(const std::vector<int32_t> &slave, long master_period)
+{
+  if(this->runner.isRunning())
+    throw std::logic_error("EPOS2 cam follower is running");
+  if(slave.size() < 2)
+    throw std::invalid_argument("EPOS2 cam table needs at least 2 points");
+  if(master_period <= 0)
+    throw std::invalid_argument("EPOS2 cam master period must be positive");
+
+  this->table = slave;
+  this->master_period_q = (int64_t)master_period << 8;
+}
+
+void CEpos2CamFollower::setPhase(long phase)
+{
+  if(this->runner.isRunning())
+    throw std::logic_error("EPOS2 cam follower is running");
+
+  this->phase = phase;
+}
+
+void CEpos2CamFollower::setDelayCompensation(bool enable, long extra_us)
+{
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->compensate     = enable;
+  this->extra_delay_us = extra_us;
+}
+
+void CEpos2CamFollower::setErrorSampling(unsigned long cycles)
+{
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->error_sampling = cycles;
+}
+
+int64_t CEpos2CamFollower::evaluate(int64_t master) const
+{
+  const int64_t period = this->master_period_q;
+  const int64_t segments = this->table.size() - 1;
+
+  // period and position in it
+  int64_t c = master / period;
+  int64_t r = master % period;
+  if(r < 0)
+  {
+    r += period;
+    c--;
+  }
+
+  // segment and Q16 fraction in it
+  int64_t u = r * segments;
+  int64_t i = u / period;
+  int64_t f = ((u % period) << 16) / period;
+
+  int64_t y0 = this->table[i];
+  int64_t y1 = this->table[i+1];
+  int64_t rise = (int64_t)this->table.back() - this->table.front();
+
+  return c*rise + y0 + (((y1 - y0)*f + 0x8000) >> 16);
+}
+
+// ----------------------------------------------------------------------------
+//   LOOP
+// ----------------------------------------------------------------------------
+
+void CEpos2CamFollower::start()
+{
+  if(this->runner.isRunning())
+    return;
+
+  this->master_origin = this->master.readPosition64();
+  this->start_time    = std::chrono::steady_clock::now();
+  this->last_master   = this->master_origin;
+  this->slave_origin  = this->slave.readPosition64() - this->evaluate((int64_t)this->phase << 8);
+  this->last_sample   = 0.0;
+  this->velocity      = 0.0;
+  this->delay         = -1.0;
+  this->cycles        = 0;
+
+  this->runner.start();
+}
+
+void CEpos2CamFollower::stop()
+{
+  this->runner.stop();
+}
+
+bool CEpos2CamFollower::isRunning()
+{
+  return this->runner.isRunning();
+}
+
+void CEpos2CamFollower::transact(CEpos2 &axis, const uint8_t *frame, int16_t length,
+                                 uint16_t *ans_frame)
+{
+  axis.sendEncodedFrame(frame, length);
+  axis.receiveFrame(ans_frame);
+  axis.checkAnswer(ans_frame);
+}
+
+void CEpos2CamFollower::cycle()
+{
+  uint16_t ans_frame[40];
+  uint16_t slave_ans_frame[40];
+  uint8_t write_frame[32];
+  std::chrono::steady_clock::time_point t2, t3;
+  CEpos2::epos_sample master_sample, slave_sample;
+  bool compensate;
+  double extra;
+  bool measure;
+  int64_t master, target;
+  int64_t slave_position = 0;
+
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    compensate = this->compensate;
+    extra      = this->extra_delay_us * 1e-6;
+    measure    = this->error_sampling != 0 && ++this->cycles % this->error_sampling == 0;
+  }
+
+  {
+    // master read, cam and slave write back to back; each link is taken
+    // once, in address order as CEpos2::transactTogether does
+    bool shared = this->master.link == this->slave.link;
+    std::unique_ptr<CEpos2::LinkGuard> master_guard, slave_guard;
+    if(shared || this->master.link.get() < this->slave.link.get())
+      master_guard.reset(new CEpos2::LinkGuard(*this->master.link));
+    if(!shared)
+      slave_guard.reset(new CEpos2::LinkGuard(*this->slave.link));
+    if(master_guard == NULL)
+      master_guard.reset(new CEpos2::LinkGuard(*this->master.link));
+
+    // on its own link the slave read of the error goes out with the master
+    // read, its answer arrives while the master answers
+    bool slave_pending = measure && !shared;
+    master_sample.sent = std::chrono::steady_clock::now();
+    this->master.sendEncodedFrame(this->master_read_frame, this->master_read_frame_len);
+    if(slave_pending)
+    {
+      slave_sample.sent = std::chrono::steady_clock::now();
+      this->slave.sendEncodedFrame(this->slave_read_frame, this->slave_read_frame_len);
+    }
+    try
+    {
+      this->master.receiveFrame(ans_frame);
+      master_sample.received = std::chrono::steady_clock::now();
+      this->master.checkAnswer(ans_frame);
+    }
+    catch(...)
+    {
+      if(slave_pending)
+        this->slave.drainAnswer(slave_ans_frame);
+      throw;
+    }
+    // the slave write doesn't need the master link
+    if(!shared)
+      master_guard.reset();
+    this->master.estimateSampleTime(master_sample);
+
+    master = this->master.position_tracker.update(((uint32_t)ans_frame[3] << 16) | ans_frame[2]);
+    double sample = std::chrono::duration<double>(master_sample.sampled - this->start_time).count();
+    if(sample > this->last_sample)
+      this->velocity = (master - this->last_master) / (sample - this->last_sample);
+    this->last_master = master;
+    this->last_sample = sample;
+
+    double lead = compensate && this->delay > 0.0 ? this->delay + extra : 0.0;
+    target = this->slave_origin +
+             this->evaluate(((master - this->master_origin + this->phase) << 8) +
+                            std::llround(this->velocity * lead * 256.0));
+    // the setting value wraps like the counter of the slave
+    int16_t length = this->slave.encodeWriteObject(0x2062, 0x00, (int32_t)target, write_frame);
+
+    if(slave_pending)
+    {
+      this->slave.receiveFrame(slave_ans_frame);
+      slave_sample.received = std::chrono::steady_clock::now();
+      this->slave.checkAnswer(slave_ans_frame);
+      slave_position = this->slave.position_tracker.update(
+          ((uint32_t)slave_ans_frame[3] << 16) | slave_ans_frame[2]);
+    }
+
+    t2 = std::chrono::steady_clock::now();
+    this->transact(this->slave, write_frame, length, ans_frame);
+    t3 = std::chrono::steady_clock::now();
+
+    if(measure && shared)
+    {
+      slave_sample.sent = t3;
+      this->transact(this->slave, this->slave_read_frame, this->slave_read_frame_len, ans_frame);
+      slave_sample.received = std::chrono::steady_clock::now();
+      slave_position = this->slave.position_tracker.update(
+          ((uint32_t)ans_frame[3] << 16) | ans_frame[2]);
+    }
+  }
+
+  // master sample to setpoint arrival (middle of the write)
+  double measured = std::chrono::duration<double>(t2 - master_sample.sampled).count() +
+                    0.5*std::chrono::duration<double>(t3 - t2).count();
+  this->delay = this->delay < 0.0 ? measured : this->delay + 0.125*(measured - this->delay);
+
+  long error = 0;
+  if(measure)
+  {
+    this->slave.estimateSampleTime(slave_sample);
+    double ahead = std::chrono::duration<double>(slave_sample.sampled - master_sample.sampled).count();
+    int64_t ideal = this->slave_origin +
+                    this->evaluate(((master - this->master_origin + this->phase) << 8) +
+                                   std::llround(this->velocity * ahead * 256.0));
+    error = slave_position - ideal;
+  }
+
+  std::lock_guard<std::mutex> lock(this->mutex);
+  long delay_us = std::lround(measured * 1e6);
+  this->delay_stats.count++;
+  this->delay_stats.last_us   = delay_us;
+  this->delay_stats.total_us += delay_us;
+  if(delay_us > this->delay_stats.worst_us)
+    this->delay_stats.worst_us = delay_us;
+  this->filtered_delay_us = std::lround(this->delay * 1e6);
+
+  if(measure)
+  {
+    this->error.count++;
+    this->error.last   = error;
+    this->error.total += std::labs(error);
+    if(std::labs(error) > this->error.worst)
+      this->error.worst = std::labs(error);
+  }
+}
+
+// ----------------------------------------------------------------------------
+//   STATUS
+// ----------------------------------------------------------------------------
+
+long CEpos2CamFollower::getTransportDelay()
+{
+  std::lock_guard<std::mutex> lock(this->mutex);
+  return this->filtered_delay_us;
+}
+
+CEpos2::epos_latency CEpos2CamFollower::getTransportDelayStats()
+{
+  std::lock_guard<std::mutex> lock(this->mutex);
+  return this->delay_stats;
+}
+
+CEpos2CamFollower::epos_sync_error CEpos2CamFollower::getSyncError()
+{
+  std::lock_guard<std::mutex> lock(this->mutex);
+  return this->error;
+}
+
+void CEpos2CamFollower::resetStatistics()
+{
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->delay_stats.count    = 0;
+  this->delay_stats.last_us  = 0;
+  this->delay_stats.worst_us = 0;
+  this->delay_stats.total_us = 0;
+  this->error.count = 0;
+  this->error.last  = 0;
+  this->error.worst = 0;
+  this->error.total = 0;
+  this->filtered_delay_us = 0;
+}
+
+CEpos2CycleRunner &CEpos2CamFollower::getRunner()
+{
+  return this->runner;
+}
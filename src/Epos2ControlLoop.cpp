@@ -0,0 +1,332 @@
+// Copyright (C) 2009-2010 Institut de Robòtica i Informàtica Industrial, CSIC-UPC.
+// Author Martí Morta Garriga  (mmorta@iri.upc.edu)
+// All rights reserved.
+//
+// Copyright (C) 2013 Jochen Sprickerhof <jochen@sprickerhof.de>
+//
+// This file is part of IRI EPOS2 Driver
+// IRI EPOS2 Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <cmath>
+#include <stdexcept>
+#include <algorithm>
+#include "epos2_motor_controller/Epos2ControlLoop.h"
+
+// ----------------------------------------------------------------------------
+//   CLASS
+// ----------------------------------------------------------------------------
+//     CONSTRUCTOR
+// ----------------------------------------------------------------------------
+
+CEpos2ControlLoop::CEpos2ControlLoop(long period_us)
+  : runner(period_us, [this]{ this->cycle(); })
+{ }
+
+//     DESTRUCTOR
+// ----------------------------------------------------------------------------
+
+CEpos2ControlLoop::~CEpos2ControlLoop()
+{
+  try
+  {
+    this->stop();
+  }
+  catch(...)
+  {
+  }
+}
+
+// ----------------------------------------------------------------------------
+//   AXES
+// ----------------------------------------------------------------------------
+
+size_t CEpos2ControlLoop::add(CEpos2 *axis, const epos_pid_gains &gains)
+{
+  // [qc/s] to [rev/min]
+  double rpm = 60.0 / (4.0 * axis->getEncoderPulseNumber());
+
+  if(this->runner.isRunning())
+    throw std::logic_error("EPOS2 control loop is running");
+
+  std::lock_guard<std::mutex> lock(this->mutex);
+
+  this->axes.push_back(axis);
+  this->kp.push_back(gains.kp);
+  this->ki.push_back(gains.ki);
+  this->kd.push_back(gains.kd);
+  this->kff.push_back(gains.kff);
+  this->kt.push_back(gains.kt);
+  this->max_output.push_back(gains.max_output);
+  this->x_ref.push_back(0.0);
+  this->v_ref.push_back(0.0);
+  this->x.push_back(0.0);
+  this->integral.push_back(0.0);
+  this->output.push_back(0.0);
+  this->rpm_per_qcs.push_back(rpm);
+  this->has_setpoint.push_back(0);
+  this->estimator.add();
+
+  return this->axes.size() - 1;
+}
+
+void CEpos2ControlLoop::setGains(size_t i, const epos_pid_gains &gains)
+{
+  std::lock_guard<std::mutex> lock(this->mutex);
+  if(i >= this->axes.size())
+    throw std::invalid_argument("EPOS2 control loop has no such axis");
+
+  this->kp[i]         = gains.kp;
+  this->ki[i]         = gains.ki;
+  this->kd[i]         = gains.kd;
+  this->kff[i]        = gains.kff;
+  this->kt[i]         = gains.kt;
+  this->max_output[i] = gains.max_output;
+}
+
+CEpos2ControlLoop::epos_pid_gains CEpos2ControlLoop::getGains(size_t i)
+{
+  std::lock_guard<std::mutex> lock(this->mutex);
+  if(i >= this->axes.size())
+    throw std::invalid_argument("EPOS2 control loop has no such axis");
+
+  epos_pid_gains gains;
+  gains.kp         = this->kp[i];
+  gains.ki         = this->ki[i];
+  gains.kd         = this->kd[i];
+  gains.kff        = this->kff[i];
+  gains.kt         = this->kt[i];
+  gains.max_output = this->max_output[i];
+  return gains;
+}
+
+// ----------------------------------------------------------------------------
+//   SETPOINTS
+// ----------------------------------------------------------------------------
+
+void CEpos2ControlLoop::setSetpoint(size_t i, double position, double velocity)
+{
+  std::lock_guard<std::mutex> lock(this->mutex);
+  if(i >= this->axes.size())
+    throw std::invalid_argument("EPOS2 control loop has no such axis");
+
+  this->x_ref[i] = position;
+  this->v_ref[i] = velocity;
+  this->has_setpoint[i] = 1;
+}
+
+void CEpos2ControlLoop::setSetpointSource(const std::function<void(double, double*, double*)> &source)
+{
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->setpoint_source = source;
+}
+
+void CEpos2ControlLoop::setOutputFilter(const std::function<void(double, const double*, double*)> &filter)
+{
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->output_filter = filter;
+}
+
+// ----------------------------------------------------------------------------
+//   LOOP
+// ----------------------------------------------------------------------------
+
+void CEpos2ControlLoop::start()
+{
+  if(this->runner.isRunning())
+    return;
+
+  size_t n = this->axes.size();
+  std::vector<double> position(n);
+  for(size_t i = 0; i < n; i++)
+    position[i] = this->axes[i]->readPosition64();
+
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    for(size_t i = 0; i < n; i++)
+    {
+      if(!this->has_setpoint[i])
+      {
+        this->x_ref[i] = position[i];
+        this->v_ref[i] = 0.0;
+      }
+      this->x[i]        = position[i];
+      this->integral[i] = 0.0;
+      this->output[i]   = 0.0;
+    }
+    this->estimator.reset();
+  }
+
+  this->cycle_x.assign(n, 0.0);
+  this->cycle_x_ref.assign(n, 0.0);
+  this->cycle_v_ref.assign(n, 0.0);
+  this->cycle_output.assign(n, 0.0);
+  this->cycle_samples.resize(n);
+  this->start_time = std::chrono::steady_clock::now();
+  this->last_read  = this->start_time;
+
+  this->runner.start();
+}
+
+void CEpos2ControlLoop::stop()
+{
+  bool was_running = this->runner.isRunning();
+
+  // an error of a cycle is thrown here, the cycle already stopped the axes
+  this->runner.stop();
+
+  if(was_running)
+    for(size_t i = 0; i < this->axes.size(); i++)
+      this->axes[i]->setTargetVelocity(0);
+}
+
+bool CEpos2ControlLoop::isRunning()
+{
+  return this->runner.isRunning();
+}
+
+// one PID step of n axes; the outputs don't alias the inputs and the
+// saturation is written with fabs, so the loop has no branches and vectorizes
+static void pidStep(size_t n, double dt, const double *kp, const double *ki,
+                    const double *kd, const double *kff, const double *kt,
+                    const double *lim, const double *x_ref, const double *v_ref,
+                    const double *x, const double *v,
+                    double *__restrict__ integral, double *__restrict__ output)
+{
+  for(size_t i = 0; i < n; i++)
+  {
+    double e = x_ref[i] - x[i];
+    double u = kff[i]*v_ref[i] + kp[i]*e + integral[i] - kd[i]*v[i];
+    double u_sat = 0.5*(std::fabs(u + lim[i]) - std::fabs(u - lim[i]));
+
+    // back-calculation: the saturation excess drains the integral
+    integral[i] += (ki[i]*e + kt[i]*(u_sat - u))*dt;
+
+    output[i] = u_sat;
+  }
+}
+
+void CEpos2ControlLoop::compute(double dt)
+{
+  pidStep(this->axes.size(), dt, this->kp.data(), this->ki.data(), this->kd.data(),
+          this->kff.data(), this->kt.data(), this->max_output.data(),
+          this->x_ref.data(), this->v_ref.data(), this->x.data(),
+          this->estimator.getVelocities(), this->integral.data(), this->output.data());
+}
+
+void CEpos2ControlLoop::cycle()
+{
+  size_t n = this->axes.size();
+  std::function<void(double, double*, double*)> source;
+  std::function<void(double, const double*, double*)> filter;
+
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    source = this->setpoint_source;
+    filter = this->output_filter;
+  }
+
+  try
+  {
+    for(size_t i = 0; i < n; i++)
+    {
+      this->cycle_samples[i] = this->axes[i]->readPositionSample();
+      // unwrapped, the error doesn't jump when the counter wraps
+      this->cycle_x[i] = this->cycle_samples[i].position;
+    }
+    std::chrono::steady_clock::time_point read = std::chrono::steady_clock::now();
+    double t  = std::chrono::duration<double>(read - this->start_time).count();
+    double dt = std::chrono::duration<double>(read - this->last_read).count();
+    this->last_read = read;
+
+    if(source)
+      source(t, this->cycle_x_ref.data(), this->cycle_v_ref.data());
+
+    {
+      std::lock_guard<std::mutex> lock(this->mutex);
+      std::copy(this->cycle_x.begin(), this->cycle_x.end(), this->x.begin());
+      this->estimator.update(this->cycle_samples);
+      if(source)
+      {
+        std::copy(this->cycle_x_ref.begin(), this->cycle_x_ref.end(), this->x_ref.begin());
+        std::copy(this->cycle_v_ref.begin(), this->cycle_v_ref.end(), this->v_ref.begin());
+      }
+      this->compute(dt);
+      std::copy(this->output.begin(), this->output.end(), this->cycle_output.begin());
+    }
+
+    if(filter)
+      filter(t, this->cycle_x.data(), this->cycle_output.data());
+
+    for(size_t i = 0; i < n; i++)
+      this->axes[i]->setTargetVelocity(
+          std::lround(this->cycle_output[i] * this->rpm_per_qcs[i]));
+  }
+  catch(...)
+  {
+    for(size_t i = 0; i < n; i++)
+    {
+      try { this->axes[i]->setTargetVelocity(0); }
+      catch(...) { }
+    }
+    // stops the runner, stop() throws it
+    throw;
+  }
+}
+
+// ----------------------------------------------------------------------------
+//   STATUS
+// ----------------------------------------------------------------------------
+
+double CEpos2ControlLoop::getPosition(size_t i)
+{
+  std::lock_guard<std::mutex> lock(this->mutex);
+  if(i >= this->axes.size())
+    throw std::invalid_argument("EPOS2 control loop has no such axis");
+
+  return this->x[i];
+}
+
+double CEpos2ControlLoop::getVelocity(size_t i)
+{
+  std::lock_guard<std::mutex> lock(this->mutex);
+  if(i >= this->axes.size())
+    throw std::invalid_argument("EPOS2 control loop has no such axis");
+
+  return this->estimator.getState(i).velocity;
+}
+
+void CEpos2ControlLoop::setEstimatorNoise(size_t i, double position_variance,
+                                          double jerk_density)
+{
+  std::lock_guard<std::mutex> lock(this->mutex);
+  if(i >= this->axes.size())
+    throw std::invalid_argument("EPOS2 control loop has no such axis");
+
+  this->estimator.setNoise(i, position_variance, jerk_density);
+}
+
+CEpos2CycleRunner::epos_cycle_stats CEpos2ControlLoop::getTiming()
+{
+  return this->runner.getStatistics();
+}
+
+void CEpos2ControlLoop::resetTiming()
+{
+  this->runner.resetStatistics();
+}
+
+CEpos2CycleRunner &CEpos2ControlLoop::getRunner()
+{
+  return this->runner;
+}
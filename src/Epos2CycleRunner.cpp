@@ -0,0 +1,332 @@
+// Copyright (C) 2009-2010 Institut de Robòtica i Informàtica Industrial, CSIC-UPC.
+// Author Martí Morta Garriga  (mmorta@iri.upc.edu)
+// All rights reserved.
+//
+// Copyright (C) 2013 Jochen Sprickerhof <jochen@sprickerhof.de>
+//
+// This file is part of IRI EPOS2 Driver
+// IRI EPOS2 Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <sstream>
+#include <pthread.h>
+#include <sched.h>
+#include <alloca.h>
+#include <sys/mman.h>
+#include "epos2_motor_controller/Epos2.h"
+#include "epos2_motor_controller/Epos2CycleRunner.h"
+
+static int64_t toNs(const struct timespec &t)
+{
+  return (int64_t)t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+static struct timespec fromNs(int64_t ns)
+{
+  struct timespec t;
+  t.tv_sec  = ns / 1000000000LL;
+  t.tv_nsec = ns % 1000000000LL;
+  return t;
+}
+
+static int64_t nowNs()
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return toNs(t);
+}
+
+// ----------------------------------------------------------------------------
+//   CLASS
+// ----------------------------------------------------------------------------
+//     CONSTRUCTOR
+// ----------------------------------------------------------------------------
+
+CEpos2CycleRunner::CEpos2CycleRunner(long period_us, const std::function<void()> &callback,
+                                     long bin_us, size_t bins)
+  : callback(callback), period_us(period_us), bin_us(bin_us > 0 ? bin_us : 1),
+    bins(bins > 0 ? bins : 1),
+    wakeup_histogram(new std::atomic<unsigned long>[this->bins]),
+    exec_histogram(new std::atomic<unsigned long>[this->bins]),
+    running(false)
+{
+  this->config.priority       = 0;
+  this->config.cpu            = -1;
+  this->config.lock_memory    = false;
+  this->config.stack_prefault = 0;
+  this->resetStatistics();
+}
+
+//     DESTRUCTOR
+// ----------------------------------------------------------------------------
+
+CEpos2CycleRunner::~CEpos2CycleRunner()
+{
+  try
+  {
+    this->stop();
+  }
+  catch(...)
+  {
+  }
+}
+
+// ----------------------------------------------------------------------------
+//   CONFIGURATION
+// ----------------------------------------------------------------------------
+
+void CEpos2CycleRunner::setRealtime(const epos_rt_config &config)
+{
+  this->config = config;
+}
+
+long CEpos2CycleRunner::getPeriod()
+{
+  return this->period_us;
+}
+
+std::string CEpos2CycleRunner::getRealtimeError()
+{
+  std::lock_guard<std::mutex> lock(this->mutex);
+  return this->rt_error;
+}
+
+std::string CEpos2CycleRunner::applyRealtime()
+{
+  std::stringstream s;
+
+  if(this->config.lock_memory && mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+    s << "mlockall: " << strerror(errno) << "; ";
+
+  if(this->config.cpu >= 0)
+  {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(this->config.cpu, &set);
+    int e = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if(e != 0)
+      s << "CPU " << this->config.cpu << ": " << strerror(e) << "; ";
+  }
+
+  if(this->config.priority > 0)
+  {
+    struct sched_param param;
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = this->config.priority;
+    int e = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    if(e != 0)
+      s << "SCHED_FIFO " << this->config.priority << ": " << strerror(e) << "; ";
+  }
+
+  // touch the stack the loop will use, so it doesn't fault in a cycle
+  if(this->config.stack_prefault > 0)
+  {
+    volatile char *stack = (volatile char*)alloca(this->config.stack_prefault);
+    for(size_t i = 0; i < this->config.stack_prefault; i += 4096)
+      stack[i] = 0;
+  }
+
+  return s.str();
+}
+
+// ----------------------------------------------------------------------------
+//   LOOP
+// ----------------------------------------------------------------------------
+
+void CEpos2CycleRunner::start()
+{
+  if(this->running)
+    return;
+  // thread stopped by an error
+  if(this->thread.joinable())
+    this->thread.join();
+
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->error.clear();
+  }
+
+  std::promise<void> ready;
+  std::future<void> applied = ready.get_future();
+
+  this->running = true;
+  this->thread = std::thread(&CEpos2CycleRunner::run, this, &ready);
+  applied.wait();
+}
+
+void CEpos2CycleRunner::stop()
+{
+  this->running = false;
+
+  if(this->thread.joinable())
+    this->thread.join();
+
+  std::lock_guard<std::mutex> lock(this->mutex);
+  if(!this->error.empty())
+  {
+    std::string error = this->error;
+    this->error.clear();
+    throw EPOS2IOException(error);
+  }
+}
+
+bool CEpos2CycleRunner::isRunning()
+{
+  return this->running;
+}
+
+void CEpos2CycleRunner::run(std::promise<void> *ready)
+{
+  {
+    std::string rt_error = this->applyRealtime();
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->rt_error = rt_error;
+  }
+  ready->set_value();
+
+  const int64_t period = (int64_t)this->period_us * 1000;
+  int64_t next = nowNs();
+
+  while(this->running)
+  {
+    next += period;
+    struct timespec deadline = fromNs(next);
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR)
+      ;
+
+    int64_t wakeup = nowNs();
+
+    try
+    {
+      this->callback();
+    }
+    catch(std::exception &e)
+    {
+      std::lock_guard<std::mutex> lock(this->mutex);
+      this->error   = e.what();
+      this->running = false;
+      break;
+    }
+    catch(...)
+    {
+      // anything else thrown would end the thread with std::terminate
+      std::lock_guard<std::mutex> lock(this->mutex);
+      this->error   = "unknown exception in the cycle callback";
+      this->running = false;
+      break;
+    }
+
+    int64_t end = nowNs();
+    long wakeup_us = (wakeup - next) / 1000;
+    long exec_us   = (end - wakeup) / 1000;
+
+    this->cycles.fetch_add(1, std::memory_order_relaxed);
+    this->last_wakeup_us.store(wakeup_us, std::memory_order_relaxed);
+    this->total_wakeup_us.fetch_add(wakeup_us, std::memory_order_relaxed);
+    if(wakeup_us > this->worst_wakeup_us.load(std::memory_order_relaxed))
+      this->worst_wakeup_us.store(wakeup_us, std::memory_order_relaxed);
+    this->last_exec_us.store(exec_us, std::memory_order_relaxed);
+    this->total_exec_us.fetch_add(exec_us, std::memory_order_relaxed);
+    if(exec_us > this->worst_exec_us.load(std::memory_order_relaxed))
+      this->worst_exec_us.store(exec_us, std::memory_order_relaxed);
+    this->account(this->wakeup_histogram.get(), wakeup_us);
+    this->account(this->exec_histogram.get(), exec_us);
+
+    // don't try to catch up after an overrun
+    if(end >= next + period)
+    {
+      this->overruns.fetch_add(1, std::memory_order_relaxed);
+      next = end;
+    }
+  }
+}
+
+// ----------------------------------------------------------------------------
+//   STATISTICS
+// ----------------------------------------------------------------------------
+
+void CEpos2CycleRunner::account(std::atomic<unsigned long> *histogram, long value_us)
+{
+  size_t bin = value_us < 0 ? 0 : value_us / this->bin_us;
+  if(bin >= this->bins)
+    bin = this->bins - 1;
+  histogram[bin].fetch_add(1, std::memory_order_relaxed);
+}
+
+CEpos2CycleRunner::epos_cycle_stats CEpos2CycleRunner::getStatistics()
+{
+  epos_cycle_stats stats;
+
+  stats.cycles          = this->cycles.load(std::memory_order_relaxed);
+  stats.overruns        = this->overruns.load(std::memory_order_relaxed);
+  stats.last_wakeup_us  = this->last_wakeup_us.load(std::memory_order_relaxed);
+  stats.worst_wakeup_us = this->worst_wakeup_us.load(std::memory_order_relaxed);
+  stats.total_wakeup_us = this->total_wakeup_us.load(std::memory_order_relaxed);
+  stats.last_exec_us    = this->last_exec_us.load(std::memory_order_relaxed);
+  stats.worst_exec_us   = this->worst_exec_us.load(std::memory_order_relaxed);
+  stats.total_exec_us   = this->total_exec_us.load(std::memory_order_relaxed);
+
+  return stats;
+}
+
+std::vector<unsigned long> CEpos2CycleRunner::getWakeupHistogram()
+{
+  std::vector<unsigned long> histogram(this->bins);
+  for(size_t i = 0; i < this->bins; i++)
+    histogram[i] = this->wakeup_histogram[i].load(std::memory_order_relaxed);
+  return histogram;
+}
+
+std::vector<unsigned long> CEpos2CycleRunner::getExecutionHistogram()
+{
+  std::vector<unsigned long> histogram(this->bins);
+  for(size_t i = 0; i < this->bins; i++)
+    histogram[i] = this->exec_histogram[i].load(std::memory_order_relaxed);
+  return histogram;
+}
+
+long CEpos2CycleRunner::getBinWidth()
+{
+  return this->bin_us;
+}
+
+void CEpos2CycleRunner::exportHistograms(std::ostream &out)
+{
+  std::vector<unsigned long> wakeup = this->getWakeupHistogram();
+  std::vector<unsigned long> exec = this->getExecutionHistogram();
+
+  out << "bin_start_us,wakeup,execution" << std::endl;
+  for(size_t i = 0; i < this->bins; i++)
+    if(wakeup[i] != 0 || exec[i] != 0)
+      out << i * this->bin_us << "," << wakeup[i] << "," << exec[i] << std::endl;
+}
+
+void CEpos2CycleRunner::resetStatistics()
+{
+  this->cycles          = 0;
+  this->overruns        = 0;
+  this->last_wakeup_us  = 0;
+  this->worst_wakeup_us = 0;
+  this->total_wakeup_us = 0;
+  this->last_exec_us    = 0;
+  this->worst_exec_us   = 0;
+  this->total_exec_us   = 0;
+  for(size_t i = 0; i < this->bins; i++)
+  {
+    this->wakeup_histogram[i] = 0;
+    this->exec_histogram[i]   = 0;
+  }
+}
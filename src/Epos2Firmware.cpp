@@ -0,0 +1,316 @@
+// Copyright (C) 2009-2010 Institut de Robòtica i Informàtica Industrial, CSIC-UPC.
+// Author Martí Morta Garriga  (mmorta@iri.upc.edu)
+// All rights reserved.
+//
+// Copyright (C) 2013 Jochen Sprickerhof <jochen@sprickerhof.de>
+//
+// This file is part of IRI EPOS2 Driver
+// IRI EPOS2 Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <cerrno>
+#include <cstring>
+#include <chrono>
+#include <thread>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include "epos2_motor_controller/Epos2Firmware.h"
+
+// reads size bytes unless the end of the file comes first
+static size_t readFully(int fd, uint8_t *data, size_t size)
+{
+  size_t done = 0;
+  while(done < size)
+  {
+    ssize_t n = read(fd, data + done, size - done);
+    if(n < 0 && errno == EINTR)
+      continue;
+    if(n < 0)
+      throw EPOS2IOException(std::string("EPOS2 firmware image can't be read: ") + strerror(errno));
+    if(n == 0)
+      break;
+    done += n;
+  }
+  return done;
+}
+
+static int openImage(const std::string &path)
+{
+  int fd = open(path.c_str(), O_RDONLY);
+  if(fd < 0)
+  {
+    std::stringstream s;
+    s << "EPOS2 firmware image " << path << " can't be opened: " << strerror(errno);
+    throw EPOS2IOException(s.str());
+  }
+  return fd;
+}
+
+static long elapsedUs(std::chrono::steady_clock::time_point since)
+{
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - since).count();
+}
+
+// ----------------------------------------------------------------------------
+//   CLASS
+// ----------------------------------------------------------------------------
+//     CONSTRUCTOR
+// ----------------------------------------------------------------------------
+
+CEpos2Firmware::CEpos2Firmware(const std::string &path) : path(path), size(0), crc(0)
+{
+  uint8_t buffer[65536];
+  uint64_t total = 0;
+  int fd = openImage(path);
+
+  try
+  {
+    size_t n;
+    while((n = readFully(fd, buffer, sizeof(buffer))) > 0)
+    {
+      this->crc = CEpos2Firmware::crc32(this->crc, buffer, n);
+      total += n;
+    }
+  }
+  catch(...)
+  {
+    close(fd);
+    throw;
+  }
+  close(fd);
+
+  if(total == 0 || total > UINT32_MAX)
+    throw std::invalid_argument("EPOS2 firmware image is empty or too large");
+  this->size = total;
+}
+
+// ----------------------------------------------------------------------------
+//   IMAGE
+// ----------------------------------------------------------------------------
+
+uint32_t CEpos2Firmware::getSize()
+{
+  return this->size;
+}
+
+uint32_t CEpos2Firmware::getCrc()
+{
+  return this->crc;
+}
+
+uint32_t CEpos2Firmware::crc32(uint32_t crc, const uint8_t *data, size_t size)
+{
+  // reflected polynomial 0x04C11DB7, table of the 256 bytes built once
+  static const std::vector<uint32_t> table = []{
+    std::vector<uint32_t> t(256);
+    for(uint32_t i = 0; i < 256; i++)
+    {
+      uint32_t c = i;
+      for(int k = 0; k < 8; k++)
+        c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+      t[i] = c;
+    }
+    return t;
+  }();
+
+  crc = ~crc;
+  for(size_t i = 0; i < size; i++)
+    crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+  return ~crc;
+}
+
+double CEpos2Firmware::linkLimit(long baud_rate)
+{
+  // request: DLE STX, header, 32 words (control byte and 63 bytes), CRC
+  // answer:  DLE STX, header, error code (2 words), CRC
+  const double request = 2 + 2*(1 + 32 + 1);
+  const double answer  = 2 + 2*(1 + 2 + 1);
+
+  return baud_rate / 10.0 * 63.0 / (request + answer);
+}
+
+// ----------------------------------------------------------------------------
+//   DOWNLOAD
+// ----------------------------------------------------------------------------
+
+CEpos2Firmware::epos_flash_result CEpos2Firmware::download(CEpos2 &axis,
+    const progress_callback &progress, long timeout_ms)
+{
+  epos_flash_result result;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+  // written through a frame cache for checkAnswer: an error code is thrown
+  CEpos2::epos_frame_cache control_frame;
+  control_frame.valid = false;
+  auto control = [&axis, &control_frame](int32_t command)
+  {
+    axis.writeObjectCached(control_frame, 0x1F51, 0x01, command);
+  };
+
+  control(0);   // stop
+  control(3);   // clear
+
+  int fd = openImage(this->path);
+  uint32_t sent = 0;
+  uint32_t crc = 0;
+  std::chrono::steady_clock::time_point download_start = std::chrono::steady_clock::now();
+
+  try
+  {
+    // every segment is read from the file while the previous one is answered
+    axis.writeObjectSegmented(0x1F50, 0x01, this->size,
+      [&](uint8_t *segment, size_t n)
+      {
+        if(readFully(fd, segment, n) != n)
+          throw EPOS2IOException("EPOS2 firmware image changed while downloading");
+        crc = CEpos2Firmware::crc32(crc, segment, n);
+        sent += n;
+        if(progress)
+          progress(0, sent, this->size);
+      });
+  }
+  catch(...)
+  {
+    close(fd);
+    throw;
+  }
+  close(fd);
+
+  result.download_us = elapsedUs(download_start);
+  if(crc != this->crc)
+    throw EPOS2IOException("EPOS2 firmware image changed while downloading");
+
+  // bit 0 while the flash is programmed, bits 1-7 the error
+  std::chrono::steady_clock::time_point deadline =
+    std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+  int32_t status;
+  while((status = axis.readObject(0x1F57, 0x01)) & 0x01)
+  {
+    if(std::chrono::steady_clock::now() >= deadline)
+      throw EPOS2IOException("EPOS2 flash programming timed out");
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  if((status >> 1) & 0x7F)
+  {
+    std::stringstream s;
+    s << "EPOS2 flash programming failed: status 0x" << std::hex << status;
+    throw EPOS2IOException(s.str());
+  }
+
+  uint32_t programmed = axis.readObject(0x1F56, 0x01);
+  if(programmed != this->crc)
+  {
+    std::stringstream s;
+    s << "EPOS2 firmware CRC-32 mismatch: image 0x" << std::hex << this->crc
+      << ", programmed 0x" << programmed;
+    throw EPOS2IOException(s.str());
+  }
+
+  control(1);   // start
+
+  result.ok          = true;
+  result.bytes       = this->size;
+  result.total_us    = elapsedUs(start);
+  result.bytes_per_s = result.download_us > 0 ? this->size * 1e6 / result.download_us : 0.0;
+  result.efficiency  = result.bytes_per_s / CEpos2Firmware::linkLimit();
+
+  return result;
+}
+
+// ----------------------------------------------------------------------------
+//   PARALLEL FLASHING
+// ----------------------------------------------------------------------------
+
+void CEpos2Firmware::flashTarget(const epos_flash_target &target, size_t i,
+                                 const progress_callback &progress, long timeout_ms,
+                                 epos_flash_result &result)
+{
+  try
+  {
+    CEpos2 axis(target.node_id, target.serial);
+    axis.init();
+
+    progress_callback numbered;
+    if(progress)
+      numbered = [&progress, i](size_t, uint32_t sent, uint32_t total) { progress(i, sent, total); };
+
+    result = this->download(axis, numbered, timeout_ms);
+  }
+  catch(std::exception &e)
+  {
+    result.ok    = false;
+    result.error = e.what();
+  }
+}
+
+std::vector<CEpos2Firmware::epos_flash_result> CEpos2Firmware::flash(
+    const std::vector<epos_flash_target> &targets, const progress_callback &progress,
+    long timeout_ms)
+{
+  std::vector<epos_flash_result> results(targets.size());
+  for(size_t i = 0; i < results.size(); i++)
+  {
+    results[i].ok          = false;
+    results[i].bytes       = 0;
+    results[i].download_us = 0;
+    results[i].total_us    = 0;
+    results[i].bytes_per_s = 0.0;
+    results[i].efficiency  = 0.0;
+  }
+
+  // the targets of a USB device share its link, one thread per device; an
+  // empty serial is the first device, resolved as CEpos2::openDevice does
+  std::map<std::string, std::vector<size_t> > devices;
+  std::string first;
+  bool resolved = false;
+  for(size_t i = 0; i < targets.size(); i++)
+  {
+    std::string serial = targets[i].serial;
+    if(serial.empty())
+    {
+      if(!resolved)
+      {
+        try
+        {
+          first = CEpos2::firstSerial();
+        }
+        catch(std::exception &e)
+        {
+          // no device: the target fails in its own thread
+        }
+        resolved = true;
+      }
+      serial = first;
+    }
+    devices[serial].push_back(i);
+  }
+
+  std::vector<std::thread> threads;
+  for(auto &device : devices)
+  {
+    const std::vector<size_t> &indices = device.second;
+    threads.push_back(std::thread([this, &targets, &indices, &progress, timeout_ms, &results]{
+      for(size_t i : indices)
+        this->flashTarget(targets[i], i, progress, timeout_ms, results[i]);
+    }));
+  }
+  for(size_t i = 0; i < threads.size(); i++)
+    threads[i].join();
+
+  return results;
+}
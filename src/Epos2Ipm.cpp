@@ -0,0 +1,363 @@
+// Copyright (C) 2009-2010 Institut de Robòtica i Informàtica Industrial, CSIC-UPC.
+// Author Martí Morta Garriga  (mmorta@iri.upc.edu)
+// All rights reserved.
+//
+// Copyright (C) 2013 Jochen Sprickerhof <jochen@sprickerhof.de>
+//
+// This file is part of IRI EPOS2 Driver
+// IRI EPOS2 Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <sstream>
+#include <stdexcept>
+#include "epos2_motor_controller/Epos2Ipm.h"
+
+// ----------------------------------------------------------------------------
+//   CLASS
+// ----------------------------------------------------------------------------
+//     CONSTRUCTOR
+// ----------------------------------------------------------------------------
+
+CEpos2Ipm::CEpos2Ipm(CEpos2 *axis, long period_us, long status_period_us)
+  : axis(axis), buffered_end_ms(0), buffer_size(0), running(false),
+    moving(false), started(false), period_us(period_us), status_period_us(status_period_us),
+    buffer_status(0), underflow_warnings(0), overflow_warnings(0)
+{ }
+
+//     DESTRUCTOR
+// ----------------------------------------------------------------------------
+
+CEpos2Ipm::~CEpos2Ipm()
+{
+  try
+  {
+    this->stop();
+  }
+  catch(...)
+  {
+  }
+}
+
+// ----------------------------------------------------------------------------
+//   TRAJECTORY
+// ----------------------------------------------------------------------------
+
+void CEpos2Ipm::configure()
+{
+  this->axis->setOperationMode(CEpos2::INTERPOLATED_PROFILE_POSITION);
+  this->axis->clearIpmBuffer();
+  long size = this->axis->getIpmBufferSize();
+
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->buffer_size = size;
+  this->queue.clear();
+  this->buffered.clear();
+  this->buffered_end_ms = 0;
+  this->buffer_status = 0;
+  this->error.clear();
+}
+
+void CEpos2Ipm::push(const epos_pvt_point *points, size_t n)
+{
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->queue.insert(this->queue.end(), points, points + n);
+  }
+  this->cond.notify_all();
+}
+
+void CEpos2Ipm::push(const long *position, const long *velocity,
+                     const unsigned char *time_ms, size_t n)
+{
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    for(size_t i = 0; i < n; i++)
+    {
+      epos_pvt_point p;
+      p.position = position[i];
+      p.velocity = velocity[i];
+      p.time_ms  = time_ms[i];
+      this->queue.push_back(p);
+    }
+  }
+  this->cond.notify_all();
+}
+
+// ----------------------------------------------------------------------------
+//   BUFFER
+// ----------------------------------------------------------------------------
+
+void CEpos2Ipm::consume(std::chrono::steady_clock::time_point now)
+{
+  if(!this->moving)
+    return;
+
+  long elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+      now - this->motion_start).count();
+  while(!this->buffered.empty() && this->buffered.front() <= elapsed_ms)
+    this->buffered.pop_front();
+}
+
+void CEpos2Ipm::fill()
+{
+  while(true)
+  {
+    epos_pvt_point p;
+
+    {
+      std::lock_guard<std::mutex> lock(this->mutex);
+      this->consume(std::chrono::steady_clock::now());
+      if(this->queue.empty() || (long)this->buffered.size() >= this->buffer_size)
+        return;
+      p = this->queue.front();
+      this->queue.pop_front();
+    }
+
+    this->axis->addPvtPoint(p.position, p.velocity, p.time_ms);
+
+    {
+      std::lock_guard<std::mutex> lock(this->mutex);
+      this->buffered_end_ms += p.time_ms;
+      this->buffered.push_back(this->buffered_end_ms);
+    }
+  }
+}
+
+// ----------------------------------------------------------------------------
+//   MOTION
+// ----------------------------------------------------------------------------
+
+void CEpos2Ipm::prefill()
+{
+  this->fill();
+}
+
+void CEpos2Ipm::start()
+{
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if(this->running)
+      return;
+  }
+
+  CEpos2Ipm::startAll(std::vector<CEpos2Ipm*>(1, this));
+}
+
+void CEpos2Ipm::startAll(const std::vector<CEpos2Ipm*> &ipms)
+{
+  size_t n = ipms.size();
+  std::vector<CEpos2*> axes(n);
+  std::vector<std::vector<uint8_t> > frames(n, std::vector<uint8_t>(32));
+  std::vector<const uint8_t*> frame_ptrs(n);
+  std::vector<int16_t> lengths(n);
+  std::vector<std::chrono::steady_clock::time_point> sent;
+  std::vector<uint16_t> answers;
+
+  for(size_t i = 0; i < n; i++)
+  {
+    std::lock_guard<std::mutex> lock(ipms[i]->mutex);
+    if(ipms[i]->running)
+      throw std::logic_error("EPOS2 IPM engine already running");
+  }
+
+  // every buffer is loaded before the first axis moves
+  for(size_t i = 0; i < n; i++)
+    ipms[i]->fill();
+
+  for(size_t i = 0; i < n; i++)
+  {
+    axes[i]       = ipms[i]->axis;
+    lengths[i]    = axes[i]->encodeWriteObject(0x6040, 0x00, 0x001F, &frames[i][0]);
+    frame_ptrs[i] = &frames[i][0];
+  }
+
+  CEpos2::writeTogether(axes, 0x6040, 0x00, std::vector<int32_t>(n, 0x001F),
+                        frame_ptrs, lengths, sent, answers);
+
+  // the buffers empty from when each start was written
+  std::string error;
+  for(size_t i = 0; i < n; i++)
+  {
+    try
+    {
+      axes[i]->checkAnswer(&answers[EPOS2_MAX_ANSWER_WORDS*i]);
+    }
+    catch(std::exception &e)
+    {
+      if(error.empty())
+        error = e.what();
+      continue;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(ipms[i]->mutex);
+      ipms[i]->motion_start = sent[i];
+      ipms[i]->moving  = true;
+      ipms[i]->started = true;
+      ipms[i]->running = true;
+    }
+    ipms[i]->thread = std::thread(&CEpos2Ipm::run, ipms[i]);
+  }
+
+  if(!error.empty())
+  {
+    for(size_t i = 0; i < n; i++)
+      ipms[i]->stop();
+    throw EPOS2IOException(error);
+  }
+}
+
+void CEpos2Ipm::stop()
+{
+  bool was_started;
+
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->running = false;
+    this->moving  = false;
+  }
+  this->cond.notify_all();
+
+  if(this->thread.joinable())
+    this->thread.join();
+
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    was_started   = this->started;
+    this->started = false;
+  }
+  if(was_started)
+    this->axis->stopIpm();
+}
+
+void CEpos2Ipm::run()
+{
+  std::chrono::steady_clock::time_point next = std::chrono::steady_clock::now();
+  std::chrono::steady_clock::time_point next_status = next;
+
+  while(true)
+  {
+    {
+      std::unique_lock<std::mutex> lock(this->mutex);
+      next += std::chrono::microseconds(this->period_us);
+      this->cond.wait_until(lock, next, [this]{ return !this->running; });
+      if(!this->running)
+        break;
+    }
+
+    try
+    {
+      this->fill();
+
+      std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+      if(now >= next_status)
+      {
+        next_status = now + std::chrono::microseconds(this->status_period_us);
+        long status = this->axis->getIpmBufferStatus();
+
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->buffer_status = status;
+        if(status & 0x0001) this->underflow_warnings++;
+        if(status & 0x0002) this->overflow_warnings++;
+        if(status & 0x0F00)
+        {
+          std::stringstream s;
+          s << "EPOS2 interpolation buffer error, status 0x" << std::hex << status;
+          this->error  = s.str();
+          this->moving = false;
+        }
+      }
+
+      std::lock_guard<std::mutex> lock(this->mutex);
+      this->consume(now);
+      // all the points executed, the EPOS2 is done
+      if(this->queue.empty() && this->buffered.empty())
+      {
+        this->moving  = false;
+        this->started = false;
+      }
+    }
+    catch(std::exception &e)
+    {
+      std::lock_guard<std::mutex> lock(this->mutex);
+      this->error  = e.what();
+      this->moving = false;
+    }
+    this->cond.notify_all();
+
+    // don't try to catch up after a long stall
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if(next < now)
+      next = now;
+  }
+}
+
+bool CEpos2Ipm::waitFinished(long timeout_ms)
+{
+  std::unique_lock<std::mutex> lock(this->mutex);
+  std::chrono::steady_clock::time_point deadline =
+    std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+
+  while(this->moving)
+  {
+    if(timeout_ms < 0)
+      this->cond.wait(lock);
+    else if(this->cond.wait_until(lock, deadline) == std::cv_status::timeout)
+      return !this->moving;
+  }
+
+  if(!this->error.empty())
+    throw EPOS2IOException(this->error);
+  return true;
+}
+
+// ----------------------------------------------------------------------------
+//   STATUS
+// ----------------------------------------------------------------------------
+
+long CEpos2Ipm::getFillLevel()
+{
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->consume(std::chrono::steady_clock::now());
+  return this->buffered.size();
+}
+
+size_t CEpos2Ipm::getQueued()
+{
+  std::lock_guard<std::mutex> lock(this->mutex);
+  return this->queue.size();
+}
+
+std::chrono::steady_clock::time_point CEpos2Ipm::getMotionStart()
+{
+  std::lock_guard<std::mutex> lock(this->mutex);
+  return this->motion_start;
+}
+
+long CEpos2Ipm::getBufferStatus()
+{
+  std::lock_guard<std::mutex> lock(this->mutex);
+  return this->buffer_status;
+}
+
+unsigned long CEpos2Ipm::getUnderflowWarnings()
+{
+  std::lock_guard<std::mutex> lock(this->mutex);
+  return this->underflow_warnings;
+}
+
+unsigned long CEpos2Ipm::getOverflowWarnings()
+{
+  std::lock_guard<std::mutex> lock(this->mutex);
+  return this->overflow_warnings;
+}
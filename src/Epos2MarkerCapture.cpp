@@ -0,0 +1,266 @@
+// Copyright (C) 2009-2010 Institut de Robòtica i Informàtica Industrial, CSIC-UPC.
+// Author Martí Morta Garriga  (mmorta@iri.upc.edu)
+// All rights reserved.
+//
+// Copyright (C) 2013 Jochen Sprickerhof <jochen@sprickerhof.de>
+//
+// This file is part of IRI EPOS2 Driver
+// IRI EPOS2 Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "epos2_motor_controller/Epos2MarkerCapture.h"
+
+// ----------------------------------------------------------------------------
+//   CLASS
+// ----------------------------------------------------------------------------
+//     CONSTRUCTOR
+// ----------------------------------------------------------------------------
+
+CEpos2MarkerCapture::CEpos2MarkerCapture(CEpos2 *axis, long period_us, size_t queue_size)
+  : axis(axis), queue_size(queue_size), running(false), period_us(period_us),
+    overruns(0), dropped(0)
+{ }
+
+//     DESTRUCTOR
+// ----------------------------------------------------------------------------
+
+CEpos2MarkerCapture::~CEpos2MarkerCapture()
+{
+  this->stop();
+}
+
+// ----------------------------------------------------------------------------
+//   THREAD
+// ----------------------------------------------------------------------------
+
+void CEpos2MarkerCapture::start()
+{
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if(this->running)
+      return;
+  }
+  // thread stopped by an error
+  if(this->thread.joinable())
+    this->thread.join();
+
+  std::lock_guard<std::mutex> lock(this->mutex);
+
+  if(this->running)
+    return;
+  this->running = true;
+  this->error.clear();
+  this->thread = std::thread(&CEpos2MarkerCapture::run, this);
+}
+
+void CEpos2MarkerCapture::stop()
+{
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->running = false;
+  }
+  this->cond.notify_all();
+
+  if(this->thread.joinable())
+    this->thread.join();
+}
+
+long CEpos2MarkerCapture::getPeriod()
+{
+  std::lock_guard<std::mutex> lock(this->mutex);
+  return this->period_us;
+}
+
+void CEpos2MarkerCapture::setPeriod(long period_us)
+{
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->period_us = period_us;
+}
+
+void CEpos2MarkerCapture::setCallback(const std::function<void(const epos_marker&)> &callback)
+{
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->callback = callback;
+}
+
+void CEpos2MarkerCapture::run()
+{
+  std::vector<epos_marker> markers;
+  unsigned long counter;
+  std::chrono::steady_clock::time_point next = std::chrono::steady_clock::now();
+
+  try
+  {
+    counter = this->axis->getPositionMarkerCounter();
+  }
+  catch(std::exception &e)
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->error = e.what();
+    this->running = false;
+    this->cond.notify_all();
+    return;
+  }
+
+  while(true)
+  {
+    std::function<void(const epos_marker&)> cb;
+
+    {
+      std::unique_lock<std::mutex> lock(this->mutex);
+      next += std::chrono::microseconds(this->period_us);
+      this->cond.wait_until(lock, next, [this]{ return !this->running; });
+      if(!this->running)
+        break;
+      cb = this->callback;
+    }
+
+    // don't try to catch up after a long stall
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if(next < now)
+      next = now;
+
+    markers.clear();
+    try
+    {
+      counter = this->poll(counter, markers);
+    }
+    catch(std::exception &e)
+    {
+      std::lock_guard<std::mutex> lock(this->mutex);
+      this->error = e.what();
+      this->running = false;
+      this->cond.notify_all();
+      return;
+    }
+
+    if(markers.empty())
+      continue;
+
+    if(cb)
+      for(size_t i = 0; i < markers.size(); i++)
+        cb(markers[i]);
+
+    {
+      std::lock_guard<std::mutex> lock(this->mutex);
+      for(size_t i = 0; i < markers.size(); i++)
+      {
+        if(this->queue.size() >= this->queue_size)
+        {
+          this->queue.pop_front();
+          this->dropped++;
+        }
+        this->queue.push_back(markers[i]);
+      }
+    }
+    this->cond.notify_all();
+  }
+}
+
+unsigned long CEpos2MarkerCapture::poll(unsigned long counter,
+                                        std::vector<epos_marker> &markers)
+{
+  // captured position, history 1, history 2: newest first
+  long position[3];
+
+  unsigned long actual = this->axis->getPositionMarkerCounter();
+
+  // retry if a marker arrives while the buffers are read, they would shift
+  for(int retry = 0; retry < 3; retry++)
+  {
+    std::chrono::steady_clock::time_point stamp = std::chrono::steady_clock::now();
+    unsigned long count = (actual - counter) & 0xFFFF;   // 16 bit counter
+
+    if(count == 0)
+      return actual;
+
+    unsigned long read = count < 3 ? count : 3;
+    for(unsigned long i = 0; i < read; i++)
+      position[i] = this->axis->getPositionMarker(i);
+
+    unsigned long check = this->axis->getPositionMarkerCounter();
+    if(check != actual)
+    {
+      actual = check;
+      continue;
+    }
+
+    if(count > read)
+    {
+      std::lock_guard<std::mutex> lock(this->mutex);
+      this->overruns += count - read;
+    }
+
+    for(unsigned long i = read; i > 0; i--)
+    {
+      epos_marker m;
+      m.position = position[i-1];
+      m.counter  = (actual - (i-1)) & 0xFFFF;
+      m.stamp    = stamp;
+      markers.push_back(m);
+    }
+    return actual;
+  }
+
+  // markers keep arriving faster than they can be read
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->overruns += (actual - counter) & 0xFFFF;
+  return actual;
+}
+
+// ----------------------------------------------------------------------------
+//   QUEUE
+// ----------------------------------------------------------------------------
+
+bool CEpos2MarkerCapture::pop(epos_marker &marker, long timeout_ms)
+{
+  std::unique_lock<std::mutex> lock(this->mutex);
+  std::chrono::steady_clock::time_point deadline =
+    std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+
+  while(this->queue.empty())
+  {
+    if(!this->error.empty())
+      throw EPOS2IOException(this->error);
+    if(!this->running || timeout_ms == 0)
+      return false;
+
+    if(timeout_ms < 0)
+      this->cond.wait(lock);
+    else if(this->cond.wait_until(lock, deadline) == std::cv_status::timeout
+            && this->queue.empty())
+      return false;
+  }
+
+  marker = this->queue.front();
+  this->queue.pop_front();
+  return true;
+}
+
+size_t CEpos2MarkerCapture::pending()
+{
+  std::lock_guard<std::mutex> lock(this->mutex);
+  return this->queue.size();
+}
+
+unsigned long CEpos2MarkerCapture::getOverruns()
+{
+  std::lock_guard<std::mutex> lock(this->mutex);
+  return this->overruns;
+}
+
+unsigned long CEpos2MarkerCapture::getDropped()
+{
+  std::lock_guard<std::mutex> lock(this->mutex);
+  return this->dropped;
+}
@@ -0,0 +1,228 @@
+// Copyright (C) 2009-2010 Institut de Robòtica i Informàtica Industrial, CSIC-UPC.
+// Author Martí Morta Garriga  (mmorta@iri.upc.edu)
+// All rights reserved.
+//
+// Copyright (C) 2013 Jochen Sprickerhof <jochen@sprickerhof.de>
+//
+// This file is part of IRI EPOS2 Driver
+// IRI EPOS2 Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <new>
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <csignal>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include "epos2_motor_controller/Epos2Mirror.h"
+
+static int64_t toNs(const std::chrono::steady_clock::time_point &time)
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+}
+
+// ----------------------------------------------------------------------------
+//   CLASS
+// ----------------------------------------------------------------------------
+//     CONSTRUCTOR
+// ----------------------------------------------------------------------------
+
+CEpos2Mirror::CEpos2Mirror(CEpos2 *axis, const std::string &name)
+  : axis(axis), name(name.empty() ? defaultName(axis->node_id, axis->link->serial) : name),
+    shm(NULL), fd(-1)
+{
+  if(axis->mirror != NULL)
+    throw std::invalid_argument("EPOS2 axis already attached to a mirror");
+
+  // a segment of a dead process is replaced, readers map the new one; a
+  // live one is someone else's
+  pid_t owner;
+  if(ownerAlive(this->name, owner))
+  {
+    std::stringstream s;
+    s << "EPOS2 mirror " << this->name << " is in use by process " << owner;
+    throw EPOS2IOException(s.str());
+  }
+  shm_unlink(this->name.c_str());
+  this->fd = shm_open(this->name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+  if(this->fd < 0 || ftruncate(this->fd, sizeof(epos2_mirror_segment)) != 0)
+  {
+    std::stringstream s;
+    s << "EPOS2 mirror can't create shared memory " << this->name << ": " << strerror(errno);
+    if(this->fd >= 0)
+      close(this->fd);
+    throw EPOS2IOException(s.str());
+  }
+
+  void *p = mmap(NULL, sizeof(epos2_mirror_segment), PROT_READ | PROT_WRITE, MAP_SHARED, this->fd, 0);
+  if(p == MAP_FAILED)
+  {
+    std::stringstream s;
+    s << "EPOS2 mirror can't map shared memory " << this->name << ": " << strerror(errno);
+    close(this->fd);
+    shm_unlink(this->name.c_str());
+    throw EPOS2IOException(s.str());
+  }
+
+  // ftruncate zeroed it: no keys, seq 0
+  this->shm = new (p) epos2_mirror_segment;
+  this->shm->version   = EPOS2_MIRROR_VERSION;
+  this->shm->owner_pid = getpid();
+  this->shm->node_id   = axis->node_id;
+  this->shm->magic.store(EPOS2_MIRROR_MAGIC, std::memory_order_release);
+
+  {
+    std::lock_guard<std::mutex> lock(axis->read_mutex);
+    for(size_t i = 0; i < axis->read_values.size(); i++)
+    {
+      const CEpos2::read_flight &v = axis->read_values[i];
+      if(v.done)
+        this->update(v.index, v.subindex, v.sample.value, v.sample.sampled, false);
+    }
+  }
+  if(axis->position_tracker.isValid())
+    this->updatePosition(axis->position_tracker.getPosition(), std::chrono::steady_clock::now());
+
+  CEpos2Mirror *none = NULL;
+  if(!axis->mirror.compare_exchange_strong(none, this))
+  {
+    this->shm->magic.store(0);
+    munmap(this->shm, sizeof(epos2_mirror_segment));
+    close(this->fd);
+    shm_unlink(this->name.c_str());
+    throw std::invalid_argument("EPOS2 axis already attached to a mirror");
+  }
+}
+
+//     DESTRUCTOR
+// ----------------------------------------------------------------------------
+
+CEpos2Mirror::~CEpos2Mirror()
+{
+  // no new update starts, the ones in progress finish before the unmap
+  this->axis->mirror.store(NULL);
+  while(this->axis->mirror_users.load() != 0)
+    std::this_thread::yield();
+
+  this->shm->magic.store(0);
+  munmap(this->shm, sizeof(epos2_mirror_segment));
+  close(this->fd);
+  shm_unlink(this->name.c_str());
+}
+
+std::string CEpos2Mirror::getName()
+{
+  return this->name;
+}
+
+std::string CEpos2Mirror::defaultName(long node_id, const std::string &serial)
+{
+  std::stringstream s;
+  s << "/epos2_mirror_";
+  if(!serial.empty())
+    s << serial << "_";
+  s << node_id;
+  return s.str();
+}
+
+bool CEpos2Mirror::ownerAlive(const std::string &name, pid_t &owner)
+{
+  int fd = shm_open(name.c_str(), O_RDONLY, 0);
+  if(fd < 0)
+    return false;
+
+  struct stat st;
+  bool alive = false;
+  if(fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(epos2_mirror_segment))
+  {
+    void *p = mmap(NULL, sizeof(epos2_mirror_segment), PROT_READ, MAP_SHARED, fd, 0);
+    if(p != MAP_FAILED)
+    {
+      const epos2_mirror_segment *shm = (const epos2_mirror_segment*)p;
+      owner = shm->owner_pid;
+      alive = shm->magic.load(std::memory_order_acquire) == EPOS2_MIRROR_MAGIC &&
+              (kill(owner, 0) == 0 || errno == EPERM);
+      munmap(p, sizeof(epos2_mirror_segment));
+    }
+  }
+  close(fd);
+
+  return alive;
+}
+
+// ----------------------------------------------------------------------------
+//   UPDATES
+// ----------------------------------------------------------------------------
+
+void CEpos2Mirror::update(int16_t index, int8_t subindex, int32_t value,
+                          const std::chrono::steady_clock::time_point &time, bool write)
+{
+  epos2_mirror_segment *shm = this->shm;
+  uint32_t key = epos2MirrorKey(index, subindex);
+  size_t i = epos2MirrorHash(key);
+  size_t probes = 0;
+
+  std::lock_guard<std::mutex> lock(this->mutex);
+
+  // only this process writes, the lookup needs no seqlock
+  while(shm->entries[i].key != key && shm->entries[i].key != 0 && probes < EPOS2_MIRROR_ENTRIES)
+  {
+    i = (i + 1) & (EPOS2_MIRROR_ENTRIES - 1);
+    probes++;
+  }
+
+  uint64_t seq = shm->seq.load(std::memory_order_relaxed);
+  shm->seq.store(seq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  if(probes == EPOS2_MIRROR_ENTRIES)
+    shm->dropped++;
+  else
+  {
+    epos2_mirror_entry &e = shm->entries[i];
+    if(e.key == 0)
+    {
+      e.key = key;
+      shm->used++;
+    }
+    e.value   = value;
+    e.time_ns = toNs(time);
+    if(write)
+      e.writes++;
+    else
+      e.reads++;
+  }
+
+  shm->seq.store(seq + 2, std::memory_order_release);
+}
+
+void CEpos2Mirror::updatePosition(int64_t position, const std::chrono::steady_clock::time_point &time)
+{
+  epos2_mirror_segment *shm = this->shm;
+
+  std::lock_guard<std::mutex> lock(this->mutex);
+
+  uint64_t seq = shm->seq.load(std::memory_order_relaxed);
+  shm->seq.store(seq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  shm->position         = position;
+  shm->position_time_ns = toNs(time);
+
+  shm->seq.store(seq + 2, std::memory_order_release);
+}
@@ -0,0 +1,235 @@
+// Copyright (C) 2009-2010 Institut de Robòtica i Informàtica Industrial, CSIC-UPC.
+// Author Martí Morta Garriga  (mmorta@iri.upc.edu)
+// All rights reserved.
+//
+// Copyright (C) 2013 Jochen Sprickerhof <jochen@sprickerhof.de>
+//
+// This file is part of IRI EPOS2 Driver
+// IRI EPOS2 Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <thread>
+#include <chrono>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <sstream>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "epos2_motor_controller/Epos2MirrorView.h"
+
+static bool valueOrder(const CEpos2MirrorView::epos_mirror_value &a,
+                       const CEpos2MirrorView::epos_mirror_value &b)
+{
+  if(a.index != b.index)
+    return (uint16_t)a.index < (uint16_t)b.index;
+  return (uint8_t)a.subindex < (uint8_t)b.subindex;
+}
+
+// ----------------------------------------------------------------------------
+//   CLASS
+// ----------------------------------------------------------------------------
+//     CONSTRUCTOR
+// ----------------------------------------------------------------------------
+
+CEpos2MirrorView::CEpos2MirrorView(const std::string &name)
+  : name(name), shm(NULL), fd(-1)
+{
+  struct stat st;
+  std::stringstream s;
+
+  this->fd = shm_open(name.c_str(), O_RDONLY, 0);
+  if(this->fd < 0)
+  {
+    s << "EPOS2 mirror " << name << " not found: " << strerror(errno);
+    throw EPOS2IOException(s.str());
+  }
+  if(fstat(this->fd, &st) != 0 || (size_t)st.st_size < sizeof(epos2_mirror_segment))
+  {
+    close(this->fd);
+    s << "EPOS2 mirror " << name << " has a bad shared memory size";
+    throw EPOS2IOException(s.str());
+  }
+
+  void *p = mmap(NULL, sizeof(epos2_mirror_segment), PROT_READ, MAP_SHARED, this->fd, 0);
+  if(p == MAP_FAILED)
+  {
+    close(this->fd);
+    s << "EPOS2 mirror " << name << " can't be mapped: " << strerror(errno);
+    throw EPOS2IOException(s.str());
+  }
+  this->shm = (const epos2_mirror_segment*)p;
+
+  if(this->shm->magic.load(std::memory_order_acquire) != EPOS2_MIRROR_MAGIC ||
+     this->shm->version != EPOS2_MIRROR_VERSION)
+  {
+    munmap(p, sizeof(epos2_mirror_segment));
+    close(this->fd);
+    s << "EPOS2 mirror " << name << " is not ready or has another version";
+    throw EPOS2IOException(s.str());
+  }
+}
+
+//     DESTRUCTOR
+// ----------------------------------------------------------------------------
+
+CEpos2MirrorView::~CEpos2MirrorView()
+{
+  munmap((void*)this->shm, sizeof(epos2_mirror_segment));
+  close(this->fd);
+}
+
+long CEpos2MirrorView::getNodeId()
+{
+  return this->shm->node_id;
+}
+
+bool CEpos2MirrorView::isOwnerAlive()
+{
+  return this->shm->magic.load(std::memory_order_acquire) == EPOS2_MIRROR_MAGIC &&
+         (kill(this->shm->owner_pid, 0) == 0 || errno == EPERM);
+}
+
+uint64_t CEpos2MirrorView::getGeneration()
+{
+  return this->shm->seq.load(std::memory_order_acquire) / 2;
+}
+
+// ----------------------------------------------------------------------------
+//   READS
+// ----------------------------------------------------------------------------
+
+uint64_t CEpos2MirrorView::beginRead()
+{
+  uint64_t seq;
+
+  // an update is a few stores, spinning is cheaper than anything else; a
+  // writer that died in an update leaves seq odd for good
+  std::chrono::steady_clock::time_point deadline;
+  unsigned long spins = 0;
+  while((seq = this->shm->seq.load(std::memory_order_acquire)) & 1)
+  {
+    if(++spins % 1024 == 0)
+    {
+      std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+      if(spins == 1024)
+        deadline = now + std::chrono::milliseconds(EPOS2_MIRROR_WRITE_TIMEOUT_MS);
+      else if(now >= deadline)
+      {
+        if(!this->isOwnerAlive())
+          throw EPOS2IOException("EPOS2 mirror " + this->name + " owner died while writing");
+        throw EPOS2IOException("EPOS2 mirror " + this->name + " is being written for too long");
+      }
+    }
+    std::this_thread::yield();
+  }
+
+  return seq;
+}
+
+bool CEpos2MirrorView::endRead(uint64_t seq)
+{
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return this->shm->seq.load(std::memory_order_relaxed) == seq;
+}
+
+bool CEpos2MirrorView::get(int16_t index, int8_t subindex, epos_mirror_value &value)
+{
+  uint32_t key = epos2MirrorKey(index, subindex);
+  bool found;
+  uint64_t seq;
+
+  do
+  {
+    seq = this->beginRead();
+    found = false;
+
+    size_t i = epos2MirrorHash(key);
+    for(size_t probes = 0; probes < EPOS2_MIRROR_ENTRIES; probes++)
+    {
+      const epos2_mirror_entry &e = this->shm->entries[i];
+      if(e.key == 0)
+        break;
+      if(e.key == key)
+      {
+        value.index    = index;
+        value.subindex = subindex;
+        value.value    = e.value;
+        value.time_ns  = e.time_ns;
+        value.reads    = e.reads;
+        value.writes   = e.writes;
+        found = true;
+        break;
+      }
+      i = (i + 1) & (EPOS2_MIRROR_ENTRIES - 1);
+    }
+  }
+  while(!this->endRead(seq));
+
+  return found;
+}
+
+void CEpos2MirrorView::getPosition(int64_t &position, int64_t &time_ns)
+{
+  uint64_t seq;
+
+  do
+  {
+    seq = this->beginRead();
+    position = this->shm->position;
+    time_ns  = this->shm->position_time_ns;
+  }
+  while(!this->endRead(seq));
+}
+
+CEpos2MirrorView::epos_mirror_snapshot CEpos2MirrorView::snapshot()
+{
+  epos_mirror_snapshot snapshot;
+  uint64_t seq;
+
+  snapshot.values.reserve(EPOS2_MIRROR_ENTRIES);
+  do
+  {
+    seq = this->beginRead();
+    snapshot.values.clear();
+    snapshot.generation       = seq / 2;
+    snapshot.position         = this->shm->position;
+    snapshot.position_time_ns = this->shm->position_time_ns;
+    snapshot.dropped          = this->shm->dropped;
+
+    for(size_t i = 0; i < EPOS2_MIRROR_ENTRIES; i++)
+    {
+      const epos2_mirror_entry &e = this->shm->entries[i];
+      if(e.key == 0)
+        continue;
+
+      epos_mirror_value v;
+      v.index    = (int16_t)((e.key - 1) >> 8);
+      v.subindex = (int8_t)((e.key - 1) & 0xFF);
+      v.value    = e.value;
+      v.time_ns  = e.time_ns;
+      v.reads    = e.reads;
+      v.writes   = e.writes;
+      snapshot.values.push_back(v);
+    }
+  }
+  while(!this->endRead(seq));
+
+  std::sort(snapshot.values.begin(), snapshot.values.end(), valueOrder);
+
+  return snapshot;
+}
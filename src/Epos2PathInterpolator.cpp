@@ -0,0 +1,515 @@
+// Copyright (C) 2009-2010 Institut de Robòtica i Informàtica Industrial, CSIC-UPC.
+// Author Martí Morta Garriga  (mmorta@iri.upc.edu)
+// All rights reserved.
+//
+// Copyright (C) 2013 Jochen Sprickerhof <jochen@sprickerhof.de>
+//
+// This file is part of IRI EPOS2 Driver
+// IRI EPOS2 Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <cmath>
+#include <chrono>
+#include <thread>
+#include <stdexcept>
+#include <algorithm>
+#include "epos2_motor_controller/Epos2PathInterpolator.h"
+
+// ----------------------------------------------------------------------------
+//   CLASS
+// ----------------------------------------------------------------------------
+//     CONSTRUCTOR
+// ----------------------------------------------------------------------------
+
+CEpos2PathInterpolator::CEpos2PathInterpolator(CEpos2AxisGroup &group, long cycle_us)
+  : cycle_us(cycle_us), acceleration(1.0), deviation(0.01), duration(0.0),
+    planned(false), stop_requested(false)
+{
+  for(size_t i = 0; i < group.size(); i++)
+  {
+    CEpos2 *axis = group.getAxis(i);
+    this->axes.push_back(axis);
+    this->scale.push_back(1.0);
+    // [qc/s] to [rev/min]
+    this->rpm_per_qcs.push_back(60.0 / (4.0 * axis->getEncoderPulseNumber()));
+  }
+  this->last.assign(this->axes.size(), 0.0);
+  this->resetPathError();
+}
+
+//     SET SCALE
+// ----------------------------------------------------------------------------
+
+void CEpos2PathInterpolator::setScale(size_t axis, double qc_per_unit)
+{
+  if(axis >= this->axes.size())
+    throw std::invalid_argument("EPOS2 path has no such axis");
+
+  this->scale[axis] = qc_per_unit;
+}
+
+//     SET LIMITS
+// ----------------------------------------------------------------------------
+
+void CEpos2PathInterpolator::setLimits(double acceleration, double deviation)
+{
+  if(acceleration <= 0.0 || deviation < 0.0)
+    throw std::invalid_argument("EPOS2 path limits are invalid");
+
+  this->acceleration = acceleration;
+  this->deviation    = deviation;
+  this->planned      = false;
+}
+
+// ----------------------------------------------------------------------------
+//   PATH
+// ----------------------------------------------------------------------------
+
+void CEpos2PathInterpolator::setStart()
+{
+  std::vector<double> position(this->axes.size());
+
+  for(size_t i = 0; i < this->axes.size(); i++)
+    position[i] = this->axes[i]->readPosition() / this->scale[i];
+
+  this->setStart(position);
+}
+
+void CEpos2PathInterpolator::setStart(const std::vector<double> &position)
+{
+  if(position.size() != this->axes.size())
+    throw std::invalid_argument("EPOS2 path needs one coordinate per axis");
+
+  this->segments.clear();
+  this->last     = position;
+  this->duration = 0.0;
+  this->planned  = false;
+}
+
+void CEpos2PathInterpolator::lineTo(const std::vector<double> &end, double feed)
+{
+  if(end.size() != this->axes.size())
+    throw std::invalid_argument("EPOS2 path needs one coordinate per axis");
+  if(feed <= 0.0)
+    throw std::invalid_argument("EPOS2 path feed must be positive");
+
+  path_segment seg;
+  seg.arc    = false;
+  seg.start  = this->last;
+  seg.end    = end;
+  seg.x      = seg.y = 0;
+  seg.cx     = seg.cy = seg.radius = seg.angle = seg.sweep = 0.0;
+  seg.feed   = feed;
+
+  double length = 0.0;
+  for(size_t i = 0; i < end.size(); i++)
+    length += (end[i] - seg.start[i]) * (end[i] - seg.start[i]);
+  seg.length = std::sqrt(length);
+
+  // nothing to move
+  if(seg.length == 0.0)
+    return;
+
+  this->segments.push_back(seg);
+  this->last    = end;
+  this->planned = false;
+}
+
+void CEpos2PathInterpolator::arcTo(const std::vector<double> &end, size_t x, size_t y,
+                                   double cx, double cy, bool ccw, double feed)
+{
+  if(end.size() != this->axes.size())
+    throw std::invalid_argument("EPOS2 path needs one coordinate per axis");
+  if(x >= end.size() || y >= end.size() || x == y)
+    throw std::invalid_argument("EPOS2 path arc plane is invalid");
+  if(feed <= 0.0)
+    throw std::invalid_argument("EPOS2 path feed must be positive");
+
+  path_segment seg;
+  seg.arc    = true;
+  seg.start  = this->last;
+  seg.end    = end;
+  seg.x      = x;
+  seg.y      = y;
+  seg.cx     = cx;
+  seg.cy     = cy;
+
+  double rs = std::hypot(seg.start[x] - cx, seg.start[y] - cy);
+  double re = std::hypot(end[x] - cx, end[y] - cy);
+  if(rs == 0.0 || std::fabs(rs - re) > 1e-3 * rs)
+    throw std::invalid_argument("EPOS2 path arc end is not on the circle");
+
+  seg.radius = rs;
+  seg.angle  = std::atan2(seg.start[y] - cy, seg.start[x] - cx);
+  seg.sweep  = std::atan2(end[y] - cy, end[x] - cx) - seg.angle;
+  if(ccw)
+    while(seg.sweep <= 0.0) seg.sweep += 2.0 * M_PI;
+  else
+    while(seg.sweep >= 0.0) seg.sweep -= 2.0 * M_PI;
+
+  double length = seg.radius * seg.sweep * seg.radius * seg.sweep;
+  for(size_t i = 0; i < end.size(); i++)
+    if(i != x && i != y)
+      length += (end[i] - seg.start[i]) * (end[i] - seg.start[i]);
+  seg.length = std::sqrt(length);
+
+  seg.feed = feed;
+
+  this->segments.push_back(seg);
+  this->last    = end;
+  this->planned = false;
+}
+
+void CEpos2PathInterpolator::point(const path_segment &seg, double s,
+                                   double *position, double *tangent) const
+{
+  double f = s / seg.length;
+
+  for(size_t i = 0; i < seg.start.size(); i++)
+  {
+    position[i] = seg.start[i] + f * (seg.end[i] - seg.start[i]);
+    tangent[i]  = (seg.end[i] - seg.start[i]) / seg.length;
+  }
+
+  if(seg.arc)
+  {
+    double theta = seg.angle + f * seg.sweep;
+    double w = seg.sweep / seg.length;     // [rad/unit]
+    position[seg.x] = seg.cx + seg.radius * std::cos(theta);
+    position[seg.y] = seg.cy + seg.radius * std::sin(theta);
+    tangent[seg.x]  = -seg.radius * std::sin(theta) * w;
+    tangent[seg.y]  =  seg.radius * std::cos(theta) * w;
+  }
+}
+
+// ----------------------------------------------------------------------------
+//   PLANNING
+// ----------------------------------------------------------------------------
+
+double CEpos2PathInterpolator::plan()
+{
+  size_t n = this->segments.size();
+  size_t dim = this->axes.size();
+  double a = this->acceleration;
+  std::vector<double> p(dim), t_out(dim), t_in(dim);
+
+  // feed, arcs also limited by the centripetal acceleration
+  std::vector<double> feed(n);
+  for(size_t k = 0; k < n; k++)
+  {
+    const path_segment &seg = this->segments[k];
+    feed[k] = seg.feed;
+    if(seg.arc)
+      feed[k] = std::min(feed[k], std::sqrt(a * seg.radius));
+  }
+
+  // maximum velocity at the start of every segment, from the corner angle
+  std::vector<double> entry(n + 1, 0.0);
+  for(size_t k = 1; k < n; k++)
+  {
+    const path_segment &prev = this->segments[k-1];
+    const path_segment &next = this->segments[k];
+    this->point(prev, prev.length, &p[0], &t_out[0]);
+    this->point(next, 0.0, &p[0], &t_in[0]);
+
+    double cos_theta = 0.0;
+    for(size_t i = 0; i < dim; i++)
+      cos_theta -= t_out[i] * t_in[i];
+
+    double v = std::min(feed[k-1], feed[k]);
+    if(cos_theta > 0.999999)
+      v = 0.0;                                          // reversal
+    else if(cos_theta > -0.999999)
+    {
+      double sin_half = std::sqrt((1.0 - cos_theta) / 2.0);
+      v = std::min(v, std::sqrt(a * this->deviation * sin_half / (1.0 - sin_half)));
+    }
+    entry[k] = v;
+  }
+
+  // lookahead: every junction must be reachable braking from the previous one
+  for(size_t k = n; k-- > 0;)
+    entry[k] = std::min(entry[k],
+        std::sqrt(entry[k+1]*entry[k+1] + 2.0*a*this->segments[k].length));
+  for(size_t k = 0; k < n; k++)
+    entry[k+1] = std::min(entry[k+1],
+        std::sqrt(entry[k]*entry[k] + 2.0*a*this->segments[k].length));
+
+  // trapezoidal velocity on every segment
+  double t = 0.0;
+  for(size_t k = 0; k < n; k++)
+  {
+    path_segment &seg = this->segments[k];
+    double v0 = entry[k], v1 = entry[k+1];
+    double vp = std::min(feed[k],
+        std::sqrt((2.0*a*seg.length + v0*v0 + v1*v1) / 2.0));
+    vp = std::max(vp, std::max(v0, v1));
+
+    double d_acc = (vp*vp - v0*v0) / (2.0*a);
+    double d_dec = (vp*vp - v1*v1) / (2.0*a);
+
+    seg.t        = t;
+    seg.v_entry  = v0;
+    seg.v_peak   = vp;
+    seg.v_exit   = v1;
+    seg.t_acc    = (vp - v0) / a;
+    seg.t_dec    = (vp - v1) / a;
+    seg.t_cruise = std::max(0.0, (seg.length - d_acc - d_dec) / vp);
+
+    t += seg.t_acc + seg.t_cruise + seg.t_dec;
+  }
+
+  this->duration = t;
+  this->planned  = true;
+  return this->duration;
+}
+
+//     EVALUATE
+// ----------------------------------------------------------------------------
+
+void CEpos2PathInterpolator::evaluate(double t, double *position, double *velocity) const
+{
+  size_t dim = this->axes.size();
+
+  if(this->segments.empty() || t >= this->duration)
+  {
+    for(size_t i = 0; i < dim; i++)
+    {
+      position[i] = this->last[i];
+      if(velocity) velocity[i] = 0.0;
+    }
+    return;
+  }
+
+  if(t < 0.0)
+    t = 0.0;
+
+  // last segment starting at or before t
+  size_t k = std::upper_bound(this->segments.begin(), this->segments.end(), t,
+      [](double t, const path_segment &seg){ return t < seg.t; })
+    - this->segments.begin() - 1;
+  const path_segment &seg = this->segments[k];
+  double a = this->acceleration;
+  double tau = t - seg.t;
+  double s, v;
+
+  if(tau < seg.t_acc)
+  {
+    s = seg.v_entry*tau + a*tau*tau/2.0;
+    v = seg.v_entry + a*tau;
+  }else if(tau < seg.t_acc + seg.t_cruise){
+    s = (seg.v_peak*seg.v_peak - seg.v_entry*seg.v_entry) / (2.0*a)
+        + seg.v_peak*(tau - seg.t_acc);
+    v = seg.v_peak;
+  }else{
+    double td = std::min(tau - seg.t_acc - seg.t_cruise, seg.t_dec);
+    s = (seg.v_peak*seg.v_peak - seg.v_entry*seg.v_entry) / (2.0*a)
+        + seg.v_peak*seg.t_cruise + seg.v_peak*td - a*td*td/2.0;
+    v = seg.v_peak - a*td;
+  }
+  s = std::min(std::max(s, 0.0), seg.length);
+
+  std::vector<double> tangent(dim);
+  this->point(seg, s, position, &tangent[0]);
+  if(velocity)
+    for(size_t i = 0; i < dim; i++)
+      velocity[i] = v * tangent[i];
+}
+
+// ----------------------------------------------------------------------------
+//   EXECUTION
+// ----------------------------------------------------------------------------
+//     RUN IPM
+// ----------------------------------------------------------------------------
+
+bool CEpos2PathInterpolator::runIpm(const std::vector<CEpos2Ipm*> &ipm)
+{
+  size_t dim = this->axes.size();
+
+  if(ipm.size() != dim)
+    throw std::invalid_argument("EPOS2 path needs one IPM engine per axis");
+  if(this->cycle_us % 1000 != 0 || this->cycle_us < 1000 || this->cycle_us > 255000)
+    throw std::invalid_argument("EPOS2 path cycle must be 1 to 255 ms for IPM");
+  if(!this->planned)
+    this->plan();
+
+  double dt = this->cycle_us / 1e6;
+  size_t points = (size_t)std::ceil(this->duration / dt) + 1;
+  std::vector<double> p(dim), v(dim);
+  std::vector<std::vector<CEpos2Ipm::epos_pvt_point> > pvt(dim,
+      std::vector<CEpos2Ipm::epos_pvt_point>(points));
+
+  // point k ends at (k+1)*dt, the last one at rest on the end point
+  for(size_t k = 0; k < points; k++)
+  {
+    this->evaluate((k+1) * dt, &p[0], &v[0]);
+    for(size_t i = 0; i < dim; i++)
+    {
+      pvt[i][k].position = std::lround(p[i] * this->scale[i]);
+      pvt[i][k].velocity = std::lround(v[i] * this->scale[i] * this->rpm_per_qcs[i]);
+      pvt[i][k].time_ms  = this->cycle_us / 1000;
+    }
+  }
+
+  this->stop_requested = false;
+  for(size_t i = 0; i < dim; i++)
+    ipm[i]->push(&pvt[i][0], points);
+  // all buffers loaded, then the starts back to back
+  CEpos2Ipm::startAll(ipm);
+
+  // the path starts when the first start was written, not when startAll
+  // returned after the answers of all axes
+  std::chrono::steady_clock::time_point start = ipm[0]->getMotionStart();
+  for(size_t i = 1; i < dim; i++)
+    start = std::min(start, ipm[i]->getMotionStart());
+  std::chrono::steady_clock::time_point next = start;
+  std::vector<double> read(dim);
+
+  while(true)
+  {
+    next += std::chrono::microseconds(this->cycle_us);
+    std::this_thread::sleep_until(next);
+
+    if(this->stop_requested)
+    {
+      for(size_t i = 0; i < dim; i++)
+        ipm[i]->stop();
+      return false;
+    }
+
+    std::chrono::steady_clock::time_point before = std::chrono::steady_clock::now();
+    for(size_t i = 0; i < dim; i++)
+      read[i] = this->axes[i]->readPosition() / this->scale[i];
+    std::chrono::steady_clock::time_point after = std::chrono::steady_clock::now();
+
+    double t = std::chrono::duration<double>(before - start).count() +
+               std::chrono::duration<double>(after - before).count() / 2.0;
+    this->accountError(read, t);
+
+    if(t > this->duration + dt)
+      break;
+  }
+
+  for(size_t i = 0; i < dim; i++)
+    ipm[i]->waitFinished();
+
+  return true;
+}
+
+//     RUN VELOCITY
+// ----------------------------------------------------------------------------
+
+bool CEpos2PathInterpolator::runVelocity(double gain)
+{
+  size_t dim = this->axes.size();
+
+  if(!this->planned)
+    this->plan();
+
+  std::vector<double> p(dim), v(dim), read(dim);
+  bool finished = false;
+
+  this->stop_requested = false;
+
+  try
+  {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point next = start;
+
+    while(!this->stop_requested)
+    {
+      std::chrono::steady_clock::time_point before = std::chrono::steady_clock::now();
+      for(size_t i = 0; i < dim; i++)
+        read[i] = this->axes[i]->readPosition() / this->scale[i];
+      std::chrono::steady_clock::time_point after = std::chrono::steady_clock::now();
+
+      double t = std::chrono::duration<double>(before - start).count() +
+                 std::chrono::duration<double>(after - before).count() / 2.0;
+      this->accountError(read, t);
+
+      if(t > this->duration)
+      {
+        finished = true;
+        break;
+      }
+
+      this->evaluate(t, &p[0], &v[0]);
+      for(size_t i = 0; i < dim; i++)
+      {
+        double u = v[i] + gain * (p[i] - read[i]);     // [unit/s]
+        this->axes[i]->setTargetVelocity(
+            std::lround(u * this->scale[i] * this->rpm_per_qcs[i]));
+      }
+
+      next += std::chrono::microseconds(this->cycle_us);
+      std::this_thread::sleep_until(next);
+    }
+  }
+  catch(...)
+  {
+    for(size_t i = 0; i < dim; i++)
+    {
+      try { this->axes[i]->setTargetVelocity(0); }
+      catch(...) { }
+    }
+    throw;
+  }
+
+  for(size_t i = 0; i < dim; i++)
+    this->axes[i]->setTargetVelocity(0);
+
+  return finished;
+}
+
+//     STOP
+// ----------------------------------------------------------------------------
+
+void CEpos2PathInterpolator::stop()
+{
+  this->stop_requested = true;
+}
+
+// ----------------------------------------------------------------------------
+//   PATH ERROR
+// ----------------------------------------------------------------------------
+
+void CEpos2PathInterpolator::accountError(const std::vector<double> &read, double t)
+{
+  size_t dim = this->axes.size();
+  std::vector<double> p(dim);
+  double e = 0.0;
+
+  this->evaluate(t, &p[0]);
+  for(size_t i = 0; i < dim; i++)
+    e += (read[i] - p[i]) * (read[i] - p[i]);
+  e = std::sqrt(e);
+
+  this->error.count++;
+  this->error.last   = e;
+  this->error.total += e;
+  if(e > this->error.worst)
+    this->error.worst = e;
+}
+
+CEpos2PathInterpolator::epos_path_error CEpos2PathInterpolator::getPathError()
+{
+  return this->error;
+}
+
+void CEpos2PathInterpolator::resetPathError()
+{
+  this->error.count = 0;
+  this->error.last  = 0.0;
+  this->error.worst = 0.0;
+  this->error.total = 0.0;
+}
@@ -0,0 +1,162 @@
+// Copyright (C) 2009-2010 Institut de Robòtica i Informàtica Industrial, CSIC-UPC.
+// Author Martí Morta Garriga  (mmorta@iri.upc.edu)
+// All rights reserved.
+//
+// Copyright (C) 2013 Jochen Sprickerhof <jochen@sprickerhof.de>
+//
+// This file is part of IRI EPOS2 Driver
+// IRI EPOS2 Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+#include "epos2_motor_controller/Epos2PositionTracker.h"
+
+// ----------------------------------------------------------------------------
+//   CLASS
+// ----------------------------------------------------------------------------
+//     CONSTRUCTOR
+// ----------------------------------------------------------------------------
+
+CEpos2PositionTracker::CEpos2PositionTracker(unsigned int bits, uint32_t max_step)
+  : bits(bits), position(0), last_raw(0), valid(false), discontinuities(0)
+{
+  if(bits < 1 || bits > 32)
+    throw std::invalid_argument("EPOS2 position tracker counter width must be 1...32 bits");
+
+  this->mask = bits == 32 ? 0xFFFFFFFF : (1u << bits) - 1;
+  this->setMaxStep(max_step);
+}
+
+// ----------------------------------------------------------------------------
+//   TRACKING
+// ----------------------------------------------------------------------------
+
+int64_t CEpos2PositionTracker::signExtend(uint32_t value) const
+{
+  int64_t half = (int64_t)1 << (this->bits - 1);
+  int64_t v = value & this->mask;
+  return v >= half ? v - 2*half : v;
+}
+
+int64_t CEpos2PositionTracker::update(uint32_t raw)
+{
+  std::lock_guard<std::mutex> lock(this->mutex);
+
+  raw &= this->mask;
+
+  if(!this->valid)
+  {
+    this->position = this->signExtend(raw);
+    this->valid    = true;
+  }
+  else
+  {
+    // shortest difference modulo the counter range
+    int64_t step = this->signExtend(raw - this->last_raw);
+    if(step > (int64_t)this->max_step || -step > (int64_t)this->max_step)
+      this->discontinuities++;
+    else
+      this->position += step;
+  }
+
+  this->last_raw = raw;
+  return this->position;
+}
+
+int64_t CEpos2PositionTracker::getPosition() const
+{
+  std::lock_guard<std::mutex> lock(this->mutex);
+  return this->position;
+}
+
+bool CEpos2PositionTracker::isValid() const
+{
+  std::lock_guard<std::mutex> lock(this->mutex);
+  return this->valid;
+}
+
+void CEpos2PositionTracker::setMaxStep(uint32_t max_step)
+{
+  uint32_t half = (uint32_t)(((uint64_t)this->mask + 1) / 2);
+
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->max_step = max_step > half ? half : max_step;
+}
+
+unsigned long CEpos2PositionTracker::getDiscontinuities() const
+{
+  std::lock_guard<std::mutex> lock(this->mutex);
+  return this->discontinuities;
+}
+
+void CEpos2PositionTracker::reset()
+{
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->position        = 0;
+  this->last_raw        = 0;
+  this->valid           = false;
+  this->discontinuities = 0;
+}
+
+// ----------------------------------------------------------------------------
+//   STATE
+// ----------------------------------------------------------------------------
+
+CEpos2PositionTracker::epos_tracker_state CEpos2PositionTracker::getState() const
+{
+  std::lock_guard<std::mutex> lock(this->mutex);
+
+  epos_tracker_state state;
+  state.position = this->position;
+  state.last_raw = this->last_raw;
+  state.valid    = this->valid;
+  return state;
+}
+
+void CEpos2PositionTracker::setState(const epos_tracker_state &state)
+{
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->position = state.position;
+  this->last_raw = state.last_raw & this->mask;
+  this->valid    = state.valid;
+}
+
+bool CEpos2PositionTracker::save(const std::string &path) const
+{
+  epos_tracker_state state = this->getState();
+  std::string tmp = path + ".tmp";
+
+  {
+    std::ofstream out(tmp.c_str(), std::ios::trunc);
+    out << state.position << " " << state.last_raw << " " << state.valid << std::endl;
+    if(!out)
+      return false;
+  }
+
+  return std::rename(tmp.c_str(), path.c_str()) == 0;
+}
+
+bool CEpos2PositionTracker::load(const std::string &path)
+{
+  std::ifstream in(path.c_str());
+  epos_tracker_state state;
+
+  if(!(in >> state.position >> state.last_raw >> state.valid))
+    return false;
+
+  this->setState(state);
+  return true;
+}
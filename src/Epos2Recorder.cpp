@@ -0,0 +1,455 @@
+// Copyright (C) 2009-2010 Institut de Robòtica i Informàtica Industrial, CSIC-UPC.
+// Author Martí Morta Garriga  (mmorta@iri.upc.edu)
+// All rights reserved.
+//
+// Copyright (C) 2013 Jochen Sprickerhof <jochen@sprickerhof.de>
+//
+// This file is part of IRI EPOS2 Driver
+// IRI EPOS2 Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <cerrno>
+#include <cstring>
+#include <chrono>
+#include <sstream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "epos2_motor_controller/Epos2.h"
+#include "epos2_motor_controller/Epos2Recorder.h"
+
+// the file grows by this much, so the mapping is rarely moved
+static const uint64_t EXTENT = 16 << 20;
+
+static uint64_t zigzag(int64_t v)
+{
+  return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static size_t varintSize(uint64_t v)
+{
+  size_t n = 1;
+  while(v >= 0x80)
+  {
+    v >>= 7;
+    n++;
+  }
+  return n;
+}
+
+static void putVarint(std::vector<uint8_t> &out, uint64_t v)
+{
+  while(v >= 0x80)
+  {
+    out.push_back((uint8_t)(v | 0x80));
+    v >>= 7;
+  }
+  out.push_back((uint8_t)v);
+}
+
+// encodes n values with the smaller encoding (see Epos2RecordingFormat.h)
+static void encodeColumn(const int64_t *v, size_t n, std::vector<uint8_t> &out)
+{
+  uint64_t min = v[0], max = v[0];
+  size_t delta_size = 1;
+  int64_t prev = 0;
+
+  // the differences wrap like the decoder's sums, any pair of values works
+  for(size_t i = 0; i < n; i++)
+  {
+    delta_size += varintSize(zigzag((int64_t)((uint64_t)v[i] - (uint64_t)prev)));
+    prev = v[i];
+    if(v[i] < (int64_t)min)
+      min = v[i];
+    if(v[i] > (int64_t)max)
+      max = v[i];
+  }
+
+  uint64_t range = max - min;
+  unsigned width = range == 0 ? 0 : 64 - __builtin_clzll(range);
+  size_t for_size = 2 + varintSize(zigzag((int64_t)min)) + (n*width + 7)/8;
+
+  if(delta_size <= for_size)
+  {
+    out.push_back(EPOS2_REC_DELTA);
+    prev = 0;
+    for(size_t i = 0; i < n; i++)
+    {
+      putVarint(out, zigzag((int64_t)((uint64_t)v[i] - (uint64_t)prev)));
+      prev = v[i];
+    }
+    return;
+  }
+
+  out.push_back(EPOS2_REC_FOR);
+  putVarint(out, zigzag((int64_t)min));
+  out.push_back((uint8_t)width);
+  if(width == 0)
+    return;
+
+  uint64_t acc = 0;
+  unsigned bits = 0;
+  for(size_t i = 0; i < n; i++)
+  {
+    uint64_t x = (uint64_t)v[i] - min;
+    acc |= x << bits;
+    if(bits + width >= 64)
+    {
+      for(int b = 0; b < 8; b++)
+        out.push_back((uint8_t)(acc >> (8*b)));
+      acc = bits == 0 ? 0 : x >> (64 - bits);
+      bits = bits + width - 64;
+    }
+    else
+      bits += width;
+  }
+  for(unsigned b = 0; b < bits; b += 8)
+    out.push_back((uint8_t)(acc >> b));
+}
+
+// ----------------------------------------------------------------------------
+//   CLASS
+// ----------------------------------------------------------------------------
+//     CONSTRUCTOR
+// ----------------------------------------------------------------------------
+
+CEpos2Recorder::CEpos2Recorder(const std::string &path, const std::vector<std::string> &columns,
+                               size_t chunk_rows, size_t queue_rows, bool reopen)
+  : columns(columns.size()), chunk_rows(chunk_rows), queue_rows(queue_rows),
+    ring_head(0), ring_tail(0), chunk_fill(0), fd(-1), map(NULL), capacity(0), length(0),
+    dropped(0), chunks(0), raw_bytes(0), running(false), closed(false)
+{
+  if(columns.empty() || chunk_rows == 0 || queue_rows == 0)
+    throw std::invalid_argument("EPOS2 recorder needs columns, chunk and queue rows");
+
+  this->ring.reset(new int64_t[queue_rows * this->columns]);
+  this->chunk.resize(chunk_rows * this->columns);
+  // worst case: a 10 byte varint per value
+  this->encoded.reserve(chunk_rows * this->columns * 10 + this->columns * 16 + 8);
+  this->offsets.resize(this->columns + 1);
+
+  this->fd = open(path.c_str(), O_CREAT | (reopen ? 0 : O_TRUNC) | O_RDWR, 0644);
+  if(this->fd < 0)
+  {
+    std::stringstream s;
+    s << "EPOS2 recorder can't create " << path << ": " << strerror(errno);
+    throw EPOS2IOException(s.str());
+  }
+
+  std::string names;
+  for(size_t i = 0; i < columns.size(); i++)
+    names.append(columns[i].c_str(), columns[i].size() + 1);
+  names.resize((names.size() + 7) & ~(size_t)7, '\0');
+
+  try
+  {
+    if(!reopen || !this->reopen(path, names))
+    {
+      epos2_rec_file_header header;
+      memset(&header, 0, sizeof(header));
+      memcpy(header.magic, EPOS2_REC_MAGIC, sizeof(header.magic));
+      header.version    = EPOS2_REC_VERSION;
+      header.columns    = this->columns;
+      header.chunk_rows = chunk_rows;
+      header.names_size = names.size();
+      header.created_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            std::chrono::system_clock::now().time_since_epoch()).count();
+
+      this->put(&header, sizeof(header));
+      this->put(names.data(), names.size());
+    }
+  }
+  catch(...)
+  {
+    if(this->map != NULL)
+      munmap(this->map, this->capacity);
+    ::close(this->fd);
+    throw;
+  }
+
+  this->running = true;
+  this->thread = std::thread(&CEpos2Recorder::run, this);
+}
+
+//     DESTRUCTOR
+// ----------------------------------------------------------------------------
+
+CEpos2Recorder::~CEpos2Recorder()
+{
+  try
+  {
+    this->close();
+  }
+  catch(...)
+  {
+  }
+}
+
+//     REOPEN
+// ----------------------------------------------------------------------------
+
+bool CEpos2Recorder::reopen(const std::string &path, const std::string &names)
+{
+  struct stat st;
+  if(fstat(this->fd, &st) != 0)
+    throw EPOS2IOException(std::string("EPOS2 recorder can't stat ") + path + ": " + strerror(errno));
+  if(st.st_size == 0)
+    return false;
+
+  uint64_t size = st.st_size;
+  this->reserve(size);
+
+  epos2_rec_file_header header;
+  uint64_t data_offset = sizeof(header) + names.size();
+  if(size < data_offset)
+    throw EPOS2IOException("EPOS2 recorder can't append to " + path + ": not a recording");
+  memcpy(&header, this->map, sizeof(header));
+  if(memcmp(header.magic, EPOS2_REC_MAGIC, sizeof(header.magic)) != 0 ||
+     header.version != EPOS2_REC_VERSION)
+    throw EPOS2IOException("EPOS2 recorder can't append to " + path + ": not a recording or another version");
+  if(header.columns != this->columns || header.names_size != names.size() ||
+     memcmp(this->map + sizeof(header), names.data(), names.size()) != 0)
+    throw std::invalid_argument("EPOS2 recorder can't append to " + path + ": other columns");
+
+  // the chunks end at the index of a closed recording
+  uint64_t end = size;
+  epos2_rec_footer footer;
+  if(size >= data_offset + sizeof(footer))
+  {
+    memcpy(&footer, this->map + size - sizeof(footer), sizeof(footer));
+    if(memcmp(footer.magic, EPOS2_REC_INDEX_MAGIC, sizeof(footer.magic)) == 0 &&
+       footer.index_offset >= data_offset && footer.index_offset <= size - sizeof(footer))
+      end = footer.index_offset;
+  }
+
+  // as the reader walks them, up to the first incomplete chunk
+  uint64_t offset = data_offset;
+  epos2_rec_chunk_header chunk;
+  while(offset + sizeof(chunk) <= end)
+  {
+    memcpy(&chunk, this->map + offset, sizeof(chunk));
+    if(chunk.magic != EPOS2_REC_CHUNK_MAGIC || chunk.rows == 0 ||
+       chunk.size > end - offset - sizeof(chunk))
+      break;
+
+    epos2_rec_index_entry entry;
+    entry.offset  = offset;
+    entry.t_first = chunk.t_first;
+    entry.t_last  = chunk.t_last;
+    entry.rows    = chunk.rows;
+    this->index.push_back(entry);
+    offset += sizeof(chunk) + chunk.size;
+  }
+
+  // the old index and any partial chunk are zeroed, so a reader walking
+  // the file being written stops at the last chunk
+  memset(this->map + offset, 0, this->capacity - offset);
+  this->length.store(offset, std::memory_order_relaxed);
+
+  return true;
+}
+
+// ----------------------------------------------------------------------------
+//   RECORDING
+// ----------------------------------------------------------------------------
+
+bool CEpos2Recorder::append(const int64_t *row)
+{
+  uint64_t head = this->ring_head.load(std::memory_order_relaxed);
+
+  if(!this->running.load(std::memory_order_relaxed) ||
+     head - this->ring_tail.load(std::memory_order_acquire) >= this->queue_rows)
+  {
+    this->dropped.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+
+  memcpy(&this->ring[(head % this->queue_rows) * this->columns], row,
+         this->columns * sizeof(int64_t));
+  this->ring_head.store(head + 1, std::memory_order_release);
+
+  return true;
+}
+
+void CEpos2Recorder::close()
+{
+  if(this->closed)
+    return;
+  this->closed = true;
+
+  this->running = false;
+  if(this->thread.joinable())
+    this->thread.join();
+
+  munmap(this->map, this->capacity);
+  // the mapping was grown in extents, cut the unused end
+  if(ftruncate(this->fd, this->length) != 0)
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if(this->error.empty())
+      this->error = std::string("EPOS2 recorder can't truncate: ") + strerror(errno);
+  }
+  ::close(this->fd);
+
+  std::lock_guard<std::mutex> lock(this->mutex);
+  if(!this->error.empty())
+    throw EPOS2IOException(this->error);
+}
+
+size_t CEpos2Recorder::getColumnCount()
+{
+  return this->columns;
+}
+
+CEpos2Recorder::epos_recorder_stats CEpos2Recorder::getStatistics()
+{
+  epos_recorder_stats stats;
+
+  stats.rows      = this->ring_head.load(std::memory_order_relaxed);
+  stats.dropped   = this->dropped.load(std::memory_order_relaxed);
+  stats.chunks    = this->chunks.load(std::memory_order_relaxed);
+  stats.bytes     = this->length.load(std::memory_order_relaxed);
+  stats.raw_bytes = this->raw_bytes.load(std::memory_order_relaxed);
+
+  return stats;
+}
+
+// ----------------------------------------------------------------------------
+//   WRITER
+// ----------------------------------------------------------------------------
+
+void CEpos2Recorder::run()
+{
+  try
+  {
+    while(true)
+    {
+      // read before draining, so the rows appended before close are written
+      bool stop = !this->running;
+      uint64_t head = this->ring_head.load(std::memory_order_acquire);
+      uint64_t tail = this->ring_tail.load(std::memory_order_relaxed);
+
+      if(head == tail)
+      {
+        if(stop)
+          break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        continue;
+      }
+
+      for(; tail < head; tail++)
+      {
+        const int64_t *row = &this->ring[(tail % this->queue_rows) * this->columns];
+        for(size_t c = 0; c < this->columns; c++)
+          this->chunk[c * this->chunk_rows + this->chunk_fill] = row[c];
+        if(++this->chunk_fill == this->chunk_rows)
+          this->writeChunk();
+      }
+      this->ring_tail.store(tail, std::memory_order_release);
+    }
+
+    if(this->chunk_fill > 0)
+      this->writeChunk();
+
+    epos2_rec_footer footer;
+    memset(&footer, 0, sizeof(footer));
+    footer.index_offset = this->length;
+    footer.chunks       = this->index.size();
+    memcpy(footer.magic, EPOS2_REC_INDEX_MAGIC, sizeof(footer.magic));
+    if(!this->index.empty())
+      this->put(this->index.data(), this->index.size() * sizeof(epos2_rec_index_entry));
+    this->put(&footer, sizeof(footer));
+  }
+  catch(std::exception &e)
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->error   = e.what();
+    // append drops from now on
+    this->running = false;
+  }
+}
+
+void CEpos2Recorder::writeChunk()
+{
+  size_t n = this->chunk_fill;
+  size_t table = (this->columns + 1) * sizeof(uint32_t);
+
+  this->encoded.clear();
+  for(size_t c = 0; c < this->columns; c++)
+  {
+    this->offsets[c] = this->encoded.size();
+    encodeColumn(&this->chunk[c * this->chunk_rows], n, this->encoded);
+  }
+  this->offsets[this->columns] = this->encoded.size();
+  // chunk headers stay 8 byte aligned
+  while((table + this->encoded.size()) % 8 != 0)
+    this->encoded.push_back(0);
+
+  epos2_rec_chunk_header header;
+  header.magic   = EPOS2_REC_CHUNK_MAGIC;
+  header.rows    = n;
+  header.size    = table + this->encoded.size();
+  header.t_first = this->chunk[0];
+  header.t_last  = this->chunk[n - 1];
+
+  epos2_rec_index_entry entry;
+  entry.offset  = this->length;
+  entry.t_first = header.t_first;
+  entry.t_last  = header.t_last;
+  entry.rows    = n;
+
+  // the header last, so a reader walking the chunks of the file being
+  // written never finds a header without its columns
+  uint64_t at = entry.offset;
+  this->reserve(at + sizeof(header) + header.size);
+  memcpy(this->map + at + sizeof(header), this->offsets.data(), table);
+  memcpy(this->map + at + sizeof(header) + table, this->encoded.data(), this->encoded.size());
+  std::atomic_thread_fence(std::memory_order_release);
+  memcpy(this->map + at, &header, sizeof(header));
+  this->length.store(at + sizeof(header) + header.size, std::memory_order_relaxed);
+  this->index.push_back(entry);
+
+  this->chunk_fill = 0;
+  this->chunks.fetch_add(1, std::memory_order_relaxed);
+  this->raw_bytes.fetch_add(n * this->columns * sizeof(int64_t), std::memory_order_relaxed);
+}
+
+void CEpos2Recorder::put(const void *data, size_t size)
+{
+  uint64_t length = this->length.load(std::memory_order_relaxed);
+
+  this->reserve(length + size);
+  memcpy(this->map + length, data, size);
+  this->length.store(length + size, std::memory_order_relaxed);
+}
+
+void CEpos2Recorder::reserve(uint64_t size)
+{
+  if(size <= this->capacity)
+    return;
+
+  uint64_t capacity = (size + EXTENT - 1) / EXTENT * EXTENT;
+  if(ftruncate(this->fd, capacity) != 0)
+    throw EPOS2IOException(std::string("EPOS2 recorder can't grow the file: ") + strerror(errno));
+
+  void *map = this->map == NULL ?
+    mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, this->fd, 0) :
+    mremap(this->map, this->capacity, capacity, MREMAP_MAYMOVE);
+  if(map == MAP_FAILED)
+    throw EPOS2IOException(std::string("EPOS2 recorder can't map the file: ") + strerror(errno));
+
+  this->map      = (uint8_t*)map;
+  this->capacity = capacity;
+}
@@ -0,0 +1,375 @@
+// Copyright (C) 2009-2010 Institut de Robòtica i Informàtica Industrial, CSIC-UPC.
+// Author Martí Morta Garriga  (mmorta@iri.upc.edu)
+// All rights reserved.
+//
+// Copyright (C) 2013 Jochen Sprickerhof <jochen@sprickerhof.de>
+//
+// This file is part of IRI EPOS2 Driver
+// IRI EPOS2 Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "epos2_motor_controller/Epos2.h"
+#include "epos2_motor_controller/Epos2RecordingReader.h"
+
+static uint64_t getVarint(const uint8_t *&p, const uint8_t *end)
+{
+  uint64_t v = 0;
+
+  for(unsigned shift = 0; p < end && shift < 64; shift += 7)
+  {
+    uint8_t b = *p++;
+    v |= (uint64_t)(b & 0x7F) << shift;
+    if(!(b & 0x80))
+      return v;
+  }
+  throw EPOS2IOException("EPOS2 recording has a bad varint");
+}
+
+static int64_t unzigzag(uint64_t v)
+{
+  return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+static uint64_t getWord(const uint8_t *&p, const uint8_t *end)
+{
+  uint64_t w = 0;
+
+  for(unsigned b = 0; b < 64 && p < end; b += 8)
+    w |= (uint64_t)*p++ << b;
+  return w;
+}
+
+static bool chunkEnd(const CEpos2RecordingReader::epos_chunk_info &chunk, int64_t t)
+{
+  return chunk.t_last < t;
+}
+
+// ----------------------------------------------------------------------------
+//   CLASS
+// ----------------------------------------------------------------------------
+//     CONSTRUCTOR
+// ----------------------------------------------------------------------------
+
+CEpos2RecordingReader::CEpos2RecordingReader(const std::string &path)
+  : path(path), fd(-1), map(NULL), size(0), complete(false)
+{
+  struct stat st;
+  std::stringstream s;
+
+  this->fd = open(path.c_str(), O_RDONLY);
+  if(this->fd < 0 || fstat(this->fd, &st) != 0)
+  {
+    s << "EPOS2 recording " << path << " can't be opened: " << strerror(errno);
+    if(this->fd >= 0)
+      close(this->fd);
+    throw EPOS2IOException(s.str());
+  }
+  this->size = st.st_size;
+
+  if(this->size >= sizeof(epos2_rec_file_header))
+  {
+    void *p = mmap(NULL, this->size, PROT_READ, MAP_SHARED, this->fd, 0);
+    if(p == MAP_FAILED)
+    {
+      s << "EPOS2 recording " << path << " can't be mapped: " << strerror(errno);
+      close(this->fd);
+      throw EPOS2IOException(s.str());
+    }
+    this->map = (const uint8_t*)p;
+    memcpy(&this->header, this->map, sizeof(this->header));
+  }
+
+  if(this->map == NULL || memcmp(this->header.magic, EPOS2_REC_MAGIC, sizeof(this->header.magic)) != 0 ||
+     this->header.version != EPOS2_REC_VERSION || this->header.columns == 0 ||
+     sizeof(this->header) + this->header.names_size > this->size)
+  {
+    if(this->map != NULL)
+      munmap((void*)this->map, this->size);
+    close(this->fd);
+    s << "EPOS2 recording " << path << " is not a recording or has another version";
+    throw EPOS2IOException(s.str());
+  }
+
+  const char *names = (const char*)this->map + sizeof(this->header);
+  size_t i = 0;
+  while(this->names.size() < this->header.columns && i < this->header.names_size)
+  {
+    this->names.push_back(std::string(names + i, strnlen(names + i, this->header.names_size - i)));
+    i += this->names.back().size() + 1;
+  }
+  while(this->names.size() < this->header.columns)
+    this->names.push_back(std::string());
+
+  this->loadIndex(sizeof(this->header) + this->header.names_size);
+}
+
+//     DESTRUCTOR
+// ----------------------------------------------------------------------------
+
+CEpos2RecordingReader::~CEpos2RecordingReader()
+{
+  munmap((void*)this->map, this->size);
+  close(this->fd);
+}
+
+// ----------------------------------------------------------------------------
+//   INDEX
+// ----------------------------------------------------------------------------
+
+void CEpos2RecordingReader::loadIndex(uint64_t data_offset)
+{
+  epos2_rec_footer footer;
+
+  if(this->size >= data_offset + sizeof(footer))
+  {
+    memcpy(&footer, this->map + this->size - sizeof(footer), sizeof(footer));
+    // the count is checked by division, a corrupted one can't overflow the sum
+    if(memcmp(footer.magic, EPOS2_REC_INDEX_MAGIC, sizeof(footer.magic)) == 0 &&
+       footer.index_offset >= data_offset &&
+       footer.index_offset <= this->size - sizeof(footer) &&
+       footer.chunks == (this->size - sizeof(footer) - footer.index_offset) / sizeof(epos2_rec_index_entry) &&
+       footer.index_offset + footer.chunks * sizeof(epos2_rec_index_entry) + sizeof(footer) == this->size)
+    {
+      const epos2_rec_index_entry *index =
+        (const epos2_rec_index_entry*)(this->map + footer.index_offset);
+      uint64_t i = 0;
+      while(i < footer.chunks)
+      {
+        // an entry must point at a whole chunk of the data, as the walk checks
+        epos2_rec_chunk_header header;
+        uint64_t offset = index[i].offset;
+        if(offset < data_offset || offset > footer.index_offset ||
+           footer.index_offset - offset < sizeof(header))
+          break;
+        memcpy(&header, this->map + offset, sizeof(header));
+        if(header.magic != EPOS2_REC_CHUNK_MAGIC || header.rows == 0 ||
+           header.rows != index[i].rows ||
+           header.size > footer.index_offset - offset - sizeof(header))
+          break;
+
+        epos_chunk_info chunk;
+        chunk.offset  = offset;
+        chunk.t_first = index[i].t_first;
+        chunk.t_last  = index[i].t_last;
+        chunk.rows    = index[i].rows;
+        this->chunks.push_back(chunk);
+        i++;
+      }
+      if(i == footer.chunks)
+      {
+        this->complete = true;
+        return;
+      }
+      // a corrupted index is ignored
+      this->chunks.clear();
+    }
+  }
+
+  // no index: walk the chunks up to the first incomplete one
+  uint64_t offset = data_offset;
+  epos2_rec_chunk_header header;
+  while(offset + sizeof(header) <= this->size)
+  {
+    memcpy(&header, this->map + offset, sizeof(header));
+    if(header.magic != EPOS2_REC_CHUNK_MAGIC || header.rows == 0 ||
+       header.size > this->size - offset - sizeof(header))
+      break;
+
+    epos_chunk_info chunk;
+    chunk.offset  = offset;
+    chunk.t_first = header.t_first;
+    chunk.t_last  = header.t_last;
+    chunk.rows    = header.rows;
+    this->chunks.push_back(chunk);
+    offset += sizeof(header) + header.size;
+  }
+}
+
+const std::vector<std::string> &CEpos2RecordingReader::getColumns()
+{
+  return this->names;
+}
+
+size_t CEpos2RecordingReader::getColumn(const std::string &name)
+{
+  std::vector<std::string>::const_iterator i =
+    std::find(this->names.begin(), this->names.end(), name);
+  if(i == this->names.end())
+    throw std::invalid_argument("EPOS2 recording has no column " + name);
+  return i - this->names.begin();
+}
+
+bool CEpos2RecordingReader::isComplete()
+{
+  return this->complete;
+}
+
+const std::vector<CEpos2RecordingReader::epos_chunk_info> &CEpos2RecordingReader::getChunks()
+{
+  return this->chunks;
+}
+
+uint64_t CEpos2RecordingReader::getRowCount()
+{
+  uint64_t rows = 0;
+  for(size_t i = 0; i < this->chunks.size(); i++)
+    rows += this->chunks[i].rows;
+  return rows;
+}
+
+int64_t CEpos2RecordingReader::getCreationTime()
+{
+  return this->header.created_ns;
+}
+
+// ----------------------------------------------------------------------------
+//   DECODING
+// ----------------------------------------------------------------------------
+
+void CEpos2RecordingReader::decodeColumn(const epos_chunk_info &chunk, size_t column, int64_t *values)
+{
+  size_t columns = this->header.columns;
+  size_t table = (columns + 1) * sizeof(uint32_t);
+  const uint8_t *base = this->map + chunk.offset + sizeof(epos2_rec_chunk_header);
+  epos2_rec_chunk_header header;
+  uint32_t begin, end;
+
+  memcpy(&header, this->map + chunk.offset, sizeof(header));
+  if(header.magic != EPOS2_REC_CHUNK_MAGIC || header.size < table)
+    throw EPOS2IOException("EPOS2 recording has a corrupted chunk");
+  memcpy(&begin, base + column * sizeof(uint32_t), sizeof(begin));
+  memcpy(&end, base + (column + 1) * sizeof(uint32_t), sizeof(end));
+  if(begin >= end || end > header.size - table)
+    throw EPOS2IOException("EPOS2 recording has a corrupted chunk");
+
+  const uint8_t *p = base + table + begin;
+  const uint8_t *last = base + table + end;
+  size_t n = chunk.rows;
+  uint8_t encoding = *p++;
+
+  if(encoding == EPOS2_REC_DELTA)
+  {
+    uint64_t prev = 0;
+    for(size_t i = 0; i < n; i++)
+    {
+      prev += (uint64_t)unzigzag(getVarint(p, last));
+      values[i] = (int64_t)prev;
+    }
+    return;
+  }
+
+  if(encoding != EPOS2_REC_FOR || p >= last)
+    throw EPOS2IOException("EPOS2 recording has a corrupted column");
+
+  uint64_t min = (uint64_t)unzigzag(getVarint(p, last));
+  if(p >= last)
+    throw EPOS2IOException("EPOS2 recording has a corrupted column");
+  unsigned width = *p++;
+  if(width > 64 || (size_t)(last - p) < (n*width + 7)/8)
+    throw EPOS2IOException("EPOS2 recording has a corrupted column");
+
+  if(width == 0)
+  {
+    std::fill(values, values + n, (int64_t)min);
+    return;
+  }
+
+  uint64_t mask = width == 64 ? ~(uint64_t)0 : ((uint64_t)1 << width) - 1;
+  uint64_t acc = 0;
+  unsigned avail = 0;
+  for(size_t i = 0; i < n; i++)
+  {
+    uint64_t x;
+    if(avail >= width)
+    {
+      x = acc & mask;
+      acc = width == 64 ? 0 : acc >> width;
+      avail -= width;
+    }
+    else
+    {
+      uint64_t word = getWord(p, last);
+      unsigned used = width - avail;
+      x = (acc | (word << avail)) & mask;
+      acc = used == 64 ? 0 : word >> used;
+      avail = 64 - used;
+    }
+    values[i] = (int64_t)(x + min);
+  }
+}
+
+uint64_t CEpos2RecordingReader::scan(int64_t from, int64_t to, const std::vector<size_t> &columns,
+                                     const std::function<void(const int64_t *const *values, size_t rows)> &callback)
+{
+  for(size_t k = 0; k < columns.size(); k++)
+    if(columns[k] >= this->header.columns)
+      throw std::invalid_argument("EPOS2 recording has no such column");
+
+  size_t max_rows = 0;
+  for(size_t i = 0; i < this->chunks.size(); i++)
+    max_rows = std::max<size_t>(max_rows, this->chunks[i].rows);
+
+  std::vector<int64_t> time(max_rows);
+  std::vector<std::vector<int64_t> > buffers(columns.size(), std::vector<int64_t>(max_rows));
+  std::vector<const int64_t*> pointers(columns.size());
+  uint64_t rows = 0;
+
+  std::vector<epos_chunk_info>::const_iterator chunk =
+    std::lower_bound(this->chunks.begin(), this->chunks.end(), from, chunkEnd);
+  for(; chunk != this->chunks.end() && chunk->t_first < to; ++chunk)
+  {
+    size_t n = chunk->rows;
+    this->decodeColumn(*chunk, 0, time.data());
+    size_t lo = std::lower_bound(time.begin(), time.begin() + n, from) - time.begin();
+    size_t hi = std::lower_bound(time.begin(), time.begin() + n, to) - time.begin();
+    if(lo >= hi)
+      continue;
+
+    for(size_t k = 0; k < columns.size(); k++)
+    {
+      if(columns[k] == 0)
+        pointers[k] = time.data() + lo;
+      else
+      {
+        this->decodeColumn(*chunk, columns[k], buffers[k].data());
+        pointers[k] = buffers[k].data() + lo;
+      }
+    }
+
+    callback(pointers.data(), hi - lo);
+    rows += hi - lo;
+  }
+
+  return rows;
+}
+
+uint64_t CEpos2RecordingReader::read(int64_t from, int64_t to, const std::vector<size_t> &columns,
+                                     std::vector<std::vector<int64_t> > &values)
+{
+  values.assign(columns.size(), std::vector<int64_t>());
+
+  return this->scan(from, to, columns, [&values](const int64_t *const *v, size_t rows)
+  {
+    for(size_t k = 0; k < values.size(); k++)
+      values[k].insert(values[k].end(), v[k], v[k] + rows);
+  });
+}
@@ -0,0 +1,443 @@
+// Copyright (C) 2009-2010 Institut de Robòtica i Informàtica Industrial, CSIC-UPC.
+// Author Martí Morta Garriga  (mmorta@iri.upc.edu)
+// All rights reserved.
+//
+// Copyright (C) 2013 Jochen Sprickerhof <jochen@sprickerhof.de>
+//
+// This file is part of IRI EPOS2 Driver
+// IRI EPOS2 Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <chrono>
+#include <thread>
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "epos2_motor_controller/Epos2Remote.h"
+
+static uint64_t nowNs()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// ----------------------------------------------------------------------------
+//   CLASS
+// ----------------------------------------------------------------------------
+//     CONSTRUCTOR
+// ----------------------------------------------------------------------------
+
+CEpos2Remote::CEpos2Remote(size_t axis, const std::string &name)
+  : axis(axis), name(name), timeout_ms(1000), shm(NULL), fd(-1)
+{
+  struct stat st;
+  std::stringstream s;
+
+  this->fd = shm_open(name.c_str(), O_RDWR, 0);
+  if(this->fd < 0)
+  {
+    s << "EPOS2 broker " << name << " not found: " << strerror(errno);
+    throw EPOS2IOException(s.str());
+  }
+  if(fstat(this->fd, &st) != 0 || (size_t)st.st_size < sizeof(epos2_shm_segment))
+  {
+    close(this->fd);
+    s << "EPOS2 broker " << name << " has a bad shared memory size";
+    throw EPOS2IOException(s.str());
+  }
+
+  void *p = mmap(NULL, sizeof(epos2_shm_segment), PROT_READ | PROT_WRITE, MAP_SHARED, this->fd, 0);
+  if(p == MAP_FAILED)
+  {
+    close(this->fd);
+    s << "EPOS2 broker " << name << " can't be mapped: " << strerror(errno);
+    throw EPOS2IOException(s.str());
+  }
+  this->shm = (epos2_shm_segment*)p;
+
+  if(this->shm->magic.load(std::memory_order_acquire) != EPOS2_SHM_MAGIC ||
+     this->shm->version != EPOS2_SHM_VERSION)
+    s << "EPOS2 broker " << name << " is not ready or has another version";
+  else if(axis >= this->shm->axes)
+    s << "EPOS2 broker " << name << " has no axis " << axis;
+
+  if(!s.str().empty())
+  {
+    munmap(this->shm, sizeof(epos2_shm_segment));
+    close(this->fd);
+    throw EPOS2IOException(s.str());
+  }
+}
+
+//     DESTRUCTOR
+// ----------------------------------------------------------------------------
+
+CEpos2Remote::~CEpos2Remote()
+{
+  munmap(this->shm, sizeof(epos2_shm_segment));
+  close(this->fd);
+}
+
+void CEpos2Remote::setTimeout(long timeout_ms)
+{
+  this->timeout_ms = timeout_ms;
+}
+
+bool CEpos2Remote::isBrokerAlive()
+{
+  uint64_t heartbeat = this->shm->heartbeat_ns.load(std::memory_order_acquire);
+
+  return this->shm->magic.load(std::memory_order_acquire) == EPOS2_SHM_MAGIC &&
+         nowNs() - heartbeat < (uint64_t)(10 * this->shm->period_ns);
+}
+
+long CEpos2Remote::getNodeId()
+{
+  return this->shm->axis[this->axis].node_id;
+}
+
+// ----------------------------------------------------------------------------
+//   TELEMETRY
+// ----------------------------------------------------------------------------
+
+bool CEpos2Remote::readSlot(uint64_t record, epos2_shm_telemetry &t)
+{
+  const epos2_shm_telemetry_slot &slot =
+    this->shm->axis[this->axis].slots[record % EPOS2_SHM_TELEMETRY_SIZE];
+
+  uint64_t seq = slot.seq.load(std::memory_order_acquire);
+  if(seq != 2*(record + 1))
+    return false;
+  t = slot.data;
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return slot.seq.load(std::memory_order_relaxed) == seq;
+}
+
+bool CEpos2Remote::getTelemetry(epos2_shm_telemetry &t)
+{
+  const epos2_shm_axis &a = this->shm->axis[this->axis];
+
+  while(true)
+  {
+    uint64_t head = a.head.load(std::memory_order_acquire);
+    if(head == 0)
+      return false;
+    // only fails if the broker lapped us, the next head is newer
+    if(this->readSlot(head - 1, t))
+      return true;
+  }
+}
+
+std::vector<epos2_shm_telemetry> CEpos2Remote::readHistory(uint64_t &since)
+{
+  std::vector<epos2_shm_telemetry> records;
+  epos2_shm_telemetry t;
+  uint64_t head = this->shm->axis[this->axis].head.load(std::memory_order_acquire);
+
+  // the slot of head is the next one written
+  if(head - since > EPOS2_SHM_TELEMETRY_SIZE - 1)
+    since = head - (EPOS2_SHM_TELEMETRY_SIZE - 1);
+  for(uint64_t r = since; r < head; r++)
+    if(this->readSlot(r, t))
+      records.push_back(t);
+  since = head;
+
+  return records;
+}
+
+epos2_shm_telemetry CEpos2Remote::latest()
+{
+  epos2_shm_telemetry t;
+
+  if(!this->getTelemetry(t))
+    throw EPOS2IOException("EPOS2 broker has not published telemetry yet");
+  if(t.error)
+    throw EPOS2IOException("EPOS2 broker failed to poll the axis");
+
+  return t;
+}
+
+long CEpos2Remote::readPosition()
+{
+  return (int32_t)this->latest().position;
+}
+
+int64_t CEpos2Remote::readPosition64()
+{
+  return this->latest().position;
+}
+
+long CEpos2Remote::readVelocityActual()
+{
+  return this->latest().velocity;
+}
+
+long CEpos2Remote::readCurrent()
+{
+  return this->latest().current;
+}
+
+long CEpos2Remote::readStatusWord()
+{
+  return this->latest().status_word;
+}
+
+bool CEpos2Remote::waitTargetReached(long timeout_ms)
+{
+  std::chrono::steady_clock::time_point end =
+    std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+  uint64_t since = this->shm->axis[this->axis].head.load(std::memory_order_acquire);
+
+  while(true)
+  {
+    // only records published after the call, an older one may be before the start
+    std::vector<epos2_shm_telemetry> records = this->readHistory(since);
+    for(size_t i = 0; i < records.size(); i++)
+      if(!records[i].error && (records[i].status_word & 0x0400))
+        return true;
+
+    if(timeout_ms >= 0 && std::chrono::steady_clock::now() >= end)
+      return false;
+    std::this_thread::sleep_for(std::chrono::nanoseconds(this->shm->period_ns));
+  }
+}
+
+// ----------------------------------------------------------------------------
+//   COMMANDS
+// ----------------------------------------------------------------------------
+
+int32_t CEpos2Remote::call(uint32_t opcode, int32_t index, int32_t subindex, int32_t value)
+{
+  epos2_shm_segment *shm = this->shm;
+  std::chrono::steady_clock::time_point end =
+    std::chrono::steady_clock::now() + std::chrono::milliseconds(this->timeout_ms);
+  uint64_t pos = shm->enqueue_pos.load(std::memory_order_relaxed);
+  epos2_shm_command_cell *cell;
+
+  // claim a free cell
+  while(true)
+  {
+    cell = &shm->commands[pos % EPOS2_SHM_COMMAND_SIZE];
+    int64_t diff = (int64_t)cell->seq.load(std::memory_order_acquire) - (int64_t)pos;
+    if(diff == 0)
+    {
+      if(shm->enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+        break;
+    }
+    else if(diff < 0)
+    {
+      // full
+      if(std::chrono::steady_clock::now() >= end)
+        throw EPOS2IOException("EPOS2 broker command queue is full");
+      std::this_thread::sleep_for(std::chrono::microseconds(50));
+      pos = shm->enqueue_pos.load(std::memory_order_relaxed);
+    }
+    else
+      pos = shm->enqueue_pos.load(std::memory_order_relaxed);
+  }
+
+  cell->command.axis     = this->axis;
+  cell->command.opcode   = opcode;
+  cell->command.index    = index;
+  cell->command.subindex = subindex;
+  cell->command.value    = value;
+  cell->state.store(EPOS2_SHM_COMMAND_QUEUED, std::memory_order_relaxed);
+  cell->seq.store(pos + 1, std::memory_order_release);
+
+  // wait for the result
+  epos2_shm_result &result = shm->results[pos % EPOS2_SHM_COMMAND_SIZE];
+  int spins = 0;
+  while(result.ticket.load(std::memory_order_acquire) != pos + 1)
+  {
+    if(std::chrono::steady_clock::now() >= end)
+    {
+      // withdrawn if the broker didn't take it yet, else it may still execute
+      uint32_t queued = EPOS2_SHM_COMMAND_QUEUED;
+      if(cell->state.compare_exchange_strong(queued, EPOS2_SHM_COMMAND_CANCELLED,
+                                             std::memory_order_acq_rel))
+        throw EPOS2IOException("EPOS2 broker didn't answer the command, it was cancelled");
+      throw EPOS2IOException("EPOS2 broker didn't answer the command in time, it may still be executed");
+    }
+    // most commands are one transaction, don't sleep at first
+    if(++spins < 100)
+      std::this_thread::yield();
+    else
+      std::this_thread::sleep_for(std::chrono::microseconds(50));
+  }
+
+  int32_t r = result.value;
+  int32_t error = result.error;
+  std::string message(result.message, strnlen(result.message, EPOS2_SHM_MESSAGE_SIZE));
+  std::atomic_thread_fence(std::memory_order_acquire);
+  if(result.ticket.load(std::memory_order_relaxed) != pos + 1)
+    throw EPOS2IOException("EPOS2 broker result overwritten before read");
+
+  if(error)
+    throw EPOS2IOException(message);
+
+  return r;
+}
+
+int32_t CEpos2Remote::readObject(int16_t index, int8_t subindex)
+{
+  return this->call(EPOS2_SHM_READ_OBJECT, index, subindex);
+}
+
+int CEpos2Remote::writeObject(int16_t index, int8_t subindex, int32_t data)
+{
+  return this->call(EPOS2_SHM_WRITE_OBJECT, index, subindex, data);
+}
+
+long CEpos2Remote::getState()
+{
+  return this->call(EPOS2_SHM_GET_STATE);
+}
+
+void CEpos2Remote::enableController()
+{
+  this->call(EPOS2_SHM_ENABLE_CONTROLLER);
+}
+
+void CEpos2Remote::enableMotor(long opmode)
+{
+  this->call(EPOS2_SHM_ENABLE_MOTOR, 0, 0, opmode);
+}
+
+void CEpos2Remote::disableOperation()
+{
+  this->call(EPOS2_SHM_DISABLE_OPERATION);
+}
+
+void CEpos2Remote::quickStop()
+{
+  this->stop(EPOS2_SHM_STOP_QUICK_STOP);
+}
+
+void CEpos2Remote::disableVoltage()
+{
+  this->stop(EPOS2_SHM_STOP_DISABLE_VOLTAGE);
+}
+
+void CEpos2Remote::stop(uint32_t request)
+{
+  epos2_shm_stop &stop = this->shm->axis[this->axis].stop;
+  std::chrono::steady_clock::time_point end =
+    std::chrono::steady_clock::now() + std::chrono::milliseconds(this->timeout_ms);
+
+  stop.request.fetch_or(request, std::memory_order_release);
+  uint64_t ticket = stop.requests.fetch_add(1, std::memory_order_acq_rel) + 1;
+
+  while(stop.served.load(std::memory_order_acquire) < ticket)
+  {
+    if(std::chrono::steady_clock::now() >= end)
+      throw EPOS2IOException("EPOS2 broker didn't serve the stop");
+    std::this_thread::yield();
+  }
+
+  if(stop.error.load(std::memory_order_relaxed))
+    throw EPOS2IOException("EPOS2 broker failed to stop the axis");
+}
+
+void CEpos2Remote::faultReset()
+{
+  this->call(EPOS2_SHM_FAULT_RESET);
+}
+
+long CEpos2Remote::getOperationMode()
+{
+  return this->call(EPOS2_SHM_GET_OPERATION_MODE);
+}
+
+void CEpos2Remote::setOperationMode(long opmode)
+{
+  this->call(EPOS2_SHM_SET_OPERATION_MODE, 0, 0, opmode);
+}
+
+void CEpos2Remote::setTargetVelocity(long velocity)
+{
+  this->call(EPOS2_SHM_SET_TARGET_VELOCITY, 0, 0, velocity);
+}
+
+void CEpos2Remote::startVelocity()
+{
+  this->call(EPOS2_SHM_START_VELOCITY);
+}
+
+void CEpos2Remote::stopVelocity()
+{
+  this->call(EPOS2_SHM_STOP_VELOCITY);
+}
+
+void CEpos2Remote::setTargetProfilePosition(long position)
+{
+  this->call(EPOS2_SHM_SET_TARGET_PROFILE_POSITION, 0, 0, position);
+}
+
+void CEpos2Remote::startProfilePosition(CEpos2::epos_posmodes mode, bool blocking,
+                                        bool wait, bool new_point)
+{
+  this->call(EPOS2_SHM_START_PROFILE_POSITION, 0, 0,
+             mode | (wait ? 0x100 : 0) | (new_point ? 0x200 : 0));
+  if(blocking)
+    this->waitTargetReached();
+}
+
+void CEpos2Remote::setTargetProfileVelocity(long velocity)
+{
+  this->call(EPOS2_SHM_SET_TARGET_PROFILE_VELOCITY, 0, 0, velocity);
+}
+
+void CEpos2Remote::startProfileVelocity()
+{
+  this->call(EPOS2_SHM_START_PROFILE_VELOCITY);
+}
+
+void CEpos2Remote::stopProfileVelocity()
+{
+  this->call(EPOS2_SHM_STOP_PROFILE_VELOCITY);
+}
+
+void CEpos2Remote::setProfileVelocity(long velocity)
+{
+  this->call(EPOS2_SHM_SET_PROFILE_VELOCITY, 0, 0, velocity);
+}
+
+void CEpos2Remote::setProfileAcceleration(long acceleration)
+{
+  this->call(EPOS2_SHM_SET_PROFILE_ACCELERATION, 0, 0, acceleration);
+}
+
+void CEpos2Remote::setProfileDeceleration(long deceleration)
+{
+  this->call(EPOS2_SHM_SET_PROFILE_DECELERATION, 0, 0, deceleration);
+}
+
+long CEpos2Remote::setTargetCurrent(long current)
+{
+  return this->call(EPOS2_SHM_SET_TARGET_CURRENT, 0, 0, current);
+}
+
+void CEpos2Remote::startCurrent()
+{
+  this->call(EPOS2_SHM_START_CURRENT);
+}
+
+void CEpos2Remote::stopCurrent()
+{
+  this->call(EPOS2_SHM_STOP_CURRENT);
+}
@@ -0,0 +1,299 @@
+// Copyright (C) 2009-2010 Institut de Robòtica i Informàtica Industrial, CSIC-UPC.
+// Author Martí Morta Garriga  (mmorta@iri.upc.edu)
+// All rights reserved.
+//
+// Copyright (C) 2013 Jochen Sprickerhof <jochen@sprickerhof.de>
+//
+// This file is part of IRI EPOS2 Driver
+// IRI EPOS2 Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <cmath>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <algorithm>
+#include "epos2_motor_controller/Epos2.h"
+#include "epos2_motor_controller/Epos2Rollup.h"
+#include "epos2_motor_controller/Epos2RecordingReader.h"
+
+// start of the bucket of t, also for negative times
+static int64_t bucketOf(int64_t t, int64_t resolution)
+{
+  int64_t q = t / resolution;
+  if(t % resolution < 0)
+    q--;
+  return q * resolution;
+}
+
+// merges the sums of one bucket into another; no branches, it vectorizes
+static void mergeStep(size_t n, const double *min, const double *max, const double *sum,
+                      const double *sumsq, double *__restrict__ to_min, double *__restrict__ to_max,
+                      double *__restrict__ to_sum, double *__restrict__ to_sumsq)
+{
+  for(size_t i = 0; i < n; i++)
+  {
+    to_min[i]    = std::min(to_min[i], min[i]);
+    to_max[i]    = std::max(to_max[i], max[i]);
+    to_sum[i]   += sum[i];
+    to_sumsq[i] += sumsq[i];
+  }
+}
+
+// ----------------------------------------------------------------------------
+//   CLASS
+// ----------------------------------------------------------------------------
+//     CONSTRUCTOR
+// ----------------------------------------------------------------------------
+
+CEpos2Rollup::CEpos2Rollup(const std::string &base, const std::vector<std::string> &signals,
+                           const std::vector<int64_t> &resolutions_ns)
+  : signals(signals.size()), closed(false)
+{
+  if(signals.empty() || resolutions_ns.empty())
+    throw std::invalid_argument("EPOS2 rollup needs signals and resolutions");
+  for(size_t k = 0; k < resolutions_ns.size(); k++)
+    if(resolutions_ns[k] <= 0 ||
+       (k > 0 && (resolutions_ns[k] <= resolutions_ns[k-1] || resolutions_ns[k] % resolutions_ns[k-1] != 0)))
+      throw std::invalid_argument("EPOS2 rollup resolutions must increase, each a multiple of the previous one");
+
+  std::vector<std::string> columns;
+  columns.push_back("time");
+  columns.push_back("count");
+  for(size_t i = 0; i < signals.size(); i++)
+  {
+    columns.push_back(signals[i] + ".min");
+    columns.push_back(signals[i] + ".max");
+    columns.push_back(signals[i] + ".mean");
+    columns.push_back(signals[i] + ".rms");
+  }
+
+  this->tiers.resize(resolutions_ns.size());
+  for(size_t k = 0; k < this->tiers.size(); k++)
+  {
+    tier &t = this->tiers[k];
+    t.resolution = resolutions_ns[k];
+    t.bucket     = 0;
+    t.count      = 0;
+    t.min.resize(this->signals);
+    t.max.resize(this->signals);
+    t.sum.resize(this->signals);
+    t.sumsq.resize(this->signals);
+    t.row.resize(columns.size());
+
+    // a chunk spans about an hour, so a crash loses little of a coarse tier;
+    // the tiers are appended to, a restart keeps the history
+    int64_t rows = 3600000000000LL / t.resolution;
+    rows = std::max<int64_t>(16, std::min<int64_t>(4096, rows));
+    t.recorder.reset(new CEpos2Recorder(tierPath(base, t.resolution), columns, rows, 1024, true));
+  }
+}
+
+//     DESTRUCTOR
+// ----------------------------------------------------------------------------
+
+CEpos2Rollup::~CEpos2Rollup()
+{
+  try
+  {
+    this->close();
+  }
+  catch(...)
+  {
+  }
+}
+
+std::vector<int64_t> CEpos2Rollup::defaultResolutions()
+{
+  std::vector<int64_t> resolutions;
+  resolutions.push_back(10000000LL);      // 10 ms
+  resolutions.push_back(1000000000LL);    // 1 s
+  resolutions.push_back(60000000000LL);   // 1 min
+  return resolutions;
+}
+
+std::string CEpos2Rollup::tierPath(const std::string &base, int64_t resolution_ns)
+{
+  std::stringstream s;
+  // whole milliseconds keep the names of earlier runs, anything else is
+  // exact so no two tiers share a file
+  if(resolution_ns % 1000000 == 0)
+    s << base << "." << resolution_ns / 1000000 << "ms.rec";
+  else
+    s << base << "." << resolution_ns << "ns.rec";
+  return s.str();
+}
+
+// ----------------------------------------------------------------------------
+//   AGGREGATION
+// ----------------------------------------------------------------------------
+
+void CEpos2Rollup::add(int64_t time_ns, const int64_t *values)
+{
+  if(this->closed)
+    return;
+
+  this->roll(0, time_ns);
+
+  tier &t = this->tiers[0];
+  if(t.count == 0)
+    for(size_t i = 0; i < this->signals; i++)
+    {
+      double v = values[i];
+      t.min[i]   = v;
+      t.max[i]   = v;
+      t.sum[i]   = v;
+      t.sumsq[i] = v*v;
+    }
+  else
+    for(size_t i = 0; i < this->signals; i++)
+    {
+      double v = values[i];
+      t.min[i]    = std::min(t.min[i], v);
+      t.max[i]    = std::max(t.max[i], v);
+      t.sum[i]   += v;
+      t.sumsq[i] += v*v;
+    }
+  t.count++;
+}
+
+void CEpos2Rollup::roll(size_t k, int64_t time_ns)
+{
+  tier &t = this->tiers[k];
+  int64_t bucket = bucketOf(time_ns, t.resolution);
+
+  if(t.count > 0 && bucket != t.bucket)
+    this->emit(k);
+  if(t.count == 0)
+    t.bucket = bucket;
+}
+
+void CEpos2Rollup::emit(size_t k)
+{
+  tier &t = this->tiers[k];
+  double n = t.count;
+
+  t.row[0] = t.bucket;
+  t.row[1] = t.count;
+  for(size_t i = 0; i < this->signals; i++)
+  {
+    t.row[2 + 4*i] = std::llround(t.min[i]);
+    t.row[3 + 4*i] = std::llround(t.max[i]);
+    t.row[4 + 4*i] = std::llround(EPOS2_ROLLUP_SCALE * t.sum[i] / n);
+    t.row[5 + 4*i] = std::llround(EPOS2_ROLLUP_SCALE * std::sqrt(t.sumsq[i] / n));
+  }
+  t.recorder->append(t.row.data());
+
+  if(k + 1 < this->tiers.size())
+  {
+    this->roll(k + 1, t.bucket);
+
+    tier &next = this->tiers[k + 1];
+    if(next.count == 0)
+    {
+      next.min   = t.min;
+      next.max   = t.max;
+      next.sum   = t.sum;
+      next.sumsq = t.sumsq;
+    }
+    else
+      mergeStep(this->signals, t.min.data(), t.max.data(), t.sum.data(), t.sumsq.data(),
+                next.min.data(), next.max.data(), next.sum.data(), next.sumsq.data());
+    next.count += t.count;
+  }
+
+  t.count = 0;
+}
+
+void CEpos2Rollup::close()
+{
+  if(this->closed)
+    return;
+  this->closed = true;
+
+  // finest first, each merges into the next before it is written
+  for(size_t k = 0; k < this->tiers.size(); k++)
+    if(this->tiers[k].count > 0)
+      this->emit(k);
+
+  std::string error;
+  for(size_t k = 0; k < this->tiers.size(); k++)
+  {
+    try
+    {
+      this->tiers[k].recorder->close();
+    }
+    catch(std::exception &e)
+    {
+      if(error.empty())
+        error = e.what();
+    }
+  }
+  if(!error.empty())
+    throw EPOS2IOException(error);
+}
+
+CEpos2Recorder::epos_recorder_stats CEpos2Rollup::getStatistics(size_t tier)
+{
+  if(tier >= this->tiers.size())
+    throw std::invalid_argument("EPOS2 rollup has no such tier");
+
+  return this->tiers[tier].recorder->getStatistics();
+}
+
+// ----------------------------------------------------------------------------
+//   QUERY
+// ----------------------------------------------------------------------------
+
+int64_t CEpos2Rollup::query(const std::string &base, const std::string &signal,
+                            int64_t from, int64_t to, size_t max_points,
+                            std::vector<epos_rollup_point> &points,
+                            const std::vector<int64_t> &resolutions_ns)
+{
+  if(resolutions_ns.empty())
+    throw std::invalid_argument("EPOS2 rollup needs resolutions");
+
+  // finest tier detailed enough, else the coarsest
+  size_t k = 0;
+  double span = (double)to - (double)from;
+  while(k + 1 < resolutions_ns.size() && span / resolutions_ns[k] > max_points)
+    k++;
+
+  CEpos2RecordingReader reader(tierPath(base, resolutions_ns[k]));
+  std::vector<size_t> columns;
+  columns.push_back(0);
+  columns.push_back(1);
+  columns.push_back(reader.getColumn(signal + ".min"));
+  columns.push_back(reader.getColumn(signal + ".max"));
+  columns.push_back(reader.getColumn(signal + ".mean"));
+  columns.push_back(reader.getColumn(signal + ".rms"));
+
+  points.clear();
+  reader.scan(from, to, columns, [&points](const int64_t *const *v, size_t rows)
+  {
+    for(size_t i = 0; i < rows; i++)
+    {
+      epos_rollup_point p;
+      p.time_ns = v[0][i];
+      p.count   = v[1][i];
+      p.min     = v[2][i];
+      p.max     = v[3][i];
+      p.mean    = (double)v[4][i] / EPOS2_ROLLUP_SCALE;
+      p.rms     = (double)v[5][i] / EPOS2_ROLLUP_SCALE;
+      points.push_back(p);
+    }
+  });
+
+  return resolutions_ns[k];
+}
@@ -0,0 +1,271 @@
+// Copyright (C) 2009-2010 Institut de Robòtica i Informàtica Industrial, CSIC-UPC.
+// Author Martí Morta Garriga  (mmorta@iri.upc.edu)
+// All rights reserved.
+//
+// Copyright (C) 2013 Jochen Sprickerhof <jochen@sprickerhof.de>
+//
+// This file is part of IRI EPOS2 Driver
+// IRI EPOS2 Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <stdexcept>
+#include <algorithm>
+#include <cmath>
+#include "epos2_motor_controller/Epos2StateEstimator.h"
+
+// ----------------------------------------------------------------------------
+//   CLASS
+// ----------------------------------------------------------------------------
+//     CONSTRUCTOR
+// ----------------------------------------------------------------------------
+
+CEpos2StateEstimator::CEpos2StateEstimator()
+  : velocity_sigma(1e5), acceleration_sigma(1e7),
+    epoch(std::chrono::steady_clock::now())
+{ }
+
+// ----------------------------------------------------------------------------
+//   AXES
+// ----------------------------------------------------------------------------
+
+size_t CEpos2StateEstimator::add(double position_variance, double jerk_density)
+{
+  this->r.push_back(position_variance);
+  this->q.push_back(jerk_density);
+  this->origin.push_back(0);
+  this->p.push_back(0.0);
+  this->v.push_back(0.0);
+  this->a.push_back(0.0);
+  this->p00.push_back(0.0);
+  this->p01.push_back(0.0);
+  this->p02.push_back(0.0);
+  this->p11.push_back(0.0);
+  this->p12.push_back(0.0);
+  this->p22.push_back(0.0);
+  this->t_last.push_back(0.0);
+  this->gain.push_back(0.0);
+  this->valid.push_back(0);
+
+  return this->r.size() - 1;
+}
+
+size_t CEpos2StateEstimator::size() const
+{
+  return this->r.size();
+}
+
+void CEpos2StateEstimator::setNoise(size_t i, double position_variance, double jerk_density)
+{
+  if(i >= this->r.size())
+    throw std::invalid_argument("EPOS2 state estimator has no such axis");
+
+  this->r[i] = position_variance;
+  this->q[i] = jerk_density;
+}
+
+void CEpos2StateEstimator::setInitialUncertainty(double velocity_sigma, double acceleration_sigma)
+{
+  this->velocity_sigma     = velocity_sigma;
+  this->acceleration_sigma = acceleration_sigma;
+}
+
+void CEpos2StateEstimator::reset()
+{
+  std::fill(this->valid.begin(), this->valid.end(), 0);
+}
+
+// ----------------------------------------------------------------------------
+//   FILTER
+// ----------------------------------------------------------------------------
+
+// one predict and update of n axes; everything is an array of one element
+// per axis and the outputs don't alias the inputs, so the loop vectorizes
+static void kalmanStep(size_t n, const double *z, const double *t, const double *dt_sample,
+                       const double *r, const double *q, const double *gain,
+                       double *__restrict__ p, double *__restrict__ v, double *__restrict__ a,
+                       double *__restrict__ p00, double *__restrict__ p01,
+                       double *__restrict__ p02, double *__restrict__ p11,
+                       double *__restrict__ p12, double *__restrict__ p22,
+                       double *__restrict__ t_last)
+{
+  for(size_t i = 0; i < n; i++)
+  {
+    double dt = t[i] - t_last[i];
+    double h  = 0.5*dt*dt;
+
+    // x = F x
+    double xp = p[i] + dt*v[i] + h*a[i];
+    double xv = v[i] + dt*a[i];
+    double xa = a[i];
+
+    // P = F P F' + Q, Q of white jerk
+    double a00 = p00[i] + dt*p01[i] + h*p02[i];
+    double a01 = p01[i] + dt*p11[i] + h*p12[i];
+    double a02 = p02[i] + dt*p12[i] + h*p22[i];
+    double a11 = p11[i] + dt*p12[i];
+    double a12 = p12[i] + dt*p22[i];
+    double dt2 = dt*dt, dt3 = dt2*dt;
+    double c00 = a00 + dt*a01 + h*a02 + q[i]*dt3*dt2/20.0;
+    double c01 = a01 + dt*a02 + q[i]*dt2*dt2/8.0;
+    double c02 = a02 + q[i]*dt3/6.0;
+    double c11 = a11 + dt*a12 + q[i]*dt3/3.0;
+    double c12 = a12 + q[i]*dt2/2.0;
+    double c22 = p22[i] + q[i]*dt;
+
+    // position measured, the sampling time uncertainty moves it by v*dt
+    double s  = c00 + r[i] + xv*xv*dt_sample[i]*dt_sample[i]/3.0;
+    double k0 = gain[i]*c00/s;
+    double k1 = gain[i]*c01/s;
+    double k2 = gain[i]*c02/s;
+    double y  = z[i] - xp;
+
+    p[i] = xp + k0*y;
+    v[i] = xv + k1*y;
+    a[i] = xa + k2*y;
+
+    p00[i] = c00 - k0*c00;
+    p01[i] = c01 - k0*c01;
+    p02[i] = c02 - k0*c02;
+    p11[i] = c11 - k1*c01;
+    p12[i] = c12 - k1*c02;
+    p22[i] = c22 - k2*c02;
+
+    t_last[i] = t[i];
+  }
+}
+
+void CEpos2StateEstimator::update(const double *position, const double *time,
+                                  const double *time_uncertainty)
+{
+  size_t n = this->r.size();
+
+  this->sample_p.resize(n);
+  for(size_t i = 0; i < n; i++)
+  {
+    if(!this->valid[i])
+      this->origin[i] = std::llround(position[i]);
+    this->sample_p[i] = position[i] - this->origin[i];
+  }
+
+  this->step(this->sample_p.data(), time, time_uncertainty);
+}
+
+void CEpos2StateEstimator::step(const double *position, const double *time,
+                                const double *time_uncertainty)
+{
+  size_t n = this->r.size();
+
+  // the first sample of an axis only sets its state
+  for(size_t i = 0; i < n; i++)
+  {
+    this->gain[i] = this->valid[i] ? 1.0 : 0.0;
+    if(!this->valid[i])
+    {
+      this->p[i]      = position[i];
+      this->v[i]      = 0.0;
+      this->a[i]      = 0.0;
+      this->p00[i]    = this->r[i];
+      this->p01[i]    = 0.0;
+      this->p02[i]    = 0.0;
+      this->p11[i]    = this->velocity_sigma * this->velocity_sigma;
+      this->p12[i]    = 0.0;
+      this->p22[i]    = this->acceleration_sigma * this->acceleration_sigma;
+      this->t_last[i] = time[i];
+      this->valid[i]  = 1;
+    }
+  }
+
+  if(time_uncertainty == NULL)
+  {
+    this->sample_dt.assign(n, 0.0);
+    time_uncertainty = this->sample_dt.data();
+  }
+
+  kalmanStep(n, position, time, time_uncertainty, this->r.data(), this->q.data(),
+             this->gain.data(), this->p.data(), this->v.data(), this->a.data(),
+             this->p00.data(), this->p01.data(), this->p02.data(), this->p11.data(),
+             this->p12.data(), this->p22.data(), this->t_last.data());
+
+  // the state stays near 0, its precision doesn't depend on how far the
+  // axis went: the whole qc are moved to the origin
+  for(size_t i = 0; i < n; i++)
+  {
+    int64_t shift = std::llround(this->p[i]);
+    this->origin[i] += shift;
+    this->p[i]      -= shift;
+  }
+}
+
+void CEpos2StateEstimator::update(const std::vector<CEpos2::epos_sample> &samples)
+{
+  size_t n = this->r.size();
+  if(samples.size() != n)
+    throw std::invalid_argument("EPOS2 state estimator needs one sample per axis");
+
+  this->sample_p.resize(n);
+  this->sample_t.resize(n);
+  this->sample_dt.resize(n);
+  for(size_t i = 0; i < n; i++)
+  {
+    // unwrapped and exact: the difference is taken in integers
+    if(!this->valid[i])
+      this->origin[i] = samples[i].position;
+    this->sample_p[i]  = (double)(samples[i].position - this->origin[i]);
+    this->sample_t[i]  = std::chrono::duration<double>(samples[i].sampled - this->epoch).count();
+    this->sample_dt[i] = samples[i].uncertainty_us * 1e-6;
+  }
+
+  this->step(this->sample_p.data(), this->sample_t.data(), this->sample_dt.data());
+}
+
+// ----------------------------------------------------------------------------
+//   STATE
+// ----------------------------------------------------------------------------
+
+CEpos2StateEstimator::epos_axis_state CEpos2StateEstimator::getState(size_t i) const
+{
+  if(i >= this->r.size())
+    throw std::invalid_argument("EPOS2 state estimator has no such axis");
+
+  epos_axis_state state;
+  state.position      = this->origin[i] + this->p[i];
+  state.velocity      = this->v[i];
+  state.acceleration  = this->a[i];
+  state.covariance[0] = this->p00[i];
+  state.covariance[1] = this->p01[i];
+  state.covariance[2] = this->p02[i];
+  state.covariance[3] = this->p11[i];
+  state.covariance[4] = this->p12[i];
+  state.covariance[5] = this->p22[i];
+  state.valid         = this->valid[i];
+  return state;
+}
+
+const double *CEpos2StateEstimator::getPositions() const
+{
+  this->positions.resize(this->p.size());
+  for(size_t i = 0; i < this->p.size(); i++)
+    this->positions[i] = this->origin[i] + this->p[i];
+  return this->positions.data();
+}
+
+const double *CEpos2StateEstimator::getVelocities() const
+{
+  return this->v.data();
+}
+
+const double *CEpos2StateEstimator::getAccelerations() const
+{
+  return this->a.data();
+}
@@ -0,0 +1,435 @@
+// Copyright (C) 2009-2010 Institut de Robòtica i Informàtica Industrial, CSIC-UPC.
+// Author Martí Morta Garriga  (mmorta@iri.upc.edu)
+// All rights reserved.
+//
+// Copyright (C) 2013 Jochen Sprickerhof <jochen@sprickerhof.de>
+//
+// This file is part of IRI EPOS2 Driver
+// IRI EPOS2 Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <chrono>
+#include <stdexcept>
+#include "epos2_motor_controller/Epos2StatusPoller.h"
+
+// ----------------------------------------------------------------------------
+//   CLASS
+// ----------------------------------------------------------------------------
+//     CONSTRUCTOR
+// ----------------------------------------------------------------------------
+
+CEpos2StatusPoller::CEpos2StatusPoller(long period_us)
+  : running(false), rescheduled(false), cycle(0), period_us(period_us),
+    max_interval_us(100000)
+{ }
+
+//     DESTRUCTOR
+// ----------------------------------------------------------------------------
+
+CEpos2StatusPoller::~CEpos2StatusPoller()
+{
+  this->stop();
+
+  std::lock_guard<std::mutex> lock(this->mutex);
+  for(size_t i = 0; i < this->axes.size(); i++)
+    this->axes[i].axis->status_poller = NULL;
+}
+
+// ----------------------------------------------------------------------------
+//   AXES
+// ----------------------------------------------------------------------------
+
+void CEpos2StatusPoller::add(CEpos2 *axis)
+{
+  std::lock_guard<std::mutex> lock(this->mutex);
+
+  if(axis->status_poller != NULL)
+    throw std::invalid_argument("EPOS2 axis already attached to a status poller");
+
+  axis_status a;
+  a.axis   = axis;
+  a.status = -1;
+  a.sample = 0;
+  a.status_sample.value = -1;
+  a.status_sample.uncertainty_us = 0;
+  a.moving = false;
+  a.next_poll = std::chrono::steady_clock::now();
+  this->axes.push_back(a);
+  axis->status_poller = this;
+  this->rescheduled = true;
+  this->cond.notify_all();
+}
+
+void CEpos2StatusPoller::remove(CEpos2 *axis)
+{
+  this->cancelWatch(axis);
+
+  std::lock_guard<std::mutex> poll_lock(this->poll_mutex);
+  std::lock_guard<std::mutex> lock(this->mutex);
+
+  for(size_t i = 0; i < this->axes.size(); i++)
+  {
+    if(this->axes[i].axis == axis)
+    {
+      this->axes.erase(this->axes.begin() + i);
+      axis->status_poller = NULL;
+      break;
+    }
+  }
+  this->cond.notify_all();
+}
+
+CEpos2StatusPoller::axis_status *CEpos2StatusPoller::find(CEpos2 *axis)
+{
+  for(size_t i = 0; i < this->axes.size(); i++)
+    if(this->axes[i].axis == axis)
+      return &this->axes[i];
+  return NULL;
+}
+
+// ----------------------------------------------------------------------------
+//   THREAD
+// ----------------------------------------------------------------------------
+
+void CEpos2StatusPoller::start()
+{
+  std::lock_guard<std::mutex> lock(this->mutex);
+
+  if(this->running)
+    return;
+  this->running = true;
+  this->thread = std::thread(&CEpos2StatusPoller::run, this);
+}
+
+void CEpos2StatusPoller::stop()
+{
+  std::vector<status_watch> cancelled;
+
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->running = false;
+    cancelled.swap(this->watches);
+  }
+  this->cond.notify_all();
+
+  if(this->thread.joinable())
+    this->thread.join();
+
+  for(size_t i = 0; i < cancelled.size(); i++)
+    cancelled[i].callback(-1);
+}
+
+long CEpos2StatusPoller::getPeriod()
+{
+  std::lock_guard<std::mutex> lock(this->mutex);
+  return this->period_us;
+}
+
+void CEpos2StatusPoller::setPeriod(long period_us)
+{
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->period_us = period_us;
+}
+
+long CEpos2StatusPoller::getMaxInterval()
+{
+  std::lock_guard<std::mutex> lock(this->mutex);
+  return this->max_interval_us;
+}
+
+void CEpos2StatusPoller::setMaxInterval(long interval_us)
+{
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->max_interval_us = interval_us;
+}
+
+// ----------------------------------------------------------------------------
+//   SCHEDULING
+// ----------------------------------------------------------------------------
+
+void CEpos2StatusPoller::expectTargetReached(CEpos2 *axis, double seconds)
+{
+  std::lock_guard<std::mutex> lock(this->mutex);
+
+  axis_status *a = this->find(axis);
+  if(a == NULL)
+    throw std::invalid_argument("EPOS2 axis not attached to the status poller");
+
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  a->moving = true;
+  a->eta    = now + std::chrono::microseconds((long)(seconds * 1e6));
+  this->schedule(a, now);
+  this->rescheduled = true;
+  this->cond.notify_all();
+}
+
+void CEpos2StatusPoller::schedule(axis_status *a,
+                                  std::chrono::steady_clock::time_point now)
+{
+  std::chrono::microseconds period(this->period_us);
+
+  if(a->moving && (a->status & 0x0400) && a->sample > 0 && now >= a->eta - period)
+    a->moving = false;
+
+  if(a->moving && a->eta - now > 2 * period)
+  {
+    // bisect the remaining time, bounded by the maximum interval
+    std::chrono::steady_clock::duration interval = (a->eta - now) / 2;
+    if(interval > std::chrono::microseconds(this->max_interval_us))
+      interval = std::chrono::microseconds(this->max_interval_us);
+    a->next_poll = now + interval;
+  }else{
+    a->next_poll += period;
+    // don't try to catch up after a long stall
+    if(a->next_poll < now)
+      a->next_poll = now;
+  }
+}
+
+// ----------------------------------------------------------------------------
+//   THREAD
+// ----------------------------------------------------------------------------
+
+void CEpos2StatusPoller::run()
+{
+  std::vector<CEpos2*> poll;
+  std::vector<long>    status;
+  std::vector<CEpos2::epos_sample> samples;
+  std::vector<status_watch> fired;
+  std::vector<long>    fired_status;
+  unsigned long        poll_cycle = 0;
+
+  while(true)
+  {
+    std::string poll_error;
+    std::chrono::steady_clock::time_point now;
+
+    {
+      std::unique_lock<std::mutex> lock(this->mutex);
+
+      std::chrono::steady_clock::time_point wake =
+        std::chrono::steady_clock::now() + std::chrono::microseconds(this->period_us);
+      for(size_t i = 0; i < this->axes.size(); i++)
+        if(this->axes[i].next_poll < wake)
+          wake = this->axes[i].next_poll;
+
+      this->cond.wait_until(lock, wake,
+          [this]{ return !this->running || this->rescheduled; });
+      if(!this->running)
+        break;
+      this->rescheduled = false;
+
+      now = std::chrono::steady_clock::now();
+      poll_cycle = ++this->cycle;
+      poll.clear();
+      for(size_t i = 0; i < this->axes.size(); i++)
+        if(this->axes[i].next_poll <= now)
+          poll.push_back(this->axes[i].axis);
+    }
+
+    if(poll.empty())
+      continue;
+
+    // read without holding mutex so waiters and getStatusWord don't block
+    {
+      std::lock_guard<std::mutex> poll_lock(this->poll_mutex);
+      status.assign(poll.size(), -1);
+      samples.resize(poll.size());
+      try
+      {
+        for(size_t i = 0; i < poll.size(); i++)
+        {
+          samples[i] = poll[i]->readStatusWordSample();
+          status[i]  = samples[i].value;
+        }
+      }
+      catch(std::exception &e)
+      {
+        poll_error = e.what();
+      }
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(this->mutex);
+      for(size_t i = 0; i < poll.size(); i++)
+      {
+        axis_status *a = this->find(poll[i]);
+        if(a == NULL)
+          continue;
+        if(status[i] >= 0)
+        {
+          a->status = status[i];
+          a->sample = poll_cycle;
+          a->status_sample = samples[i];
+        }
+        this->schedule(a, now);
+      }
+      this->error = poll_error;
+
+      fired.clear();
+      fired_status.clear();
+      for(size_t i = 0; i < this->watches.size(); )
+      {
+        status_watch &w = this->watches[i];
+        axis_status *a = this->find(w.axis);
+        // bits left by a previous operation don't complete it, like in
+        // CEpos2::threadTargetReached
+        if(a != NULL && a->sample >= w.first && w.stale_mask != 0 &&
+           (!(a->status & w.stale_mask) || now >= w.stale_until))
+          w.stale_mask = 0;
+        if(a != NULL && a->sample >= w.first &&
+           (((a->status & w.mask) == w.mask && w.stale_mask == 0) || (a->status & w.error_mask)))
+        {
+          fired.push_back(w);
+          fired_status.push_back(a->status);
+          this->watches.erase(this->watches.begin() + i);
+        }else{
+          i++;
+        }
+      }
+    }
+    this->cond.notify_all();
+
+    // callbacks may use the poller, call them without holding the mutex
+    for(size_t i = 0; i < fired.size(); i++)
+      fired[i].callback(fired_status[i]);
+  }
+}
+
+// ----------------------------------------------------------------------------
+//   STATUS
+// ----------------------------------------------------------------------------
+
+long CEpos2StatusPoller::getStatusWord(CEpos2 *axis)
+{
+  std::lock_guard<std::mutex> lock(this->mutex);
+
+  axis_status *a = this->find(axis);
+  if(a == NULL)
+    throw std::invalid_argument("EPOS2 axis not attached to the status poller");
+  return a->status;
+}
+
+CEpos2::epos_sample CEpos2StatusPoller::getStatusSample(CEpos2 *axis)
+{
+  std::lock_guard<std::mutex> lock(this->mutex);
+
+  axis_status *a = this->find(axis);
+  if(a == NULL)
+    throw std::invalid_argument("EPOS2 axis not attached to the status poller");
+  return a->status_sample;
+}
+
+bool CEpos2StatusPoller::waitStatus(CEpos2 *axis, long mask, long timeout_ms)
+{
+  return this->waitStatus(std::vector<CEpos2*>(1, axis), mask, timeout_ms);
+}
+
+bool CEpos2StatusPoller::waitStatus(const std::vector<CEpos2*> &axes, long mask,
+                                    long timeout_ms)
+{
+  std::unique_lock<std::mutex> lock(this->mutex);
+  std::vector<unsigned long> first(axes.size());
+
+  for(size_t i = 0; i < axes.size(); i++)
+  {
+    axis_status *a = this->find(axes[i]);
+    if(a == NULL)
+      throw std::invalid_argument("EPOS2 axis not attached to the status poller");
+    first[i] = this->cycle + 1;
+  }
+
+  std::chrono::steady_clock::time_point deadline =
+    std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+
+  bool expired = false;
+  while(true)
+  {
+    if(!this->running)
+      throw EPOS2IOException("EPOS2 status poller is not running");
+    if(!this->error.empty())
+      throw EPOS2IOException(this->error);
+
+    bool done = true;
+    for(size_t i = 0; i < axes.size() && done; i++)
+    {
+      axis_status *a = this->find(axes[i]);
+      if(a == NULL)
+        throw std::invalid_argument("EPOS2 axis detached from the status poller");
+      done = a->sample >= first[i] && (a->status & mask) == mask;
+    }
+    if(done)
+      return true;
+    if(expired)
+      return false;
+
+    if(timeout_ms < 0)
+      this->cond.wait(lock);
+    else
+      expired = this->cond.wait_until(lock, deadline) == std::cv_status::timeout;
+  }
+}
+
+void CEpos2StatusPoller::watchStatus(CEpos2 *axis, long mask, long error_mask,
+                                     const std::function<void(long)> &callback,
+                                     long stale_mask)
+{
+  std::lock_guard<std::mutex> lock(this->mutex);
+
+  axis_status *a = this->find(axis);
+  if(a == NULL)
+    throw std::invalid_argument("EPOS2 axis not attached to the status poller");
+
+  status_watch w;
+  w.axis       = axis;
+  w.mask       = mask;
+  w.error_mask = error_mask;
+  w.first      = this->cycle + 1;
+  w.stale_mask = stale_mask;
+  w.stale_until = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+  w.callback   = callback;
+  this->watches.push_back(w);
+}
+
+void CEpos2StatusPoller::cancelWatch(CEpos2 *axis)
+{
+  std::vector<status_watch> cancelled;
+
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    for(size_t i = 0; i < this->watches.size(); )
+    {
+      if(this->watches[i].axis == axis)
+      {
+        cancelled.push_back(this->watches[i]);
+        this->watches.erase(this->watches.begin() + i);
+      }else{
+        i++;
+      }
+    }
+  }
+
+  for(size_t i = 0; i < cancelled.size(); i++)
+    cancelled[i].callback(-1);
+}
+
+bool CEpos2StatusPoller::waitTargetReached(CEpos2 *axis, long timeout_ms)
+{
+  return this->waitStatus(axis, 0x0400, timeout_ms);
+}
+
+bool CEpos2StatusPoller::waitTargetReached(const std::vector<CEpos2*> &axes,
+                                           long timeout_ms)
+{
+  return this->waitStatus(axes, 0x0400, timeout_ms);
+}
@@ -0,0 +1,257 @@
+// Copyright (C) 2009-2010 Institut de Robòtica i Informàtica Industrial, CSIC-UPC.
+// Author Martí Morta Garriga  (mmorta@iri.upc.edu)
+// All rights reserved.
+//
+// Copyright (C) 2013 Jochen Sprickerhof <jochen@sprickerhof.de>
+//
+// This file is part of IRI EPOS2 Driver
+// IRI EPOS2 Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <cmath>
+#include "epos2_motor_controller/Epos2Trajectory.h"
+
+// ----------------------------------------------------------------------------
+//   CLASS
+// ----------------------------------------------------------------------------
+//     CONSTRUCTOR
+// ----------------------------------------------------------------------------
+
+CEpos2Trajectory::CEpos2Trajectory()
+  : num_phases(0), duration(0.0), start(0.0), target(0.0)
+{ }
+
+//     READ LIMITS
+// ----------------------------------------------------------------------------
+
+CEpos2Trajectory::epos_limits CEpos2Trajectory::readLimits(CEpos2 &axis, double jerk)
+{
+  epos_limits limits;
+
+  // [rev/min] and [rev/min/s] to [qc/s] and [qc/s^2]
+  double qc_rpm = 4.0 * axis.getEncoderPulseNumber() / 60.0;
+
+  limits.velocity     = axis.getProfileMaxVelocity() * qc_rpm;
+  limits.acceleration = axis.getMaxAcceleration() * qc_rpm;
+  limits.jerk         = jerk;
+  limits.min_position = (int32_t)axis.getMinPositionLimit();
+  limits.max_position = (int32_t)axis.getMaxPositionLimit();
+
+  return limits;
+}
+
+// ----------------------------------------------------------------------------
+//   PLANNING
+// ----------------------------------------------------------------------------
+
+void CEpos2Trajectory::addPhase(double duration, double a, double j)
+{
+  epos_phase &ph = this->phases[this->num_phases];
+
+  if(this->num_phases == 0)
+  {
+    ph.t = 0.0;
+    ph.p = this->start;
+    ph.v = 0.0;
+  }else{
+    const epos_phase &prev = this->phases[this->num_phases - 1];
+    double T = this->duration - prev.t;
+    ph.t = this->duration;
+    ph.p = prev.p + prev.v*T + prev.a*T*T/2.0 + prev.j*T*T*T/6.0;
+    ph.v = prev.v + prev.a*T + prev.j*T*T/2.0;
+  }
+  ph.a = a;
+  ph.j = j;
+
+  this->num_phases++;
+  this->duration += duration;
+}
+
+void CEpos2Trajectory::planTrapezoid(double start, double target, const epos_limits &limits)
+{
+  if(target < limits.min_position) target = limits.min_position;
+  if(target > limits.max_position) target = limits.max_position;
+
+  this->start      = start;
+  this->target     = target;
+  this->num_phases = 0;
+  this->duration   = 0.0;
+
+  double s = target >= start ? 1.0 : -1.0;
+  double d = std::fabs(target - start);
+  double V = limits.velocity;
+  double A = limits.acceleration;
+
+  if(d == 0.0 || V <= 0.0 || A <= 0.0)
+    return;
+
+  // ramp time and cruise time, triangular if V can't be reached
+  double Ta = V / A;
+  double Tv = (d - V*V/A) / V;
+  if(Tv < 0.0)
+  {
+    Ta = std::sqrt(d / A);
+    Tv = 0.0;
+  }
+
+  this->addPhase(Ta, s*A, 0.0);
+  if(Tv > 0.0)
+    this->addPhase(Tv, 0.0, 0.0);
+  this->addPhase(Ta, -s*A, 0.0);
+}
+
+void CEpos2Trajectory::planSCurve(double start, double target, const epos_limits &limits)
+{
+  if(target < limits.min_position) target = limits.min_position;
+  if(target > limits.max_position) target = limits.max_position;
+
+  this->start      = start;
+  this->target     = target;
+  this->num_phases = 0;
+  this->duration   = 0.0;
+
+  double s = target >= start ? 1.0 : -1.0;
+  double d = std::fabs(target - start);
+  double V = limits.velocity;
+  double A = limits.acceleration;
+  double J = limits.jerk;
+
+  if(d == 0.0 || V <= 0.0 || A <= 0.0 || J <= 0.0)
+    return;
+
+  // jerk time Tj and acceleration time Ta (including both jerk phases)
+  double Tj, Ta, Tv;
+  if(V*J >= A*A)
+  {
+    Tj = A / J;
+    Ta = Tj + V / A;
+  }else{
+    Tj = std::sqrt(V / J);
+    Ta = 2.0 * Tj;
+  }
+  Tv = d / V - Ta;
+
+  if(Tv < 0.0)
+  {
+    // V not reached, reduce it (and A if even A isn't reached)
+    Tv = 0.0;
+    if(d >= 2.0*A*A*A/(J*J))
+    {
+      Tj = A / J;
+      Ta = Tj/2.0 + std::sqrt(Tj*Tj/4.0 + d/A);
+    }else{
+      Tj = std::cbrt(d / (2.0*J));
+      Ta = 2.0 * Tj;
+    }
+  }
+
+  double a_lim = J * Tj;
+  double Tc = Ta - 2.0*Tj;     // constant acceleration time
+
+  this->addPhase(Tj, 0.0, s*J);
+  if(Tc > 0.0)
+    this->addPhase(Tc, s*a_lim, 0.0);
+  this->addPhase(Tj, s*a_lim, -s*J);
+  if(Tv > 0.0)
+    this->addPhase(Tv, 0.0, 0.0);
+  this->addPhase(Tj, 0.0, -s*J);
+  if(Tc > 0.0)
+    this->addPhase(Tc, -s*a_lim, 0.0);
+  this->addPhase(Tj, -s*a_lim, s*J);
+}
+
+// ----------------------------------------------------------------------------
+//   EVALUATION
+// ----------------------------------------------------------------------------
+
+double CEpos2Trajectory::getDuration() const
+{
+  return this->duration;
+}
+
+double CEpos2Trajectory::getTarget() const
+{
+  return this->target;
+}
+
+void CEpos2Trajectory::evaluate(double t, double &position, double &velocity,
+                                double &acceleration) const
+{
+  this->sample(t, 0.0, 1, &position, &velocity, &acceleration);
+}
+
+void CEpos2Trajectory::sample(double t0, double dt, size_t n, double *position,
+                              double *velocity, double *acceleration) const
+{
+  size_t i = 0;
+
+  // first sample at or after time t, n if none
+  auto first = [&](double t) -> size_t
+  {
+    if(dt <= 0.0)
+      return t0 < t ? n : 0;
+    double k = std::ceil((t - t0) / dt);
+    if(k <= 0.0)
+      return 0;
+    return k >= (double)n ? n : (size_t)k;
+  };
+
+  // before the start
+  size_t end = this->num_phases > 0 ? first(0.0) : n;
+  for(; i < end; i++)
+  {
+    position[i] = this->start;
+    if(velocity)     velocity[i] = 0.0;
+    if(acceleration) acceleration[i] = 0.0;
+  }
+
+  for(int k = 0; k < this->num_phases; k++)
+  {
+    const epos_phase &ph = this->phases[k];
+    double t_end = k+1 < this->num_phases ? this->phases[k+1].t : this->duration;
+    size_t begin = i;
+    end = first(t_end);
+    if(end < begin)
+      end = begin;
+
+    const double p = ph.p, v = ph.v, a = ph.a, j = ph.j;
+    const double tau0 = t0 - ph.t;
+
+    for(i = begin; i < end; i++)
+    {
+      double tau = tau0 + i*dt;
+      position[i] = p + tau*(v + tau*(a/2.0 + tau*j/6.0));
+    }
+    if(velocity)
+      for(i = begin; i < end; i++)
+      {
+        double tau = tau0 + i*dt;
+        velocity[i] = v + tau*(a + tau*j/2.0);
+      }
+    if(acceleration)
+      for(i = begin; i < end; i++)
+      {
+        double tau = tau0 + i*dt;
+        acceleration[i] = a + tau*j;
+      }
+    i = end;
+  }
+
+  // after the end
+  for(; i < n; i++)
+  {
+    position[i] = this->target;
+    if(velocity)     velocity[i] = 0.0;
+    if(acceleration) acceleration[i] = 0.0;
+  }
+}
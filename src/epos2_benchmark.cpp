@@ -0,0 +1,159 @@
+// Copyright (C) 2009-2010 Institut de Robòtica i Informàtica Industrial, CSIC-UPC.
+// Author Martí Morta Garriga  (mmorta@iri.upc.edu)
+// All rights reserved.
+//
+// Copyright (C) 2013 Jochen Sprickerhof <jochen@sprickerhof.de>
+//
+// This file is part of IRI EPOS2 Driver
+// IRI EPOS2 Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+// Measures the link to an EPOS2: the round trip of expedited reads, the
+// throughput of a segmented upload (the buffer of the data recorder) and the
+// latency of quick stops sent while another thread keeps the link busy.
+//
+//   epos2_benchmark [-n reads] [-s stops] node_id
+//
+// The recorder is uploaded as it is, configure and run it before to
+// measure a full buffer. The stops leave the axis in quick stop, -s 0 skips
+// them.
+
+#include <iostream>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <unistd.h>
+#include "epos2_motor_controller/Epos2.h"
+
+static void usage(const char *program)
+{
+  std::cerr << "usage: " << program << " [-n reads] [-s stops] node_id" << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+  long reads = 1000;
+  long stops = 100;
+  int c;
+
+  while((c = getopt(argc, argv, "n:s:h")) != -1)
+  {
+    switch(c)
+    {
+      case 'n':
+        reads = atol(optarg);
+        break;
+      case 's':
+        stops = atol(optarg);
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+  if(optind + 1 != argc || reads <= 0 || stops < 0)
+  {
+    usage(argv[0]);
+    return 1;
+  }
+
+  CEpos2 axis(atoi(argv[optind]));
+
+  try
+  {
+    axis.init();
+
+    axis.resetRoundTrip();
+    for(long i = 0; i < reads; i++)
+      axis.readStatusWord();
+
+    CEpos2::epos_latency rtt = axis.getRoundTrip();
+    std::cout << "read round trip: " << rtt.count << " reads, mean "
+              << (rtt.count > 0 ? rtt.total_us / (long)rtt.count : 0) << " us, worst "
+              << rtt.worst_us << " us" << std::endl;
+
+    // readRecorder refuses a recorder without variables, nothing to time
+    // without samples either
+    if(axis.getRecorderVariables().empty() || axis.getRecorderSampleCount() <= 0)
+      std::cout << "segmented upload: recorder empty" << std::endl;
+    else
+    {
+      axis.resetTransferStats();
+      CEpos2::epos_recorder_data data = axis.readRecorder();
+
+      CEpos2::epos_transfer_stats transfer = axis.getTransferStats();
+      std::cout << "segmented upload: " << transfer.bytes << " bytes ("
+                << (data.values.empty() ? 0 : data.values[0].size()) << " samples) in "
+                << transfer.total_us << " us, "
+                << (transfer.total_us > 0 ? (long)(transfer.bytes * 1e6 / transfer.total_us) : 0)
+                << " bytes/s" << std::endl;
+    }
+
+    if(stops > 0)
+    {
+      // the reads queue on the link, every stop has to jump them
+      std::atomic<bool> loading(true);
+      std::string load_error;
+      std::thread load([&]()
+      {
+        try
+        {
+          while(loading)
+            axis.readStatusWord();
+        }
+        catch(std::exception &e)
+        {
+          load_error = e.what();
+        }
+      });
+
+      axis.resetStopLatency();
+      try
+      {
+        for(long i = 0; i < stops; i++)
+        {
+          axis.quickStop();
+          std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+      }
+      catch(...)
+      {
+        loading = false;
+        load.join();
+        throw;
+      }
+      loading = false;
+      load.join();
+      if(!load_error.empty())
+        throw EPOS2IOException(load_error);
+
+      CEpos2::epos_latency stop = axis.getStopLatency();
+      std::cout << "quick stop under read load: " << stop.count << " stops, mean "
+                << (stop.count > 0 ? stop.total_us / (long)stop.count : 0) << " us, worst "
+                << stop.worst_us << " us" << std::endl;
+    }
+  }
+  catch(std::exception &e)
+  {
+    std::cerr << e.what() << std::endl;
+    axis.close();
+    return 1;
+  }
+
+  axis.close();
+
+  return 0;
+}
@@ -0,0 +1,105 @@
+// Copyright (C) 2009-2010 Institut de Robòtica i Informàtica Industrial, CSIC-UPC.
+// Author Martí Morta Garriga  (mmorta@iri.upc.edu)
+// All rights reserved.
+//
+// Copyright (C) 2013 Jochen Sprickerhof <jochen@sprickerhof.de>
+//
+// This file is part of IRI EPOS2 Driver
+// IRI EPOS2 Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+// Daemon owning the EPOS2 link and serving the axes to other processes
+// through shared memory (see CEpos2Broker and CEpos2Remote).
+//
+//   epos2_broker [-n name] [-p period_us] node_id...
+//
+// Client axis i is the i-th node id. It runs until SIGINT or SIGTERM.
+
+#include <iostream>
+#include <memory>
+#include <vector>
+#include <cstdlib>
+#include <csignal>
+#include <unistd.h>
+#include "epos2_motor_controller/Epos2Broker.h"
+
+static void usage(const char *program)
+{
+  std::cerr << "usage: " << program << " [-n name] [-p period_us] node_id..." << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+  std::string name = "/epos2_broker";
+  long period_us = 10000;
+  int c;
+
+  while((c = getopt(argc, argv, "n:p:h")) != -1)
+  {
+    switch(c)
+    {
+      case 'n':
+        name = optarg;
+        break;
+      case 'p':
+        period_us = atol(optarg);
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+  if(optind == argc || period_us <= 0)
+  {
+    usage(argv[0]);
+    return 1;
+  }
+
+  // the signals are taken by sigwait, block them before any thread starts
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+  std::vector<std::unique_ptr<CEpos2> > axes;
+  CEpos2Broker broker(name, period_us);
+
+  try
+  {
+    for(int i = optind; i < argc; i++)
+    {
+      axes.push_back(std::unique_ptr<CEpos2>(new CEpos2(atoi(argv[i]))));
+      axes.back()->init();
+      broker.add(axes.back().get());
+    }
+    broker.start();
+  }
+  catch(std::exception &e)
+  {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+
+  std::cout << "serving " << axes.size() << " axes on " << name << std::endl;
+
+  int signal;
+  sigwait(&signals, &signal);
+
+  broker.stop();
+  for(size_t i = 0; i < axes.size(); i++)
+    axes[i]->close();
+
+  return 0;
+}
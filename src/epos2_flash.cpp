@@ -0,0 +1,133 @@
+// Copyright (C) 2009-2010 Institut de Robòtica i Informàtica Industrial, CSIC-UPC.
+// Author Martí Morta Garriga  (mmorta@iri.upc.edu)
+// All rights reserved.
+//
+// Copyright (C) 2013 Jochen Sprickerhof <jochen@sprickerhof.de>
+//
+// This file is part of IRI EPOS2 Driver
+// IRI EPOS2 Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+// Downloads a firmware image to EPOS2, in parallel to the ones on different
+// USB devices (see CEpos2Firmware).
+//
+//   epos2_flash [-n node_id] [-t timeout_ms] image [serial...]
+//
+// Without serials the first USB device found is flashed. It prints the
+// progress, then per EPOS2 the throughput of the download against the
+// theoretical limit of the link, and the throughput of all of them.
+
+#include <iostream>
+#include <iomanip>
+#include <mutex>
+#include <chrono>
+#include <cstdlib>
+#include <unistd.h>
+#include "epos2_motor_controller/Epos2Firmware.h"
+
+static void usage(const char *program)
+{
+  std::cerr << "usage: " << program << " [-n node_id] [-t timeout_ms] image [serial...]" << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+  int node_id = 1;
+  long timeout_ms = 30000;
+  int c;
+
+  while((c = getopt(argc, argv, "n:t:h")) != -1)
+  {
+    switch(c)
+    {
+      case 'n':
+        node_id = atoi(optarg);
+        break;
+      case 't':
+        timeout_ms = atol(optarg);
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+  if(optind == argc || timeout_ms <= 0)
+  {
+    usage(argv[0]);
+    return 1;
+  }
+
+  std::vector<CEpos2Firmware::epos_flash_target> targets;
+  for(int i = optind + 1; i < argc || targets.empty(); i++)
+  {
+    CEpos2Firmware::epos_flash_target target;
+    target.serial  = i < argc ? argv[i] : "";
+    target.node_id = node_id;
+    targets.push_back(target);
+  }
+
+  try
+  {
+    CEpos2Firmware firmware(argv[optind]);
+    std::cout << argv[optind] << ": " << firmware.getSize() << " bytes, CRC-32 0x"
+              << std::hex << firmware.getCrc() << std::dec << std::endl;
+
+    // a line every 10 %
+    std::mutex output;
+    std::vector<int> shown(targets.size(), -1);
+    auto progress = [&](size_t i, uint32_t sent, uint32_t total)
+    {
+      int tenth = (int)(10ULL * sent / total);
+      std::lock_guard<std::mutex> lock(output);
+      if(tenth != shown[i])
+      {
+        shown[i] = tenth;
+        std::cout << "[" << (targets[i].serial.empty() ? "default" : targets[i].serial)
+                  << "] " << 10*tenth << " %" << std::endl;
+      }
+    };
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::vector<CEpos2Firmware::epos_flash_result> results =
+      firmware.flash(targets, progress, timeout_ms);
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    int failed = 0;
+    uint64_t bytes = 0;
+    std::cout << std::fixed << std::setprecision(1);
+    for(size_t i = 0; i < results.size(); i++)
+    {
+      std::cout << "[" << (targets[i].serial.empty() ? "default" : targets[i].serial) << "] ";
+      if(results[i].ok)
+      {
+        bytes += results[i].bytes;
+        std::cout << "ok, " << results[i].bytes_per_s << " bytes/s, "
+                  << 100.0 * results[i].efficiency << " % of the link, "
+                  << results[i].total_us / 1000 << " ms" << std::endl;
+      }else{
+        failed++;
+        std::cout << "failed: " << results[i].error << std::endl;
+      }
+    }
+    std::cout << "total " << bytes / elapsed << " bytes/s (link limit "
+              << CEpos2Firmware::linkLimit() << " bytes/s per device)" << std::endl;
+
+    return failed == 0 ? 0 : 2;
+  }
+  catch(std::exception &e)
+  {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+}
@@ -0,0 +1,86 @@
+// Copyright (C) 2009-2010 Institut de Robòtica i Informàtica Industrial, CSIC-UPC.
+// Author Martí Morta Garriga  (mmorta@iri.upc.edu)
+// All rights reserved.
+//
+// Copyright (C) 2013 Jochen Sprickerhof <jochen@sprickerhof.de>
+//
+// This file is part of IRI EPOS2 Driver
+// IRI EPOS2 Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef Epos2Test_H
+#define Epos2Test_H
+
+#include <iostream>
+#include <string>
+#include <cmath>
+#include <cstdlib>
+#include <unistd.h>
+
+// Checks of the unit tests: a failed one is reported and counted, the test
+// goes on so one run shows all of them. main returns EPOS2_TEST_RESULT.
+
+static int epos2_test_failures = 0;
+
+#define EPOS2_CHECK(condition) \
+  do { \
+    if(!(condition)) \
+    { \
+      std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #condition << std::endl; \
+      epos2_test_failures++; \
+    } \
+  } while(0)
+
+#define EPOS2_CHECK_EQUAL(a, b) \
+  do { \
+    if(!((a) == (b))) \
+    { \
+      std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #a " == " #b \
+                << " (" << (a) << " != " << (b) << ")" << std::endl; \
+      epos2_test_failures++; \
+    } \
+  } while(0)
+
+#define EPOS2_CHECK_NEAR(a, b, tolerance) \
+  do { \
+    if(!(std::fabs((double)(a) - (double)(b)) <= (tolerance))) \
+    { \
+      std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #a " ~ " #b \
+                << " (" << (a) << " != " << (b) << ")" << std::endl; \
+      epos2_test_failures++; \
+    } \
+  } while(0)
+
+#define EPOS2_CHECK_THROW(statement, exception) \
+  do { \
+    bool thrown = false; \
+    try { statement; } catch(exception &) { thrown = true; } \
+    if(!thrown) \
+    { \
+      std::cerr << __FILE__ << ":" << __LINE__ << ": " #statement " didn't throw " #exception << std::endl; \
+      epos2_test_failures++; \
+    } \
+  } while(0)
+
+#define EPOS2_TEST_RESULT (epos2_test_failures == 0 ? 0 : 1)
+
+// a file name of this process in the temporary directory
+static inline std::string epos2TestPath(const std::string &name)
+{
+  const char *dir = getenv("TMPDIR");
+  return std::string(dir != NULL ? dir : "/tmp") + "/epos2_test_" +
+         std::to_string(getpid()) + "_" + name;
+}
+
+#endif
@@ -0,0 +1,98 @@
+// Copyright (C) 2009-2010 Institut de Robòtica i Informàtica Industrial, CSIC-UPC.
+// Author Martí Morta Garriga  (mmorta@iri.upc.edu)
+// All rights reserved.
+//
+// Copyright (C) 2013 Jochen Sprickerhof <jochen@sprickerhof.de>
+//
+// This file is part of IRI EPOS2 Driver
+// IRI EPOS2 Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+// The fixed-point cam of CEpos2CamFollower: gears, tables, negative master
+// positions and periods far from 0. The loop is never started, the axes are
+// never opened.
+
+#include <vector>
+#include <stdexcept>
+#include "epos2_motor_controller/Epos2CamFollower.h"
+#include "Epos2Test.h"
+
+int main()
+{
+  CEpos2 master(1), slave(2);
+  CEpos2CamFollower follower(master, slave);
+
+  // 1:1 until set, exact at any magnitude
+  EPOS2_CHECK_EQUAL(follower.evaluate(0), 0);
+  EPOS2_CHECK_EQUAL(follower.evaluate(1234LL << 8), 1234);
+  EPOS2_CHECK_EQUAL(follower.evaluate(-1234LL * 256), -1234);
+  EPOS2_CHECK_EQUAL(follower.evaluate(1LL << 48), 1LL << 40);
+
+  // 3:7 gear: exact on whole periods, rounded in between
+  follower.setGear(3, 7);
+  for(int64_t m = -7000; m <= 7000; m += 7)
+    if(follower.evaluate(m * 256) != 3 * m / 7)
+    {
+      EPOS2_CHECK_EQUAL(follower.evaluate(m * 256), 3 * m / 7);
+      break;
+    }
+  for(int64_t q = -5000; q <= 5000; q++)
+    if(std::fabs(follower.evaluate(q) - 3.0 * q / 256.0 / 7.0) > 0.5 + 1e-3)
+    {
+      EPOS2_CHECK_NEAR(follower.evaluate(q), 3.0 * q / 256.0 / 7.0, 0.5 + 1e-3);
+      break;
+    }
+
+  // a cam table: the points, linear in between, the rise every period
+  std::vector<int32_t> table;
+  table.push_back(0);
+  table.push_back(100);
+  table.push_back(50);
+  table.push_back(200);
+  follower.setCamTable(table, 300);
+  EPOS2_CHECK_EQUAL(follower.evaluate(0), 0);
+  EPOS2_CHECK_EQUAL(follower.evaluate(100LL << 8), 100);
+  EPOS2_CHECK_EQUAL(follower.evaluate(150LL << 8), 75);
+  EPOS2_CHECK_EQUAL(follower.evaluate(200LL << 8), 50);
+  EPOS2_CHECK_EQUAL(follower.evaluate(300LL << 8), 200);
+  EPOS2_CHECK_EQUAL(follower.evaluate(-100LL * 256), -200 + 50);
+  EPOS2_CHECK_EQUAL(follower.evaluate((50LL << 8) + 192), 51);     // 50.75 rounded
+
+  // periods far from 0 give the same cam plus their rise
+  const int64_t period_q = 300LL << 8;
+  const int64_t far = 1LL << 30;
+  for(int64_t q = 0; q < period_q; q += 37)
+  {
+    int64_t y = follower.evaluate(q);
+    if(follower.evaluate(q + far * period_q) != y + far * 200 ||
+       follower.evaluate(q - far * period_q) != y - far * 200)
+    {
+      EPOS2_CHECK_EQUAL(follower.evaluate(q + far * period_q), y + far * 200);
+      EPOS2_CHECK_EQUAL(follower.evaluate(q - far * period_q), y - far * 200);
+      break;
+    }
+  }
+
+  // a table returning to its start repeats without rise
+  table.back() = 0;
+  follower.setCamTable(table, 300);
+  EPOS2_CHECK_EQUAL(follower.evaluate(100LL << 8), follower.evaluate(400LL << 8));
+  EPOS2_CHECK_EQUAL(follower.evaluate(100LL << 8), follower.evaluate(-200LL * 256));
+
+  EPOS2_CHECK_THROW(follower.setCamTable(std::vector<int32_t>(1, 0), 300), std::invalid_argument);
+  EPOS2_CHECK_THROW(follower.setCamTable(table, 0), std::invalid_argument);
+  EPOS2_CHECK_THROW(follower.setGear(1, -1), std::invalid_argument);
+
+  return EPOS2_TEST_RESULT;
+}
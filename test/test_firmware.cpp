@@ -0,0 +1,87 @@
+// Copyright (C) 2009-2010 Institut de Robòtica i Informàtica Industrial, CSIC-UPC.
+// Author Martí Morta Garriga  (mmorta@iri.upc.edu)
+// All rights reserved.
+//
+// Copyright (C) 2013 Jochen Sprickerhof <jochen@sprickerhof.de>
+//
+// This file is part of IRI EPOS2 Driver
+// IRI EPOS2 Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+// The image side of CEpos2Firmware: the CRC-32 against the IEEE 802.3
+// reference values, incremental CRCs, and the size and CRC of image files
+// larger than the read buffer. Nothing is downloaded.
+
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include "epos2_motor_controller/Epos2Firmware.h"
+#include "Epos2Test.h"
+
+static uint32_t crcOf(const char *text)
+{
+  return CEpos2Firmware::crc32(0, (const uint8_t*)text, strlen(text));
+}
+
+int main()
+{
+  // reference values (as zlib crc32)
+  EPOS2_CHECK_EQUAL(crcOf(""), 0u);
+  EPOS2_CHECK_EQUAL(crcOf("a"), 0xE8B7BE43u);
+  EPOS2_CHECK_EQUAL(crcOf("123456789"), 0xCBF43926u);
+  EPOS2_CHECK_EQUAL(crcOf("The quick brown fox jumps over the lazy dog"), 0x414FA339u);
+
+  // a CRC goes on from the one of the previous bytes, at any split
+  std::vector<uint8_t> image(200003);
+  uint32_t x = 12345;
+  for(size_t i = 0; i < image.size(); i++)
+  {
+    x = x * 1103515245u + 12345u;
+    image[i] = x >> 24;
+  }
+  uint32_t whole = CEpos2Firmware::crc32(0, &image[0], image.size());
+  for(size_t split = 0; split <= image.size(); split += 65537)
+  {
+    uint32_t crc = CEpos2Firmware::crc32(0, &image[0], split);
+    crc = CEpos2Firmware::crc32(crc, &image[split], image.size() - split);
+    EPOS2_CHECK_EQUAL(crc, whole);
+  }
+
+  // an image read in several buffers
+  std::string path = epos2TestPath("firmware.bin");
+  {
+    std::ofstream out(path.c_str(), std::ios::binary);
+    out.write((const char*)&image[0], image.size());
+  }
+  {
+    CEpos2Firmware firmware(path);
+    EPOS2_CHECK_EQUAL(firmware.getSize(), image.size());
+    EPOS2_CHECK_EQUAL(firmware.getCrc(), whole);
+  }
+
+  // empty or missing images are refused
+  {
+    std::ofstream out(path.c_str(), std::ios::binary | std::ios::trunc);
+  }
+  EPOS2_CHECK_THROW(CEpos2Firmware firmware(path), std::invalid_argument);
+  std::remove(path.c_str());
+  EPOS2_CHECK_THROW(CEpos2Firmware firmware(path), EPOS2IOException);
+
+  // 63 bytes per 80 bytes on the wire, 10 bits each
+  EPOS2_CHECK_NEAR(CEpos2Firmware::linkLimit(1000000), 63.0 * 100000.0 / 80.0, 1e-6);
+
+  return EPOS2_TEST_RESULT;
+}
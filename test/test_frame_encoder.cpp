@@ -0,0 +1,163 @@
+// Copyright (C) 2009-2010 Institut de Robòtica i Informàtica Industrial, CSIC-UPC.
+// Author Martí Morta Garriga  (mmorta@iri.upc.edu)
+// All rights reserved.
+//
+// Copyright (C) 2013 Jochen Sprickerhof <jochen@sprickerhof.de>
+//
+// This file is part of IRI EPOS2 Driver
+// IRI EPOS2 Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+// Frames of the EPOS2 serial protocol: the CRC-CCITT checksum, the sync
+// characters, the byte order and the stuffing of 0x90. Nothing is sent, the
+// axis is never opened.
+
+#include <vector>
+#include <cstdint>
+#include "epos2_motor_controller/Epos2.h"
+#include "Epos2Test.h"
+
+class CEpos2FrameTest {
+
+  public:
+
+    static int16_t checksum(CEpos2 &axis, std::vector<int16_t> words)
+    {
+      return axis.computeChecksum(&words[0], words.size());
+    }
+
+    static std::vector<uint8_t> readObject(CEpos2 &axis, int16_t index, int8_t subindex)
+    {
+      std::vector<uint8_t> frame(32);
+      frame.resize(axis.encodeReadObject(index, subindex, &frame[0]));
+      return frame;
+    }
+
+    static std::vector<uint8_t> writeObject(CEpos2 &axis, int16_t index, int8_t subindex,
+                                            int32_t data)
+    {
+      std::vector<uint8_t> frame(32);
+      frame.resize(axis.encodeWriteObject(index, subindex, data, &frame[0]));
+      return frame;
+    }
+
+    static std::vector<uint8_t> quickStop(CEpos2 &axis)
+    {
+      return std::vector<uint8_t>(axis.quick_stop_frame,
+                                  axis.quick_stop_frame + axis.quick_stop_frame_len);
+    }
+};
+
+// words of a transmission frame: after DLE STX, little endian, 0x90 doubled
+static bool unstuff(const std::vector<uint8_t> &frame, std::vector<uint16_t> &words)
+{
+  std::vector<uint8_t> bytes;
+
+  words.clear();
+  if(frame.size() < 2 || frame[0] != 0x90 || frame[1] != 0x02)
+    return false;
+  for(size_t i = 2; i < frame.size(); i++)
+  {
+    if(frame[i] == 0x90)
+    {
+      if(i + 1 == frame.size() || frame[i+1] != 0x90)
+        return false;
+      i++;
+    }
+    bytes.push_back(frame[i]);
+  }
+  if(bytes.size() % 2 != 0)
+    return false;
+  for(size_t i = 0; i < bytes.size(); i += 2)
+    words.push_back(bytes[i] | (bytes[i+1] << 8));
+  return true;
+}
+
+static size_t count(const std::vector<uint8_t> &frame, uint8_t byte)
+{
+  size_t n = 0;
+  for(size_t i = 0; i < frame.size(); i++)
+    n += frame[i] == byte;
+  return n;
+}
+
+int main()
+{
+  CEpos2 axis(1);
+  std::vector<uint16_t> words;
+
+  // CRC-CCITT (XModem) of "12345678", the checksum word zero
+  EPOS2_CHECK_EQUAL((uint16_t)CEpos2FrameTest::checksum(axis,
+                      {0x3132, 0x3334, 0x3536, 0x3738, 0x0000}), 0x9015);
+  EPOS2_CHECK_EQUAL(CEpos2FrameTest::checksum(axis, {0x0000}), 0);
+
+  // WriteObject 0x6040-00 = 0x000F to node 1
+  std::vector<uint8_t> write = CEpos2FrameTest::writeObject(axis, 0x6040, 0x00, 0x000F);
+  EPOS2_CHECK(unstuff(write, words));
+  EPOS2_CHECK_EQUAL(words.size(), 6u);
+  if(words.size() == 6)
+  {
+    EPOS2_CHECK_EQUAL(words[0], 0x0411);
+    EPOS2_CHECK_EQUAL(words[1], 0x6040);
+    EPOS2_CHECK_EQUAL(words[2], 0x0100);
+    EPOS2_CHECK_EQUAL(words[3], 0x000F);
+    EPOS2_CHECK_EQUAL(words[4], 0x0000);
+    EPOS2_CHECK_EQUAL((uint16_t)CEpos2FrameTest::checksum(axis,
+                        {0x0411, 0x6040, 0x0100, 0x000F, 0x0000, 0x0000}), words[5]);
+    // the checksum of a frame with its checksum is zero
+    EPOS2_CHECK_EQUAL(CEpos2FrameTest::checksum(axis,
+                        std::vector<int16_t>(words.begin(), words.end())), 0);
+  }
+
+  // ReadObject 0x6064-00 (Position Actual Value)
+  std::vector<uint8_t> read = CEpos2FrameTest::readObject(axis, 0x6064, 0x00);
+  EPOS2_CHECK(unstuff(read, words));
+  EPOS2_CHECK_EQUAL(words.size(), 4u);
+  if(words.size() == 4)
+  {
+    EPOS2_CHECK_EQUAL(words[0], 0x0210);
+    EPOS2_CHECK_EQUAL(words[1], 0x6064);
+    EPOS2_CHECK_EQUAL(words[2], 0x0100);
+    EPOS2_CHECK_EQUAL(CEpos2FrameTest::checksum(axis,
+                        std::vector<int16_t>(words.begin(), words.end())), 0);
+  }
+
+  // every 0x90 of the data is doubled, the words are unchanged
+  std::vector<uint8_t> stuffed = CEpos2FrameTest::writeObject(axis, 0x6090, 0x00, 0x90909090);
+  EPOS2_CHECK(unstuff(stuffed, words));
+  EPOS2_CHECK_EQUAL(words.size(), 6u);
+  if(words.size() == 6)
+  {
+    EPOS2_CHECK_EQUAL(words[1], 0x6090);
+    EPOS2_CHECK_EQUAL(words[3], 0x9090);
+    EPOS2_CHECK_EQUAL(words[4], 0x9090);
+    size_t data_90 = 0;
+    for(size_t i = 0; i < words.size(); i++)
+      data_90 += ((words[i] & 0xFF) == 0x90) + ((words[i] >> 8) == 0x90);
+    // DLE, and the doubled bytes of the words
+    EPOS2_CHECK_EQUAL(count(stuffed, 0x90), 1 + 2*data_90);
+    EPOS2_CHECK_EQUAL(stuffed.size(), 2 + 12 + data_90);
+  }
+
+  // the pre-encoded quick stop is the controlword 0x0002
+  EPOS2_CHECK(CEpos2FrameTest::quickStop(axis) ==
+              CEpos2FrameTest::writeObject(axis, 0x6040, 0x00, 0x0002));
+
+  // the node id goes in the high byte of the third word
+  CEpos2 node(5);
+  EPOS2_CHECK(unstuff(CEpos2FrameTest::writeObject(node, 0x6040, 0x01, 0), words));
+  EPOS2_CHECK(words.size() == 6 && words[2] == 0x0501);
+
+  return EPOS2_TEST_RESULT;
+}
@@ -0,0 +1,122 @@
+// Copyright (C) 2009-2010 Institut de Robòtica i Informàtica Industrial, CSIC-UPC.
+// Author Martí Morta Garriga  (mmorta@iri.upc.edu)
+// All rights reserved.
+//
+// Copyright (C) 2013 Jochen Sprickerhof <jochen@sprickerhof.de>
+//
+// This file is part of IRI EPOS2 Driver
+// IRI EPOS2 Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+// Unwrapping of the position counter: wrap-around in both directions, narrow
+// counters, steps too large to unwrap, and the persisted state.
+
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+#include "epos2_motor_controller/Epos2PositionTracker.h"
+#include "Epos2Test.h"
+
+int main()
+{
+  // 32 bit counter: the first sample is sign extended
+  CEpos2PositionTracker tracker;
+  EPOS2_CHECK(!tracker.isValid());
+  EPOS2_CHECK_EQUAL(tracker.getPosition(), 0);
+  EPOS2_CHECK_EQUAL(tracker.update(0xFFFFFFF6u), -10);
+  EPOS2_CHECK(tracker.isValid());
+
+  // forwards over 2^31 and 2^32, many turns of the counter
+  int64_t expected = -10;
+  uint32_t raw = 0xFFFFFFF6u;
+  const uint32_t step = 0x3FFFFFFFu;
+  for(int i = 0; i < 40; i++)
+  {
+    raw += step;
+    expected += step;
+    if(tracker.update(raw) != expected)
+    {
+      EPOS2_CHECK_EQUAL(tracker.getPosition(), expected);
+      break;
+    }
+  }
+  EPOS2_CHECK(expected > (int64_t)1 << 35);
+
+  // and back below 0
+  for(int i = 0; i < 45; i++)
+  {
+    raw -= step;
+    expected -= step;
+    tracker.update(raw);
+  }
+  EPOS2_CHECK_EQUAL(tracker.getPosition(), expected);
+  EPOS2_CHECK(expected < 0);
+  EPOS2_CHECK_EQUAL(tracker.getDiscontinuities(), 0u);
+
+  // a step over max_step is counted, not taken
+  tracker.setMaxStep(1000);
+  int64_t before = tracker.getPosition();
+  tracker.update(raw + 5000);
+  EPOS2_CHECK_EQUAL(tracker.getPosition(), before);
+  EPOS2_CHECK_EQUAL(tracker.getDiscontinuities(), 1u);
+  // and the next step starts from the new value
+  EPOS2_CHECK_EQUAL(tracker.update(raw + 5100), before + 100);
+
+  tracker.reset();
+  EPOS2_CHECK(!tracker.isValid());
+  EPOS2_CHECK_EQUAL(tracker.getDiscontinuities(), 0u);
+
+  // 16 bit counter: higher bits ignored, wraps every 65536
+  CEpos2PositionTracker narrow(16, 0x8000);
+  EPOS2_CHECK_EQUAL(narrow.update(0x12347FF0u), 0x7FF0);
+  EPOS2_CHECK_EQUAL(narrow.update(0x00008010u), 0x8010);
+  EPOS2_CHECK_EQUAL(narrow.update(0x0000FFF0u), 0xFFF0);
+  EPOS2_CHECK_EQUAL(narrow.update(0x00000010u), 0x10010);
+  EPOS2_CHECK_EQUAL(narrow.update(0x0000FFF0u), 0xFFF0);
+  EPOS2_CHECK_EQUAL(narrow.update(0x0000C000u), 0xC000);
+  EPOS2_CHECK_EQUAL(narrow.update(0xABCD0010u), 0x10010);
+  // half the range is still taken, backwards
+  EPOS2_CHECK_EQUAL(narrow.update(0x00008010u), 0x8010);
+
+  EPOS2_CHECK_THROW(CEpos2PositionTracker(0), std::invalid_argument);
+  EPOS2_CHECK_THROW(CEpos2PositionTracker(33), std::invalid_argument);
+
+  // the state survives a save and a load
+  CEpos2PositionTracker saved;
+  saved.update(100);
+  for(int i = 0; i < 10; i++)
+    saved.update(100 + (uint32_t)(i + 1) * 0x40000000u);
+  std::string path = epos2TestPath("tracker");
+  EPOS2_CHECK(saved.save(path));
+
+  CEpos2PositionTracker loaded;
+  EPOS2_CHECK(loaded.load(path));
+  EPOS2_CHECK(loaded.isValid());
+  EPOS2_CHECK_EQUAL(loaded.getPosition(), saved.getPosition());
+  EPOS2_CHECK_EQUAL(loaded.update(100 + 11 * 0x40000000u), saved.update(100 + 11 * 0x40000000u));
+  std::remove(path.c_str());
+
+  // a missing or corrupt file leaves the state alone
+  EPOS2_CHECK(!loaded.load(path));
+  {
+    std::ofstream out(path.c_str());
+    out << "not a state" << std::endl;
+  }
+  int64_t position = loaded.getPosition();
+  EPOS2_CHECK(!loaded.load(path));
+  EPOS2_CHECK_EQUAL(loaded.getPosition(), position);
+  std::remove(path.c_str());
+
+  return EPOS2_TEST_RESULT;
+}
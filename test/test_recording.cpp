@@ -0,0 +1,203 @@
+// Copyright (C) 2009-2010 Institut de Robòtica i Informàtica Industrial, CSIC-UPC.
+// Author Martí Morta Garriga  (mmorta@iri.upc.edu)
+// All rights reserved.
+//
+// Copyright (C) 2013 Jochen Sprickerhof <jochen@sprickerhof.de>
+//
+// This file is part of IRI EPOS2 Driver
+// IRI EPOS2 Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+// CEpos2Recorder to CEpos2RecordingReader round trip: every encoding gets
+// its values back, time ranges select the right rows, a file without index
+// (writer killed) is still read, and a reopened recording is appended to.
+
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "epos2_motor_controller/Epos2Recorder.h"
+#include "epos2_motor_controller/Epos2RecordingReader.h"
+#include "epos2_motor_controller/Epos2RecordingFormat.h"
+#include "Epos2Test.h"
+
+static const size_t COLUMNS = 5;
+
+// time, a slow signal, a counter, a constant and full range noise
+static void makeRow(uint64_t i, int64_t *row)
+{
+  static uint64_t noise = 0x9E3779B97F4A7C15ull;
+  noise ^= noise << 13;
+  noise ^= noise >> 7;
+  noise ^= noise << 17;
+
+  row[0] = 1000000000LL + (int64_t)i * 1000 + (int64_t)(i % 7);
+  row[1] = (int64_t)(100000.0 * std::sin(i / 50.0));
+  row[2] = -(int64_t)i * 3;
+  row[3] = 42;
+  row[4] = (int64_t)noise;
+}
+
+static std::vector<std::string> columnNames()
+{
+  std::vector<std::string> names;
+  names.push_back("time");
+  names.push_back("position");
+  names.push_back("counter");
+  names.push_back("constant");
+  names.push_back("noise");
+  return names;
+}
+
+// rows read back are the rows written from first on
+static bool sameRows(const std::vector<std::vector<int64_t> > &values,
+                     const std::vector<std::vector<int64_t> > &rows, size_t first)
+{
+  for(size_t c = 0; c < values.size(); c++)
+    for(size_t r = 0; r < values[c].size(); r++)
+      if(first + r >= rows.size() || values[c][r] != rows[first + r][c])
+        return false;
+  return true;
+}
+
+int main()
+{
+  const std::string path = epos2TestPath("recording.rec");
+  const size_t n = 10000, chunk = 256;
+  std::vector<std::vector<int64_t> > rows(n, std::vector<int64_t>(COLUMNS));
+  for(size_t i = 0; i < n; i++)
+    makeRow(i, &rows[i][0]);
+
+  std::vector<size_t> all;
+  for(size_t c = 0; c < COLUMNS; c++)
+    all.push_back(c);
+
+  {
+    CEpos2Recorder recorder(path, columnNames(), chunk, n);
+    EPOS2_CHECK_EQUAL(recorder.getColumnCount(), COLUMNS);
+    for(size_t i = 0; i < n; i++)
+      EPOS2_CHECK(recorder.append(&rows[i][0]));
+    recorder.close();
+
+    CEpos2Recorder::epos_recorder_stats stats = recorder.getStatistics();
+    EPOS2_CHECK_EQUAL(stats.rows, n);
+    EPOS2_CHECK_EQUAL(stats.dropped, 0u);
+    EPOS2_CHECK_EQUAL(stats.chunks, (n + chunk - 1) / chunk);
+    EPOS2_CHECK(stats.bytes < stats.raw_bytes);
+    // closed: nothing more is taken
+    EPOS2_CHECK(!recorder.append(&rows[0][0]));
+  }
+
+  // everything back, and time ranges
+  {
+    CEpos2RecordingReader reader(path);
+    EPOS2_CHECK(reader.isComplete());
+    EPOS2_CHECK(reader.getColumns() == columnNames());
+    EPOS2_CHECK_EQUAL(reader.getColumn("counter"), 2u);
+    EPOS2_CHECK_THROW(reader.getColumn("velocity"), std::invalid_argument);
+    EPOS2_CHECK_EQUAL(reader.getRowCount(), n);
+    EPOS2_CHECK_EQUAL(reader.getChunks().size(), (n + chunk - 1) / chunk);
+
+    std::vector<std::vector<int64_t> > values;
+    EPOS2_CHECK_EQUAL(reader.read(rows[0][0], rows[n-1][0] + 1, all, values), n);
+    EPOS2_CHECK(values.size() == COLUMNS && values[0].size() == n);
+    EPOS2_CHECK(sameRows(values, rows, 0));
+
+    // a range across chunk boundaries, end excluded
+    size_t first = 1000, last = 3333;
+    EPOS2_CHECK_EQUAL(reader.read(rows[first][0], rows[last][0], all, values), last - first);
+    EPOS2_CHECK(sameRows(values, rows, first));
+
+    // some columns only, in the order asked for
+    std::vector<size_t> some;
+    some.push_back(4);
+    some.push_back(0);
+    EPOS2_CHECK_EQUAL(reader.read(rows[5000][0], rows[5010][0], some, values), 10u);
+    EPOS2_CHECK(values.size() == 2 && values[0].size() == 10 &&
+                values[0][0] == rows[5000][4] && values[1][9] == rows[5009][0]);
+
+    // outside the recording
+    EPOS2_CHECK_EQUAL(reader.read(0, rows[0][0], all, values), 0u);
+    EPOS2_CHECK_EQUAL(reader.read(rows[n-1][0] + 1, rows[n-1][0] + 1000000, all, values), 0u);
+
+    // scan passes the same rows chunk by chunk
+    uint64_t scanned = 0;
+    bool same = true;
+    reader.scan(rows[first][0], rows[last][0], all,
+        [&](const int64_t *const *v, size_t count)
+        {
+          for(size_t r = 0; r < count; r++)
+            for(size_t c = 0; c < COLUMNS; c++)
+              same = same && v[c][r] == rows[first + scanned + r][c];
+          scanned += count;
+        });
+    EPOS2_CHECK_EQUAL(scanned, last - first);
+    EPOS2_CHECK(same);
+  }
+
+  // without the index and the footer, and with the last chunk cut, as if
+  // the writer had been killed
+  {
+    int fd = open(path.c_str(), O_RDWR);
+    struct stat st;
+    epos2_rec_footer footer;
+    EPOS2_CHECK(fd >= 0 && fstat(fd, &st) == 0);
+    EPOS2_CHECK(pread(fd, &footer, sizeof(footer), st.st_size - sizeof(footer)) == sizeof(footer));
+    EPOS2_CHECK(memcmp(footer.magic, EPOS2_REC_INDEX_MAGIC, 8) == 0);
+    EPOS2_CHECK(ftruncate(fd, footer.index_offset - 10) == 0);
+    close(fd);
+
+    CEpos2RecordingReader reader(path);
+    size_t whole = (n / chunk) * chunk;     // the last chunk is the short one
+    if(n % chunk == 0)
+      whole -= chunk;
+    EPOS2_CHECK(!reader.isComplete());
+    EPOS2_CHECK_EQUAL(reader.getRowCount(), whole);
+
+    std::vector<std::vector<int64_t> > values;
+    EPOS2_CHECK_EQUAL(reader.read(rows[0][0], rows[n-1][0] + 1, all, values), whole);
+    EPOS2_CHECK(sameRows(values, rows, 0));
+  }
+
+  // reopened: the rows left are appended after the whole chunks
+  {
+    size_t whole = (n / chunk) * chunk;
+    if(n % chunk == 0)
+      whole -= chunk;
+
+    CEpos2Recorder recorder(path, columnNames(), chunk, n, true);
+    for(size_t i = whole; i < n; i++)
+      EPOS2_CHECK(recorder.append(&rows[i][0]));
+    recorder.close();
+
+    CEpos2RecordingReader reader(path);
+    EPOS2_CHECK(reader.isComplete());
+    EPOS2_CHECK_EQUAL(reader.getRowCount(), n);
+    std::vector<std::vector<int64_t> > values;
+    EPOS2_CHECK_EQUAL(reader.read(rows[0][0], rows[n-1][0] + 1, all, values), n);
+    EPOS2_CHECK(sameRows(values, rows, 0));
+
+    // other columns can't be appended to it
+    std::vector<std::string> other = columnNames();
+    other[1] = "velocity";
+    EPOS2_CHECK_THROW(CEpos2Recorder(path, other, chunk, n, true), std::invalid_argument);
+  }
+
+  std::remove(path.c_str());
+
+  return EPOS2_TEST_RESULT;
+}
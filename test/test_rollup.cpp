@@ -0,0 +1,164 @@
+// Copyright (C) 2009-2010 Institut de Robòtica i Informàtica Industrial, CSIC-UPC.
+// Author Martí Morta Garriga  (mmorta@iri.upc.edu)
+// All rights reserved.
+//
+// Copyright (C) 2013 Jochen Sprickerhof <jochen@sprickerhof.de>
+//
+// This file is part of IRI EPOS2 Driver
+// IRI EPOS2 Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+// CEpos2Rollup: every tier matches the statistics computed directly from the
+// samples (the coarse tiers are merged, not resampled), query picks the
+// tier by the number of points, and the tier files don't collide.
+
+#include <map>
+#include <vector>
+#include <cstdio>
+#include <stdexcept>
+#include "epos2_motor_controller/Epos2Rollup.h"
+#include "Epos2Test.h"
+
+struct bucket {
+  uint64_t count;
+  double min, max, sum, sumsq;
+};
+
+// bucket start of t, rounding down also for negative times
+static int64_t floorTo(int64_t t, int64_t resolution)
+{
+  int64_t q = t / resolution;
+  if(t % resolution < 0)
+    q--;
+  return q * resolution;
+}
+
+int main()
+{
+  const std::string base = epos2TestPath("rollup");
+  std::vector<int64_t> resolutions;
+  resolutions.push_back(1000000LL);       // 1 ms
+  resolutions.push_back(10000000LL);      // 10 ms
+  resolutions.push_back(100000000LL);     // 100 ms
+  std::vector<std::string> signals;
+  signals.push_back("ramp");
+  signals.push_back("square");
+
+  // 1 s of samples every 130 us, from before 0 so buckets of negative
+  // times are checked too
+  const int64_t t0 = -250000000LL, period = 130000LL;
+  const size_t n = 7700;
+  std::vector<std::map<int64_t, bucket> > expected(resolutions.size());
+
+  {
+    CEpos2Rollup rollup(base, signals, resolutions);
+    for(size_t i = 0; i < n; i++)
+    {
+      int64_t t = t0 + (int64_t)i * period;
+      int64_t values[2] = { (int64_t)i - 3000, (i / 3) % 2 ? 25 : -10 };
+      rollup.add(t, values);
+
+      // the signal ramp only, square checked through its mean below
+      for(size_t k = 0; k < resolutions.size(); k++)
+      {
+        bucket &b = expected[k][floorTo(t, resolutions[k])];
+        double v = values[0];
+        if(b.count == 0)
+          b.min = b.max = v, b.sum = b.sumsq = 0.0;
+        b.min = std::min(b.min, v);
+        b.max = std::max(b.max, v);
+        b.sum += v;
+        b.sumsq += v*v;
+        b.count++;
+      }
+    }
+    rollup.close();
+
+    for(size_t k = 0; k < resolutions.size(); k++)
+    {
+      CEpos2Recorder::epos_recorder_stats stats = rollup.getStatistics(k);
+      EPOS2_CHECK_EQUAL(stats.rows, expected[k].size());
+      EPOS2_CHECK_EQUAL(stats.dropped, 0u);
+    }
+    EPOS2_CHECK_THROW(rollup.getStatistics(resolutions.size()), std::invalid_argument);
+  }
+
+  // query takes the buckets starting in the range
+  const int64_t from = floorTo(t0, resolutions.back()), to = t0 + (int64_t)n * period;
+  const double span = (double)(to - from);
+  for(size_t k = 0; k < resolutions.size(); k++)
+  {
+    // just enough points for tier k
+    size_t max_points = (size_t)std::ceil(span / resolutions[k]);
+    std::vector<CEpos2Rollup::epos_rollup_point> points;
+    int64_t resolution = CEpos2Rollup::query(base, "ramp", from, to, max_points, points, resolutions);
+    EPOS2_CHECK_EQUAL(resolution, resolutions[k]);
+    EPOS2_CHECK_EQUAL(points.size(), expected[k].size());
+
+    uint64_t total = 0;
+    std::map<int64_t, bucket>::const_iterator e = expected[k].begin();
+    for(size_t i = 0; i < points.size() && e != expected[k].end(); i++, e++)
+    {
+      const bucket &b = e->second;
+      const CEpos2Rollup::epos_rollup_point &p = points[i];
+      if(p.time_ns != e->first || p.count != b.count || p.min != b.min || p.max != b.max ||
+         std::fabs(p.mean - b.sum / b.count) > 1.0 / EPOS2_ROLLUP_SCALE ||
+         std::fabs(p.rms - std::sqrt(b.sumsq / b.count)) > 1.0 / EPOS2_ROLLUP_SCALE)
+      {
+        EPOS2_CHECK_EQUAL(p.time_ns, e->first);
+        EPOS2_CHECK_EQUAL(p.count, b.count);
+        EPOS2_CHECK_EQUAL(p.min, b.min);
+        EPOS2_CHECK_EQUAL(p.max, b.max);
+        EPOS2_CHECK_NEAR(p.mean, b.sum / b.count, 1.0 / EPOS2_ROLLUP_SCALE);
+        EPOS2_CHECK_NEAR(p.rms, std::sqrt(b.sumsq / b.count), 1.0 / EPOS2_ROLLUP_SCALE);
+        break;
+      }
+      total += p.count;
+    }
+    EPOS2_CHECK_EQUAL(total, n);
+  }
+
+  // the other signal is in the same files: every tier has the same mean
+  std::vector<CEpos2Rollup::epos_rollup_point> points;
+  double weighted[2] = { 0.0, 0.0 };
+  CEpos2Rollup::query(base, "square", from, to, 1000000, points, resolutions);
+  for(size_t i = 0; i < points.size(); i++)
+  {
+    weighted[0] += points[i].mean * points[i].count;
+    EPOS2_CHECK(points[i].min >= -10 && points[i].max <= 25);
+  }
+  CEpos2Rollup::query(base, "square", from, to, 1, points, resolutions);
+  for(size_t i = 0; i < points.size(); i++)
+    weighted[1] += points[i].mean * points[i].count;
+  EPOS2_CHECK_NEAR(weighted[0], weighted[1], (double)n / EPOS2_ROLLUP_SCALE);
+  EPOS2_CHECK_THROW(CEpos2Rollup::query(base, "current", from, to, 10, points, resolutions),
+                    std::invalid_argument);
+
+  // tiers that aren't whole milliseconds don't share files
+  EPOS2_CHECK(CEpos2Rollup::tierPath(base, 1000000LL) != CEpos2Rollup::tierPath(base, 1500000LL));
+  EPOS2_CHECK(CEpos2Rollup::tierPath(base, 1500000LL) != CEpos2Rollup::tierPath(base, 1500001LL));
+  EPOS2_CHECK_EQUAL(CEpos2Rollup::tierPath("x", 1000000000LL), "x.1000ms.rec");
+
+  std::vector<int64_t> bad;
+  bad.push_back(10000000LL);
+  bad.push_back(15000000LL);
+  EPOS2_CHECK_THROW(CEpos2Rollup(base, signals, bad), std::invalid_argument);
+  EPOS2_CHECK_THROW(CEpos2Rollup(base, std::vector<std::string>(), resolutions),
+                    std::invalid_argument);
+
+  for(size_t k = 0; k < resolutions.size(); k++)
+    std::remove(CEpos2Rollup::tierPath(base, resolutions[k]).c_str());
+
+  return EPOS2_TEST_RESULT;
+}
@@ -0,0 +1,179 @@
+// Copyright (C) 2009-2010 Institut de Robòtica i Informàtica Industrial, CSIC-UPC.
+// Author Martí Morta Garriga  (mmorta@iri.upc.edu)
+// All rights reserved.
+//
+// Copyright (C) 2013 Jochen Sprickerhof <jochen@sprickerhof.de>
+//
+// This file is part of IRI EPOS2 Driver
+// IRI EPOS2 Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+// Trapezoidal and S-curve profiles: they end at rest on the target, respect
+// the limits, are continuous, and sample() agrees with evaluate().
+
+#include <vector>
+#include <algorithm>
+#include "epos2_motor_controller/Epos2Trajectory.h"
+#include "Epos2Test.h"
+
+static CEpos2Trajectory::epos_limits limits(double velocity, double acceleration, double jerk)
+{
+  CEpos2Trajectory::epos_limits l;
+  l.velocity     = velocity;
+  l.acceleration = acceleration;
+  l.jerk         = jerk;
+  l.min_position = -1e9;
+  l.max_position = 1e9;
+  return l;
+}
+
+// checks a planned trajectory over a fine sampling
+static void checkProfile(const CEpos2Trajectory &trajectory, double start,
+                         const CEpos2Trajectory::epos_limits &l, bool scurve)
+{
+  const double target = trajectory.getTarget();
+  const double distance = std::fabs(target - start);
+  const double T = trajectory.getDuration();
+  const size_t n = 20001;
+  const double dt = T / (n - 1);
+  std::vector<double> p(n), v(n), a(n);
+
+  trajectory.sample(0.0, dt, n, &p[0], &v[0], &a[0]);
+
+  EPOS2_CHECK_NEAR(p[0], start, 1e-9 * (1.0 + distance));
+  EPOS2_CHECK_NEAR(v[0], 0.0, 1e-9 * l.velocity);
+  EPOS2_CHECK_NEAR(p[n-1], target, 1e-6 * (1.0 + distance));
+  EPOS2_CHECK_NEAR(v[n-1], 0.0, 1e-6 * l.velocity);
+
+  double peak_v = 0.0, peak_a = 0.0, jump_p = 0.0, jump_v = 0.0;
+  bool monotonic = true;
+  for(size_t i = 0; i < n; i++)
+  {
+    peak_v = std::max(peak_v, std::fabs(v[i]));
+    peak_a = std::max(peak_a, std::fabs(a[i]));
+    if(i > 0)
+    {
+      // no step between two samples larger than the limits allow
+      jump_p = std::max(jump_p, std::fabs(p[i] - p[i-1]) - l.velocity * dt);
+      jump_v = std::max(jump_v, std::fabs(v[i] - v[i-1]) - l.acceleration * dt);
+      if((target - start) * (p[i] - p[i-1]) < -1e-9)
+        monotonic = false;
+    }
+  }
+  EPOS2_CHECK(peak_v <= l.velocity * (1.0 + 1e-9));
+  EPOS2_CHECK(peak_a <= l.acceleration * (1.0 + 1e-9));
+  EPOS2_CHECK(jump_p <= 1e-6 * (1.0 + distance));
+  EPOS2_CHECK(jump_v <= 1e-6 * l.velocity);
+  EPOS2_CHECK(monotonic);
+
+  // an S-curve has a continuous acceleration, bounded by the jerk
+  if(scurve)
+    for(size_t i = 1; i < n; i++)
+      if(std::fabs(a[i] - a[i-1]) > l.jerk * dt * (1.0 + 1e-6) + 1e-6)
+      {
+        EPOS2_CHECK(std::fabs(a[i] - a[i-1]) <= l.jerk * dt * (1.0 + 1e-6) + 1e-6);
+        break;
+      }
+}
+
+// sample, with any t0 and dt, is evaluate at every instant
+static void checkSampling(const CEpos2Trajectory &trajectory)
+{
+  const double T = trajectory.getDuration();
+  const size_t n = 997;
+  const double t0 = -0.1 * T - 0.01, dt = 1.3 * T / n;
+  std::vector<double> p(n), v(n), a(n);
+
+  trajectory.sample(t0, dt, n, &p[0], &v[0], &a[0]);
+  for(size_t i = 0; i < n; i++)
+  {
+    double pe, ve, ae;
+    trajectory.evaluate(t0 + i*dt, pe, ve, ae);
+    if(std::fabs(p[i] - pe) > 1e-6 || std::fabs(v[i] - ve) > 1e-6 || std::fabs(a[i] - ae) > 1e-6)
+    {
+      EPOS2_CHECK_NEAR(p[i], pe, 1e-6);
+      EPOS2_CHECK_NEAR(v[i], ve, 1e-6);
+      EPOS2_CHECK_NEAR(a[i], ae, 1e-6);
+      break;
+    }
+  }
+
+  // the optional outputs may be left out
+  std::vector<double> only(n);
+  trajectory.sample(t0, dt, n, &only[0]);
+  EPOS2_CHECK(only == p);
+}
+
+int main()
+{
+  CEpos2Trajectory trajectory;
+  double p, v, a;
+
+  // not planned: at rest at 0
+  trajectory.evaluate(1.0, p, v, a);
+  EPOS2_CHECK_EQUAL(p, 0.0);
+  EPOS2_CHECK_EQUAL(trajectory.getDuration(), 0.0);
+
+  // trapezoid reaching the velocity: ramps of V/A, cruise for the rest
+  CEpos2Trajectory::epos_limits l = limits(10000.0, 50000.0, 1e6);
+  trajectory.planTrapezoid(0.0, 100000.0, l);
+  EPOS2_CHECK_NEAR(trajectory.getDuration(), 0.2 + 9.8 + 0.2, 1e-9);
+  trajectory.evaluate(5.0, p, v, a);
+  EPOS2_CHECK_NEAR(v, 10000.0, 1e-6);
+  EPOS2_CHECK_NEAR(a, 0.0, 1e-9);
+  checkProfile(trajectory, 0.0, l, false);
+  checkSampling(trajectory);
+
+  // triangular: too short to reach the velocity
+  trajectory.planTrapezoid(500.0, -500.0, l);
+  EPOS2_CHECK_NEAR(trajectory.getDuration(), 2.0 * std::sqrt(1000.0 / 50000.0), 1e-9);
+  trajectory.evaluate(trajectory.getDuration() / 2.0, p, v, a);
+  EPOS2_CHECK_NEAR(p, 0.0, 1e-6);
+  EPOS2_CHECK(v < 0.0 && -v < l.velocity);
+  checkProfile(trajectory, 500.0, l, false);
+  checkSampling(trajectory);
+
+  // S-curve with the three limits reached
+  trajectory.planSCurve(-20000.0, 80000.0, l);
+  EPOS2_CHECK(trajectory.getDuration() > 100000.0 / l.velocity);
+  checkProfile(trajectory, -20000.0, l, true);
+  checkSampling(trajectory);
+
+  // S-curve too short for the velocity, long enough for the acceleration
+  CEpos2Trajectory::epos_limits fast = limits(1e6, 50000.0, 1e6);
+  trajectory.planSCurve(0.0, 3000.0, fast);
+  checkProfile(trajectory, 0.0, fast, true);
+  checkSampling(trajectory);
+
+  // S-curve too short for the acceleration as well, backwards
+  trajectory.planSCurve(0.0, -10.0, l);
+  checkProfile(trajectory, 0.0, l, true);
+  checkSampling(trajectory);
+
+  // the target is clamped to the position limits
+  l.max_position = 5000.0;
+  trajectory.planTrapezoid(0.0, 8000.0, l);
+  EPOS2_CHECK_EQUAL(trajectory.getTarget(), 5000.0);
+  trajectory.evaluate(trajectory.getDuration() + 1.0, p, v, a);
+  EPOS2_CHECK_EQUAL(p, 5000.0);
+  EPOS2_CHECK_EQUAL(v, 0.0);
+
+  // no move: stays at the start
+  trajectory.planSCurve(42.0, 42.0, l);
+  EPOS2_CHECK_EQUAL(trajectory.getDuration(), 0.0);
+  trajectory.evaluate(0.5, p, v, a);
+  EPOS2_CHECK_EQUAL(p, 42.0);
+
+  return EPOS2_TEST_RESULT;
+}